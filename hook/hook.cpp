@@ -8,6 +8,7 @@
 #include <atomic>
 
 #include "p2p_network.h"
+#include "relay_shim.h"
 
 // ============================================================================
 // 日志系统 - 使用条件编译控制
@@ -224,17 +225,11 @@ bool HOOK_CALL Hook_IsP2PPacketAvailable(void* thisptr,
             uint32_t readSize = 0;
             
             if (P2P_ReadPacket(peerID, rawBuffer.data(), size, &readSize, &peerID) == P2P_OK) {
-                // 数据格式: [CSteamID (8 bytes)] [原始数据]
-                if (readSize >= sizeof(CSteamID)) {
-                    // 读取 CSteamID
-                    std::memcpy(&g_tcpRecvSteamID, rawBuffer.data(), sizeof(CSteamID));
-                    
-                    // 提取原始数据（去掉 CSteamID 头部）
-                    uint32_t dataSize = readSize - sizeof(CSteamID);
-                    g_tcpRecvBuffer.resize(dataSize);
-                    if (dataSize > 0) {
-                        std::memcpy(g_tcpRecvBuffer.data(), rawBuffer.data() + sizeof(CSteamID), dataSize);
-                    }
+                // 数据格式: [来源CSteamID (8 bytes)] [原始数据]
+                const uint8_t* data = nullptr;
+                uint32_t dataSize = 0;
+                if (relay_shim::ParseRecvPacket(rawBuffer.data(), readSize, g_tcpRecvSteamID, data, dataSize)) {
+                    g_tcpRecvBuffer.assign(data, data + dataSize);
                     g_hasTcpData = true;
                     
                     TraceDebug("IsP2PPacketAvailable TCP: CSteamID=%llu, DataSize=%u, PeerID=%u", 
@@ -296,6 +291,15 @@ bool HOOK_CALL Hook_ReadP2PPacket(void* thisptr,
 // 本地 CSteamID (从原函数调用中记录)
 static CSteamID g_localSteamID = 0;
 
+// 中继会话选项：来源 SteamID 由中继补上（中继不支持时由库补上），发送时不再附带本地 SteamID；
+// 一帧内的多次 SendP2PPacket 合并为一个打包帧，在下一次 IsP2PPacketAvailable 的 P2P_RunCallbacks 中发出；
+// 逐个发给每个队友的相同数据合并为一条扇出记录，上行只发一份；
+// 不可靠发送的数据包（位置同步等）标为不可靠类别，队友积压时不排在大块数据之后
+static constexpr uint32_t g_relayFlags = P2P_RELAY_FLAG_RESUME | P2P_RELAY_FLAG_PRESENCE | P2P_RELAY_FLAG_COMPACT |
+                                         P2P_RELAY_FLAG_SOURCE | P2P_RELAY_FLAG_BUNDLE | P2P_RELAY_FLAG_FANOUT |
+                                         P2P_RELAY_FLAG_LANES;
+static std::vector<uint8_t> g_tcpSendBuffer;
+
 // bool ISteamNetworking::SendP2PPacket(CSteamID steamIDRemote, const void *pubData, uint32 cubData, EP2PSend eP2PSendType, int nChannel = 0)
 bool HOOK_CALL Hook_SendP2PPacket(void* thisptr,
 #ifndef _WIN64
@@ -309,23 +313,25 @@ bool HOOK_CALL Hook_SendP2PPacket(void* thisptr,
     
     P2PPeerID targetPeer = g_connectedPeer;
     
-    // 通过 TCP 发送，数据格式: [目标SteamID (8 bytes)] [本地SteamID (8 bytes)] [原始数据]
+    // 中继告知对方尚未上线（加载中/重连中）或已离开：不再把完整数据包发往中继
+    if (targetPeer != P2P_INVALID_PEER_ID && !P2P_IsRelayTargetAvailable(targetPeer, steamIDRemote)) {
+        TraceDebug("SendP2PPacket TCP Skipped: target offline, CSteamID=%llu, DataSize=%u", steamIDRemote, cubData);
+        return originalResult;
+    }
+    
+    // 通过 TCP 发送，数据格式: [目标SteamID (8 bytes)] [原始数据]（本地SteamID由中继补上）
     if (targetPeer != P2P_INVALID_PEER_ID) {
-        uint32 totalSize = sizeof(CSteamID) + sizeof(CSteamID) + cubData;
-        std::vector<uint8_t> sendBuffer(totalSize);
+        uint32 totalSize = relay_shim::BuildSendPacket(g_tcpSendBuffer, steamIDRemote, g_localSteamID,
+                                                       (g_relayFlags & P2P_RELAY_FLAG_SOURCE) != 0, pubData, cubData);
         
-        // 写入目标 SteamID (offset 0)
-        std::memcpy(sendBuffer.data(), &steamIDRemote, sizeof(CSteamID));
-        // 写入本地 SteamID（发送方）(offset 8)
-        std::memcpy(sendBuffer.data() + sizeof(CSteamID), &g_localSteamID, sizeof(CSteamID));
-        // 写入原始数据 (offset 16)
-        if (cubData > 0 && pubData) {
-            std::memcpy(sendBuffer.data() + sizeof(CSteamID) + sizeof(CSteamID), pubData, cubData);
-        }
-        
-        P2PResult tcpResult = P2P_SendPacket(targetPeer, sendBuffer.data(), totalSize);
+        // EP2PSend: 0 k_EP2PSendUnreliable, 1 k_EP2PSendUnreliableNoDelay, 2/3 可靠
+        uint32_t sendFlags = (eP2PSendType == 0 || eP2PSendType == 1) ? P2P_SEND_UNRELIABLE : 0;
+        P2PResult tcpResult = P2P_SendPacketEx(targetPeer, g_tcpSendBuffer.data(), totalSize, sendFlags);
         
-        if (tcpResult != P2P_OK) {
+        if (tcpResult == P2P_ERROR_TARGET_UNAVAILABLE) {
+            TraceDebug("SendP2PPacket TCP Skipped: target offline, CSteamID=%llu, Size=%u",
+                steamIDRemote, totalSize);
+        } else if (tcpResult != P2P_OK) {
             TraceError("SendP2PPacket TCP Error: send failed, Size=%u, Error=%d",
                 totalSize, tcpResult);
         }
@@ -348,21 +354,18 @@ void ConnectionCallback(P2PPeerID peerID, bool connected, void* userData) {
     if (connected) {
         g_connectedPeer = peerID;  // 保存连接的 PeerID
         TraceInfo("P2P Connection Connected PeerID: %u Global PeerID: %u", peerID, g_connectedPeer);
-
-        if (g_localSteamID != 0) {
-            const size_t dataSize = sizeof(CSteamID);
-            uint8_t data[dataSize] = {0};
-            std::memcpy(data, &g_localSteamID, sizeof(CSteamID));
-            P2P_SendPacket(peerID, data, static_cast<uint32_t>(dataSize));
-        }
+        // 重连后的注册由中继会话自动完成 (P2P_EnableRelaySession)
     } else {
+        // 连接保留自动重连，断线期间发送的数据由续传会话缓存，重连后补发
         TraceInfo("P2P Connection Disconnected PeerID: %u", peerID);
-        if (g_connectedPeer == peerID) {
-            g_connectedPeer = P2P_INVALID_PEER_ID;
-        }
     }
 }
 
+// 中继上其他玩家的上线/下线（仅用于调试日志，发送时由 P2P_IsRelayTargetAvailable 判断）
+void PresenceCallback(P2PPeerID peerID, uint64_t mark, bool online, void* userData) {
+    TraceInfo("P2P Relay Presence PeerID: %u SteamID: %llu %s", peerID, mark, online ? "online" : "offline");
+}
+
 // ============================================================================
 // 获取本地 SteamID
 // ============================================================================
@@ -457,10 +460,10 @@ DWORD WINAPI InjectionThread(LPVOID lpParam) {
     g_localSteamID = GetLocalSteamID();
     TraceInfo("Local SteamID: %llu", g_localSteamID);
 
-    const size_t dataSize = sizeof(CSteamID);
-    uint8_t data[dataSize] = {0};
-    std::memcpy(data, &g_localSteamID, sizeof(CSteamID));
-    P2P_SendPacket(g_connectedPeer, data, dataSize);
+    // 以本地 SteamID 注册到中继，启用断线续传、在线通知、紧凑帧（目标 SteamID 由库换成1字节短编号）、来源标记、打包帧与扇出
+    if (P2P_EnableRelaySession(g_connectedPeer, g_localSteamID, g_relayFlags) != P2P_OK) {
+        TraceError("P2P EnableRelaySession failed PeerID: %u", g_connectedPeer);
+    }
     
     return 0;
 }
@@ -494,6 +497,7 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserv
         }
         
         P2P_SetConnectionCallback(ConnectionCallback, nullptr);
+        P2P_SetPresenceCallback(PresenceCallback, nullptr);
 
         if (P2P_Connect(g_strRemoteIP.c_str(), g_nPort, &g_connectedPeer) != P2P_OK) {
             TraceError("P2P Connect Error Connect to %s:%u failed", g_strRemoteIP.c_str(), g_nPort);
@@ -0,0 +1,62 @@
+#ifndef RELAY_SHIM_H
+#define RELAY_SHIM_H
+
+/**
+ * Hook 与中继之间的数据包格式（不依赖 Windows，可在测试中直接使用）
+ *
+ * 发送: [目标SteamID (8 bytes)] [本地SteamID (8 bytes)] [原始数据]
+ *   以 P2P_RELAY_FLAG_SOURCE 启用中继会话时省略本地SteamID，由中继（或客户端库）补上。
+ * 接收: [来源SteamID (8 bytes)] [原始数据]，与发送方是否省略本地SteamID无关。
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace relay_shim {
+
+constexpr uint32_t STEAM_ID_SIZE = 8;
+
+/**
+ * 组装发往中继的数据包
+ * @param out 输出缓冲区（覆盖原内容）
+ * @param target 目标 SteamID
+ * @param local 本地 SteamID
+ * @param sourceStamped true 时省略本地 SteamID
+ * @return 数据包大小
+ */
+inline uint32_t BuildSendPacket(std::vector<uint8_t>& out, uint64_t target, uint64_t local, bool sourceStamped,
+                                const void* data, uint32_t size) {
+    uint32_t headerSize = sourceStamped ? STEAM_ID_SIZE : STEAM_ID_SIZE * 2;
+    out.resize(headerSize + size);
+    std::memcpy(out.data(), &target, STEAM_ID_SIZE);
+    if (!sourceStamped) {
+        std::memcpy(out.data() + STEAM_ID_SIZE, &local, STEAM_ID_SIZE);
+    }
+    if (size > 0 && data) {
+        std::memcpy(out.data() + headerSize, data, size);
+    }
+    return static_cast<uint32_t>(out.size());
+}
+
+/**
+ * 解析从中继收到的数据包
+ * @param outSource 输出来源 SteamID
+ * @param outData 输出原始数据位置（指向 packet 内部）
+ * @param outSize 输出原始数据大小
+ * @return false 数据包过短
+ */
+inline bool ParseRecvPacket(const uint8_t* packet, uint32_t size, uint64_t& outSource, const uint8_t*& outData,
+                            uint32_t& outSize) {
+    if (size < STEAM_ID_SIZE) {
+        return false;
+    }
+    std::memcpy(&outSource, packet, STEAM_ID_SIZE);
+    outData = packet + STEAM_ID_SIZE;
+    outSize = size - STEAM_ID_SIZE;
+    return true;
+}
+
+} // namespace relay_shim
+
+#endif // RELAY_SHIM_H
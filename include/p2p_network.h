@@ -36,12 +36,31 @@ typedef enum P2PResult {
     P2P_ERROR_NO_PACKET = -7,
     P2P_ERROR_SOCKET_ERROR = -8,
     P2P_ERROR_INVALID_PARAM = -9,
-    P2P_ERROR_LISTEN_FAILED = -10
+    P2P_ERROR_LISTEN_FAILED = -10,
+    P2P_ERROR_TARGET_UNAVAILABLE = -11
 } P2PResult;
 
+// 中继会话选项 (P2P_EnableRelaySession)
+#define P2P_RELAY_FLAG_RESUME 0x1u   // 断线续传：重连后恢复会话，不丢失断线期间的数据包
+#define P2P_RELAY_FLAG_PRESENCE 0x2u // 在线通知：接收中继的标记上线/下线事件，不向已知离线的目标发送
+#define P2P_RELAY_FLAG_COMPACT 0x4u  // 紧凑帧：变长长度 + 1字节短编号代替8字节目标标记（隐含在线通知）
+#define P2P_RELAY_FLAG_SOURCE 0x8u   // 来源标记：发送的数据不带本地标记，由中继补上（中继不支持时由库补上）
+#define P2P_RELAY_FLAG_BUNDLE 0x10u  // 打包帧：两次 P2P_RunCallbacks 之间发送的数据包合并为一帧发出
+#define P2P_RELAY_FLAG_FANOUT 0x20u  // 扇出：打包时连续发往不同目标的相同数据合并为一条，由中继复制给各目标
+#define P2P_RELAY_FLAG_LANES 0x40u   // 出站调度：声明数据包类别，中继在目标积压时优先发出小的、不可靠的数据包
+
+// 发送选项 (P2P_SendPacketEx)
+#define P2P_SEND_UNRELIABLE 0x1u     // 可被新数据取代的数据包（如位置同步），启用 P2P_RELAY_FLAG_LANES 时单独排队
+
+// 中继目标标记：发往本会话的队友，即此前发送过数据的标记（中继支持扇出且启用 P2P_RELAY_FLAG_FANOUT 时）
+#define P2P_RELAY_BROADCAST_MARK 0xFFFFFFFFFFFFFFFFull
+
 // 连接事件回调类型
 typedef void (*P2PConnectionCallback)(P2PPeerID peerID, bool connected, void* userData);
 
+// 中继标记在线状态回调类型 (P2P_RELAY_FLAG_PRESENCE)
+typedef void (*P2PPresenceCallback)(P2PPeerID peerID, uint64_t mark, bool online, void* userData);
+
 /**
  * 初始化 P2P 网络库
  * @return P2P_OK 成功, 其他值表示错误
@@ -83,6 +102,20 @@ P2P_API P2PResult P2P_Connect(const char* ip, uint16_t port, P2PPeerID* outPeerI
  */
 P2P_API void P2P_SetAutoReconnect(P2PPeerID peerID, bool enable, uint32_t baseDelayMs, uint32_t maxDelayMs);
 
+/**
+ * 在到 relay_server 的连接上启用中继会话，代替手动发送8字节注册包
+ * 库会立即发送扩展注册 (CTRL_HELLO)，并在每次自动重连后重新注册。
+ * 使用 P2P_RELAY_FLAG_RESUME 时，断线期间发送的数据包会被缓存，
+ * 重连后与中继交换确认序号，只重发对方尚未收到的数据包。
+ * 中继为集群节点时，注册可能被重定向到其他节点（标记已在该节点上线或本节点负载较高），
+ * 库会自动改连该节点并重新注册，peerID 不变，之后的自动重连也连到该节点。
+ * @param peerID 对端 ID
+ * @param localMark 本地标记 (如本地 SteamID)
+ * @param flags P2P_RELAY_FLAG_* 组合
+ * @return P2P_OK 成功
+ */
+P2P_API P2PResult P2P_EnableRelaySession(P2PPeerID peerID, uint64_t localMark, uint32_t flags);
+
 /**
  * 断开与指定对端的连接
  * @param peerID 对端 ID
@@ -91,6 +124,10 @@ P2P_API void P2P_Disconnect(P2PPeerID peerID);
 
 /**
  * 发送数据包到指定对端
+ * 启用 P2P_RELAY_FLAG_PRESENCE 的中继会话中，数据前8字节为目标标记；
+ * 目标已知不在线时直接丢弃并返回 P2P_ERROR_TARGET_UNAVAILABLE。
+ * 未启用 P2P_RELAY_FLAG_SOURCE 时，目标标记之后按约定附带本地标记，接收方读到的数据以来源标记开头；
+ * 启用后省略本地标记，接收方读到的格式不变。
  * @param peerID 对端 ID
  * @param data 数据指针
  * @param size 数据大小 (字节)
@@ -98,6 +135,18 @@ P2P_API void P2P_Disconnect(P2PPeerID peerID);
  */
 P2P_API P2PResult P2P_SendPacket(P2PPeerID peerID, const void* data, uint32_t size);
 
+/**
+ * 发送数据包到指定对端，附带发送选项
+ * 启用 P2P_RELAY_FLAG_LANES 的中继会话中，类别变化时先发出已打包的数据包并通知中继；
+ * 中继在目标积压时按来源与类别轮流发出，同一来源同一类别的数据包保持顺序。
+ * @param peerID 对端 ID
+ * @param data 数据指针
+ * @param size 数据大小 (字节)
+ * @param flags P2P_SEND_* 组合
+ * @return P2P_OK 成功
+ */
+P2P_API P2PResult P2P_SendPacketEx(P2PPeerID peerID, const void* data, uint32_t size, uint32_t flags);
+
 /**
  * 检查是否有来自指定对端的数据包可读
  * @param peerID 对端 ID, 如果为 P2P_INVALID_PEER_ID 则检查所有连接
@@ -146,6 +195,24 @@ P2P_API uint32_t P2P_GetPeerCount(void);
  */
 P2P_API uint32_t P2P_GetConnectedPeers(P2PPeerID* outPeerIDs, uint32_t maxCount);
 
+/**
+ * 查询中继上的目标标记是否可能在线
+ * 中继通知目标已下线、或回复目标未注册 (NACK) 后返回 false，直到收到上线通知；
+ * 期间每隔约2秒放行一次试探，以免错过通知。未启用在线通知时总是返回 true。
+ * @param peerID 到中继的连接 ID
+ * @param mark 目标标记 (如对方 SteamID)
+ * @return true 可以发送
+ */
+P2P_API bool P2P_IsRelayTargetAvailable(P2PPeerID peerID, uint64_t mark);
+
+/**
+ * 设置中继标记在线状态回调 (需以 P2P_RELAY_FLAG_PRESENCE 启用中继会话)
+ * 注册成功后先为每个已在线的标记回调一次 online=true，此后随上线/下线事件回调。
+ * @param callback 回调函数，在 P2P_RunCallbacks 中调用
+ * @param userData 用户数据，会传递给回调函数
+ */
+P2P_API void P2P_SetPresenceCallback(P2PPresenceCallback callback, void* userData);
+
 #ifdef __cplusplus
 }
 #endif
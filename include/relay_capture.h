@@ -0,0 +1,202 @@
+#ifndef RELAY_CAPTURE_H
+#define RELAY_CAPTURE_H
+
+/**
+ * 中继流量抓包文件格式（relay_server -w 写入，relay_replay 与测试读取）
+ *
+ * 文件: [文件头 CAPTURE_HEADER_SIZE][记录...][连接索引]
+ *   文件头: [8字节 魔数 "RLYCAP01"][u32 版本][u32 snaplen，0为不截断][u64 开始时间 (CLOCK_REALTIME, ns)]
+ *           [u64 记录区结束偏移][u64 索引偏移][u32 索引条目数][余下保留为0]
+ *   记录 (起始偏移8字节对齐): [u64 时间 (ns，相对开始)][u32 连接编号][1字节 类型][3字节 保留]
+ *           [u32 原始长度][u32 保存长度][数据][填充到8字节]
+ *     CAPTURE_OPEN / CAPTURE_CLOSE 没有数据；CAPTURE_FRAME 的数据为客户端发出的一个完整帧，
+ *     原样包含帧头（或紧凑帧的 varint 长度与标签），超出 snaplen 的部分被截断，重放时以0补足原始长度。
+ *     记录按中继处理的先后顺序写入，时间单调不减。
+ *   索引条目: [u32 连接编号][u32 标志][8字节 标记][u64 首条记录偏移][u64 打开时间][u64 关闭时间]
+ *           [u64 帧数][u64 帧字节数（原始长度之和）]
+ *
+ * 中继边写边通过 mmap 追加记录，退出时写入索引并把文件截到实际长度；索引偏移为0（中继未正常退出）
+ * 时读取方可以顺序扫描记录重建索引（没有标记信息）。连接编号从1开始，按 accept 顺序分配。
+ *
+ * 所有多字节整数均为小端序（与 relay_protocol.h 相同）。
+ */
+
+#include "relay_protocol.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace relay {
+
+constexpr uint8_t CAPTURE_MAGIC[8] = {'R', 'L', 'Y', 'C', 'A', 'P', '0', '1'};
+constexpr uint32_t CAPTURE_VERSION = 1;
+constexpr size_t CAPTURE_HEADER_SIZE = 64;
+constexpr size_t CAPTURE_RECORD_HEADER_SIZE = 24;
+constexpr size_t CAPTURE_INDEX_ENTRY_SIZE = 56;
+
+constexpr uint8_t CAPTURE_OPEN = 1;    // 中继接受了连接
+constexpr uint8_t CAPTURE_FRAME = 2;   // 连接发来的一个完整帧
+constexpr uint8_t CAPTURE_CLOSE = 3;   // 连接关闭
+
+constexpr uint32_t CAPTURE_CONN_REGISTERED = 1u << 0;  // 关闭时已注册，标记有效
+constexpr uint32_t CAPTURE_CONN_TRUNK = 1u << 1;       // 集群节点发起的中继链路（重放时跳过）
+constexpr uint32_t CAPTURE_CONN_OPEN = 1u << 2;        // 中继退出时连接仍未关闭
+
+inline size_t captureRecordSize(uint32_t capLen) {
+    return (CAPTURE_RECORD_HEADER_SIZE + capLen + 7) & ~static_cast<size_t>(7);
+}
+
+struct CaptureHeader {
+    uint32_t version = CAPTURE_VERSION;
+    uint32_t snaplen = 0;
+    uint64_t startRealtimeNs = 0;
+    uint64_t dataEnd = CAPTURE_HEADER_SIZE;
+    uint64_t indexOffset = 0;
+    uint32_t indexCount = 0;
+};
+
+struct CaptureRecord {
+    uint64_t timeNs = 0;
+    uint32_t conn = 0;
+    uint8_t type = 0;
+    uint32_t origLen = 0;
+    uint32_t capLen = 0;
+    const uint8_t* data = nullptr;
+};
+
+struct CaptureConn {
+    uint32_t id = 0;
+    uint32_t flags = 0;
+    uint8_t mark[8] = {};
+    uint64_t firstOffset = 0;
+    uint64_t openNs = 0;
+    uint64_t closeNs = 0;
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+};
+
+inline void writeCaptureHeader(uint8_t* buf, const CaptureHeader& h) {
+    memset(buf, 0, CAPTURE_HEADER_SIZE);
+    memcpy(buf, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    writeU32(buf + 8, h.version);
+    writeU32(buf + 12, h.snaplen);
+    writeU64(buf + 16, h.startRealtimeNs);
+    writeU64(buf + 24, h.dataEnd);
+    writeU64(buf + 32, h.indexOffset);
+    writeU32(buf + 40, h.indexCount);
+}
+
+// 校验魔数与版本，并检查偏移不超出文件
+inline bool readCaptureHeader(const uint8_t* buf, size_t fileSize, CaptureHeader& h) {
+    if (fileSize < CAPTURE_HEADER_SIZE || memcmp(buf, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0) {
+        return false;
+    }
+    h.version = readU32(buf + 8);
+    h.snaplen = readU32(buf + 12);
+    h.startRealtimeNs = readU64(buf + 16);
+    h.dataEnd = readU64(buf + 24);
+    h.indexOffset = readU64(buf + 32);
+    h.indexCount = readU32(buf + 40);
+    return h.version == CAPTURE_VERSION && h.dataEnd >= CAPTURE_HEADER_SIZE && h.dataEnd <= fileSize &&
+           (h.indexOffset == 0 ||
+            (h.indexOffset >= h.dataEnd &&
+             h.indexOffset + static_cast<uint64_t>(h.indexCount) * CAPTURE_INDEX_ENTRY_SIZE <= fileSize));
+}
+
+inline void writeCaptureRecordHeader(uint8_t* buf, uint64_t timeNs, uint32_t conn, uint8_t type, uint32_t origLen,
+                                     uint32_t capLen) {
+    writeU64(buf, timeNs);
+    writeU32(buf + 8, conn);
+    buf[12] = type;
+    buf[13] = buf[14] = buf[15] = 0;
+    writeU32(buf + 16, origLen);
+    writeU32(buf + 20, capLen);
+}
+
+// 读取 offset 处的一条记录并前进到下一条；到达 end 或记录不完整时返回 false
+inline bool readCaptureRecord(const uint8_t* base, uint64_t end, uint64_t& offset, CaptureRecord& rec) {
+    if (offset + CAPTURE_RECORD_HEADER_SIZE > end) {
+        return false;
+    }
+    const uint8_t* p = base + offset;
+    rec.timeNs = readU64(p);
+    rec.conn = readU32(p + 8);
+    rec.type = p[12];
+    rec.origLen = readU32(p + 16);
+    rec.capLen = readU32(p + 20);
+    if (rec.capLen > rec.origLen || offset + captureRecordSize(rec.capLen) > end) {
+        return false;
+    }
+    rec.data = p + CAPTURE_RECORD_HEADER_SIZE;
+    offset += captureRecordSize(rec.capLen);
+    return true;
+}
+
+inline void writeCaptureConn(uint8_t* buf, const CaptureConn& c) {
+    writeU32(buf, c.id);
+    writeU32(buf + 4, c.flags);
+    memcpy(buf + 8, c.mark, 8);
+    writeU64(buf + 16, c.firstOffset);
+    writeU64(buf + 24, c.openNs);
+    writeU64(buf + 32, c.closeNs);
+    writeU64(buf + 40, c.frames);
+    writeU64(buf + 48, c.bytes);
+}
+
+inline void readCaptureConn(const uint8_t* buf, CaptureConn& c) {
+    c.id = readU32(buf);
+    c.flags = readU32(buf + 4);
+    memcpy(c.mark, buf + 8, 8);
+    c.firstOffset = readU64(buf + 16);
+    c.openNs = readU64(buf + 24);
+    c.closeNs = readU64(buf + 32);
+    c.frames = readU64(buf + 40);
+    c.bytes = readU64(buf + 48);
+}
+
+// 读取连接索引（按连接编号排列）；文件没有索引时顺序扫描记录重建
+inline bool loadCaptureIndex(const uint8_t* base, const CaptureHeader& h, std::vector<CaptureConn>& conns) {
+    conns.clear();
+    if (h.indexOffset != 0) {
+        conns.resize(h.indexCount);
+        for (uint32_t i = 0; i < h.indexCount; i++) {
+            readCaptureConn(base + h.indexOffset + static_cast<uint64_t>(i) * CAPTURE_INDEX_ENTRY_SIZE, conns[i]);
+            if (conns[i].id != i + 1) {
+                return false;
+            }
+        }
+        return true;
+    }
+    uint64_t offset = CAPTURE_HEADER_SIZE;
+    uint64_t recordOffset = offset;
+    CaptureRecord rec;
+    while (readCaptureRecord(base, h.dataEnd, offset, rec)) {
+        if (rec.conn == 0 || rec.conn > conns.size() + 1) {
+            return false;
+        }
+        if (rec.conn == conns.size() + 1) {
+            CaptureConn c;
+            c.id = rec.conn;
+            c.flags = CAPTURE_CONN_OPEN;
+            c.firstOffset = recordOffset;
+            c.openNs = rec.timeNs;
+            conns.push_back(c);
+        }
+        CaptureConn& c = conns[rec.conn - 1];
+        if (rec.type == CAPTURE_FRAME) {
+            c.frames++;
+            c.bytes += rec.origLen;
+        } else if (rec.type == CAPTURE_CLOSE) {
+            c.flags &= ~CAPTURE_CONN_OPEN;
+            c.closeNs = rec.timeNs;
+        }
+        recordOffset = offset;
+    }
+    return true;
+}
+
+}  // namespace relay
+
+#endif  // RELAY_CAPTURE_H
@@ -0,0 +1,341 @@
+#ifndef RELAY_PROTOCOL_H
+#define RELAY_PROTOCOL_H
+
+/**
+ * 中继服务器扩展协议定义（客户端库、relay_server 与测试共用）
+ *
+ * 帧格式: [4字节帧头(小端序)] + [帧体]
+ *   帧头低24位为帧体长度，高8位为帧类型。
+ *   旧版协议的长度不超过 65535，高8位恒为0，即旧版数据帧 == FRAME_DATA，完全兼容。
+ *
+ * 控制帧 (FRAME_CTRL) 帧体: [1字节操作码] + [操作数据]
+ *   只有通过 CTRL_HELLO 注册的客户端才会收到中继发出的控制帧，旧版客户端不受影响。
+ *
+ * 紧凑帧 (v2，HELLO 协商 CAP_COMPACT 后，自 HELLO_ACK 之后的所有帧双向生效):
+ *   [varint 长度][1字节标签][帧体]，长度包含标签字节
+ *   标签 COMPACT_TAG_CTRL: 控制帧；COMPACT_TAG_DATA: 数据帧，入站帧体仍以8字节目标标记开头；
+ *   1..COMPACT_MAX_SLOT: 入站数据帧发往该短编号对应的标记，帧体即负载。
+ *   短编号由中继在 CTRL_PEER_JOIN 中按连接分配，连接存续期间与标记的对应关系不变。
+ *   出站数据帧的标签为 COMPACT_TAG_DATA，或为来源标记的短编号（见 CAP_SOURCE）。
+ *
+ * 来源标记 (CAP_SOURCE): 声明该能力的客户端发出的数据帧负载不再附带自己的标记，
+ *   由中继在转发时补上，接收方收到的负载总是 [8字节 来源标记][数据]，与旧版客户端自带标记的格式一致；
+ *   接收方为紧凑帧连接且持有来源的短编号时，改用该短编号作为出站标签，省去8字节标记。
+ *
+ * 打包帧 (CAP_BUNDLE): 一个帧头装多个数据包，v1 帧类型 FRAME_BUNDLE，紧凑帧标签 COMPACT_TAG_BUNDLE。
+ *   帧体为若干条记录，每条记录的格式与紧凑数据帧相同: [varint 长度][标签][帧体]，标签含义同上
+ *   （COMPACT_TAG_DATA 或短编号，不允许控制帧）。入站记录可发往不同目标，中继按目标分组，
+ *   每个目标出站一个打包帧（目标未声明 CAP_BUNDLE 时逐条转发）。续传序号按记录计数。
+ *
+ * 扇出 (CAP_FANOUT): 两个保留的目标标记（v1 数据帧、COMPACT_TAG_DATA 数据帧与打包帧记录中均可使用）:
+ *   FANOUT_MULTICAST: 帧体为 [1字节 目标数 n][n × 8字节 目标标记][负载]，负载发往列出的每个目标。
+ *   FANOUT_BROADCAST: 负载发往会话的队友，即该会话此前发往过的标记（最多64个，含断线保留中、
+ *   在其他节点注册的标记；会话续传、接管与热重启后保留）。还没有队友时丢弃（计入 drop_no_target）。
+ *   中继只保存一份负载，各目标的发送队列引用同一缓冲区。续传序号中列表扇出按目标数计数
+ *   （与逐个发送时一致），广播计为一帧。
+ *
+ * 观察连接 (CTRL_TAP): 以 CTRL_TAP 代替注册的连接只读地订阅所列标记的转发流量，本身不是可寻址的标记，
+ *   不出现在在线通知中。需出示中继配置的观察密钥（未配置时不接受观察连接）。中继把每个转发的负载以 FRAME_TAP 镜像给它（只用 v1 帧头）:
+ *   [8字节 来源标记][8字节 目标标记（扇出时为扇出标记）][负载]。
+ *   观察连接的发送队列超过上限时直接丢弃镜像帧，慢速观察者不会拖慢玩家。
+ *
+ * 出站调度 (CAP_LANES): 中继发往每个连接的帧分为控制、可靠、不可靠三条通道，控制帧优先；
+ *   数据帧按 (类别, 来源) 分成子队列，目标积压时按差额轮询发出，同一子队列内保持顺序。
+ *   客户端以 CTRL_CLASS 声明之后发出的数据帧的类别（每个连接从 CLASS_RELIABLE 开始），
+ *   可靠类别的数据帧总是按序送达；截止时间只对不可靠类别生效，过期的不可靠帧被丢弃。
+ *
+ * 集群中继链路 (CTRL_TRUNK): 多个 relay_server 节点两两之间各有一条普通 TCP 连接，
+ *   发起方以 CTRL_TRUNK 代替注册，接受方回复自己的 CTRL_TRUNK，双方随后以 CTRL_TRUNK_MARKS
+ *   同步本节点注册的标记（先快照，之后增量）。发往其他节点标记的负载以 FRAME_TRUNK 转发，
+ *   一个帧体装多个会话的记录: [varint 长度][1字节 标志][8字节 来源标记][8字节 目标标记][负载]，
+ *   长度包含标志与两个标记。中继链路只在节点之间使用，客户端不会收到这些帧。
+ *
+ * 负载感知的会话放置 (CAP_REDIRECT): 节点之间以 CTRL_TRUNK_LOAD 周期交换负载（连接数、出站带宽、
+ *   事件循环延迟）。声明 CAP_REDIRECT 的客户端注册时，若其标记已在其他节点上线，或本节点负载过高而
+ *   其他节点明显空闲，中继以 CTRL_REDIRECT 代替 CTRL_HELLO_ACK 回复目标节点的地址并关闭连接，
+ *   客户端改连该节点重新注册。已在本节点上线或断线保留中的标记不会被重定向。
+ *
+ * 所有多字节整数均为小端序。
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+namespace relay {
+
+// ----------------------------------------------------------------------------
+// 帧头
+// ----------------------------------------------------------------------------
+
+constexpr uint32_t FRAME_HEADER_SIZE = 4;
+constexpr uint32_t FRAME_LENGTH_MASK = 0x00FFFFFF;
+constexpr uint32_t FRAME_TYPE_SHIFT = 24;
+
+constexpr uint8_t FRAME_DATA = 0x00;    // 数据帧（旧版格式）
+constexpr uint8_t FRAME_CTRL = 0x01;    // 控制帧
+constexpr uint8_t FRAME_BUNDLE = 0x02;  // 打包帧（CAP_BUNDLE）
+constexpr uint8_t FRAME_TAP = 0x03;     // 观察帧（中继 -> 观察连接）
+constexpr uint8_t FRAME_TRUNK = 0x04;   // 集群中继帧（节点 <-> 节点）
+
+inline uint32_t readU32(const uint8_t* buf) {
+    return static_cast<uint32_t>(buf[0])        |
+           (static_cast<uint32_t>(buf[1]) << 8) |
+           (static_cast<uint32_t>(buf[2]) << 16) |
+           (static_cast<uint32_t>(buf[3]) << 24);
+}
+
+inline void writeU32(uint8_t* buf, uint32_t v) {
+    buf[0] = static_cast<uint8_t>(v & 0xFF);
+    buf[1] = static_cast<uint8_t>((v >> 8) & 0xFF);
+    buf[2] = static_cast<uint8_t>((v >> 16) & 0xFF);
+    buf[3] = static_cast<uint8_t>((v >> 24) & 0xFF);
+}
+
+inline uint16_t readU16(const uint8_t* buf) {
+    return static_cast<uint16_t>(buf[0] | (buf[1] << 8));
+}
+
+inline void writeU16(uint8_t* buf, uint16_t v) {
+    buf[0] = static_cast<uint8_t>(v & 0xFF);
+    buf[1] = static_cast<uint8_t>((v >> 8) & 0xFF);
+}
+
+inline uint64_t readU64(const uint8_t* buf) {
+    return static_cast<uint64_t>(readU32(buf)) | (static_cast<uint64_t>(readU32(buf + 4)) << 32);
+}
+
+inline void writeU64(uint8_t* buf, uint64_t v) {
+    writeU32(buf, static_cast<uint32_t>(v & 0xFFFFFFFFu));
+    writeU32(buf + 4, static_cast<uint32_t>(v >> 32));
+}
+
+inline void writeFrameHeader(uint8_t* buf, uint32_t bodyLen, uint8_t type) {
+    writeU32(buf, (bodyLen & FRAME_LENGTH_MASK) | (static_cast<uint32_t>(type) << FRAME_TYPE_SHIFT));
+}
+
+inline uint32_t frameLength(uint32_t header) { return header & FRAME_LENGTH_MASK; }
+inline uint8_t frameType(uint32_t header) { return static_cast<uint8_t>(header >> FRAME_TYPE_SHIFT); }
+
+// ----------------------------------------------------------------------------
+// 紧凑帧 (v2)
+// ----------------------------------------------------------------------------
+
+constexpr uint8_t COMPACT_TAG_CTRL = 0x00;   // 控制帧
+constexpr uint8_t COMPACT_TAG_DATA = 0xFF;   // 数据帧（入站带8字节目标标记）
+constexpr uint8_t COMPACT_TAG_BUNDLE = 0xFE; // 打包帧
+constexpr uint8_t COMPACT_MAX_SLOT = 0xFD;   // 短编号范围 1..253，0 表示未分配
+constexpr uint32_t VARINT_MAX_SIZE = 4;      // 帧长度不超过24位
+constexpr uint32_t COMPACT_HEADER_MAX = VARINT_MAX_SIZE + 1;
+
+// 写入 LEB128 变长整数，返回写入的字节数
+inline uint32_t writeVarint(uint8_t* buf, uint32_t v) {
+    uint32_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = static_cast<uint8_t>(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = static_cast<uint8_t>(v);
+    return n;
+}
+
+// LEB128 编码后的字节数
+inline uint32_t varintSize(uint32_t v) {
+    uint32_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+// 读取 LEB128 变长整数：返回消耗的字节数，数据不足返回0，超过 VARINT_MAX_SIZE 字节返回-1
+inline int readVarint(const uint8_t* buf, size_t avail, uint32_t& v) {
+    v = 0;
+    for (uint32_t i = 0; i < VARINT_MAX_SIZE; i++) {
+        if (i >= avail) {
+            return 0;
+        }
+        v |= static_cast<uint32_t>(buf[i] & 0x7F) << (7 * i);
+        if ((buf[i] & 0x80) == 0) {
+            return static_cast<int>(i + 1);
+        }
+    }
+    return -1;
+}
+
+// ----------------------------------------------------------------------------
+// 控制帧
+// ----------------------------------------------------------------------------
+
+constexpr uint8_t PROTOCOL_VERSION = 1;
+
+enum CtrlOp : uint8_t {
+    CTRL_HELLO = 0x01,       // 客户端 -> 中继: 扩展注册（代替8字节注册包）
+    CTRL_HELLO_ACK = 0x02,   // 中继 -> 客户端: 注册结果
+    CTRL_ACK = 0x03,         // 双向: 累计确认 [8字节 已收到的数据帧数]
+    CTRL_PING = 0x04,        // 双向: 心跳 [8字节 发送方时间戳]
+    CTRL_PONG = 0x05,        // 双向: 心跳应答，原样带回 PING 的时间戳
+    CTRL_PEER_JOIN = 0x06,   // 中继 -> 客户端: 标记上线 [8字节 标记]
+    CTRL_PEER_LEAVE = 0x07,  // 中继 -> 客户端: 标记下线 [8字节 标记]
+    CTRL_NACK = 0x08,        // 中继 -> 客户端: 数据帧未被转发 [1字节 原因][8字节 目标标记]
+    CTRL_TAP = 0x09,         // 客户端 -> 中继: 注册为观察连接，中继回复 CTRL_HELLO_ACK
+    CTRL_CLASS = 0x0A,       // 客户端 -> 中继: 之后发出的数据帧的类别 [1字节 TrafficClass]
+    CTRL_TRUNK = 0x0B,       // 节点 <-> 节点: 建立中继链路 [1字节 协议版本][2字节 节点编号]
+    CTRL_TRUNK_MARKS = 0x0C, // 节点 <-> 节点: 标记上线/下线 [1字节 状态][2字节 标记数 n][n × 8字节 标记]
+    CTRL_REDIRECT = 0x0D,    // 中继 -> 客户端: 改连其他节点注册 [2字节 节点编号][4字节 IPv4 地址][2字节 端口]
+    CTRL_TRUNK_LOAD = 0x0E,  // 节点 <-> 节点: 负载通告 [4字节 连接数][4字节 连接上限][2字节 带宽‰][2字节 延迟‰]
+};
+
+// 客户端能力位 (HELLO)
+constexpr uint32_t CAP_RESUME = 1u << 0;    // 断线续传：数据帧按序编号，断线后可在宽限期内恢复会话
+constexpr uint32_t CAP_HEARTBEAT = 1u << 1; // 心跳：客户端应答 CTRL_PING，中继据此测量RTT并回收空闲连接
+constexpr uint32_t CAP_PRESENCE = 1u << 2;  // 在线通知：接收 CTRL_PEER_JOIN/LEAVE 与 CTRL_NACK
+constexpr uint32_t CAP_COMPACT = 1u << 3;   // 紧凑帧 (v2)：需同时声明 CAP_PRESENCE，通过 CTRL_PEER_JOIN 获得短编号
+constexpr uint32_t CAP_SOURCE = 1u << 4;    // 来源标记：负载不带本地标记，由中继在转发时补上
+constexpr uint32_t CAP_BUNDLE = 1u << 5;    // 打包帧：收发 FRAME_BUNDLE / COMPACT_TAG_BUNDLE
+constexpr uint32_t CAP_FANOUT = 1u << 6;    // 扇出：发往 FANOUT_BROADCAST / FANOUT_MULTICAST 的数据帧由中继复制给多个目标
+constexpr uint32_t CAP_LANES = 1u << 7;     // 出站调度：可用 CTRL_CLASS 声明数据帧类别
+constexpr uint32_t CAP_REDIRECT = 1u << 8;  // 重定向：注册时可能收到 CTRL_REDIRECT，需改连其他集群节点
+
+constexpr uint32_t BUNDLE_MAX_SIZE = 65535; // 打包帧体上限（与旧版最大包长一致）
+
+// 保留的目标标记（按 readU64 读取），不能用于注册
+constexpr uint64_t FANOUT_BROADCAST = 0xFFFFFFFFFFFFFFFFull;
+constexpr uint64_t FANOUT_MULTICAST = 0xFFFFFFFFFFFFFFFEull;
+constexpr uint32_t FANOUT_MAX_TARGETS = 255;
+
+inline bool isFanoutMark(uint64_t mark) { return mark == FANOUT_BROADCAST || mark == FANOUT_MULTICAST; }
+
+/**
+ * CTRL_HELLO 帧体:
+ *   [1字节 op][1字节 协议版本][4字节 能力位][8字节 标记][TLV...]
+ * TLV: [1字节 类型][2字节 长度][值]，未知类型直接跳过
+ */
+constexpr uint32_t HELLO_FIXED_SIZE = 1 + 1 + 4 + 8;
+
+enum HelloTlv : uint8_t {
+    // 重连: [8字节 会话令牌][8字节 客户端已收到的数据帧数]
+    // 令牌匹配时，若标记仍被旧连接占用（网络已断但尚未被回收）则立即接管；
+    // 启用 CAP_RESUME 时同时恢复会话
+    TLV_RESUME = 0x01,
+    // 数据帧截止时间: [4字节 毫秒]
+    // 发往本连接的不可靠类别数据帧在中继排队超过该时间仍未开始发送时直接丢弃（可靠类别与控制帧不受影响）；
+    // 0 或不带此项时使用中继的 data_deadline_ms。续传客户端的帧序号按实际发出的帧计算
+    TLV_DEADLINE = 0x02,
+};
+
+constexpr uint32_t TLV_HEADER_SIZE = 3;
+constexpr uint32_t TLV_RESUME_SIZE = 16;
+constexpr uint32_t TLV_DEADLINE_SIZE = 4;
+
+/**
+ * CTRL_HELLO_ACK 帧体:
+ *   [1字节 op][1字节 状态][8字节 会话令牌][8字节 中继已收到的客户端数据帧数][4字节 生效的能力位]
+ *   [1字节 中继协议版本][4字节 槽位号][4字节 中继支持的全部能力位]
+ * 注册完成后立即下发，客户端收到即可开始发送，无需等待或猜测注册是否生效。
+ * 每次注册都会下发非0会话令牌，客户端重连时通过 TLV_RESUME 出示。
+ * 槽位号是中继为在线连接分配的小整数（从1开始，断开后复用）。
+ * 状态为 HELLO_RESUMED 时，中继随后重放客户端尚未收到的数据帧；
+ * 客户端应丢弃已被中继收到的缓存帧，并按序重发其余帧。
+ * 状态 >= HELLO_ERR_* 时注册失败，令牌/帧数/槽位均为0，中继随后关闭连接。
+ * 以后新增字段只追加在末尾，客户端只需检查帧体不短于自己认识的长度。
+ */
+constexpr uint32_t HELLO_ACK_SIZE = 1 + 1 + 8 + 8 + 4 + 1 + 4 + 4;
+
+enum HelloStatus : uint8_t {
+    HELLO_OK = 0x00,                 // 新会话注册成功（数据帧序号从1开始）
+    HELLO_RESUMED = 0x01,            // 恢复了断线前的会话
+    HELLO_ERR_MARK_IN_USE = 0x10,    // 标记已被在线连接占用（且未出示匹配的令牌）
+    HELLO_ERR_BAD_REQUEST = 0x11,    // HELLO 格式错误或重复注册
+    HELLO_ERR_VERSION = 0x12,        // 协议版本不受支持
+    HELLO_ERR_DENIED = 0x13,         // 未获授权（观察密钥不符或未启用观察连接）
+    HELLO_ERR_FULL = 0x14,           // 已注册的客户端数达到 max_connections
+};
+
+inline bool helloFailed(uint8_t status) { return status >= HELLO_ERR_MARK_IN_USE; }
+
+// CTRL_ACK 帧体: [1字节 op][8字节 累计确认的数据帧数]
+constexpr uint32_t CTRL_ACK_SIZE = 1 + 8;
+
+// CTRL_PING / CTRL_PONG 帧体: [1字节 op][8字节 时间戳]
+// 时间戳只对发送方有意义，应答方原样带回；中继使用单调时钟微秒
+constexpr uint32_t CTRL_PING_SIZE = 1 + 8;
+
+/**
+ * CTRL_PEER_JOIN / CTRL_PEER_LEAVE 帧体: [1字节 op][8字节 标记]
+ * 通知只涉及该会话发往过的标记（同一局的队友）：首次发往在线（含断线保留中）的标记时发 JOIN，
+ * 此后该标记注册时发 JOIN，真正离开（断开且不保留、保留超时、被踢出）时发 LEAVE。
+ * 注册成功后中继为这些标记中在线的下发 JOIN 作为快照（新会话为空，续传与接管时带上原会话的标记）。
+ * 续传恢复与令牌接管不改变在线状态，不会产生通知。
+ * 紧凑帧连接收到的 CTRL_PEER_JOIN 末尾追加1字节短编号（0 表示短编号已用完，只能用标记寻址）。
+ */
+constexpr uint32_t CTRL_PEER_EVENT_SIZE = 1 + 8;
+constexpr uint32_t CTRL_PEER_JOIN_COMPACT_SIZE = CTRL_PEER_EVENT_SIZE + 1;
+
+/**
+ * CTRL_NACK 帧体: [1字节 op][1字节 原因][8字节 目标标记]
+ * 同一连接对同一目标在 nack_interval_ms 内最多收到一次，客户端可据此暂停发往该目标的数据。
+ */
+constexpr uint32_t CTRL_NACK_SIZE = 1 + 1 + 8;
+
+enum NackReason : uint8_t {
+    NACK_NO_TARGET = 0x01,   // 目标标记未注册
+};
+
+/**
+ * CTRL_TAP 帧体:
+ *   [1字节 op][1字节 协议版本][8字节 观察密钥][1字节 标记数 n][n × 8字节 标记]
+ * 订阅来源或目标为任一标记的流量；n 至少为1（不支持订阅全部流量）。
+ * 密钥与中继的 -k 不符或中继未配置 -k 时以 HELLO_ERR_DENIED 拒绝。
+ */
+constexpr uint32_t CTRL_TAP_FIXED_SIZE = 1 + 1 + 8 + 1;
+constexpr uint32_t TAP_MAX_MARKS = 64;
+constexpr uint32_t TAP_HEADER_SIZE = 8 + 8;   // FRAME_TAP 帧体中负载之前的来源与目标标记
+
+// CTRL_CLASS 帧体: [1字节 op][1字节 类别]
+constexpr uint32_t CTRL_CLASS_SIZE = 1 + 1;
+
+enum TrafficClass : uint8_t {
+    CLASS_RELIABLE = 0x00,    // 默认：状态变更等必须到达的数据
+    CLASS_UNRELIABLE = 0x01,  // 位置同步等可被新数据取代的数据
+};
+
+constexpr uint32_t CLASS_COUNT = 2;
+
+// CTRL_TRUNK 帧体: [1字节 op][1字节 协议版本][2字节 节点编号（非0）]
+constexpr uint32_t CTRL_TRUNK_SIZE = 1 + 1 + 2;
+
+/**
+ * CTRL_TRUNK_MARKS 帧体: [1字节 op][1字节 状态][2字节 标记数 n][n × 8字节 标记]
+ * 状态为 TRUNK_MARKS_UP 时标记在发送方节点上线（含断线保留中），TRUNK_MARKS_DOWN 时下线。
+ * 链路建立后双方先各发一次全部标记，之后只发变化；链路断开时对方节点的标记全部视为下线。
+ */
+constexpr uint32_t CTRL_TRUNK_MARKS_FIXED_SIZE = 1 + 1 + 2;
+constexpr uint32_t TRUNK_MARKS_MAX = 4096;   // 单个帧最多携带的标记数，快照按此拆分
+constexpr uint8_t TRUNK_MARKS_DOWN = 0x00;
+constexpr uint8_t TRUNK_MARKS_UP = 0x01;
+
+// FRAME_TRUNK 记录标志：位0 为目标应收到来源标记（发送方声明了 CAP_SOURCE），位1 为数据帧类别
+constexpr uint8_t TRUNK_FLAG_SOURCE = 0x01;
+constexpr uint8_t TRUNK_FLAG_CLASS_SHIFT = 1;
+constexpr uint32_t TRUNK_RECORD_HEADER_SIZE = 1 + 8 + 8;
+
+/**
+ * CTRL_REDIRECT 帧体: [1字节 op][2字节 节点编号][4字节 IPv4 地址（点分顺序）][2字节 端口]
+ * 只发给声明 CAP_REDIRECT 且尚未注册成功的客户端，代替 CTRL_HELLO_ACK，中继随后关闭连接。
+ * 客户端应以同一 HELLO（含 TLV_RESUME）向新地址注册；HELLO_ACK 之前发出的数据帧随旧连接丢弃。
+ */
+constexpr uint32_t CTRL_REDIRECT_SIZE = 1 + 2 + 4 + 2;
+
+/**
+ * CTRL_TRUNK_LOAD 帧体: [1字节 op][4字节 连接数][4字节 连接上限][2字节 出站带宽占用‰][2字节 事件循环延迟占用‰]
+ * 链路建立时与每个 load_report_ms 周期各发一次；节点负载取三项占用率中的最大值。
+ */
+constexpr uint32_t CTRL_TRUNK_LOAD_SIZE = 1 + 4 + 4 + 2 + 2;
+
+// 每收到多少个数据帧至少发送一次累计确认
+constexpr uint32_t ACK_EVERY_FRAMES = 32;
+
+} // namespace relay
+
+#endif // RELAY_PROTOCOL_H
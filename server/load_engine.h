@@ -0,0 +1,637 @@
+/**
+ * 负载生成客户端引擎（relay_loadgen 与 relay_bench 共用）
+ *
+ * - 每个会话 players 个玩家，每个玩家一个以 CTRL_HELLO 注册的 TCP 连接，标记为
+ *   [0x6C][工具标签][2字节进程号][3字节会话号][1字节玩家号]，多个进程可以同时压同一个中继
+ * - 每个玩家按 ChannelModel 发包：通道 n 发往同会话的第 (玩家 + 1 + n) % players 个玩家，
+ *   每个通道是一个突发过程（空闲 idle_us 后连发 bursts 个包，包间隔 gaps_us，负载长度取自 sizes）
+ * - 数据包为 v1 数据帧 [帧头][8字节目标标记][负载]，负载开头8字节为发送时间（负载至少8字节），
+ *   接收方据此计算单程延迟（同一主机的 CLOCK_MONOTONIC）
+ * - 每个线程一个 LoadEngine：一个 epoll 与一个 timerfd（绝对时间调度），发送计划按到期时间放在最小堆中
+ * - churn_interval_ns 非0时每个连接按该间隔（随机相位）断开并以非阻塞方式重新连接、注册，
+ *   重连期间该玩家不发包，发往它的包由中继丢弃，计入丢失
+ *
+ * 不是线程安全的：每个 LoadEngine 只在一个线程中运行，结束后再合并统计。
+ */
+
+#ifndef RELAY_LOAD_ENGINE_H
+#define RELAY_LOAD_ENGINE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "relay_protocol.h"
+
+inline uint64_t load_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// 加权经验分布
+struct TrafficDistribution {
+    static constexpr size_t LEARN_BINS = 64;   // 由样本学习时保留的分位点数
+
+    std::vector<std::pair<uint64_t, double>> bins;   // (值, 权重)
+    std::vector<double> cumulative;
+
+    bool empty() const { return bins.empty(); }
+
+    void finalize() {
+        std::sort(bins.begin(), bins.end());
+        cumulative.clear();
+        double sum = 0;
+        for (const auto& bin : bins) {
+            sum += bin.second;
+            cumulative.push_back(sum);
+        }
+    }
+
+    uint64_t sample(std::mt19937_64& rng) const {
+        double x = std::uniform_real_distribution<double>(0, cumulative.back())(rng);
+        size_t i = static_cast<size_t>(std::upper_bound(cumulative.begin(), cumulative.end(), x) - cumulative.begin());
+        return bins[std::min(i, bins.size() - 1)].first;
+    }
+
+    // 由样本取 LEARN_BINS 个分位点，相同的值合并权重
+    void learn(std::vector<uint64_t>& samples) {
+        bins.clear();
+        std::sort(samples.begin(), samples.end());
+        for (size_t k = 0; k < LEARN_BINS && !samples.empty(); k++) {
+            uint64_t v = samples[(2 * k + 1) * samples.size() / (2 * LEARN_BINS)];
+            if (!bins.empty() && bins.back().first == v) {
+                bins.back().second += 1;
+            } else {
+                bins.emplace_back(v, 1.0);
+            }
+        }
+        finalize();
+    }
+
+    static TrafficDistribution constant(uint64_t v) {
+        TrafficDistribution d;
+        d.bins.emplace_back(v, 1.0);
+        d.finalize();
+        return d;
+    }
+
+    // [lo, hi] 内均匀取最多 LEARN_BINS 个值
+    static TrafficDistribution uniform(uint64_t lo, uint64_t hi) {
+        TrafficDistribution d;
+        uint64_t steps = std::min<uint64_t>(hi - lo, LEARN_BINS - 1);
+        for (uint64_t k = 0; k <= steps; k++) {
+            d.bins.emplace_back(steps == 0 ? lo : lo + (hi - lo) * k / steps, 1.0);
+        }
+        d.finalize();
+        return d;
+    }
+};
+
+struct ChannelModel {
+    TrafficDistribution fields[4];   // sizes, bursts, gaps_us, idle_us
+    TrafficDistribution& sizes() { return fields[0]; }
+    TrafficDistribution& bursts() { return fields[1]; }
+    TrafficDistribution& gaps() { return fields[2]; }
+    TrafficDistribution& idle() { return fields[3]; }
+    const TrafficDistribution& sizes() const { return fields[0]; }
+    const TrafficDistribution& bursts() const { return fields[1]; }
+    const TrafficDistribution& gaps() const { return fields[2]; }
+    const TrafficDistribution& idle() const { return fields[3]; }
+    // 空闲间隔与突发长度缺一不可；其余缺省为最小包、无间隔
+    bool enabled() const { return !fields[1].empty() && !fields[3].empty(); }
+};
+
+// 延迟直方图：每个2的幂区间分为64个子桶（误差约1.6%）
+struct LatencyHistogram {
+    static constexpr int SUB = 64;
+    std::vector<uint64_t> counts = std::vector<uint64_t>(60 * SUB, 0);
+    uint64_t total = 0;
+    uint64_t max = 0;
+
+    static size_t bucket(uint64_t v) {
+        if (v < SUB) {
+            return static_cast<size_t>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        return static_cast<size_t>((msb - 5) * SUB) + static_cast<size_t>((v >> (msb - 6)) - SUB);
+    }
+    static uint64_t value(size_t b) {
+        if (b < SUB) {
+            return b;
+        }
+        int msb = static_cast<int>(b / SUB) + 5;
+        return (SUB + b % SUB) << (msb - 6);
+    }
+    void add(uint64_t v) {
+        counts[bucket(v)]++;
+        total++;
+        max = std::max(max, v);
+    }
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        max = std::max(max, other.max);
+    }
+    uint64_t percentile(double p) const {
+        uint64_t target = std::max<uint64_t>(static_cast<uint64_t>(std::ceil(total * p / 100.0)), 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= target) {
+                return std::min(value(i), max);
+            }
+        }
+        return max;
+    }
+};
+
+struct LoadConfig {
+    int players = 4;                      // 每个会话的玩家数
+    std::vector<ChannelModel> channels;   // 最多 players - 1 个
+    uint64_t churn_interval_ns = 0;       // 每个连接断开重连的间隔，0为不重连
+    uint8_t tag = 'G';                    // 标记中的工具标签
+};
+
+struct LoadStats {
+    static constexpr uint64_t INTERVAL_NS = 100000000ULL;   // 吞吐统计区间
+
+    uint64_t sent_frames = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t recv_frames = 0;
+    uint64_t recv_bytes = 0;
+    uint64_t send_dropped = 0;     // 发送积压超过上限而未发出的包
+    uint64_t disconnected = 0;     // 被中继断开（不含主动重连）
+    uint64_t reconnects = 0;       // 完成的重连
+    uint64_t register_failed = 0;  // 重连注册失败
+    LatencyHistogram latency_us;
+    LatencyHistogram reconnect_us;          // 重连到收到 HELLO_ACK 的耗时
+    std::vector<uint64_t> interval_bytes;   // 每个统计区间收到的负载字节数
+
+    void merge(const LoadStats& s) {
+        sent_frames += s.sent_frames;
+        sent_bytes += s.sent_bytes;
+        recv_frames += s.recv_frames;
+        recv_bytes += s.recv_bytes;
+        send_dropped += s.send_dropped;
+        disconnected += s.disconnected;
+        reconnects += s.reconnects;
+        register_failed += s.register_failed;
+        latency_us.merge(s.latency_us);
+        reconnect_us.merge(s.reconnect_us);
+        if (interval_bytes.size() < s.interval_bytes.size()) {
+            interval_bytes.resize(s.interval_bytes.size(), 0);
+        }
+        for (size_t i = 0; i < s.interval_bytes.size(); i++) {
+            interval_bytes[i] += s.interval_bytes[i];
+        }
+    }
+
+    // 发送期间每个完整区间的接收吞吐 (Mbit/s)，升序
+    std::vector<double> interval_mbps(int duration_ms) const {
+        std::vector<double> mbps;
+        size_t full_intervals = static_cast<size_t>(duration_ms) * 1000000ULL / INTERVAL_NS;
+        for (size_t i = 0; i < full_intervals; i++) {
+            uint64_t bytes = i < interval_bytes.size() ? interval_bytes[i] : 0;
+            mbps.push_back(bytes * 8.0 / (INTERVAL_NS / 1e9) / 1e6);
+        }
+        std::sort(mbps.begin(), mbps.end());
+        return mbps;
+    }
+};
+
+class LoadEngine {
+public:
+    static constexpr uint32_t MIN_PAYLOAD = 8;   // 负载开头的发送时间
+    static constexpr uint32_t MAX_PAYLOAD = 65535 - 8;
+
+    LoadEngine(const LoadConfig& config, const sockaddr_in& addr, uint64_t seed)
+        : config_(config), addr_(addr), rng_(seed) {}
+
+    LoadEngine(const LoadEngine&) = delete;
+    LoadEngine& operator=(const LoadEngine&) = delete;
+
+    // 阻塞地建立连接并注册，全部完成后才开始计时
+    bool setup(int first_session, int sessions, uint16_t run_id) {
+        const int players = config_.players;
+        players_.resize(static_cast<size_t>(sessions) * static_cast<size_t>(players));
+        for (int s = 0; s < sessions; s++) {
+            uint32_t session = static_cast<uint32_t>(first_session + s);
+            for (int p = 0; p < players; p++) {
+                Player& player = players_[static_cast<size_t>(s * players + p)];
+                uint8_t mark[8] = {0x6C, config_.tag, static_cast<uint8_t>(run_id), static_cast<uint8_t>(run_id >> 8),
+                                   static_cast<uint8_t>(session), static_cast<uint8_t>(session >> 8),
+                                   static_cast<uint8_t>(session >> 16), static_cast<uint8_t>(p)};
+                std::memcpy(player.mark, mark, 8);
+                player.session_base = static_cast<uint32_t>(s * players);
+                player.index = static_cast<uint32_t>(p);
+                player.fd = open_socket(true);
+                if (player.fd == -1 || !register_blocking(player)) {
+                    return false;
+                }
+            }
+        }
+        epfd_ = epoll_create1(EPOLL_CLOEXEC);
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = TIMER_EVENT;
+        if (epfd_ == -1 || timer_fd_ == -1 || epoll_ctl(epfd_, EPOLL_CTL_ADD, timer_fd_, &ev) != 0) {
+            return false;
+        }
+        for (size_t i = 0; i < players_.size(); i++) {
+            ev.data.u32 = static_cast<uint32_t>(i);
+            if (epoll_ctl(epfd_, EPOLL_CTL_ADD, players_[i].fd, &ev) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void run(uint64_t start_ns, uint64_t end_ns, uint64_t drain_ns) {
+        // 各通道从随机相位开始，避免所有会话同时发出
+        size_t channels = std::min(config_.channels.size(), static_cast<size_t>(config_.players - 1));
+        for (size_t i = 0; i < players_.size(); i++) {
+            for (size_t c = 0; c < channels; c++) {
+                const ChannelModel& ch = config_.channels[c];
+                if (ch.enabled()) {
+                    uint64_t idle = ch.idle().sample(rng_) * 1000;
+                    uint64_t phase = idle == 0 ? 0 : rng_() % idle;
+                    events_.push(Event{start_ns + phase, static_cast<uint32_t>(i), static_cast<uint16_t>(c), 0});
+                }
+            }
+            if (config_.churn_interval_ns != 0) {
+                uint64_t phase = rng_() % config_.churn_interval_ns;
+                events_.push(Event{start_ns + phase, static_cast<uint32_t>(i), CHURN_EVENT, 0});
+            }
+        }
+        start_ns_ = start_ns;
+        struct epoll_event events[MAX_EVENTS];
+        std::vector<uint8_t> payload(MAX_PAYLOAD, 0);
+        while (true) {
+            uint64_t now = load_now_ns();
+            while (!events_.empty() && events_.top().due_ns <= now && now < end_ns) {
+                Event e = events_.top();
+                events_.pop();
+                if (e.channel == CHURN_EVENT) {
+                    reconnect(e.player, now);
+                    e.due_ns += config_.churn_interval_ns;
+                    events_.push(e);
+                } else {
+                    emit(e, payload.data(), now);
+                }
+            }
+            if (now >= end_ns + drain_ns) {
+                break;
+            }
+            uint64_t wake = now < end_ns && !events_.empty() ? std::min(events_.top().due_ns, end_ns) : end_ns + drain_ns;
+            if (wake > now) {
+                struct itimerspec its;
+                std::memset(&its, 0, sizeof(its));
+                its.it_value.tv_sec = static_cast<time_t>(wake / 1000000000ULL);
+                its.it_value.tv_nsec = static_cast<long>(wake % 1000000000ULL);
+                timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+            }
+            int n = epoll_wait(epfd_, events, MAX_EVENTS, wake > now ? 1000 : 0);
+            for (int i = 0; i < n; i++) {
+                uint32_t id = events[i].data.u32;
+                if (id == TIMER_EVENT) {
+                    uint64_t expirations;
+                    ssize_t unused = read(timer_fd_, &expirations, sizeof(expirations));
+                    (void)unused;
+                    continue;
+                }
+                Player& player = players_[id];
+                if (player.fd == -1) {
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    receive(player);
+                }
+                if (player.fd != -1 && (events[i].events & EPOLLOUT)) {
+                    flush(player, id);
+                }
+            }
+        }
+        for (Player& player : players_) {
+            if (player.fd != -1) {
+                close(player.fd);
+            }
+        }
+        close(timer_fd_);
+        close(epfd_);
+    }
+
+    size_t connections() const { return players_.size(); }
+    const LoadStats& stats() const { return stats_; }
+
+private:
+    static constexpr int MAX_EVENTS = 256;
+    static constexpr size_t MAX_OUT_BYTES = 4 * 1024 * 1024;   // 单连接发送积压上限，超过后生成的包直接丢弃
+    static constexpr uint32_t TIMER_EVENT = UINT32_MAX;
+    static constexpr uint16_t CHURN_EVENT = UINT16_MAX;
+
+    struct Player {
+        int fd = -1;
+        uint8_t mark[8];
+        uint32_t session_base = 0;    // 同会话第一个玩家的下标
+        uint32_t index = 0;           // 会话内的编号
+        bool registering = false;     // 已发出 HELLO，尚未收到 HELLO_ACK
+        bool want_write = false;
+        uint64_t connect_ns = 0;
+        std::vector<uint8_t> out;
+        size_t out_off = 0;
+        std::vector<uint8_t> in;
+    };
+
+    // 每个 (玩家, 通道) 的下一次发送，或下一次重连
+    struct Event {
+        uint64_t due_ns;
+        uint32_t player;
+        uint16_t channel;
+        uint32_t burst_left;
+        bool operator>(const Event& other) const { return due_ns > other.due_ns; }
+    };
+
+    int open_socket(bool blocking) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK), 0);
+        if (fd == -1) {
+            return -1;
+        }
+        int flag = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&addr_), sizeof(addr_)) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    void append_hello(Player& player) {
+        uint8_t hello[relay::FRAME_HEADER_SIZE + relay::HELLO_FIXED_SIZE];
+        uint8_t* body = hello + relay::FRAME_HEADER_SIZE;
+        relay::writeFrameHeader(hello, relay::HELLO_FIXED_SIZE, relay::FRAME_CTRL);
+        body[0] = relay::CTRL_HELLO;
+        body[1] = relay::PROTOCOL_VERSION;
+        relay::writeU32(body + 2, 0);
+        std::memcpy(body + 6, player.mark, 8);
+        player.out.insert(player.out.end(), hello, hello + sizeof(hello));
+    }
+
+    bool register_blocking(Player& player) {
+        struct timeval tv = {3, 0};
+        setsockopt(player.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        append_hello(player);
+        uint8_t header[relay::FRAME_HEADER_SIZE];
+        std::vector<uint8_t> ack;
+        bool ok = write(player.fd, player.out.data(), player.out.size()) == static_cast<ssize_t>(player.out.size()) &&
+                  recv(player.fd, header, sizeof(header), MSG_WAITALL) == static_cast<ssize_t>(sizeof(header));
+        player.out.clear();
+        if (ok) {
+            ack.resize(relay::frameLength(relay::readU32(header)));
+            ok = ack.size() > 1 && recv(player.fd, ack.data(), ack.size(), MSG_WAITALL) == static_cast<ssize_t>(ack.size()) &&
+                 ack[0] == relay::CTRL_HELLO_ACK && ack[1] == relay::HELLO_OK;
+        }
+        if (!ok || fcntl(player.fd, F_SETFL, fcntl(player.fd, F_GETFL) | O_NONBLOCK) != 0) {
+            close(player.fd);
+            player.fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // 断开并以非阻塞方式重新连接，HELLO 排在发送缓冲中，收到 HELLO_ACK 后恢复发包
+    void reconnect(uint32_t id, uint64_t now) {
+        Player& player = players_[id];
+        if (player.fd != -1) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, player.fd, nullptr);
+            close(player.fd);
+        }
+        player.out.clear();
+        player.out_off = 0;
+        player.in.clear();
+        player.want_write = false;
+        player.fd = open_socket(false);
+        if (player.fd == -1) {
+            stats_.register_failed++;
+            return;
+        }
+        player.registering = true;
+        player.connect_ns = now;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = id;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, player.fd, &ev);
+        append_hello(player);
+        flush(player, id);
+    }
+
+    void emit(Event e, uint8_t* payload, uint64_t now) {
+        const ChannelModel& ch = config_.channels[e.channel];
+        if (e.burst_left == 0) {
+            e.burst_left = static_cast<uint32_t>(std::max<uint64_t>(ch.bursts().sample(rng_), 1));
+        }
+        Player& player = players_[e.player];
+        uint32_t size = ch.sizes().empty() ? MIN_PAYLOAD : static_cast<uint32_t>(ch.sizes().sample(rng_));
+        size = std::min(std::max(size, MIN_PAYLOAD), MAX_PAYLOAD);
+        if (player.fd != -1 && !player.registering && player.out.size() - player.out_off < MAX_OUT_BYTES) {
+            const Player& target =
+                players_[player.session_base + (player.index + 1 + e.channel) % static_cast<uint32_t>(config_.players)];
+            uint8_t header[relay::FRAME_HEADER_SIZE + 8];
+            relay::writeFrameHeader(header, 8 + size, relay::FRAME_DATA);
+            std::memcpy(header + relay::FRAME_HEADER_SIZE, target.mark, 8);
+            relay::writeU64(payload, now);
+            player.out.insert(player.out.end(), header, header + sizeof(header));
+            player.out.insert(player.out.end(), payload, payload + size);
+            stats_.sent_frames++;
+            stats_.sent_bytes += size;
+            flush(player, e.player);
+        } else if (player.fd != -1 && !player.registering) {
+            stats_.send_dropped++;
+        }
+        // 突发内的下一个包，或空闲后的下一次突发
+        e.burst_left--;
+        uint64_t wait_us = e.burst_left > 0 ? (ch.gaps().empty() ? 0 : ch.gaps().sample(rng_)) : ch.idle().sample(rng_);
+        e.due_ns = std::max(e.due_ns + wait_us * 1000, e.due_ns + 1);
+        events_.push(e);
+    }
+
+    void flush(Player& player, uint32_t id) {
+        while (player.out_off < player.out.size()) {
+            ssize_t n = write(player.fd, player.out.data() + player.out_off, player.out.size() - player.out_off);
+            if (n > 0) {
+                player.out_off += static_cast<size_t>(n);
+            } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                disconnect(player);
+                return;
+            }
+        }
+        if (player.out_off == player.out.size()) {
+            player.out.clear();
+            player.out_off = 0;
+        } else if (player.out_off >= 1024 * 1024) {
+            player.out.erase(player.out.begin(), player.out.begin() + static_cast<std::ptrdiff_t>(player.out_off));
+            player.out_off = 0;
+        }
+        bool want_write = player.out_off < player.out.size();
+        if (want_write != player.want_write) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            if (want_write) {
+                ev.events |= EPOLLOUT;
+            }
+            ev.data.u32 = id;
+            epoll_ctl(epfd_, EPOLL_CTL_MOD, player.fd, &ev);
+            player.want_write = want_write;
+        }
+    }
+
+    void receive(Player& player) {
+        uint8_t buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(player.fd, buf, sizeof(buf))) > 0) {
+            player.in.insert(player.in.end(), buf, buf + n);
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            disconnect(player);
+            return;
+        }
+        uint64_t now = load_now_ns();
+        size_t off = 0;
+        while (player.in.size() - off >= relay::FRAME_HEADER_SIZE) {
+            uint32_t header = relay::readU32(player.in.data() + off);
+            uint32_t len = relay::frameLength(header);
+            if (player.in.size() - off < relay::FRAME_HEADER_SIZE + len) {
+                break;
+            }
+            const uint8_t* body = player.in.data() + off + relay::FRAME_HEADER_SIZE;
+            uint8_t type = relay::frameType(header);
+            if (type == relay::FRAME_DATA && len >= MIN_PAYLOAD) {
+                uint64_t sent = relay::readU64(body);
+                stats_.recv_frames++;
+                stats_.recv_bytes += len;
+                stats_.latency_us.add(now > sent ? (now - sent) / 1000 : 0);
+                size_t interval = static_cast<size_t>((now - start_ns_) / LoadStats::INTERVAL_NS);
+                if (stats_.interval_bytes.size() <= interval) {
+                    stats_.interval_bytes.resize(interval + 1, 0);
+                }
+                stats_.interval_bytes[interval] += len;
+            } else if (type == relay::FRAME_CTRL && player.registering && len >= 2 && body[0] == relay::CTRL_HELLO_ACK) {
+                player.registering = false;
+                if (body[1] == relay::HELLO_OK) {
+                    stats_.reconnects++;
+                    stats_.reconnect_us.add((now - player.connect_ns) / 1000);
+                } else {
+                    stats_.register_failed++;
+                    disconnect(player);
+                    return;
+                }
+            }
+            off += relay::FRAME_HEADER_SIZE + len;
+        }
+        player.in.erase(player.in.begin(), player.in.begin() + static_cast<std::ptrdiff_t>(off));
+    }
+
+    void disconnect(Player& player) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, player.fd, nullptr);
+        close(player.fd);
+        player.fd = -1;
+        if (player.registering) {
+            player.registering = false;
+            stats_.register_failed++;
+        } else {
+            stats_.disconnected++;
+        }
+    }
+
+    const LoadConfig& config_;
+    sockaddr_in addr_;
+    std::mt19937_64 rng_;
+    std::vector<Player> players_;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+    int epfd_ = -1;
+    int timer_fd_ = -1;
+    uint64_t start_ns_ = 0;
+    LoadStats stats_;
+};
+
+// 解析 IPv4 主机名与端口
+inline bool resolve_load_target(const char* host, const char* port, sockaddr_in& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(std::atoi(port)));
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (addr.sin_port == 0 || getaddrinfo(host, nullptr, &hints, &res) != 0) {
+        return false;
+    }
+    addr.sin_addr = reinterpret_cast<sockaddr_in*>(res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return true;
+}
+
+// 把会话平均分给 threads 个 LoadEngine，全部注册后同时开始，持续 duration_ms，结束后再等 drain_ms 接收在途的包
+inline bool run_load(const LoadConfig& config, const sockaddr_in& addr, int sessions, int threads, uint64_t seed,
+                     int duration_ms, int drain_ms, LoadStats& total, size_t& connections, std::string& error) {
+    threads = std::max(1, std::min(threads, sessions));
+    std::vector<std::unique_ptr<LoadEngine>> engines;
+    uint16_t run_id = static_cast<uint16_t>(getpid());
+    int first = 0;
+    for (int t = 0; t < threads; t++) {
+        int count = sessions / threads + (t < sessions % threads ? 1 : 0);
+        engines.emplace_back(new LoadEngine(config, addr, seed * 1000003ULL + static_cast<uint64_t>(t)));
+        if (!engines.back()->setup(first, count, run_id)) {
+            error = "会话注册失败（第 " + std::to_string(first) + " 个会话附近），检查中继的 -c 连接上限与本进程的文件描述符上限";
+            return false;
+        }
+        first += count;
+    }
+
+    uint64_t start_ns = load_now_ns() + 10000000ULL;
+    uint64_t end_ns = start_ns + static_cast<uint64_t>(duration_ms) * 1000000ULL;
+    uint64_t drain_ns = static_cast<uint64_t>(drain_ms) * 1000000ULL;
+    std::vector<std::thread> workers;
+    for (auto& engine : engines) {
+        LoadEngine* e = engine.get();
+        workers.emplace_back([e, start_ns, end_ns, drain_ns]() { e->run(start_ns, end_ns, drain_ns); });
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+    connections = 0;
+    for (const auto& engine : engines) {
+        connections += engine->connections();
+        total.merge(engine->stats());
+    }
+    return true;
+}
+
+#endif  // RELAY_LOAD_ENGINE_H
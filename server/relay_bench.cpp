@@ -0,0 +1,223 @@
+/**
+ * relay_server 基准测试工具
+ *
+ * 打开大量已注册的连接，按会话分组，以固定速率与长度发送带时间戳的包，
+ * 报告吞吐、单程延迟分位数、丢包与连接变动速率。作为中继性能改动的参考基准：
+ * 同一台机器、同一组参数的结果写入同一个 CSV 文件，逐行比较。
+ *
+ * 客户端引擎见 load_engine.h（epoll + timerfd，每线程一个，与 relay_loadgen 共用）：
+ *   每个会话 -p 个玩家，每个玩家以 -r 包/秒的总速率轮流发往同会话的其他玩家，
+ *   负载长度在 -s 给出的范围内均匀取值（至少8字节，开头为发送时间）。
+ *   -k 非0时按该速率（全体连接合计，次/秒）让连接断开后重新连接注册，重连期间发往它的包计入丢失。
+ *
+ * 使用: ./relay_bench [选项] <host> <port>
+ *   -n <sessions>  会话数（默认100）
+ *   -p <players>   每个会话的玩家数（默认4，2-256）
+ *   -r <pps>       每个玩家每秒发出的包数（默认60）
+ *   -s <bytes>     负载长度，或 最小-最大（默认128）
+ *   -d <ms>        持续时间（默认10000）
+ *   -D <ms>        结束发送后等待在途包的时间（默认500）
+ *   -t <threads>   线程数（默认1）
+ *   -k <per_sec>   连接变动速率：每秒断开重连的连接数（默认0）
+ *   -C <csv>       把结果追加到 CSV 文件（新文件先写表头）
+ *   -l <label>     CSV 中的标签列（如版本号或改动名称）
+ *   -S <seed>      随机种子（默认1）
+ *   例: ./relay_bench -n 500 -r 60 -s 64-512 -t 4 -d 30000 -C bench.csv -l baseline 127.0.0.1 27015
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "load_engine.h"
+
+namespace {
+
+const char* const CSV_HEADER =
+    "time,label,sessions,players,connections,threads,rate_pps,size_min,size_max,duration_ms,churn_target,"
+    "sent_frames,recv_frames,lost,drop_pct,send_dropped,disconnected,recv_pps,recv_mbps,"
+    "lat_p50_us,lat_p99_us,lat_p999_us,lat_max_us,reconnects,churn_per_s,reconnect_p50_us,reconnect_p99_us,"
+    "register_failed";
+
+void print_usage(const char* program) {
+    fprintf(stderr, "使用: %s [选项] <host> <port>\n", program);
+    fprintf(stderr, "  -n <sessions>  会话数（默认100）\n");
+    fprintf(stderr, "  -p <players>   每个会话的玩家数（默认4，2-256）\n");
+    fprintf(stderr, "  -r <pps>       每个玩家每秒发出的包数（默认60）\n");
+    fprintf(stderr, "  -s <bytes>     负载长度，或 最小-最大（默认128）\n");
+    fprintf(stderr, "  -d <ms>        持续时间（默认10000）\n");
+    fprintf(stderr, "  -D <ms>        结束发送后等待在途包的时间（默认500）\n");
+    fprintf(stderr, "  -t <threads>   线程数（默认1）\n");
+    fprintf(stderr, "  -k <per_sec>   每秒断开重连的连接数（默认0）\n");
+    fprintf(stderr, "  -C <csv>       把结果追加到 CSV 文件\n");
+    fprintf(stderr, "  -l <label>     CSV 中的标签列\n");
+    fprintf(stderr, "  -S <seed>      随机种子（默认1）\n");
+}
+
+bool parse_size_range(const char* text, uint32_t& lo, uint32_t& hi) {
+    char* end = nullptr;
+    lo = static_cast<uint32_t>(std::strtoul(text, &end, 10));
+    hi = lo;
+    if (*end == '-') {
+        hi = static_cast<uint32_t>(std::strtoul(end + 1, &end, 10));
+    }
+    return *end == '\0' && lo > 0 && lo <= hi && hi <= LoadEngine::MAX_PAYLOAD;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int sessions = 100;
+    int players = 4;
+    double rate = 60;
+    uint32_t size_min = 128;
+    uint32_t size_max = 128;
+    int duration_ms = 10000;
+    int drain_ms = 500;
+    int threads = 1;
+    double churn = 0;
+    std::string csv_path;
+    std::string label;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:r:s:d:D:t:k:C:l:S:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            sessions = std::atoi(optarg);
+            break;
+        case 'p':
+            players = std::atoi(optarg);
+            break;
+        case 'r':
+            rate = std::atof(optarg);
+            break;
+        case 's':
+            if (!parse_size_range(optarg, size_min, size_max)) {
+                fprintf(stderr, "无效的负载长度: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            duration_ms = std::atoi(optarg);
+            break;
+        case 'D':
+            drain_ms = std::atoi(optarg);
+            break;
+        case 't':
+            threads = std::atoi(optarg);
+            break;
+        case 'k':
+            churn = std::atof(optarg);
+            break;
+        case 'C':
+            csv_path = optarg;
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'S':
+            seed = std::strtoull(optarg, nullptr, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (sessions <= 0 || players < 2 || players > 256 || rate <= 0 || duration_ms <= 0 || drain_ms < 0 ||
+        threads <= 0 || churn < 0 || label.find(',') != std::string::npos || argc - optind != 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    sockaddr_in addr;
+    if (!resolve_load_target(argv[optind], argv[optind + 1], addr)) {
+        fprintf(stderr, "无效地址: %s:%s\n", argv[optind], argv[optind + 1]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // 每个玩家轮流发往其余 players-1 人：每个通道的间隔为总间隔的 players-1 倍
+    LoadConfig config;
+    config.players = players;
+    config.tag = 'B';
+    ChannelModel channel;
+    channel.sizes() = TrafficDistribution::uniform(size_min, size_max);
+    channel.bursts() = TrafficDistribution::constant(1);
+    channel.idle() = TrafficDistribution::constant(
+        std::max<uint64_t>(static_cast<uint64_t>(1e6 * (players - 1) / rate), 1));
+    config.channels.assign(static_cast<size_t>(players - 1), channel);
+    uint64_t total_connections = static_cast<uint64_t>(sessions) * static_cast<uint64_t>(players);
+    if (churn > 0) {
+        config.churn_interval_ns = std::max<uint64_t>(static_cast<uint64_t>(total_connections * 1e9 / churn), 1000000);
+    }
+
+    LoadStats total;
+    size_t connections = 0;
+    std::string error;
+    if (!run_load(config, addr, sessions, threads, seed, duration_ms, drain_ms, total, connections, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    double seconds = duration_ms / 1000.0;
+    long long lost = static_cast<long long>(total.sent_frames) - static_cast<long long>(total.recv_frames);
+    double drop_pct = total.sent_frames == 0 ? 0 : lost * 100.0 / total.sent_frames;
+    double recv_pps = total.recv_frames / seconds;
+    double recv_mbps = total.recv_bytes * 8.0 / seconds / 1e6;
+    double churn_per_s = total.reconnects / seconds;
+    const LatencyHistogram& lat = total.latency_us;
+    const LatencyHistogram& reconnect = total.reconnect_us;
+    std::vector<double> mbps = total.interval_mbps(duration_ms);
+
+    printf("relay_bench: %d 个会话 x %d 人（%zu 个连接），每人 %.0f 包/秒，负载 %u-%u 字节，%d ms，%d 线程\n",
+           sessions, players, connections, rate, size_min, size_max, duration_ms, threads);
+    printf("  吞吐:     发送 %llu 帧，接收 %llu 帧，%.0f 包/秒，%.3f Mbit/s（每100ms 最低 %.3f，中位 %.3f）\n",
+           static_cast<unsigned long long>(total.sent_frames), static_cast<unsigned long long>(total.recv_frames),
+           recv_pps, recv_mbps, mbps.empty() ? 0.0 : mbps.front(), mbps.empty() ? 0.0 : mbps[mbps.size() / 2]);
+    printf("  延迟(us): p50 %llu，p99 %llu，p99.9 %llu，最大 %llu\n",
+           static_cast<unsigned long long>(lat.percentile(50)), static_cast<unsigned long long>(lat.percentile(99)),
+           static_cast<unsigned long long>(lat.percentile(99.9)), static_cast<unsigned long long>(lat.max));
+    printf("  丢包:     %lld 帧（%.4f%%），发送积压丢弃 %llu，被中继断开 %llu\n", lost, drop_pct,
+           static_cast<unsigned long long>(total.send_dropped), static_cast<unsigned long long>(total.disconnected));
+    printf("  连接变动: 重连 %llu 次（%.2f 次/秒），重连耗时 p50 %llu us，p99 %llu us，注册失败 %llu\n",
+           static_cast<unsigned long long>(total.reconnects), churn_per_s,
+           static_cast<unsigned long long>(reconnect.percentile(50)),
+           static_cast<unsigned long long>(reconnect.percentile(99)),
+           static_cast<unsigned long long>(total.register_failed));
+
+    if (!csv_path.empty()) {
+        struct stat st;
+        bool fresh = stat(csv_path.c_str(), &st) != 0 || st.st_size == 0;
+        FILE* csv = fopen(csv_path.c_str(), "a");
+        if (!csv) {
+            fprintf(stderr, "无法写入 CSV 文件 %s\n", csv_path.c_str());
+            return 1;
+        }
+        if (fresh) {
+            fprintf(csv, "%s\n", CSV_HEADER);
+        }
+        char when[32];
+        time_t now = time(nullptr);
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        fprintf(csv, "%s,%s,%d,%d,%zu,%d,%.2f,%u,%u,%d,%.2f,%llu,%llu,%lld,%.4f,%llu,%llu,%.0f,%.3f,%llu,%llu,%llu,%llu,"
+                     "%llu,%.2f,%llu,%llu,%llu\n",
+                when, label.c_str(), sessions, players, connections, threads, rate, size_min, size_max, duration_ms,
+                churn, static_cast<unsigned long long>(total.sent_frames),
+                static_cast<unsigned long long>(total.recv_frames), lost, drop_pct,
+                static_cast<unsigned long long>(total.send_dropped), static_cast<unsigned long long>(total.disconnected),
+                recv_pps, recv_mbps, static_cast<unsigned long long>(lat.percentile(50)),
+                static_cast<unsigned long long>(lat.percentile(99)), static_cast<unsigned long long>(lat.percentile(99.9)),
+                static_cast<unsigned long long>(lat.max), static_cast<unsigned long long>(total.reconnects), churn_per_s,
+                static_cast<unsigned long long>(reconnect.percentile(50)),
+                static_cast<unsigned long long>(reconnect.percentile(99)),
+                static_cast<unsigned long long>(total.register_failed));
+        fclose(csv);
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * relay_server 管理命令行工具
+ *
+ * 通过 Unix domain 管理socket 向运行中的 relay_server 发送一条命令并打印响应。
+ *
+ * 使用: ./relay_ctl <socket_path> <command> [args...]
+ *   例: ./relay_ctl /tmp/relay.sock list
+ *       ./relay_ctl /tmp/relay.sock kick 0102030405060708
+ *       ./relay_ctl /tmp/relay.sock set max_connections 16
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "使用: %s <socket_path> <command> [args...]\n", argv[0]);
+        fprintf(stderr, "      %s <socket_path> help   查看可用命令\n", argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[1];
+    struct sockaddr_un addr;
+    if (std::strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket路径过长: %s\n", path);
+        return 1;
+    }
+
+    std::string line;
+    for (int i = 2; i < argc; i++) {
+        if (i > 2) {
+            line += ' ';
+        }
+        line += argv[i];
+    }
+    line += '\n';
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        fprintf(stderr, "创建socket失败: %s\n", strerror(errno));
+        return 1;
+    }
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "连接 %s 失败: %s\n", path, strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    size_t sent = 0;
+    while (sent < line.size()) {
+        ssize_t n = write(fd, line.data() + sent, line.size() - sent);
+        if (n <= 0) {
+            fprintf(stderr, "发送命令失败: %s\n", strerror(errno));
+            close(fd);
+            return 1;
+        }
+        sent += static_cast<size_t>(n);
+    }
+
+    // 读取响应，直到遇到单独一行 "END"
+    std::string reply;
+    char buf[4096];
+    bool ok = false;
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        reply.append(buf, static_cast<size_t>(n));
+        if (reply.size() >= 4 && reply.compare(reply.size() - 4, 4, "END\n") == 0 &&
+            (reply.size() == 4 || reply[reply.size() - 5] == '\n')) {
+            reply.resize(reply.size() - 4);
+            ok = true;
+            break;
+        }
+    }
+    close(fd);
+
+    fputs(reply.c_str(), stdout);
+    if (!ok) {
+        fprintf(stderr, "响应不完整（连接提前关闭）\n");
+        return 1;
+    }
+    return reply.compare(0, 4, "ERR ") == 0 ? 2 : 0;
+}
@@ -0,0 +1,503 @@
+/**
+ * 中继服务端内部接口
+ *
+ * relay_server.cpp 的实现细节都在 relay_detail 命名空间中；这里声明它们共用的常量、连接与中继状态，
+ * 以及微基准直接测量的帧解析、缓冲区与发送路径函数。只供 relay_server.cpp 与 tests/bench_server.cpp 使用，
+ * 对外接口见 relay_server.h。
+ *
+ * 这些函数通过线程局部的 ctx 访问当前中继：在 RelayServer 之外调用前用 ContextScope 指定一个 RelayContext。
+ */
+
+#ifndef RELAY_INTERNAL_H
+#define RELAY_INTERNAL_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include "relay_protocol.h"
+#include "relay_capture.h"
+#include "timer_wheel.h"
+#include "relay_server.h"
+
+namespace relay_detail {
+
+// 常量定义
+constexpr int DEFAULT_MAX_CONNECTIONS = 4;  // 默认最大连接数（可用 -c 或管理命令调整）
+constexpr int MAX_EVENTS = 64;
+constexpr int BUFFER_SIZE = 65536 + 32;     // 接收缓冲区大小（余量容纳中继链路记录头，见 FRAME_TRUNK）
+constexpr int MAX_PACKET_SIZE = 65535;      // 最大包大小
+constexpr int LENGTH_SIZE = 4;              // 长度字段大小（4字节）
+constexpr int MARK_SIZE = 8;                // 标记大小（8字节）
+constexpr uint64_t TIMER_TICK_MS = 10;      // 时间轮tick粒度
+constexpr uint64_t HOUSEKEEPING_INTERVAL_MS = 1000;  // 补发确认、清理保留会话的周期
+constexpr size_t NACK_TRACK_LIMIT = 64;     // 每个连接最多记录多少个目标的NACK限速状态
+constexpr size_t PRESENCE_PEER_LIMIT = 64;  // 每个会话最多关注多少个标记的在线状态
+constexpr int SEND_IOV_MAX = 64;            // flush_send_buffer 单次 writev 的最多分段数
+constexpr size_t EGRESS_WIRE_BYTES = 16 * 1024;   // 发送队列超过该长度后数据帧进入子队列排队
+constexpr size_t SEND_BUF_RETAIN_BYTES = 64 * 1024;   // 发送队列清空后 send_buf 最多保留的容量，突发后多出的部分归还
+constexpr int EGRESS_NOTSENT_LOWAT = 16 * 1024;    // 内核中最多积压的未发送字节，其余积压留在子队列中调度
+constexpr int64_t INGRESS_UNIT = 1000;             // 入站令牌以千分之一为单位记账，按毫秒补充时不丢失零头
+constexpr uint32_t TRUNK_FRAME_MAX = BUFFER_SIZE - LENGTH_SIZE;   // FRAME_TRUNK 帧体上限（对方接收缓冲区可容纳）
+// 中继支持的能力位（HELLO_ACK 下发；客户端声明的能力位与之取交集）
+constexpr uint32_t SERVER_CAPS = relay::CAP_RESUME | relay::CAP_HEARTBEAT | relay::CAP_PRESENCE |
+                                 relay::CAP_COMPACT | relay::CAP_SOURCE | relay::CAP_BUNDLE | relay::CAP_FANOUT |
+                                 relay::CAP_LANES | relay::CAP_REDIRECT;
+
+// 断线续传会话状态（仅 CAP_RESUME 客户端使用）
+// 双向数据帧都从1开始隐式编号，通过 CTRL_ACK 累计确认
+struct ResumeState {
+    uint64_t token = 0;           // 会话令牌（HELLO_ACK 下发，恢复会话/接管标记时校验）
+    uint64_t rx_seq = 0;          // 已从客户端收到的数据帧数
+    uint64_t rx_acked = 0;        // 已通过 CTRL_ACK 告知客户端的 rx_seq
+    uint64_t tx_base = 1;         // tx_log 第一帧的序号
+    std::deque<std::vector<uint8_t>> tx_log;   // 已发往客户端但尚未被确认的数据帧（仅负载）
+    size_t tx_log_bytes = 0;
+    bool tx_log_overflow = false; // 客户端长期不确认导致缓存超限，会话不再可恢复
+    // 会话的队友：会话发往过的目标标记（最多 PRESENCE_PEER_LIMIT 个），即同一局的其他玩家；
+    // 在线通知 (CAP_PRESENCE) 只通知这些标记的上线/下线，广播扇出 (FANOUT_BROADCAST) 只发给这些标记
+    std::vector<uint64_t> presence_peers;
+
+    uint64_t tx_next() const { return tx_base + tx_log.size(); }
+};
+
+// 连接信息结构
+struct Connection {
+    int fd;
+    uint8_t mark[MARK_SIZE];  // 8字节标记
+    bool registered;           // 是否已注册
+    bool hello = false;        // 通过 CTRL_HELLO 注册（可接收控制帧）
+    uint32_t slot = 0;         // 注册后分配的槽位号（HELLO_ACK 下发，0为未分配）
+    uint32_t caps = 0;         // 客户端能力位 (relay::CAP_*)
+    ResumeState resume;
+
+    // 发送队列：send_buf 为连续字节；扇出负载不逐目标复制，以共享缓冲区的引用插在 send_buf 的某个位置
+    struct SharedSegment {
+        size_t offset;   // 在 send_buf 中的插入位置，之前的字节先于本段发出
+        std::shared_ptr<const std::vector<uint8_t>> data;
+        size_t begin;    // 从 data 的该位置开始发送（跳过来源标记或已写出的部分）
+    };
+    std::vector<uint8_t> send_buf;
+    std::deque<SharedSegment> send_shared;
+    size_t send_shared_bytes = 0;   // send_shared 中尚未发出的字节数
+
+    bool send_pending() const { return !send_buf.empty() || !send_shared.empty(); }
+    size_t send_bytes() const { return send_buf.size() + send_shared_bytes; }
+
+    // 出站调度：控制帧直接追加到发送队列（优先于所有排队的数据帧）；发送队列积压时数据帧改为进入
+    // (类别, 来源) 子队列，socket 可写时按差额轮询补充到发送队列，大流量来源不会拖慢其他来源的小包
+    struct EgressFrame {
+        uint32_t len;            // 在子队列 bytes 中的字节数（共享负载除外）
+        uint32_t count;          // 包含的负载数（打包帧为记录数）
+        uint64_t queued_ms;      // 入队时间（收到该数据的那轮事件循环）
+        std::shared_ptr<const std::vector<uint8_t>> shared;   // 扇出的共享负载，紧跟在 bytes 之后发出
+        size_t begin;
+        std::vector<std::vector<uint8_t>> tx_log;   // 续传客户端：发出时才记入 tx_log，帧序号与实际发送顺序一致
+    };
+    struct EgressFlow {
+        uint64_t source;         // 发送方标记
+        uint8_t lane;            // relay::CLASS_*
+        int64_t deficit = 0;
+        std::vector<uint8_t> bytes;
+        size_t head = 0;         // bytes 中已移入发送队列的字节数
+        std::deque<EgressFrame> frames;
+    };
+    std::vector<EgressFlow> egress_flows;   // 有待发帧的子队列，按轮询顺序排列
+    size_t egress_cursor = 0;
+    bool egress_granted = false;     // egress_cursor 指向的子队列本轮已加过配额
+    size_t egress_bytes = 0;         // 子队列中的字节数
+    uint8_t rx_class = relay::CLASS_RELIABLE;   // 本连接发出的数据帧类别 (CTRL_CLASS)
+
+    size_t queued_bytes() const { return send_bytes() + egress_bytes; }
+
+    // 数据帧截止时间：不可靠类别在子队列中等待超过时限的数据帧在调度时丢弃
+    uint32_t deadline_ms = 0;        // TLV_DEADLINE 指定的截止时间，0 为使用 data_deadline_ms
+    uint64_t deadline_drops = 0;     // 因过期丢弃的负载数
+
+    // 观察连接 (CTRL_TAP)：不注册标记，只接收 FRAME_TAP 镜像帧
+    bool tap = false;
+    bool tap_dirty = false;              // 本轮有新的镜像帧，等待 flush_dirty_taps
+    std::vector<uint64_t> tap_marks;     // 订阅的标记（至少一个）
+    uint64_t tap_dropped = 0;            // 因发送队列超限丢弃的镜像帧数
+
+    // 集群中继链路 (CTRL_TRUNK)：不注册标记，承载与另一个节点之间所有会话的转发
+    bool trunk = false;
+    bool trunk_dialed = false;           // 由本节点发起（断开后按 trunk_retry_ms 重连）
+    bool trunk_up = false;               // 握手完成
+    uint16_t trunk_node = 0;             // 对方节点编号
+    std::vector<uint8_t> trunk_batch;    // 本轮待发的 FRAME_TRUNK 记录，事件处理完后统一成帧
+    bool trunk_dirty = false;            // 已加入 dirty_trunks
+    uint64_t trunk_records = 0;          // 经本链路发出的记录数
+
+    // 金丝雀镜像 (-m)：入站数据先 splice 进主管道，tee 一份到镜像管道后再读入 recv_buf，
+    // 镜像管道中的数据在金丝雀连接可写时 splice 出去，全程不经过用户态
+    int mirror_fd = -1;                  // 到金丝雀中继的连接，-1 为未镜像
+    int mirror_in[2] = {-1, -1};         // 主管道: socket -> 管道 -> recv_buf
+    int mirror_out[2] = {-1, -1};        // 镜像管道: tee 的副本 -> mirror_fd
+    size_t mirror_pending = 0;           // 镜像管道中尚未发出的字节数
+    bool mirror_connected = false;       // 到金丝雀的非阻塞连接已完成
+    bool mirror_want_write = true;       // mirror_fd 当前是否关注 EPOLLOUT
+
+    uint32_t capture_id = 0;             // 抓包文件中的连接编号 (-w)，0为不抓包
+
+    // 接收缓冲区（处理粘包/拆包）
+    uint8_t recv_buf[BUFFER_SIZE];
+    size_t recv_len;           // 当前缓冲区中的数据长度
+
+    std::string peer_addr;     // 对端地址 ip:port（管理命令展示用）
+    uint32_t peer_ip = 0;      // 对端 IPv4 地址（网络字节序，计入 ip_connections），0为未计入
+
+    // 入站限速：包/秒与字节/秒两个令牌桶，容量为一秒的配额；令牌耗尽时暂停读取（关闭 EPOLLIN），
+    // 积压留在内核接收缓冲区，由 TCP 流控压回发送方，TIMER_INGRESS 到期后恢复
+    int64_t ingress_packets = 0;     // 剩余的包令牌
+    int64_t ingress_bytes = 0;       // 剩余的字节令牌
+    uint64_t ingress_refill_ms = 0;  // 上次补充令牌的时间
+    bool ingress_paused = false;
+    uint64_t ingress_pauses = 0;     // 因超出配额暂停读取的次数
+
+    // 单连接统计（管理命令 list 使用）
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t packets_in = 0;
+    uint64_t packets_out = 0;
+    uint64_t rate_snapshot_in = 0;   // 上次PERF周期时的 bytes_in
+    uint64_t rate_snapshot_out = 0;  // 上次PERF周期时的 bytes_out
+    double rate_in = 0.0;            // 入站速率 (B/s)
+    double rate_out = 0.0;           // 出站速率 (B/s)
+
+    // 定时器（见 TimerKind）；触发或取消后置0
+    TimerWheel::TimerId register_timer = TimerWheel::INVALID_TIMER;
+    TimerWheel::TimerId idle_timer = TimerWheel::INVALID_TIMER;
+    TimerWheel::TimerId ping_timer = TimerWheel::INVALID_TIMER;
+    TimerWheel::TimerId ingress_timer = TimerWheel::INVALID_TIMER;
+    uint64_t last_rx_ms = 0;         // 最近一次收到数据的时间（粗粒度时钟）
+    uint64_t rtt_us = 0;             // 最近一次心跳RTT（仅 CAP_HEARTBEAT 客户端）
+    uint64_t srtt_us = 0;            // 平滑RTT (EWMA 1/8)
+
+    // 目标标记 -> 下次允许发送 CTRL_NACK 的时间（仅 CAP_PRESENCE 客户端）
+    std::unordered_map<uint64_t, uint64_t> nack_until;
+
+    // 紧凑帧 (CAP_COMPACT)：HELLO_ACK 之后双向使用 v2 帧
+    // 短编号按连接分配，连接存续期间不复用；fd 只是转发时的提示，使用前按标记校验
+    struct PeerSlot {
+        uint64_t key;
+        int fd;
+    };
+    bool compact = false;
+    std::vector<PeerSlot> peer_slots;                  // 短编号-1 -> 标记
+    std::unordered_map<uint64_t, uint8_t> peer_slot_of; // 标记 -> 短编号
+
+    Connection() : fd(-1), registered(false), recv_len(0) {
+        std::memset(mark, 0, MARK_SIZE);
+        std::memset(recv_buf, 0, BUFFER_SIZE);
+    }
+
+    explicit Connection(int socket_fd) : fd(socket_fd), registered(false), recv_len(0) {
+        std::memset(mark, 0, MARK_SIZE);
+        std::memset(recv_buf, 0, BUFFER_SIZE);
+    }
+
+    // 从缓冲区移除已处理的数据
+    void consume(size_t len) {
+        if (len >= recv_len) {
+            recv_len = 0;
+        } else {
+            std::memmove(recv_buf, recv_buf + len, recv_len - len);
+            recv_len -= len;
+        }
+    }
+};
+
+// 将8字节标记转换为uint64_t用于map key
+inline uint64_t mark_to_key(const uint8_t* mark) {
+    uint64_t key;
+    std::memcpy(&key, mark, sizeof(key));
+    return key;
+}
+
+// 断线后保留的会话：标记保持占用，发往该标记的数据缓存到 tx_log，宽限期内可恢复
+struct ParkedSession {
+    uint8_t mark[MARK_SIZE];
+    ResumeState state;
+    uint64_t expire_at_ms = 0;
+};
+
+// ============================================================================
+// 中继状态
+//
+// 一个 RelayServer 的全部可变状态（连接表、定时器、运行时限制、统计计数、管理与热重启socket）
+// 都在它持有的 RelayContext 中，start() 时新建，同一进程可以同时运行多个中继（如进程内的集群节点）。
+// 事件循环中的函数通过线程局部的 ctx 访问当前中继，RelayServer 的入口函数负责设置它。
+// ============================================================================
+
+// -j 配置的集群节点：本节点向每个节点发起中继链路，两端同时发起时只保留编号较小的节点发起的那条
+struct TrunkPeer {
+    uint16_t node = 0;
+    std::string addr;              // host:port（日志与管理命令展示用）
+    sockaddr_in sockaddr{};
+    int fd = -1;                   // 本节点发起、正在连接或已建立的链路
+    TimerWheel::TimerId retry_timer = TimerWheel::INVALID_TIMER;
+    // 最近一次 CTRL_TRUNK_LOAD；重定向到该节点时 load_connections 先行加1，下次通告时以实际值为准
+    bool load_known = false;
+    uint32_t load_connections = 0;
+    uint32_t load_capacity = 0;
+    uint16_t load_egress = 0;      // 出站带宽占用‰
+    uint16_t load_lag = 0;         // 事件循环延迟占用‰
+};
+
+constexpr size_t CAPTURE_GROW_BYTES = 16 * 1024 * 1024;  // 抓包文件每次扩展的长度
+
+// 打包帧中的一条负载（指向发送方的接收缓冲区）
+struct BundleRecord {
+    const uint8_t* payload;
+    uint32_t len;
+};
+
+// 打包帧按目标分组的记录
+struct BundleRoute {
+    int fd;
+    std::vector<BundleRecord> records;
+};
+
+// PERF统计：按 perf_interval_ms 周期输出增量，同时更新单连接速率
+struct PerfSnapshot {
+    uint64_t at_ms = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t packets_in = 0;
+    uint64_t packets_out = 0;
+    uint64_t drop_no_target = 0;
+    uint64_t drop_small_packet = 0;
+    uint64_t drop_send_eagain = 0;
+    uint64_t partial_writes = 0;
+    uint64_t write_errors = 0;
+    uint64_t event_loops = 0;
+    uint64_t events = 0;
+};
+
+constexpr size_t ADMIN_QUEUE_CAPACITY = 64;
+
+struct AdminClient {
+    uint64_t id = 0;           // 连接序号，防止fd复用后把响应发给新连接
+    std::string in_buf;
+    std::string out_buf;
+    int pending = 0;           // 已入队尚未执行的命令数
+    bool read_paused = false;  // 命令队列已满：其余命令留在 in_buf 中，暂停读取直到队列有空位（回复保持命令顺序）
+    bool peer_closed = false;  // 对端已关闭写方向，发送完响应后关闭
+};
+
+struct AdminCommand {
+    int fd = -1;
+    uint64_t client_id = 0;
+    std::string line;
+};
+
+struct RelayContext {
+    // 事件循环
+    std::atomic<bool> running{true};         // RelayServer::stop() 可在信号处理函数或其他线程中清除
+    int epfd = -1;
+    int listen_fd = -1;
+    int wake_fd = -1;                        // RelayServer::stop() 通过它唤醒 epoll_wait
+    RelayClock clock;                        // 注入的时钟（RelayOptions::clock），为空时使用 CLOCK_MONOTONIC_COARSE
+    uint64_t now_ms = 0;                     // 每轮事件循环刷新一次的缓存时钟，避免在热路径上反复取时间
+    TimerWheel timers{TIMER_TICK_MS, 0};
+    int timer_fd = -1;
+    uint64_t timer_armed_ms = TimerWheel::NO_EXPIRY;   // timerfd 当前设置的到期时间
+
+    // 连接与会话
+    std::unordered_map<int, Connection> connections;      // fd -> Connection
+    std::unordered_map<uint64_t, int> mark_to_fd;         // mark -> fd
+    std::unordered_map<uint64_t, ParkedSession> parked;   // mark -> 断线保留的会话
+    std::vector<int> taps;                                // 观察连接fd
+    std::unordered_map<uint32_t, int> ip_connections;     // 对端IP -> 连接数 (max_connections_per_ip)
+    std::vector<int> dirty_taps;                          // 本轮有新镜像帧的观察连接fd
+    std::unordered_map<uint16_t, int> trunks;             // 节点编号 -> 已握手的中继链路fd
+    std::unordered_map<uint64_t, uint16_t> remote_marks;  // 其他节点注册的标记 -> 节点编号
+    std::vector<int> dirty_trunks;                        // 本轮有待发记录的中继链路fd
+    size_t trunk_connections = 0;                         // connections 中的中继链路数（含握手中的）
+    std::unordered_map<int, int> mirrors;                 // 金丝雀连接fd -> 被镜像的客户端fd
+    bool mirror_enabled = false;                          // -m 指定了金丝雀中继
+    sockaddr_in mirror_addr{};
+    std::string mirror_target;                            // host:port（日志展示用）
+
+    // 观察连接密钥 (-k)：未配置时拒绝全部 CTRL_TAP
+    bool tap_key_set = false;
+    uint64_t tap_key = 0;
+
+    // 抓包文件 (-w)：记录经 mmap 追加，退出时写入连接索引
+    int capture_fd = -1;
+    std::string capture_path;
+    uint8_t* capture_map = nullptr;
+    size_t capture_mapped = 0;                      // 当前映射（文件）长度
+    relay::CaptureHeader capture_header;
+    std::vector<relay::CaptureConn> capture_conns;  // 按连接编号排列的索引
+    uint64_t capture_start_ns = 0;                  // 开始时的 CLOCK_MONOTONIC
+    bool capture_full = false;                      // 已达到 capture_max_mb，不再写入
+
+    // 集群 (-n/-j)
+    uint16_t node_id = 0;  // -n 指定的本节点编号，0 为未启用集群
+    std::vector<TrunkPeer> trunk_peers;
+
+    // 槽位号：在线已注册连接的小整数编号，优先复用最小的空闲号
+    std::vector<int> slot_to_fd;  // 槽位号-1 -> fd（-1为空闲）
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<uint32_t>> free_slots;
+
+    // 运行时限制（可通过管理命令 set/get 调整）
+    int max_connections = DEFAULT_MAX_CONNECTIONS;
+    int max_connections_per_ip = 0;
+    int ingress_packets_per_sec = 0;
+    int ingress_bytes_per_sec = 0;
+    int perf_interval_ms = 1000;
+    int resume_grace_ms = 15000;
+    int resume_buffer_bytes = 1024 * 1024;
+    int tap_queue_bytes = 256 * 1024;
+    int data_deadline_ms = 0;
+    int egress_quantum_bytes = 4096;
+    int register_timeout_ms = 5000;
+    int ping_interval_ms = 5000;
+    int idle_timeout_ms = 15000;
+    int legacy_idle_timeout_ms = 0;
+    int nack_interval_ms = 1000;
+    int trunk_retry_ms = 1000;
+    int trunk_queue_bytes = 16 * 1024 * 1024;
+    int load_report_ms = 500;
+    int load_egress_bytes_per_sec = 0;
+    int load_lag_ms = 50;
+    int redirect_load_permille = 800;
+    int redirect_margin_permille = 100;
+    int mirror_pipe_bytes = 1024 * 1024;
+    int capture_snaplen = 0;
+    int capture_max_mb = 1024;
+
+    // 负载采样
+    uint32_t load_egress_permille = 0;
+    uint32_t load_lag_permille = 0;
+    uint64_t loop_lag_us = 0;       // 事件循环延迟：TIMER_LOAD 实际执行晚于到期时间的部分 (EWMA 1/4)
+    uint64_t load_due_ms = 0;       // 本次 TIMER_LOAD 的到期时间
+    uint64_t load_bytes_out = 0;    // 上次采样时的 stat_bytes_out
+    uint64_t load_sampled_ms = 0;
+
+    // 热路径上复用的临时缓冲区，避免每帧分配
+    std::vector<std::vector<uint8_t>>* tx_capture = nullptr;   // 数据帧进入出站子队列时，续传负载先暂存在这里，随帧一起排队（见 end_egress）
+    std::vector<std::vector<uint8_t>> tx_capture_buf;
+    std::vector<std::array<uint8_t, MARK_SIZE>> fanout_marks;  // 扇出目标标记
+    std::vector<BundleRoute> bundle_routes;                     // 打包帧按目标分组的记录
+
+    // 统计
+    std::atomic<uint64_t> stat_bytes_in{0};
+    std::atomic<uint64_t> stat_bytes_out{0};
+    std::atomic<uint64_t> stat_packets_in{0};
+    std::atomic<uint64_t> stat_packets_out{0};
+    std::atomic<uint64_t> stat_drop_no_target{0};
+    std::atomic<uint64_t> stat_drop_small_packet{0};
+    std::atomic<uint64_t> stat_drop_send_eagain{0};   // 目标发送缓慢、排队超过截止时间而丢弃的负载数
+    std::atomic<uint64_t> stat_partial_writes{0};
+    std::atomic<uint64_t> stat_write_errors{0};
+    std::atomic<uint64_t> stat_event_loops{0};
+    std::atomic<uint64_t> stat_events{0};
+    std::atomic<uint64_t> stat_sessions_parked{0};
+    std::atomic<uint64_t> stat_sessions_resumed{0};
+    std::atomic<uint64_t> stat_sessions_expired{0};
+    std::atomic<uint64_t> stat_resume_overflow{0};
+    std::atomic<uint64_t> stat_sessions_taken_over{0};
+    std::atomic<uint64_t> stat_register_timeouts{0};
+    std::atomic<uint64_t> stat_hello_rejected{0};
+    std::atomic<uint64_t> stat_idle_timeouts{0};
+    std::atomic<uint64_t> stat_timers_fired{0};
+    std::atomic<uint64_t> stat_nacks_sent{0};
+    std::atomic<uint64_t> stat_presence_events{0};
+    std::atomic<uint64_t> stat_bundles_in{0};
+    std::atomic<uint64_t> stat_bundles_out{0};
+    std::atomic<uint64_t> stat_fanout_in{0};
+    std::atomic<uint64_t> stat_fanout_out{0};
+    std::atomic<uint64_t> stat_tap_frames{0};
+    std::atomic<uint64_t> stat_tap_drops{0};
+    std::atomic<uint64_t> stat_egress_queued{0};
+    std::atomic<uint64_t> stat_class_switches{0};
+    std::atomic<uint64_t> stat_ingress_paused{0};
+    std::atomic<uint64_t> stat_ip_limit_rejected{0};
+    std::atomic<uint64_t> stat_register_full{0};      // 客户端数已满而拒绝的注册
+    std::atomic<uint64_t> stat_trunk_frames_out{0};
+    std::atomic<uint64_t> stat_trunk_records_out{0};
+    std::atomic<uint64_t> stat_trunk_frames_in{0};
+    std::atomic<uint64_t> stat_trunk_records_in{0};
+    std::atomic<uint64_t> stat_trunk_drops{0};
+    std::atomic<uint64_t> stat_redirects{0};
+    std::atomic<uint64_t> stat_mirror_bytes{0};       // 复制到镜像管道的字节数
+    std::atomic<uint64_t> stat_mirror_sent{0};        // 发往金丝雀的字节数
+    std::atomic<uint64_t> stat_mirror_drops{0};       // 因金丝雀过慢或断开而放弃镜像的连接数
+    std::atomic<uint64_t> stat_mirror_failed{0};      // 无法建立镜像的连接数
+    std::atomic<uint64_t> stat_capture_records{0};    // 写入抓包文件的记录数
+    std::atomic<uint64_t> stat_capture_truncated{0};  // 超过 capture_snaplen 被截断的帧数
+    std::atomic<uint64_t> stat_capture_dropped{0};    // 抓包文件已满而未写入的记录数
+    std::atomic<uint64_t> stat_buf_released{0};       // 突发后归还 send_buf 多余容量的次数
+    PerfSnapshot last_perf;
+
+    // 管理控制面
+    int admin_listen_fd = -1;
+    std::string admin_path;
+    uint64_t admin_next_id = 1;
+    std::unordered_map<int, AdminClient> admin_clients;   // fd -> AdminClient
+    std::deque<AdminCommand> admin_queue;                 // 待执行的命令，最多 ADMIN_QUEUE_CAPACITY 条
+
+    // 热重启
+    int handoff_listen_fd = -1;
+    std::string handoff_path;
+    bool handed_off = false;   // 已把所有连接移交给新进程
+};
+
+// 当前线程正在驱动的中继（RelayServer 入口函数中有效）
+extern thread_local RelayContext* ctx;
+
+// RelayServer 的入口函数把当前线程的 ctx 指向自己的中继，返回时恢复（run() 调用 run_once() 等嵌套入口）
+class ContextScope {
+public:
+    explicit ContextScope(RelayContext* current) : saved_(ctx) { ctx = current; }
+    ~ContextScope() { ctx = saved_; }
+
+    ContextScope(const ContextScope&) = delete;
+    ContextScope& operator=(const ContextScope&) = delete;
+
+private:
+    RelayContext* saved_;
+};
+
+// 从缓冲区读取4字节长度（小端序）
+inline uint32_t read_packet_length(const uint8_t* buf) {
+    return static_cast<uint32_t>(buf[0])        |
+           (static_cast<uint32_t>(buf[1]) << 8) |
+           (static_cast<uint32_t>(buf[2]) << 16) |
+           (static_cast<uint32_t>(buf[3]) << 24);
+}
+
+// 写入4字节长度（小端序）
+inline void write_packet_length(uint8_t* buf, uint32_t len) {
+    buf[0] = len & 0xFF;
+    buf[1] = (len >> 8) & 0xFF;
+    buf[2] = (len >> 16) & 0xFF;
+    buf[3] = (len >> 24) & 0xFF;
+}
+
+// 注册标记（8字节注册包与 CTRL_HELLO 共用）；标记已被在线连接占用时返回false
+bool register_mark(Connection& conn, const uint8_t* mark);
+
+// 追加一个发往客户端的数据帧；source 非空时负载前补上来源标记
+void append_data_frame(Connection& conn, const uint8_t* source, const uint8_t* payload, uint32_t payload_len);
+
+// 尽量写出发送队列，写不完时关注 EPOLLOUT
+void flush_send_buffer(Connection& conn, int epfd);
+
+// 处理接收缓冲区中所有完整的帧；返回 false 表示连接已关闭
+bool process_recv_buffer(Connection& conn, int epfd);
+
+}  // namespace relay_detail
+
+#endif // RELAY_INTERNAL_H
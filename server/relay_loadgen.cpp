@@ -0,0 +1,370 @@
+/**
+ * relay_server 合成流量负载生成器
+ *
+ * 按会话模型合成任意数量的4人会话发往中继，测量中继达到的延迟与吞吐分位数。
+ * 模型可以从抓包文件学习（relay_server -w 的输出），也可以手写或由 -O 导出后修改。
+ *
+ * 模型: 每个玩家有三个通道，通道 n 发往该玩家第 n+1 常用的对端（4人会话中即其余三人）。
+ *   每个通道是一个突发过程：空闲 idle_us 后连续发出 bursts 个包，包间隔 gaps_us，每个包的负载长度取自 sizes。
+ *   四项均为经验分布（值:权重）。学习时按连接统计各目标的包数排定通道，相邻两包间隔超过
+ *   BURST_GAP_US 即视为新的突发；只学习 v1 帧连接发出的数据帧（紧凑帧连接与打包帧被跳过）。
+ *
+ * 模型文件（# 开头为注释）:
+ *   channel <n> <sizes|bursts|gaps_us|idle_us> <值>:<权重> ...
+ *
+ * 连接、注册、发包与延迟测量由 load_engine.h 完成（与 relay_bench 共用）：每个玩家以 CTRL_HELLO 注册，
+ * 数据包为 v1 数据帧，负载开头8字节为发送时间（负载短于8字节时按8字节发送），接收方据此计算单程延迟。
+ *
+ * 使用: ./relay_loadgen [选项] <host> <port>
+ *   -c <capture>   从抓包文件学习模型
+ *   -P <profile>   读取模型文件（未指定 -c/-P 时使用内置的模型）
+ *   -O <profile>   把使用的模型写入文件
+ *   -n <sessions>  会话数（默认10，0为只学习/导出模型不发流量）
+ *   -d <ms>        持续时间（默认10000）
+ *   -t <threads>   线程数，会话平均分配（默认1）
+ *   -r <seed>      随机种子（默认1，相同的种子与模型产生相同的发送计划）
+ *   例: ./relay_loadgen -c /var/tmp/relay.cap -n 1000 -t 4 -d 30000 127.0.0.1 27015
+ *
+ * 结束时在标准输出打印一行 key=value 汇总（收发帧数、丢失、延迟与每100ms吞吐的分位数），便于脚本比较。
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "load_engine.h"
+#include "relay_capture.h"
+
+namespace {
+
+constexpr int PLAYERS = 4;
+constexpr int CHANNELS = PLAYERS - 1;
+constexpr uint64_t BURST_GAP_US = 2000;   // 学习时相邻两包间隔超过该值即为新的突发
+
+const char* const FIELD_NAMES[] = {"sizes", "bursts", "gaps_us", "idle_us"};
+
+// 内置模型：约60Hz的游戏帧，主对端的包更大更频繁
+const char* const BUILTIN_PROFILE =
+    "channel 0 sizes 48:4 96:3 160:2 320:1 1100:0.2\n"
+    "channel 0 bursts 1:6 2:3 3:1\n"
+    "channel 0 gaps_us 100:1 300:1\n"
+    "channel 0 idle_us 16000:8 33000:1\n"
+    "channel 1 sizes 48:4 96:2 200:1\n"
+    "channel 1 bursts 1:8 2:2\n"
+    "channel 1 gaps_us 100:1 300:1\n"
+    "channel 1 idle_us 16000:4 33000:1\n"
+    "channel 2 sizes 48:4 96:2\n"
+    "channel 2 bursts 1:1\n"
+    "channel 2 gaps_us 200:1\n"
+    "channel 2 idle_us 33000:4 66000:1\n";
+
+// 通道 n 发往第 n+1 常用的对端
+struct Model {
+    ChannelModel channels[CHANNELS];
+};
+
+bool parse_profile(std::istream& in, Model& model, std::string& error) {
+    std::string line;
+    int line_no = 0;
+    while (std::getline(in, line)) {
+        line_no++;
+        std::istringstream words(line);
+        std::string keyword;
+        if (!(words >> keyword) || keyword[0] == '#') {
+            continue;
+        }
+        int channel = -1;
+        std::string field;
+        words >> channel >> field;
+        int f = static_cast<int>(std::find(std::begin(FIELD_NAMES), std::end(FIELD_NAMES), field) - std::begin(FIELD_NAMES));
+        if (keyword != "channel" || channel < 0 || channel >= CHANNELS || f >= 4) {
+            error = "第" + std::to_string(line_no) + "行格式错误";
+            return false;
+        }
+        TrafficDistribution& d = model.channels[channel].fields[f];
+        d.bins.clear();
+        std::string item;
+        while (words >> item) {
+            size_t colon = item.find(':');
+            char* end = nullptr;
+            double weight = colon == std::string::npos ? 0 : std::strtod(item.c_str() + colon + 1, &end);
+            if (colon == std::string::npos || weight <= 0 || item[0] == '-') {
+                error = "第" + std::to_string(line_no) + "行分布项错误: " + item;
+                return false;
+            }
+            d.bins.emplace_back(std::strtoull(item.c_str(), nullptr, 10), weight);
+        }
+        d.finalize();
+    }
+    return true;
+}
+
+void write_profile(std::ostream& out, const Model& model) {
+    out << "# relay_loadgen 会话模型：通道 n 发往第 n+1 常用的对端\n";
+    out << "# channel <n> <sizes|bursts|gaps_us|idle_us> <值>:<权重> ...\n";
+    for (int c = 0; c < CHANNELS; c++) {
+        for (int f = 0; f < 4; f++) {
+            const TrafficDistribution& d = model.channels[c].fields[f];
+            if (d.empty()) {
+                continue;
+            }
+            out << "channel " << c << " " << FIELD_NAMES[f];
+            for (const auto& bin : d.bins) {
+                out << " " << bin.first << ":" << bin.second;
+            }
+            out << "\n";
+        }
+    }
+}
+
+// 从抓包文件学习：每个 v1 帧连接的数据帧按目标排定通道，统计负载长度、突发长度与间隔
+bool learn_profile(const std::string& path, Model& model, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        error = "无法打开抓包文件 " + path;
+        if (fd != -1) close(fd);
+        return false;
+    }
+    size_t file_size = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    const uint8_t* base = static_cast<const uint8_t*>(map);
+    relay::CaptureHeader header;
+    std::vector<relay::CaptureConn> index;
+    if (map == MAP_FAILED || !relay::readCaptureHeader(base, file_size, header) ||
+        !relay::loadCaptureIndex(base, header, index)) {
+        error = "抓包文件格式错误: " + path;
+        if (map != MAP_FAILED) munmap(map, file_size);
+        return false;
+    }
+
+    // 每个连接: 是否可学习，以及每个目标的 (时间, 负载长度) 序列
+    struct Flow {
+        uint64_t target;
+        std::vector<std::pair<uint64_t, uint32_t>> packets;
+    };
+    struct ConnState {
+        bool first = true;
+        bool usable = true;
+        std::vector<Flow> flows;
+    };
+    std::vector<ConnState> conns(index.size());
+    uint64_t offset = relay::CAPTURE_HEADER_SIZE;
+    relay::CaptureRecord rec;
+    while (relay::readCaptureRecord(base, header.dataEnd, offset, rec)) {
+        if (rec.type != relay::CAPTURE_FRAME || rec.conn == 0 || rec.conn > conns.size() ||
+            (index[rec.conn - 1].flags & relay::CAPTURE_CONN_TRUNK) || rec.capLen < relay::FRAME_HEADER_SIZE) {
+            continue;
+        }
+        ConnState& c = conns[rec.conn - 1];
+        uint32_t frame_header = relay::readU32(rec.data);
+        uint8_t type = relay::frameType(frame_header);
+        uint32_t body_len = relay::frameLength(frame_header);
+        const uint8_t* body = rec.data + relay::FRAME_HEADER_SIZE;
+        uint32_t body_cap = rec.capLen - relay::FRAME_HEADER_SIZE;
+        bool first = c.first;
+        c.first = false;
+        if (!c.usable || body_len + relay::FRAME_HEADER_SIZE != rec.origLen) {
+            c.usable = false;   // 紧凑帧连接：长度不是 v1 帧头
+            continue;
+        }
+        if (first && type == relay::FRAME_CTRL && body_cap >= relay::HELLO_FIXED_SIZE && body[0] == relay::CTRL_HELLO) {
+            c.usable = !(relay::readU32(body + 2) & relay::CAP_COMPACT);
+            continue;
+        }
+        if (first && type == relay::FRAME_DATA && body_len == 8) {
+            continue;   // 旧版注册
+        }
+        if (type != relay::FRAME_DATA || body_len < 8 || body_cap < 8) {
+            continue;
+        }
+        uint64_t target = relay::readU64(body);
+        if (relay::isFanoutMark(target)) {
+            continue;
+        }
+        auto it = std::find_if(c.flows.begin(), c.flows.end(), [&](const Flow& f) { return f.target == target; });
+        if (it == c.flows.end()) {
+            c.flows.push_back(Flow{target, {}});
+            it = c.flows.end() - 1;
+        }
+        it->packets.emplace_back(rec.timeNs, body_len - 8);
+    }
+    munmap(map, file_size);
+
+    std::vector<uint64_t> samples[CHANNELS][4];
+    for (ConnState& c : conns) {
+        if (!c.usable) {
+            continue;
+        }
+        std::stable_sort(c.flows.begin(), c.flows.end(),
+                         [](const Flow& a, const Flow& b) { return a.packets.size() > b.packets.size(); });
+        for (size_t ch = 0; ch < c.flows.size() && ch < static_cast<size_t>(CHANNELS); ch++) {
+            const auto& packets = c.flows[ch].packets;
+            uint64_t burst = 0;
+            for (size_t i = 0; i < packets.size(); i++) {
+                samples[ch][0].push_back(packets[i].second);
+                uint64_t gap_us = i == 0 ? 0 : (packets[i].first - packets[i - 1].first) / 1000;
+                if (i > 0 && gap_us > BURST_GAP_US) {
+                    samples[ch][1].push_back(burst);
+                    samples[ch][3].push_back(gap_us);
+                    burst = 0;
+                } else if (i > 0) {
+                    samples[ch][2].push_back(gap_us);
+                }
+                burst++;
+            }
+            if (burst > 0) {
+                samples[ch][1].push_back(burst);
+            }
+        }
+    }
+    bool any = false;
+    for (int ch = 0; ch < CHANNELS; ch++) {
+        for (int f = 0; f < 4; f++) {
+            model.channels[ch].fields[f].learn(samples[ch][f]);
+        }
+        any = any || model.channels[ch].enabled();
+    }
+    if (!any) {
+        error = "抓包文件中没有可学习的数据流（至少需要一个连接向同一目标发出多次突发）";
+        return false;
+    }
+    return true;
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr, "使用: %s [选项] <host> <port>\n", program);
+    fprintf(stderr, "  -c <capture>   从抓包文件学习会话模型\n");
+    fprintf(stderr, "  -P <profile>   读取模型文件（未指定 -c/-P 时使用内置模型）\n");
+    fprintf(stderr, "  -O <profile>   把使用的模型写入文件\n");
+    fprintf(stderr, "  -n <sessions>  4人会话数（默认10，0为只导出模型）\n");
+    fprintf(stderr, "  -d <ms>        持续时间（默认10000）\n");
+    fprintf(stderr, "  -t <threads>   线程数（默认1）\n");
+    fprintf(stderr, "  -r <seed>      随机种子（默认1）\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string capture_path;
+    std::string profile_path;
+    std::string output_path;
+    int sessions = 10;
+    int duration_ms = 10000;
+    int threads = 1;
+    uint64_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:P:O:n:d:t:r:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            capture_path = optarg;
+            break;
+        case 'P':
+            profile_path = optarg;
+            break;
+        case 'O':
+            output_path = optarg;
+            break;
+        case 'n':
+            sessions = std::atoi(optarg);
+            break;
+        case 'd':
+            duration_ms = std::atoi(optarg);
+            break;
+        case 't':
+            threads = std::atoi(optarg);
+            break;
+        case 'r':
+            seed = std::strtoull(optarg, nullptr, 10);
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    bool need_target = sessions > 0;
+    if (sessions < 0 || duration_ms <= 0 || threads <= 0 || argc - optind != (need_target ? 2 : 0) ||
+        (!capture_path.empty() && !profile_path.empty())) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Model model;
+    std::string error;
+    if (!capture_path.empty()) {
+        if (!learn_profile(capture_path, model, error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    } else if (!profile_path.empty()) {
+        std::ifstream in(profile_path);
+        if (!in || !parse_profile(in, model, error)) {
+            fprintf(stderr, "模型文件 %s: %s\n", profile_path.c_str(), in ? error.c_str() : "无法打开");
+            return 1;
+        }
+    } else {
+        std::istringstream in(BUILTIN_PROFILE);
+        parse_profile(in, model, error);
+    }
+    if (!output_path.empty()) {
+        std::ofstream out(output_path);
+        write_profile(out, model);
+        if (!out) {
+            fprintf(stderr, "无法写入模型文件 %s\n", output_path.c_str());
+            return 1;
+        }
+    }
+    if (!need_target) {
+        return 0;
+    }
+
+    sockaddr_in addr;
+    if (!resolve_load_target(argv[optind], argv[optind + 1], addr)) {
+        fprintf(stderr, "无效地址: %s:%s\n", argv[optind], argv[optind + 1]);
+        return 1;
+    }
+
+    LoadConfig config;
+    config.players = PLAYERS;
+    config.channels.assign(std::begin(model.channels), std::end(model.channels));
+    config.tag = 'G';
+    LoadStats total;
+    size_t connections = 0;
+    if (!run_load(config, addr, sessions, threads, seed, duration_ms, 500, total, connections, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    // 吞吐分位数只取发送期间的完整区间
+    std::vector<double> mbps = total.interval_mbps(duration_ms);
+    auto mbps_at = [&](int pct) {
+        return mbps.empty() ? 0.0 : mbps[std::min(mbps.size() - 1, mbps.size() * static_cast<size_t>(pct) / 100)];
+    };
+    const LatencyHistogram& lat = total.latency_us;
+    printf("loadgen sessions=%d connections=%zu duration_ms=%d sent_frames=%llu sent_bytes=%llu recv_frames=%llu "
+           "recv_bytes=%llu lost=%lld send_dropped=%llu disconnected=%llu pps=%.0f "
+           "lat_p50_us=%llu lat_p90_us=%llu lat_p99_us=%llu lat_p999_us=%llu lat_max_us=%llu "
+           "tput_p1_mbps=%.3f tput_p50_mbps=%.3f tput_p99_mbps=%.3f\n",
+           sessions, connections, duration_ms, static_cast<unsigned long long>(total.sent_frames),
+           static_cast<unsigned long long>(total.sent_bytes), static_cast<unsigned long long>(total.recv_frames),
+           static_cast<unsigned long long>(total.recv_bytes),
+           static_cast<long long>(total.sent_frames) - static_cast<long long>(total.recv_frames),
+           static_cast<unsigned long long>(total.send_dropped), static_cast<unsigned long long>(total.disconnected),
+           total.recv_frames * 1000.0 / duration_ms, static_cast<unsigned long long>(lat.percentile(50)),
+           static_cast<unsigned long long>(lat.percentile(90)), static_cast<unsigned long long>(lat.percentile(99)),
+           static_cast<unsigned long long>(lat.percentile(99.9)), static_cast<unsigned long long>(lat.max),
+           mbps_at(1), mbps_at(50), mbps_at(99));
+    return 0;
+}
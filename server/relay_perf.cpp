@@ -0,0 +1,639 @@
+/**
+ * relay_server 性能回归检测
+ *
+ * 把同一组测量重复 -R 次，按机器保存为 JSON 基线；之后的构建重新测量并与本机基线逐项比较。
+ *   - 微基准: 运行 tests/p2p_bench（Catch2 XML 报告），每项取每次调用的平均耗时（ns，越低越好）
+ *   - 场景:   进程内启动 RelayServer（临时端口），用 load_engine.h 的客户端引擎施加固定负载（同 relay_bench）
+ *       latency     50 个4人会话，每人 60 包/秒，128 字节：lat_p50_us、lat_p99_us（越低越好）
+ *       throughput  8 个2人会话，每人 10000 包/秒，256 字节（接近单核饱和）：recv_pps（越高越好）
+ * 每个指标报告 R 次结果的均值与 95% 置信区间（t 分布）。比较时，变化超过阈值（吞吐下降 -T%，
+ * 耗时与延迟增加 -L%）且新旧均值之差的 95% 置信区间（Welch）不含0时判为回归。
+ * 全部离线运行：基线只是本地文件，同一文件可按机器键保存多台机器的基线。
+ *
+ * 使用: ./relay_perf [选项] record|compare
+ *   record   测量并保存为本机基线（替换同一机器键下的旧基线）
+ *   compare  测量并与本机基线比较，有回归时退出码为2
+ *   -f <file>    基线文件（默认 perf_baseline.json）
+ *   -m <key>     机器键（默认 主机名/CPU型号/核数）
+ *   -R <runs>    每项重复次数（默认5，至少2）
+ *   -B <path>    p2p_bench 路径（默认 ../tests/p2p_bench，- 为不运行微基准）
+ *   -F <filter>  微基准的 Catch2 过滤条件（默认 [server]）
+ *   -d <ms>      每个场景的持续时间（默认3000）
+ *   -T <pct>     吞吐下降阈值（默认5）
+ *   -L <pct>     耗时与延迟增加阈值（默认10）
+ *   -o <file>    另外把本次结果写入 JSON 文件（格式同基线文件）
+ *   -i <file>    不测量，改用之前 -o 保存的结果（同一机器键）
+ *   例: ./relay_perf record && (修改代码并重新编译) && ./relay_perf compare
+ */
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "load_engine.h"
+#include "relay_server.h"
+
+namespace {
+
+// 一个指标的 R 次测量
+struct Metric {
+    std::string unit;
+    bool higher_better = false;
+    std::vector<double> samples;
+};
+
+// 指标名 -> 测量
+using MetricSet = std::map<std::string, Metric>;
+
+struct MachineResult {
+    std::string recorded;
+    MetricSet metrics;
+};
+
+// ----------------------------------------------------------------------------
+// 统计
+// ----------------------------------------------------------------------------
+
+double mean_of(const std::vector<double>& v) {
+    double sum = 0;
+    for (double x : v) {
+        sum += x;
+    }
+    return v.empty() ? 0 : sum / v.size();
+}
+
+double variance_of(const std::vector<double>& v) {
+    if (v.size() < 2) {
+        return 0;
+    }
+    double m = mean_of(v);
+    double sum = 0;
+    for (double x : v) {
+        sum += (x - m) * (x - m);
+    }
+    return sum / (v.size() - 1);
+}
+
+// 双侧 95% 的 t 分布临界值
+double t_critical(double df) {
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    int n = static_cast<int>(std::floor(df));
+    if (n < 1) {
+        return table[0];
+    }
+    return n <= 30 ? table[n - 1] : 1.960;
+}
+
+// 均值的 95% 置信区间半宽
+double ci_half_width(const std::vector<double>& v) {
+    return v.size() < 2 ? 0 : t_critical(v.size() - 1) * std::sqrt(variance_of(v) / v.size());
+}
+
+struct Comparison {
+    double change_pct = 0;    // 新均值相对基线的变化
+    double diff_lo = 0;       // 新旧均值之差的 95% 置信区间
+    double diff_hi = 0;
+    bool significant = false;
+};
+
+// Welch t 区间：两组方差不必相同
+Comparison compare_samples(const std::vector<double>& base, const std::vector<double>& cur) {
+    Comparison c;
+    double mb = mean_of(base);
+    double mc = mean_of(cur);
+    double vb = variance_of(base) / base.size();
+    double vc = variance_of(cur) / cur.size();
+    double se = std::sqrt(vb + vc);
+    double df = se == 0 ? 1e9 : (vb + vc) * (vb + vc) /
+                                    ((base.size() > 1 ? vb * vb / (base.size() - 1) : 0) +
+                                     (cur.size() > 1 ? vc * vc / (cur.size() - 1) : 0) + 1e-300);
+    double half = t_critical(df) * se;
+    c.change_pct = mb == 0 ? 0 : (mc - mb) * 100.0 / mb;
+    c.diff_lo = mc - mb - half;
+    c.diff_hi = mc - mb + half;
+    c.significant = c.diff_lo > 0 || c.diff_hi < 0;
+    return c;
+}
+
+// ----------------------------------------------------------------------------
+// JSON（只需要读写本工具自己的文件格式）
+// ----------------------------------------------------------------------------
+
+struct Json {
+    enum Type { NUL, NUMBER, STRING, ARRAY, OBJECT } type = NUL;
+    double number = 0;
+    std::string text;
+    std::vector<Json> items;
+    std::vector<std::pair<std::string, Json>> fields;
+
+    const Json* find(const std::string& key) const {
+        for (const auto& f : fields) {
+            if (f.first == key) {
+                return &f.second;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : s_(text) {}
+
+    bool parse(Json& out) {
+        return value(out) && (skip(), pos_ == s_.size());
+    }
+
+private:
+    void skip() {
+        while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_]))) {
+            pos_++;
+        }
+    }
+
+    bool literal(const char* word) {
+        size_t n = std::strlen(word);
+        if (s_.compare(pos_, n, word) != 0) {
+            return false;
+        }
+        pos_ += n;
+        return true;
+    }
+
+    bool string(std::string& out) {
+        if (pos_ >= s_.size() || s_[pos_] != '"') {
+            return false;
+        }
+        pos_++;
+        while (pos_ < s_.size() && s_[pos_] != '"') {
+            char c = s_[pos_++];
+            if (c == '\\' && pos_ < s_.size()) {
+                c = s_[pos_++];
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+            }
+            out += c;
+        }
+        return pos_++ < s_.size();
+    }
+
+    bool value(Json& out) {
+        skip();
+        if (pos_ >= s_.size()) {
+            return false;
+        }
+        char c = s_[pos_];
+        if (c == '{' || c == '[') {
+            bool object = c == '{';
+            out.type = object ? Json::OBJECT : Json::ARRAY;
+            pos_++;
+            skip();
+            if (pos_ < s_.size() && s_[pos_] == (object ? '}' : ']')) {
+                pos_++;
+                return true;
+            }
+            while (true) {
+                Json item;
+                std::string key;
+                if (object) {
+                    skip();
+                    if (!string(key) || (skip(), !literal(":"))) {
+                        return false;
+                    }
+                }
+                if (!value(item)) {
+                    return false;
+                }
+                if (object) {
+                    out.fields.emplace_back(key, item);
+                } else {
+                    out.items.push_back(item);
+                }
+                skip();
+                if (literal(",")) {
+                    continue;
+                }
+                return literal(object ? "}" : "]");
+            }
+        }
+        if (c == '"') {
+            out.type = Json::STRING;
+            return string(out.text);
+        }
+        if (literal("null")) {
+            return true;
+        }
+        char* end = nullptr;
+        out.number = std::strtod(s_.c_str() + pos_, &end);
+        if (end == s_.c_str() + pos_) {
+            return false;
+        }
+        out.type = Json::NUMBER;
+        pos_ = static_cast<size_t>(end - s_.c_str());
+        return true;
+    }
+
+    const std::string& s_;
+    size_t pos_ = 0;
+};
+
+std::string json_quote(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c == '\n' ? ' ' : c;
+    }
+    return out + "\"";
+}
+
+// 读取结果文件：{"version":1,"machines":{key:{"recorded":..,"metrics":{name:{"unit","better","samples"}}}}}
+bool load_results(const std::string& path, std::map<std::string, MachineResult>& machines) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::stringstream buf;
+    buf << in.rdbuf();
+    std::string text = buf.str();
+    Json root;
+    const Json* list = nullptr;
+    if (!JsonParser(text).parse(root) || !(list = root.find("machines")) || list->type != Json::OBJECT) {
+        return false;
+    }
+    for (const auto& m : list->fields) {
+        MachineResult& result = machines[m.first];
+        const Json* recorded = m.second.find("recorded");
+        result.recorded = recorded ? recorded->text : "";
+        const Json* metrics = m.second.find("metrics");
+        if (!metrics) {
+            continue;
+        }
+        for (const auto& f : metrics->fields) {
+            Metric& metric = result.metrics[f.first];
+            const Json* unit = f.second.find("unit");
+            const Json* better = f.second.find("better");
+            const Json* samples = f.second.find("samples");
+            metric.unit = unit ? unit->text : "";
+            metric.higher_better = better && better->text == "higher";
+            for (size_t i = 0; samples && i < samples->items.size(); i++) {
+                metric.samples.push_back(samples->items[i].number);
+            }
+        }
+    }
+    return true;
+}
+
+bool save_results(const std::string& path, const std::map<std::string, MachineResult>& machines) {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out << "{\n  \"version\": 1,\n  \"machines\": {";
+    const char* machine_sep = "\n";
+    for (const auto& m : machines) {
+        out << machine_sep << "    " << json_quote(m.first) << ": {\n";
+        out << "      \"recorded\": " << json_quote(m.second.recorded) << ",\n";
+        out << "      \"metrics\": {";
+        const char* metric_sep = "\n";
+        for (const auto& f : m.second.metrics) {
+            out << metric_sep << "        " << json_quote(f.first) << ": {\"unit\": " << json_quote(f.second.unit)
+                << ", \"better\": \"" << (f.second.higher_better ? "higher" : "lower") << "\", \"samples\": [";
+            for (size_t i = 0; i < f.second.samples.size(); i++) {
+                char num[32];
+                snprintf(num, sizeof(num), "%.6g", f.second.samples[i]);
+                out << (i ? ", " : "") << num;
+            }
+            out << "]}";
+            metric_sep = ",\n";
+        }
+        out << "\n      }\n    }";
+        machine_sep = ",\n";
+    }
+    out << "\n  }\n}\n";
+    return static_cast<bool>(out);
+}
+
+// ----------------------------------------------------------------------------
+// 测量
+// ----------------------------------------------------------------------------
+
+// 主机名/CPU型号/核数
+std::string default_machine_key() {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    std::string cpu = "unknown-cpu";
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos) {
+            cpu = line.substr(line.find(':') + 1);
+            cpu.erase(0, cpu.find_first_not_of(' '));
+            break;
+        }
+    }
+    return std::string(host) + "/" + cpu + "/" + std::to_string(std::thread::hardware_concurrency()) + "cpu";
+}
+
+// XML 属性值
+std::string xml_attr(const std::string& tag, const char* name) {
+    std::string key = std::string(name) + "=\"";
+    size_t at = tag.find(key);
+    if (at == std::string::npos) {
+        return "";
+    }
+    at += key.size();
+    std::string value = tag.substr(at, tag.find('"', at) - at);
+    for (const auto& entity : {std::make_pair("&lt;", "<"), std::make_pair("&gt;", ">"),
+                               std::make_pair("&quot;", "\""), std::make_pair("&amp;", "&")}) {
+        for (size_t pos; (pos = value.find(entity.first)) != std::string::npos;) {
+            value.replace(pos, std::strlen(entity.first), entity.second);
+        }
+    }
+    return value;
+}
+
+// 运行一次 p2p_bench，把每项基准的平均耗时追加到 metrics
+bool run_microbenchmarks(const std::string& bench, const std::string& filter, MetricSet& metrics) {
+    std::string command = "'" + bench + "' '" + filter +
+                          "' -r xml --benchmark-samples 20 --benchmark-warmup-time 100 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return false;
+    }
+    std::string xml;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), pipe)) > 0) {
+        xml.append(chunk, n);
+    }
+    if (pclose(pipe) != 0) {
+        return false;
+    }
+    size_t count = 0;
+    for (size_t at = 0; (at = xml.find("<BenchmarkResults ", at)) != std::string::npos; count++) {
+        std::string name = xml_attr(xml.substr(at, xml.find('>', at) - at), "name");
+        size_t mean_at = xml.find("<mean ", at);
+        if (mean_at == std::string::npos) {
+            break;
+        }
+        Metric& metric = metrics["bench/" + name];
+        metric.unit = "ns";
+        metric.higher_better = false;
+        metric.samples.push_back(std::atof(xml_attr(xml.substr(mean_at, xml.find('>', mean_at) - mean_at), "value").c_str()));
+        at = mean_at;
+    }
+    return count > 0;
+}
+
+struct Scenario {
+    const char* name;
+    int sessions;
+    int players;
+    double rate;       // 每个玩家每秒发出的包数
+    uint32_t size;
+};
+
+const Scenario SCENARIOS[] = {
+    {"latency", 50, 4, 60, 128},
+    {"throughput", 8, 2, 10000, 256},
+};
+
+// 进程内中继上运行一次场景
+bool run_scenario(const Scenario& sc, int duration_ms, uint64_t seed, MetricSet& metrics, std::string& error) {
+    RelayServer server;
+    RelayOptions options;
+    options.max_connections = sc.sessions * sc.players + 16;
+    options.log_level = "warn";
+    if (!server.start(options, error)) {
+        return false;
+    }
+    std::thread loop([&server] { server.run(); });
+
+    LoadConfig config;
+    config.players = sc.players;
+    config.tag = 'P';
+    ChannelModel channel;
+    channel.sizes() = TrafficDistribution::constant(sc.size);
+    channel.bursts() = TrafficDistribution::constant(1);
+    channel.idle() = TrafficDistribution::constant(
+        std::max<uint64_t>(static_cast<uint64_t>(1e6 * (sc.players - 1) / sc.rate), 1));
+    config.channels.assign(static_cast<size_t>(sc.players - 1), channel);
+
+    sockaddr_in addr;
+    bool ok = resolve_load_target("127.0.0.1", std::to_string(server.port()).c_str(), addr);
+    LoadStats total;
+    size_t connections = 0;
+    ok = ok && run_load(config, addr, sc.sessions, 1, seed, duration_ms, 300, total, connections, error);
+    server.stop();
+    loop.join();
+    server.shutdown();
+    if (!ok) {
+        return false;
+    }
+
+    std::string prefix = std::string("scenario/") + sc.name + "/";
+    auto add = [&](const char* name, const char* unit, bool higher_better, double value) {
+        Metric& metric = metrics[prefix + name];
+        metric.unit = unit;
+        metric.higher_better = higher_better;
+        metric.samples.push_back(value);
+    };
+    if (std::string(sc.name) == "throughput") {
+        add("recv_pps", "pps", true, total.recv_frames * 1000.0 / duration_ms);
+    } else {
+        add("lat_p50_us", "us", false, static_cast<double>(total.latency_us.percentile(50)));
+        add("lat_p99_us", "us", false, static_cast<double>(total.latency_us.percentile(99)));
+    }
+    return true;
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr, "使用: %s [选项] record|compare\n", program);
+    fprintf(stderr, "  record        测量并保存为本机基线\n");
+    fprintf(stderr, "  compare       测量并与本机基线比较，有回归时退出码为2\n");
+    fprintf(stderr, "  -f <file>     基线文件（默认 perf_baseline.json）\n");
+    fprintf(stderr, "  -m <key>      机器键（默认 主机名/CPU型号/核数）\n");
+    fprintf(stderr, "  -R <runs>     每项重复次数（默认5，至少2）\n");
+    fprintf(stderr, "  -B <path>     p2p_bench 路径（默认 ../tests/p2p_bench，- 为不运行微基准）\n");
+    fprintf(stderr, "  -F <filter>   微基准的 Catch2 过滤条件（默认 [server]）\n");
+    fprintf(stderr, "  -d <ms>       每个场景的持续时间（默认3000）\n");
+    fprintf(stderr, "  -T <pct>      吞吐下降阈值（默认5）\n");
+    fprintf(stderr, "  -L <pct>      耗时与延迟增加阈值（默认10）\n");
+    fprintf(stderr, "  -o <file>     另外把本次结果写入 JSON 文件\n");
+    fprintf(stderr, "  -i <file>     不测量，改用之前 -o 保存的结果\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string baseline_path = "perf_baseline.json";
+    std::string machine = default_machine_key();
+    int runs = 5;
+    std::string bench = "../tests/p2p_bench";
+    std::string filter = "[server]";
+    int duration_ms = 3000;
+    double throughput_pct = 5;
+    double latency_pct = 10;
+    std::string output_path;
+    std::string input_path;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:m:R:B:F:d:T:L:o:i:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            baseline_path = optarg;
+            break;
+        case 'm':
+            machine = optarg;
+            break;
+        case 'R':
+            runs = std::atoi(optarg);
+            break;
+        case 'B':
+            bench = optarg;
+            break;
+        case 'F':
+            filter = optarg;
+            break;
+        case 'd':
+            duration_ms = std::atoi(optarg);
+            break;
+        case 'T':
+            throughput_pct = std::atof(optarg);
+            break;
+        case 'L':
+            latency_pct = std::atof(optarg);
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
+        case 'i':
+            input_path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    std::string mode = optind == argc - 1 ? argv[optind] : "";
+    if ((mode != "record" && mode != "compare") || runs < 2 || duration_ms <= 0 || throughput_pct < 0 ||
+        latency_pct < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // 测量（或读取之前保存的结果）
+    MachineResult current;
+    if (!input_path.empty()) {
+        std::map<std::string, MachineResult> saved;
+        if (!load_results(input_path, saved) || !saved.count(machine)) {
+            fprintf(stderr, "%s 中没有机器 %s 的结果\n", input_path.c_str(), machine.c_str());
+            return 1;
+        }
+        current = saved[machine];
+    } else {
+        char when[32];
+        time_t now = time(nullptr);
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        current.recorded = when;
+        for (int r = 0; r < runs; r++) {
+            fprintf(stderr, "第 %d/%d 轮...\n", r + 1, runs);
+            if (bench != "-" && !run_microbenchmarks(bench, filter, current.metrics)) {
+                fprintf(stderr, "微基准运行失败: %s %s\n", bench.c_str(), filter.c_str());
+                return 1;
+            }
+            for (const Scenario& sc : SCENARIOS) {
+                std::string error;
+                if (!run_scenario(sc, duration_ms, static_cast<uint64_t>(r + 1), current.metrics, error)) {
+                    fprintf(stderr, "场景 %s 运行失败: %s\n", sc.name, error.c_str());
+                    return 1;
+                }
+            }
+        }
+    }
+    if (!output_path.empty()) {
+        std::map<std::string, MachineResult> out;
+        out[machine] = current;
+        if (!save_results(output_path, out)) {
+            fprintf(stderr, "无法写入 %s\n", output_path.c_str());
+            return 1;
+        }
+    }
+
+    std::map<std::string, MachineResult> baselines;
+    bool have_file = load_results(baseline_path, baselines);
+    printf("机器: %s\n", machine.c_str());
+
+    if (mode == "record") {
+        baselines[machine] = current;
+        if (!save_results(baseline_path, baselines)) {
+            fprintf(stderr, "无法写入基线文件 %s\n", baseline_path.c_str());
+            return 1;
+        }
+        for (const auto& f : current.metrics) {
+            double m = mean_of(f.second.samples);
+            printf("  %-60s %12.3f ±%-10.3f %s\n", f.first.c_str(), m, ci_half_width(f.second.samples),
+                   f.second.unit.c_str());
+        }
+        printf("基线已保存: %s（%zu 个指标，每项 %zu 次）\n", baseline_path.c_str(), current.metrics.size(),
+               current.metrics.empty() ? static_cast<size_t>(0) : current.metrics.begin()->second.samples.size());
+        return 0;
+    }
+
+    if (!have_file || !baselines.count(machine)) {
+        fprintf(stderr, "基线文件 %s 中没有本机 (%s) 的基线，先运行 record\n", baseline_path.c_str(), machine.c_str());
+        return 1;
+    }
+    const MachineResult& base = baselines[machine];
+    printf("基线: %s\n", base.recorded.c_str());
+    printf("  %-60s %12s %12s %9s  %s\n", "指标", "基线", "本次", "变化", "");
+    int regressions = 0;
+    for (const auto& f : current.metrics) {
+        auto it = base.metrics.find(f.first);
+        if (it == base.metrics.end() || it->second.samples.empty() || f.second.samples.empty()) {
+            printf("  %-60s %12s %12.3f %9s  新指标\n", f.first.c_str(), "-", mean_of(f.second.samples), "");
+            continue;
+        }
+        Comparison c = compare_samples(it->second.samples, f.second.samples);
+        double threshold = f.second.higher_better ? throughput_pct : latency_pct;
+        double worse_pct = f.second.higher_better ? -c.change_pct : c.change_pct;
+        const char* verdict = "";
+        if (c.significant && worse_pct > threshold) {
+            verdict = "回归";
+            regressions++;
+        } else if (c.significant && -worse_pct > threshold) {
+            verdict = "改进";
+        } else if (!c.significant) {
+            verdict = "(差异不显著)";
+        }
+        printf("  %-60s %12.3f %12.3f %+8.2f%%  %s\n", f.first.c_str(), mean_of(it->second.samples),
+               mean_of(f.second.samples), c.change_pct, verdict);
+    }
+    for (const auto& f : base.metrics) {
+        if (!current.metrics.count(f.first)) {
+            printf("  %-60s %12.3f %12s %9s  本次未测量\n", f.first.c_str(), mean_of(f.second.samples), "-", "");
+        }
+    }
+    if (regressions > 0) {
+        printf("发现 %d 项回归（吞吐下降超过 %.1f%% 或耗时/延迟增加超过 %.1f%%，且95%%置信区间不含0）\n", regressions,
+               throughput_pct, latency_pct);
+        return 2;
+    }
+    printf("无回归\n");
+    return 0;
+}
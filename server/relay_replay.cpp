@@ -0,0 +1,512 @@
+/**
+ * relay_server 流量重放工具
+ *
+ * 读取 relay_server -w 写下的抓包文件（格式见 include/relay_capture.h），按记录的时间重新建立每个连接、
+ * 发出相同的帧并在记录的时间关闭，用同一份真实流量比较不同版本中继的吞吐与延迟。
+ * 每个连接的字节流与抓包时完全相同（被截断的帧以0补足），连接之间按记录时间交错；
+ * 中继发回的数据只计数不解析。集群节点之间的中继链路不重放。
+ *
+ * 使用: ./relay_replay [选项] <capture> <host> <port>
+ *   -s <speed>  播放速度倍数（默认1，即原始节奏；0为不等待，尽快发出）
+ *   -p <ms>     探测间隔：另建两个连接经中继往返探测包，测量重放期间的往返延迟（默认10，0为不探测）
+ *   -d <ms>     发完后继续接收中继数据的时间（默认500）
+ *   例: ./relay_replay -s 4 /tmp/relay.cap 127.0.0.1 27015
+ *
+ * 结束时在标准输出打印一行 key=value 汇总（发送吞吐、调度延迟、探测往返延迟等），便于脚本比较。
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "relay_capture.h"
+
+namespace {
+
+constexpr int MAX_EVENTS = 64;
+constexpr size_t BATCH_RECORDS = 256;       // 每轮最多发出的记录数，之后先处理一次事件
+constexpr uint32_t TIMER_EVENT = UINT32_MAX;  // timerfd 的 epoll 数据
+constexpr uint64_t PROBE_TIMEOUT_NS = 1000000000ULL;
+constexpr uint8_t PROBE_MARKS[2][8] = {{0x7F, 'P', 'R', 'O', 'B', 'E', 0x00, 0x01},
+                                       {0x7F, 'P', 'R', 'O', 'B', 'E', 0x00, 0x02}};
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+struct ReplayConn {
+    int fd = -1;
+    bool skip = false;            // 中继链路或连接失败：其记录全部跳过
+    bool closing = false;         // 已到关闭时间，发完后关闭
+    bool want_write = false;
+    std::vector<uint8_t> out;     // 尚未写出的字节（out_off 之前的已写出）
+    size_t out_off = 0;
+    uint64_t queued = 0;          // 累计排队的字节数
+    uint64_t written = 0;         // 累计写出的字节数
+    std::deque<std::pair<uint64_t, uint64_t>> frame_ends;   // (帧末尾在累计字节中的位置, 计划发送时间)
+};
+
+struct Replay {
+    int epfd = -1;
+    sockaddr_in addr{};
+    std::vector<ReplayConn> conns;
+    std::vector<uint64_t> lags_ns;   // 每帧从计划时间到完全写入内核的延迟
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t rx_bytes = 0;
+    uint64_t connect_failed = 0;
+    uint64_t closed_by_relay = 0;
+    uint64_t last_write_ns = 0;
+
+    // 探测连接：probe[0] 定期发出 [8字节 发送时间]，probe[1] 原样回送
+    int probe[2] = {-1, -1};
+    std::vector<uint8_t> probe_in[2];
+    uint64_t probe_sent_ns = 0;       // 0 为没有未完成的探测
+    uint64_t probe_lost = 0;
+    std::vector<uint64_t> rtts_ns;
+};
+
+void update_events(Replay& r, ReplayConn& c) {
+    bool want_write = c.out_off < c.out.size();
+    if (want_write == c.want_write) {
+        return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    if (want_write) {
+        ev.events |= EPOLLOUT;
+    }
+    ev.data.u32 = static_cast<uint32_t>(&c - r.conns.data());
+    epoll_ctl(r.epfd, EPOLL_CTL_MOD, c.fd, &ev);
+    c.want_write = want_write;
+}
+
+void close_conn(Replay& r, ReplayConn& c) {
+    if (c.fd != -1) {
+        epoll_ctl(r.epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+    }
+    c.skip = true;
+    c.out.clear();
+    c.out_off = 0;
+    c.frame_ends.clear();
+}
+
+void flush_conn(Replay& r, ReplayConn& c) {
+    while (c.out_off < c.out.size()) {
+        ssize_t n = write(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off);
+        if (n > 0) {
+            c.out_off += static_cast<size_t>(n);
+            c.written += static_cast<uint64_t>(n);
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOTCONN)) {
+            break;   // 连接尚未完成或发送缓冲区已满
+        } else {
+            r.closed_by_relay++;
+            close_conn(r, c);
+            return;
+        }
+    }
+    uint64_t now = now_ns();
+    while (!c.frame_ends.empty() && c.frame_ends.front().first <= c.written) {
+        r.lags_ns.push_back(now > c.frame_ends.front().second ? now - c.frame_ends.front().second : 0);
+        c.frame_ends.pop_front();
+        r.last_write_ns = now;
+    }
+    if (c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+        if (c.closing) {
+            close_conn(r, c);
+            return;
+        }
+    } else if (c.out_off >= 1024 * 1024) {
+        c.out.erase(c.out.begin(), c.out.begin() + static_cast<std::ptrdiff_t>(c.out_off));
+        c.out_off = 0;
+    }
+    update_events(r, c);
+}
+
+bool open_conn(Replay& r, ReplayConn& c) {
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int flag = 1;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.u32 = static_cast<uint32_t>(&c - r.conns.data());
+    if (c.fd == -1 || setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) != 0 ||
+        (connect(c.fd, reinterpret_cast<const sockaddr*>(&r.addr), sizeof(r.addr)) != 0 && errno != EINPROGRESS) ||
+        epoll_ctl(r.epfd, EPOLL_CTL_ADD, c.fd, &ev) != 0) {
+        r.connect_failed++;
+        close_conn(r, c);
+        return false;
+    }
+    c.want_write = true;
+    return true;
+}
+
+void apply_record(Replay& r, const relay::CaptureRecord& rec, uint64_t due_ns) {
+    if (rec.conn == 0 || rec.conn > r.conns.size()) {
+        return;
+    }
+    ReplayConn& c = r.conns[rec.conn - 1];
+    if (c.skip) {
+        return;
+    }
+    if (c.fd == -1 && (rec.type == relay::CAPTURE_CLOSE || !open_conn(r, c))) {
+        return;
+    }
+    if (rec.type == relay::CAPTURE_FRAME) {
+        // 被截断的部分以0补足，保持原始帧长，中继按相同的边界解析
+        c.out.insert(c.out.end(), rec.data, rec.data + rec.capLen);
+        c.out.resize(c.out.size() + (rec.origLen - rec.capLen), 0);
+        c.queued += rec.origLen;
+        c.frame_ends.emplace_back(c.queued, due_ns);
+        r.frames++;
+        r.bytes += rec.origLen;
+        flush_conn(r, c);
+    } else if (rec.type == relay::CAPTURE_CLOSE) {
+        c.closing = true;
+        flush_conn(r, c);
+    }
+}
+
+// 阻塞地连接并以 CTRL_HELLO 注册，等待 HELLO_ACK（探测连接用）
+int connect_probe(const sockaddr_in& addr, const uint8_t* mark) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    struct timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    uint8_t hello[relay::FRAME_HEADER_SIZE + relay::HELLO_FIXED_SIZE];
+    uint8_t* body = hello + relay::FRAME_HEADER_SIZE;
+    relay::writeFrameHeader(hello, relay::HELLO_FIXED_SIZE, relay::FRAME_CTRL);
+    body[0] = relay::CTRL_HELLO;
+    body[1] = relay::PROTOCOL_VERSION;
+    relay::writeU32(body + 2, 0);
+    std::memcpy(body + 6, mark, 8);
+    uint8_t header[relay::FRAME_HEADER_SIZE];
+    std::vector<uint8_t> ack;
+    bool ok = connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 &&
+              write(fd, hello, sizeof(hello)) == static_cast<ssize_t>(sizeof(hello)) &&
+              recv(fd, header, sizeof(header), MSG_WAITALL) == static_cast<ssize_t>(sizeof(header));
+    if (ok) {
+        ack.resize(relay::frameLength(relay::readU32(header)));
+        ok = !ack.empty() && recv(fd, ack.data(), ack.size(), MSG_WAITALL) == static_cast<ssize_t>(ack.size()) &&
+             relay::frameType(relay::readU32(header)) == relay::FRAME_CTRL && ack[0] == relay::CTRL_HELLO_ACK &&
+             ack.size() > 1 && ack[1] == relay::HELLO_OK;
+    }
+    if (!ok || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void send_probe(Replay& r, int from, const uint8_t* target, const uint8_t* payload) {
+    uint8_t frame[relay::FRAME_HEADER_SIZE + 8 + 8];
+    relay::writeFrameHeader(frame, 16, relay::FRAME_DATA);
+    std::memcpy(frame + relay::FRAME_HEADER_SIZE, target, 8);
+    std::memcpy(frame + relay::FRAME_HEADER_SIZE + 8, payload, 8);
+    // 探测包很小，发送缓冲区满时视为丢失
+    ssize_t unused = write(r.probe[from], frame, sizeof(frame));
+    (void)unused;
+}
+
+// 探测连接上的数据：probe[1] 收到的回送给 probe[0]，probe[0] 收到的即为往返完成
+void handle_probe(Replay& r, int index) {
+    uint8_t buf[4096];
+    ssize_t n;
+    while ((n = read(r.probe[index], buf, sizeof(buf))) > 0) {
+        r.probe_in[index].insert(r.probe_in[index].end(), buf, buf + n);
+    }
+    std::vector<uint8_t>& in = r.probe_in[index];
+    size_t off = 0;
+    while (in.size() - off >= relay::FRAME_HEADER_SIZE) {
+        uint32_t header = relay::readU32(in.data() + off);
+        uint32_t len = relay::frameLength(header);
+        if (in.size() - off < relay::FRAME_HEADER_SIZE + len) {
+            break;
+        }
+        const uint8_t* body = in.data() + off + relay::FRAME_HEADER_SIZE;
+        if (relay::frameType(header) == relay::FRAME_DATA && len == 8) {
+            if (index == 1) {
+                send_probe(r, 1, PROBE_MARKS[0], body);
+            } else if (r.probe_sent_ns != 0 && relay::readU64(body) == r.probe_sent_ns) {
+                r.rtts_ns.push_back(now_ns() - r.probe_sent_ns);
+                r.probe_sent_ns = 0;
+            }
+        }
+        off += relay::FRAME_HEADER_SIZE + len;
+    }
+    in.erase(in.begin(), in.begin() + static_cast<std::ptrdiff_t>(off));
+}
+
+uint64_t percentile(std::vector<uint64_t>& v, int pct) {
+    if (v.empty()) {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, v.size() * static_cast<size_t>(pct) / 100)];
+}
+
+void print_usage(const char* program) {
+    fprintf(stderr, "使用: %s [-s speed] [-p probe_ms] [-d drain_ms] <capture> <host> <port>\n", program);
+    fprintf(stderr, "  -s <speed>  播放速度倍数（默认1；0为尽快发出）\n");
+    fprintf(stderr, "  -p <ms>     往返探测间隔（默认10，0为不探测）\n");
+    fprintf(stderr, "  -d <ms>     发完后继续接收的时间（默认500）\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    double speed = 1.0;
+    int probe_ms = 10;
+    int drain_ms = 500;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:p:d:h")) != -1) {
+        switch (opt) {
+        case 's':
+            speed = std::atof(optarg);
+            break;
+        case 'p':
+            probe_ms = std::atoi(optarg);
+            break;
+        case 'd':
+            drain_ms = std::atoi(optarg);
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 3 || speed < 0 || probe_ms < 0 || drain_ms < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    const char* path = argv[optind];
+    int file_fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file_fd == -1 || fstat(file_fd, &st) != 0) {
+        fprintf(stderr, "无法打开抓包文件 %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    size_t file_size = static_cast<size_t>(st.st_size);
+    void* map = file_size > 0 ? mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file_fd, 0) : MAP_FAILED;
+    close(file_fd);
+    const uint8_t* base = static_cast<const uint8_t*>(map);
+    relay::CaptureHeader header;
+    std::vector<relay::CaptureConn> index;
+    if (map == MAP_FAILED || !relay::readCaptureHeader(base, file_size, header) ||
+        !relay::loadCaptureIndex(base, header, index)) {
+        fprintf(stderr, "抓包文件格式错误: %s\n", path);
+        return 1;
+    }
+    if (header.indexOffset == 0) {
+        fprintf(stderr, "抓包文件没有索引（中继未正常退出），按记录重建\n");
+    }
+    madvise(map, file_size, MADV_SEQUENTIAL);
+
+    Replay r;
+    r.addr.sin_family = AF_INET;
+    r.addr.sin_port = htons(static_cast<uint16_t>(std::atoi(argv[optind + 2])));
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (r.addr.sin_port == 0 || getaddrinfo(argv[optind + 1], nullptr, &hints, &res) != 0) {
+        fprintf(stderr, "无效地址: %s:%s\n", argv[optind + 1], argv[optind + 2]);
+        return 1;
+    }
+    r.addr.sin_addr = reinterpret_cast<sockaddr_in*>(res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+
+    // 发送时间由 timerfd 按绝对时间唤醒（纳秒精度，epoll_wait 的超时只有毫秒）
+    r.epfd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event timer_ev;
+    timer_ev.events = EPOLLIN;
+    timer_ev.data.u32 = TIMER_EVENT;
+    if (r.epfd == -1 || timer_fd == -1 || epoll_ctl(r.epfd, EPOLL_CTL_ADD, timer_fd, &timer_ev) != 0) {
+        fprintf(stderr, "epoll/timerfd 初始化失败: %s\n", strerror(errno));
+        return 1;
+    }
+    r.conns.resize(index.size());
+    for (size_t i = 0; i < index.size(); i++) {
+        r.conns[i].skip = (index[i].flags & relay::CAPTURE_CONN_TRUNK) != 0;
+    }
+    // 探测连接的 epoll 数据为 conns.size() 与 conns.size() + 1
+    for (int i = 0; i < 2 && probe_ms > 0; i++) {
+        r.probe[i] = connect_probe(r.addr, PROBE_MARKS[i]);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = static_cast<uint32_t>(r.conns.size() + i);
+        if (r.probe[i] == -1 || epoll_ctl(r.epfd, EPOLL_CTL_ADD, r.probe[i], &ev) != 0) {
+            fprintf(stderr, "探测连接注册失败: %s:%s\n", argv[optind + 1], argv[optind + 2]);
+            return 1;
+        }
+    }
+
+    uint64_t offset = relay::CAPTURE_HEADER_SIZE;
+    relay::CaptureRecord rec;
+    bool have_rec = relay::readCaptureRecord(base, header.dataEnd, offset, rec);
+    uint64_t first_ns = have_rec ? rec.timeNs : 0;
+    uint64_t start_ns = now_ns();
+    uint64_t next_probe_ns = start_ns;
+    uint64_t drain_until_ns = 0;
+    uint8_t discard[64 * 1024];
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        uint64_t now = now_ns();
+        // 发出所有到期的记录
+        size_t batch = 0;
+        while (have_rec && batch < BATCH_RECORDS) {
+            uint64_t due = speed > 0 ? start_ns + static_cast<uint64_t>((rec.timeNs - first_ns) / speed) : now;
+            if (due > now) {
+                break;
+            }
+            apply_record(r, rec, due);
+            have_rec = relay::readCaptureRecord(base, header.dataEnd, offset, rec);
+            batch++;
+        }
+        bool pending = false;
+        for (const ReplayConn& c : r.conns) {
+            pending = pending || c.out_off < c.out.size();
+        }
+        if (!have_rec && !pending) {
+            if (drain_until_ns == 0) {
+                drain_until_ns = now + static_cast<uint64_t>(drain_ms) * 1000000ULL;
+            } else if (now >= drain_until_ns) {
+                break;
+            }
+        }
+
+        if (probe_ms > 0 && now >= next_probe_ns) {
+            if (r.probe_sent_ns != 0 && now - r.probe_sent_ns >= PROBE_TIMEOUT_NS) {
+                r.probe_lost++;
+                r.probe_sent_ns = 0;
+            }
+            if (r.probe_sent_ns == 0) {
+                uint8_t payload[8];
+                r.probe_sent_ns = now;
+                relay::writeU64(payload, now);
+                send_probe(r, 0, PROBE_MARKS[1], payload);
+            }
+            next_probe_ns = now + static_cast<uint64_t>(probe_ms) * 1000000ULL;
+        }
+
+        // 等到下一条记录、下一次探测或接收结束
+        uint64_t wake_ns = drain_until_ns != 0 ? drain_until_ns : UINT64_MAX;
+        if (have_rec) {
+            wake_ns = batch == BATCH_RECORDS || speed == 0
+                          ? now
+                          : start_ns + static_cast<uint64_t>((rec.timeNs - first_ns) / speed);
+        }
+        if (probe_ms > 0) {
+            wake_ns = std::min(wake_ns, next_probe_ns);
+        }
+        int timeout_ms = 0;
+        if (wake_ns > now) {
+            struct itimerspec its;
+            std::memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec = static_cast<time_t>(wake_ns / 1000000000ULL);
+            its.it_value.tv_nsec = static_cast<long>(wake_ns % 1000000000ULL);
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, nullptr);
+            timeout_ms = 1000;
+        }
+        int n = epoll_wait(r.epfd, events, MAX_EVENTS, timeout_ms);
+        for (int i = 0; i < n; i++) {
+            uint32_t id = events[i].data.u32;
+            if (id == TIMER_EVENT) {
+                uint64_t expirations;
+                ssize_t unused = read(timer_fd, &expirations, sizeof(expirations));
+                (void)unused;
+                continue;
+            }
+            if (id >= r.conns.size()) {
+                handle_probe(r, static_cast<int>(id - r.conns.size()));
+                continue;
+            }
+            ReplayConn& c = r.conns[id];
+            if (c.fd == -1) {
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ssize_t got;
+                while ((got = read(c.fd, discard, sizeof(discard))) > 0) {
+                    r.rx_bytes += static_cast<uint64_t>(got);
+                }
+                if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    // 中继关闭了连接（例如注册被拒绝），该连接之后的记录跳过
+                    r.closed_by_relay++;
+                    close_conn(r, c);
+                    continue;
+                }
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_conn(r, c);
+            }
+        }
+    }
+
+    for (ReplayConn& c : r.conns) {
+        if (c.fd != -1) {
+            close(c.fd);
+        }
+    }
+    for (int fd : r.probe) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+    close(timer_fd);
+    close(r.epfd);
+    munmap(map, file_size);
+
+    uint64_t frames_written = r.lags_ns.size();
+    double duration_ms = r.last_write_ns > start_ns ? (r.last_write_ns - start_ns) / 1e6 : 0;
+    double mbps = duration_ms > 0 ? r.bytes * 8 / (duration_ms * 1000.0) : 0;
+    uint64_t rtt_p50 = percentile(r.rtts_ns, 50);
+    uint64_t rtt_p99 = percentile(r.rtts_ns, 99);
+    uint64_t lag_p50 = percentile(r.lags_ns, 50);
+    uint64_t lag_p99 = percentile(r.lags_ns, 99);
+    printf("replay connections=%zu frames=%llu frames_written=%llu bytes=%llu rx_bytes=%llu duration_ms=%.1f "
+           "mbps=%.2f lag_p50_us=%llu lag_p99_us=%llu lag_max_us=%llu probes=%zu probes_lost=%llu "
+           "rtt_p50_us=%llu rtt_p99_us=%llu rtt_max_us=%llu connect_failed=%llu closed_by_relay=%llu\n",
+           index.size(), static_cast<unsigned long long>(r.frames), static_cast<unsigned long long>(frames_written),
+           static_cast<unsigned long long>(r.bytes), static_cast<unsigned long long>(r.rx_bytes), duration_ms, mbps,
+           static_cast<unsigned long long>(lag_p50 / 1000), static_cast<unsigned long long>(lag_p99 / 1000),
+           static_cast<unsigned long long>(r.lags_ns.empty() ? 0 : r.lags_ns.back() / 1000), r.rtts_ns.size(),
+           static_cast<unsigned long long>(r.probe_lost), static_cast<unsigned long long>(rtt_p50 / 1000),
+           static_cast<unsigned long long>(rtt_p99 / 1000),
+           static_cast<unsigned long long>(r.rtts_ns.empty() ? 0 : r.rtts_ns.back() / 1000),
+           static_cast<unsigned long long>(r.connect_failed), static_cast<unsigned long long>(r.closed_by_relay));
+    return 0;
+}
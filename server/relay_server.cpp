@@ -0,0 +1,4814 @@
+/**
+ * TCP P2P Relay Server 核心
+ *
+ * 低并发TCP转发服务器，最多支持4个连接
+ * - 首次连接：客户端发送8字节标记注册自己
+ * - 后续数据：前8字节为目标标记，转发时去掉标记只发数据
+ * - 无匹配时：丢弃不处理
+ * - 扩展客户端可用 CTRL_HELLO 注册并启用断线续传（协议见 include/relay_protocol.h）
+ *
+ * - 定时器（注册截止、空闲超时、心跳、周期统计）由 timerfd 驱动的分层时间轮统一管理
+ * - 可按连接限制入站包速率与字节速率（超出时暂停读取），按IP限制连接数
+ * - 多个节点可组成集群：节点之间以中继链路同步标记目录，发往其他节点标记的数据经中继链路批量转发
+ * - 集群节点之间交换负载，过载节点把新注册的会话重定向到较空闲的节点
+ * - 可把每个客户端连接的入站字节流经 tee/splice 镜像到金丝雀中继，用真实流量验证新版本
+ * - 可把客户端发来的每个帧连同纳秒时间戳写入抓包文件（格式见 include/relay_capture.h），由 relay_replay 重放
+ *
+ * 对外接口只有 relay_server.h 中的 RelayServer；以下实现细节都在 relay_detail 命名空间中，
+ * 每个 RelayServer 的全部状态在自己的 RelayContext 里，同一进程可以同时运行多个中继。
+ * 命令行入口见 main.cpp，测试与基准可以在进程内启动中继。
+ *
+ * 编译选项:
+ *   -DDEBUG_MODE  启用debug级别日志
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <cstdint>
+#include <cstdarg>
+#include <ctime>
+#include <atomic>
+#include <unordered_map>
+#include <array>
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <queue>
+#include <functional>
+#include <memory>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <malloc.h>
+#include <dirent.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "relay_protocol.h"
+#include "relay_capture.h"
+#include "relay_internal.h"
+
+namespace relay_detail {
+
+constexpr int LOG_BUFFER_SIZE = 1024;
+
+// 日志级别枚举（避免与syslog宏冲突）
+enum class LogLevel {
+    LVL_DEBUG = 0,
+    LVL_INFO,
+    LVL_WARN,
+    LVL_ERR
+};
+
+// 日志级别名称
+const char* log_level_names[] = {
+    "DEBUG",
+    "INFO",
+    "WARN",
+    "ERROR"
+};
+
+// 日志级别对应的syslog优先级
+int log_level_to_syslog[] = {
+    7,  // LOGD
+    6,  // LOGI
+    4,  // LOGWING
+    3   // LOGE
+};
+
+/**
+ * 日志类 - 同时输出到标准输出和syslog
+ */
+class Logger {
+public:
+    // 同一进程可运行多个中继：syslog 在第一个中继启动时打开，最后一个关闭时关闭
+    static void init(const char* ident) {
+        if (users_.fetch_add(1) == 0) {
+            openlog(ident, LOG_PID | LOG_NDELAY, LOG_DAEMON);
+            initialized_ = true;
+        }
+    }
+
+    static void close() {
+        if (users_.fetch_sub(1) == 1) {
+            initialized_ = false;
+            closelog();
+        }
+    }
+
+    static void log(LogLevel level, const char* fmt, ...) {
+        if (level < min_level_.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        char buffer[LOG_BUFFER_SIZE];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(buffer, sizeof(buffer), fmt, args);
+        va_end(args);
+
+        // 获取当前时间
+        time_t now = time(nullptr);
+        struct tm* tm_info = localtime(&now);
+        char time_buf[32];
+        strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", tm_info);
+
+        // 输出到标准输出/错误
+        FILE* out = (level >= LogLevel::LVL_WARN) ? stderr : stdout;
+        fprintf(out, "[%s] [%s] %s\n", time_buf, log_level_names[static_cast<int>(level)], buffer);
+        fflush(out);
+
+        // 输出到syslog
+        if (initialized_) {
+            syslog(log_level_to_syslog[static_cast<int>(level)], "%s", buffer);
+        }
+    }
+
+    // 格式化8字节标记为十六进制字符串
+    static std::string format_mark(const uint8_t* mark) {
+        char buf[MARK_SIZE * 2 + 1];
+        for (int i = 0; i < MARK_SIZE; i++) {
+            snprintf(buf + i * 2, 3, "%02x", mark[i]);
+        }
+        return std::string(buf);
+    }
+
+    // 运行时日志级别（低于该级别的日志直接丢弃）；进程级，各中继的线程与管理命令并发读写
+    static void set_level(LogLevel level) { min_level_.store(level, std::memory_order_relaxed); }
+    static LogLevel level() { return min_level_.load(std::memory_order_relaxed); }
+
+    // 按名称解析日志级别（不区分大小写），失败返回false
+    static bool parse_level(const std::string& name, LogLevel& out) {
+        for (int i = 0; i <= static_cast<int>(LogLevel::LVL_ERR); i++) {
+            if (strcasecmp(name.c_str(), log_level_names[i]) == 0) {
+                out = static_cast<LogLevel>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static std::atomic<bool> initialized_;
+    static std::atomic<int> users_;
+    static std::atomic<LogLevel> min_level_;
+};
+
+std::atomic<bool> Logger::initialized_{false};
+std::atomic<int> Logger::users_{0};
+#ifdef DEBUG_MODE
+std::atomic<LogLevel> Logger::min_level_{LogLevel::LVL_DEBUG};
+#else
+std::atomic<LogLevel> Logger::min_level_{LogLevel::LVL_INFO};
+#endif
+
+// 日志宏定义（使用LOGX避免与syslog宏冲突）
+#define LOGI(fmt, ...)  Logger::log(LogLevel::LVL_INFO, fmt, ##__VA_ARGS__)
+#define LOGW(fmt, ...)  Logger::log(LogLevel::LVL_WARN, fmt, ##__VA_ARGS__)
+#define LOGE(fmt, ...)  Logger::log(LogLevel::LVL_ERR, fmt, ##__VA_ARGS__)
+
+// DEBUG级别日志 - 仅在编译时定义DEBUG_MODE时启用
+#ifdef DEBUG_MODE
+    #define LOGD(fmt, ...) Logger::log(LogLevel::LVL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+    #define LOGD(fmt, ...) ((void)0)
+#endif
+
+// 中继状态（RelayContext）与连接的定义见 relay_internal.h
+thread_local RelayContext* ctx = nullptr;
+
+struct RuntimeLimit {
+    const char* name;
+    int RelayContext::*value;
+    int min_value;
+    int max_value;
+    const char* desc;
+};
+
+const RuntimeLimit g_runtime_limits[] = {
+    {"max_connections", &RelayContext::max_connections, 1, 65536, "最大客户端连接数（不影响已建立的连接）"},
+    {"max_connections_per_ip", &RelayContext::max_connections_per_ip, 0, 65536, "同一IP最多同时保持的连接数（0为不限制，不影响已建立的连接）"},
+    {"ingress_packets_per_sec", &RelayContext::ingress_packets_per_sec, 0, 10 * 1000 * 1000, "每个连接每秒最多处理的帧数，超出时暂停读取（0为不限制）"},
+    {"ingress_bytes_per_sec", &RelayContext::ingress_bytes_per_sec, 0, 1024 * 1024 * 1024, "每个连接每秒最多读取的字节数，超出时暂停读取（0为不限制）"},
+    {"perf_interval_ms", &RelayContext::perf_interval_ms, 100, 3600 * 1000, "PERF统计日志输出间隔"},
+    {"resume_grace_ms", &RelayContext::resume_grace_ms, 0, 3600 * 1000, "断线续传会话保留时长（0为禁用）"},
+    {"resume_buffer_bytes", &RelayContext::resume_buffer_bytes, 4096, 256 * 1024 * 1024, "每个续传会话最多缓存的未确认字节数"},
+    {"data_deadline_ms", &RelayContext::data_deadline_ms, 0, 60 * 1000, "数据帧排队超过该时间仍未开始发送时丢弃（0为不限制，HELLO 可单独指定）"},
+    {"egress_quantum_bytes", &RelayContext::egress_quantum_bytes, 256, 1024 * 1024, "出站子队列每轮可发送的字节数（差额轮询配额）"},
+    {"tap_queue_bytes", &RelayContext::tap_queue_bytes, 4096, 64 * 1024 * 1024, "每个观察连接最多排队的镜像字节数，超过时丢弃新的镜像帧"},
+    {"register_timeout_ms", &RelayContext::register_timeout_ms, 0, 3600 * 1000, "连接建立后必须完成注册的时限（0为不限制）"},
+    {"ping_interval_ms", &RelayContext::ping_interval_ms, 100, 3600 * 1000, "向心跳客户端发送PING的间隔"},
+    {"idle_timeout_ms", &RelayContext::idle_timeout_ms, 0, 3600 * 1000, "心跳客户端无任何数据多久后断开（0为不限制）"},
+    {"legacy_idle_timeout_ms", &RelayContext::legacy_idle_timeout_ms, 0, 24 * 3600 * 1000, "其他已注册连接无任何数据多久后断开（0为不限制）"},
+    {"nack_interval_ms", &RelayContext::nack_interval_ms, 0, 3600 * 1000, "同一目标不存在时向同一发送方重复发送NACK的最小间隔"},
+    {"trunk_retry_ms", &RelayContext::trunk_retry_ms, 10, 3600 * 1000, "集群中继链路断开或连接失败后重连的间隔"},
+    {"trunk_queue_bytes", &RelayContext::trunk_queue_bytes, 65536, 1024 * 1024 * 1024, "每条中继链路最多排队的字节数，超过时丢弃新的转发记录"},
+    {"load_report_ms", &RelayContext::load_report_ms, 50, 60 * 1000, "集群节点采样本节点负载并通告给其他节点的间隔"},
+    {"load_egress_bytes_per_sec", &RelayContext::load_egress_bytes_per_sec, 0, 1024 * 1024 * 1024, "出站带宽容量，负载按占用比例计（0为不计带宽）"},
+    {"load_lag_ms", &RelayContext::load_lag_ms, 0, 60 * 1000, "事件循环延迟达到该值时视为满负载（0为不计延迟）"},
+    {"redirect_load_permille", &RelayContext::redirect_load_permille, 0, 1000, "负载达到该千分比后把新注册重定向到较空闲的节点（0为不按负载重定向）"},
+    {"redirect_margin_permille", &RelayContext::redirect_margin_permille, 0, 1000, "目标节点加上新连接后的负载至少比本节点低多少千分比才重定向"},
+    {"capture_snaplen", &RelayContext::capture_snaplen, 0, MAX_PACKET_SIZE, "抓包时每帧最多保存的字节数，0为保存完整的帧"},
+    {"capture_max_mb", &RelayContext::capture_max_mb, 1, 1024 * 1024, "抓包文件的长度上限(MB)，达到后停止抓包"},
+    {"mirror_pipe_bytes", &RelayContext::mirror_pipe_bytes, 4096, 64 * 1024 * 1024, "每个镜像连接的管道容量，金丝雀跟不上、积压超过时放弃该连接的镜像（不影响已建立的镜像）"},
+};
+
+
+// 粗粒度单调时钟（毫秒），用于超时与统计；CLOCK_MONOTONIC_COARSE 不触发系统调用，但精度只有几毫秒
+uint64_t read_coarse_clock_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+// 精确单调时钟（微秒），只用于测量心跳RTT
+uint64_t precise_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+uint64_t read_clock_ms() {
+    return ctx->clock ? ctx->clock() : read_coarse_clock_ms();
+}
+
+uint64_t now_ms() {
+    return ctx->now_ms;
+}
+
+// ============================================================================
+// 定时器
+//
+// 所有定时器都挂在同一个时间轮上，时间轮的最早到期时间写入一个 timerfd，
+// 事件循环因此不再需要轮询超时（epoll_wait 无限等待）。
+// user_data 高32位为 TimerKind，低32位为连接fd；连接关闭时取消其全部定时器，fd复用不会误触发。
+// ============================================================================
+
+enum TimerKind : uint32_t {
+    TIMER_REGISTER = 1,     // 注册截止
+    TIMER_IDLE = 2,         // 空闲超时（到期时按 last_rx_ms 惰性续期）
+    TIMER_PING = 3,         // 心跳
+    TIMER_PERF = 4,         // PERF统计日志
+    TIMER_HOUSEKEEPING = 5, // 补发确认、清理保留会话
+    TIMER_INGRESS = 6,      // 入站限速：补充令牌后恢复读取
+    TIMER_TRUNK = 7,        // 集群中继链路重连（低32位为 trunk_peers 下标）
+    TIMER_LOAD = 8,         // 采样本节点负载并通告给其他节点
+};
+
+
+TimerWheel::TimerId schedule_timer_at(TimerKind kind, int fd, uint64_t expire_ms) {
+    return ctx->timers.schedule(expire_ms, (static_cast<uint64_t>(kind) << 32) | static_cast<uint32_t>(fd));
+}
+
+TimerWheel::TimerId schedule_timer(TimerKind kind, int fd, uint64_t delay_ms) {
+    return schedule_timer_at(kind, fd, ctx->now_ms + delay_ms);
+}
+
+void cancel_timer(TimerWheel::TimerId& id) {
+    if (id != TimerWheel::INVALID_TIMER) {
+        ctx->timers.cancel(id);
+        id = TimerWheel::INVALID_TIMER;
+    }
+}
+
+// 按时间轮的最早到期时间设置 timerfd（值未变化时不做系统调用）
+// 注入时钟时不使用 timerfd：定时器只在 RelayServer::run_once() 中按注入的时间推进
+void arm_timerfd() {
+    uint64_t next = ctx->timers.next_expiry_ms();
+    if (next == ctx->timer_armed_ms || ctx->timer_fd == -1 || ctx->clock) {
+        return;
+    }
+    struct itimerspec spec;
+    std::memset(&spec, 0, sizeof(spec));
+    if (next != TimerWheel::NO_EXPIRY) {
+        spec.it_value.tv_sec = static_cast<time_t>(next / 1000);
+        spec.it_value.tv_nsec = static_cast<long>((next % 1000) * 1000000);
+    }
+    if (timerfd_settime(ctx->timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        LOGE("timerfd_settime失败: %s", strerror(errno));
+        return;
+    }
+    ctx->timer_armed_ms = next;
+}
+
+// 生成非0的随机会话令牌：令牌用于接管标记，必须不可预测，每次直接从内核取随机数（不共享状态，各实例线程安全）
+// 取不到随机数时返回0，该会话不可接管或续传
+uint64_t generate_token() {
+    uint64_t token = 0;
+    while (token == 0) {
+        ssize_t n = getrandom(&token, sizeof(token), 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n != static_cast<ssize_t>(sizeof(token))) {
+            LOGE("getrandom 失败，会话不可接管: %s", strerror(errno));
+            return 0;
+        }
+    }
+    return token;
+}
+
+uint32_t alloc_slot(int fd) {
+    if (!ctx->free_slots.empty()) {
+        uint32_t slot = ctx->free_slots.top();
+        ctx->free_slots.pop();
+        ctx->slot_to_fd[slot - 1] = fd;
+        return slot;
+    }
+    ctx->slot_to_fd.push_back(fd);
+    return static_cast<uint32_t>(ctx->slot_to_fd.size());
+}
+
+void release_slot(uint32_t slot) {
+    if (slot == 0 || slot > ctx->slot_to_fd.size()) {
+        return;
+    }
+    ctx->slot_to_fd[slot - 1] = -1;
+    ctx->free_slots.push(slot);
+}
+
+// 热重启接管：沿用旧进程分配的槽位号，全部接收完后调用 rebuild_free_slots
+void claim_slot(uint32_t slot, int fd) {
+    if (slot == 0) {
+        return;
+    }
+    if (ctx->slot_to_fd.size() < slot) {
+        ctx->slot_to_fd.resize(slot, -1);
+    }
+    ctx->slot_to_fd[slot - 1] = fd;
+}
+
+void rebuild_free_slots() {
+    ctx->free_slots = decltype(ctx->free_slots)();
+    for (size_t i = 0; i < ctx->slot_to_fd.size(); i++) {
+        if (ctx->slot_to_fd[i] == -1) {
+            ctx->free_slots.push(static_cast<uint32_t>(i + 1));
+        }
+    }
+}
+
+// 对端IP的连接计数 (max_connections_per_ip)
+void track_peer_ip(Connection& conn, uint32_t ip) {
+    conn.peer_ip = ip;
+    ctx->ip_connections[ip]++;
+}
+
+void untrack_peer_ip(Connection& conn) {
+    if (conn.peer_ip == 0) {
+        return;
+    }
+    auto it = ctx->ip_connections.find(conn.peer_ip);
+    if (it != ctx->ip_connections.end() && --it->second <= 0) {
+        ctx->ip_connections.erase(it);
+    }
+    conn.peer_ip = 0;
+}
+
+void close_connection(int fd, int epfd, bool keep_session = true);
+void notify_presence(uint8_t op, const uint8_t* mark, int epfd, int joined_fd = -1, bool remote = false);
+void trunk_link_down(Connection& conn, int epfd);
+
+bool update_epoll_events(int epfd, const Connection& conn, bool want_write) {
+    int fd = conn.fd;
+    struct epoll_event ev;
+    ev.data.fd = fd;
+    uint32_t events = conn.ingress_paused ? 0u : static_cast<uint32_t>(EPOLLIN);
+    if (want_write) {
+        events |= EPOLLOUT;
+    }
+    ev.events = events;
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        LOGE("epoll_ctl MOD 失败 fd=%d: %s", fd, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+// 按发送顺序填充 iovec：send_buf 的各段字节与插在其间的共享负载，返回使用的分段数
+int fill_send_iov(const Connection& conn, iovec* iov, int max_iov) {
+    int n = 0;
+    size_t pos = 0;
+    for (const auto& seg : conn.send_shared) {
+        if (n + 2 > max_iov) {
+            return n;
+        }
+        if (seg.offset > pos) {
+            iov[n++] = {const_cast<uint8_t*>(conn.send_buf.data()) + pos, seg.offset - pos};
+            pos = seg.offset;
+        }
+        iov[n++] = {const_cast<uint8_t*>(seg.data->data()) + seg.begin, seg.data->size() - seg.begin};
+    }
+    if (pos < conn.send_buf.size()) {
+        iov[n++] = {const_cast<uint8_t*>(conn.send_buf.data()) + pos, conn.send_buf.size() - pos};
+    }
+    return n;
+}
+
+// 从发送队列头部移除已写出的字节
+void consume_sent(Connection& conn, size_t sent) {
+    while (sent > 0) {
+        size_t head = conn.send_shared.empty() ? conn.send_buf.size() : conn.send_shared.front().offset;
+        if (head > 0) {
+            size_t n = std::min(sent, head);
+            conn.send_buf.erase(conn.send_buf.begin(), conn.send_buf.begin() + n);
+            for (auto& seg : conn.send_shared) {
+                seg.offset -= n;
+            }
+            sent -= n;
+            continue;
+        }
+        Connection::SharedSegment& seg = conn.send_shared.front();
+        size_t left = seg.data->size() - seg.begin;
+        if (sent < left) {
+            seg.begin += sent;
+            conn.send_shared_bytes -= sent;
+            return;
+        }
+        sent -= left;
+        conn.send_shared_bytes -= left;
+        conn.send_shared.pop_front();
+    }
+}
+
+// 发送队列的全部字节（共享负载展开为副本；热重启交接、出错前尽力发送时使用）
+std::vector<uint8_t> pending_send_bytes(const Connection& conn) {
+    if (conn.send_shared.empty()) {
+        return conn.send_buf;
+    }
+    std::vector<uint8_t> out;
+    out.reserve(conn.send_bytes());
+    size_t pos = 0;
+    for (const auto& seg : conn.send_shared) {
+        out.insert(out.end(), conn.send_buf.begin() + pos, conn.send_buf.begin() + seg.offset);
+        out.insert(out.end(), seg.data->begin() + seg.begin, seg.data->end());
+        pos = seg.offset;
+    }
+    out.insert(out.end(), conn.send_buf.begin() + pos, conn.send_buf.end());
+    return out;
+}
+
+uint64_t data_deadline_ms(const Connection& conn) {
+    return conn.deadline_ms > 0 ? conn.deadline_ms : static_cast<uint64_t>(ctx->data_deadline_ms);
+}
+
+void schedule_egress(Connection& conn, size_t budget);
+
+void flush_send_buffer(Connection& conn, int epfd) {
+    if (conn.fd < 0) {
+        return;
+    }
+
+    while (true) {
+        if (!conn.egress_flows.empty() && conn.send_bytes() < EGRESS_WIRE_BYTES) {
+            schedule_egress(conn, EGRESS_WIRE_BYTES);
+        }
+        if (!conn.send_pending()) {
+            break;
+        }
+        ssize_t sent;
+        if (conn.send_shared.empty()) {
+            sent = write(conn.fd, conn.send_buf.data(), conn.send_buf.size());
+        } else {
+            iovec iov[SEND_IOV_MAX];
+            int iov_count = fill_send_iov(conn, iov, SEND_IOV_MAX);
+            sent = writev(conn.fd, iov, iov_count);
+        }
+        if (sent > 0) {
+            ctx->stat_bytes_out.fetch_add(static_cast<uint64_t>(sent), std::memory_order_relaxed);
+            conn.bytes_out += static_cast<uint64_t>(sent);
+            consume_sent(conn, static_cast<size_t>(sent));
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            (void)update_epoll_events(epfd, conn, true);
+            return;
+        } else {
+            ctx->stat_write_errors.fetch_add(1, std::memory_order_relaxed);
+            close_connection(conn.fd, epfd);
+            return;
+        }
+    }
+
+    // 突发积压的 send_buf 清空后不会自动缩小，长时间运行的连接各自占着峰值容量
+    if (conn.send_buf.capacity() > SEND_BUF_RETAIN_BYTES) {
+        std::vector<uint8_t>().swap(conn.send_buf);
+        ctx->stat_buf_released.fetch_add(1, std::memory_order_relaxed);
+    }
+    (void)update_epoll_events(epfd, conn, false);
+}
+
+void handle_client_write(int fd, int epfd) {
+    auto it = ctx->connections.find(fd);
+    if (it == ctx->connections.end()) {
+        close_connection(fd, epfd);
+        return;
+    }
+    flush_send_buffer(it->second, epfd);
+}
+
+// 设置socket为非阻塞模式
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        LOGE("fcntl F_GETFL 失败: %s", strerror(errno));
+        return false;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        LOGE("fcntl F_SETFL 失败: %s", strerror(errno));
+        return false;
+    }
+    LOGD("设置fd=%d为非阻塞模式", fd);
+    return true;
+}
+
+// 创建监听socket
+int create_listen_socket(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        LOGE("创建socket失败: %s", strerror(errno));
+        return -1;
+    }
+    LOGD("创建socket fd=%d", listen_fd);
+
+    // 设置SO_REUSEADDR
+    int opt = 1;
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+        LOGE("setsockopt SO_REUSEADDR 失败: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    // 绑定地址
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        LOGE("bind失败: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+    LOGD("bind成功 port=%d", port);
+
+    // 开始监听
+    if (listen(listen_fd, SOMAXCONN) == -1) {
+        LOGE("listen失败: %s", strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    // 设置非阻塞
+    if (!set_nonblocking(listen_fd)) {
+        close(listen_fd);
+        return -1;
+    }
+
+    return listen_fd;
+}
+
+// 关闭连接并清理资源
+// keep_session=true 时，启用断线续传的已注册连接进入保留状态（标记继续占用），
+// 宽限期内客户端可通过 CTRL_HELLO + TLV_RESUME 恢复会话；踢出或协议错误时传false
+// ============================================================================
+// 金丝雀镜像 (-m)
+//
+// 每个客户端连接对应一条到金丝雀中继的连接，金丝雀看到的入站字节流与本中继完全相同，
+// 两边的统计计数可以直接对比。主路径用 splice/tee 经管道读取，不比普通 read 多一次用户态拷贝；
+// 镜像管道写满（金丝雀跟不上）时放弃该连接的镜像而不是阻塞，金丝雀发回的数据读出后丢弃。
+// ============================================================================
+
+void close_pipe(int (&fds)[2]) {
+    for (int& fd : fds) {
+        if (fd != -1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+}
+
+// 停止镜像：之后按普通 read 读取
+void release_mirror(Connection& conn, int epfd) {
+    if (conn.mirror_fd == -1) {
+        return;
+    }
+    ctx->mirrors.erase(conn.mirror_fd);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn.mirror_fd, nullptr);
+    close(conn.mirror_fd);
+    conn.mirror_fd = -1;
+    close_pipe(conn.mirror_in);
+    close_pipe(conn.mirror_out);
+    conn.mirror_pending = 0;
+}
+
+void drop_mirror(Connection& conn, int epfd, const char* reason) {
+    LOGW("放弃金丝雀镜像 fd=%d mirror_fd=%d pending=%zu: %s", conn.fd, conn.mirror_fd, conn.mirror_pending, reason);
+    ctx->stat_mirror_drops.fetch_add(1, std::memory_order_relaxed);
+    release_mirror(conn, epfd);
+}
+
+void start_mirror(Connection& conn, int epfd) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bool ok = fd != -1 && pipe2(conn.mirror_in, O_NONBLOCK | O_CLOEXEC) == 0 &&
+              pipe2(conn.mirror_out, O_NONBLOCK | O_CLOEXEC) == 0 &&
+              (connect(fd, reinterpret_cast<const sockaddr*>(&ctx->mirror_addr), sizeof(ctx->mirror_addr)) == 0 ||
+               errno == EINPROGRESS);
+    if (ok) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.fd = fd;
+        ok = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+    if (!ok) {
+        LOGW("无法建立金丝雀镜像 fd=%d target=%s: %s", conn.fd, ctx->mirror_target.c_str(), strerror(errno));
+        ctx->stat_mirror_failed.fetch_add(1, std::memory_order_relaxed);
+        if (fd != -1) {
+            close(fd);
+        }
+        close_pipe(conn.mirror_in);
+        close_pipe(conn.mirror_out);
+        return;
+    }
+    // 管道容量即允许的积压；超出系统上限时保留默认容量
+    fcntl(conn.mirror_out[1], F_SETPIPE_SZ, ctx->mirror_pipe_bytes);
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    conn.mirror_fd = fd;
+    conn.mirror_connected = false;
+    conn.mirror_want_write = true;
+    ctx->mirrors[fd] = conn.fd;
+}
+
+// 把镜像管道中的数据 splice 到金丝雀连接，写不完时关注 EPOLLOUT
+void flush_mirror(Connection& conn, int epfd) {
+    while (conn.mirror_connected && conn.mirror_pending > 0) {
+        ssize_t n = splice(conn.mirror_out[0], nullptr, conn.mirror_fd, nullptr, conn.mirror_pending,
+                           SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n > 0) {
+            conn.mirror_pending -= static_cast<size_t>(n);
+            ctx->stat_mirror_sent.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        } else if (n == -1 && errno == EAGAIN) {
+            break;
+        } else {
+            drop_mirror(conn, epfd, n == 0 ? "金丝雀连接已关闭" : strerror(errno));
+            return;
+        }
+    }
+    bool want_write = !conn.mirror_connected || conn.mirror_pending > 0;
+    if (want_write != conn.mirror_want_write) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        if (want_write) {
+            ev.events |= EPOLLOUT;
+        }
+        ev.data.fd = conn.mirror_fd;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn.mirror_fd, &ev);
+        conn.mirror_want_write = want_write;
+    }
+}
+
+// 镜像连接的读取：socket -> 主管道 (splice)，主管道 -> 镜像管道 (tee)，主管道 -> buf (read)
+// 返回值与 read 相同
+ssize_t read_mirrored(Connection& conn, int epfd, uint8_t* buf, size_t len) {
+    ssize_t n = splice(conn.fd, nullptr, conn.mirror_in[1], nullptr, len, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+    if (n <= 0) {
+        return n;
+    }
+    ssize_t copied = tee(conn.mirror_in[0], conn.mirror_out[1], static_cast<size_t>(n), SPLICE_F_NONBLOCK);
+    ssize_t got = read(conn.mirror_in[0], buf, static_cast<size_t>(n));
+    if (copied == n) {
+        conn.mirror_pending += static_cast<size_t>(n);
+        ctx->stat_mirror_bytes.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+        flush_mirror(conn, epfd);
+    } else {
+        // 只复制了一部分：金丝雀收到的字节流已不完整，不能再继续
+        drop_mirror(conn, epfd, "镜像管道已满");
+    }
+    return got;
+}
+
+// 金丝雀连接上的事件：连接完成后开始发送积压；金丝雀发回的数据（HELLO_ACK、转发给镜像连接的数据等）直接丢弃
+void handle_mirror_event(int mirror_fd, uint32_t events, int epfd) {
+    auto mirror_it = ctx->mirrors.find(mirror_fd);
+    auto it = mirror_it == ctx->mirrors.end() ? ctx->connections.end() : ctx->connections.find(mirror_it->second);
+    if (it == ctx->connections.end()) {
+        return;
+    }
+    Connection& conn = it->second;
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(mirror_fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        drop_mirror(conn, epfd, err != 0 ? strerror(err) : "金丝雀连接已关闭");
+        return;
+    }
+    if (events & EPOLLIN) {
+        uint8_t discard[16 * 1024];
+        ssize_t n;
+        while ((n = read(mirror_fd, discard, sizeof(discard))) > 0) {
+        }
+        if (n == 0 || errno != EAGAIN) {
+            drop_mirror(conn, epfd, n == 0 ? "金丝雀连接已关闭" : strerror(errno));
+            return;
+        }
+    }
+    if (events & EPOLLOUT) {
+        if (!conn.mirror_connected) {
+            LOGI("金丝雀镜像已连接 fd=%d mirror_fd=%d", conn.fd, mirror_fd);
+        }
+        conn.mirror_connected = true;
+    }
+    flush_mirror(conn, epfd);
+}
+
+// ============================================================================
+// 抓包 (-w)
+//
+// 客户端发来的每个完整帧在处理之前原样写入抓包文件（可按 capture_snaplen 截断），连同纳秒时间戳与连接编号，
+// 连接的建立与关闭也各记一条。文件按 CAPTURE_GROW_BYTES 扩展并重新映射，写入只是一次内存拷贝；
+// 退出时（含热重启移交后）写入连接索引。集群链路在握手之后不再抓包。
+// ============================================================================
+
+uint64_t capture_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec) - ctx->capture_start_ns;
+}
+
+// 确保记录区末尾还有 need 字节可写，必要时扩展文件并重新映射（文件长度不超过 limit）
+bool capture_reserve(size_t need, size_t limit) {
+    uint64_t end = ctx->capture_header.dataEnd;
+    if (end + need <= ctx->capture_mapped) {
+        return true;
+    }
+    size_t size = (end + need + CAPTURE_GROW_BYTES - 1) / CAPTURE_GROW_BYTES * CAPTURE_GROW_BYTES;
+    size = std::min(size, limit);
+    void* map = MAP_FAILED;
+    if (end + need <= size && ftruncate(ctx->capture_fd, static_cast<off_t>(size)) == 0) {
+        map = mremap(ctx->capture_map, ctx->capture_mapped, size, MREMAP_MAYMOVE);
+    }
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    ctx->capture_map = static_cast<uint8_t*>(map);
+    ctx->capture_mapped = size;
+    return true;
+}
+
+void capture_record(Connection& conn, uint8_t type, const uint8_t* data, uint32_t len) {
+    uint32_t cap_len = len;
+    if (ctx->capture_snaplen > 0 && cap_len > static_cast<uint32_t>(ctx->capture_snaplen)) {
+        cap_len = static_cast<uint32_t>(ctx->capture_snaplen);
+        ctx->stat_capture_truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+    size_t size = relay::captureRecordSize(cap_len);
+    if (!ctx->capture_full && !capture_reserve(size, static_cast<size_t>(ctx->capture_max_mb) * 1024 * 1024)) {
+        LOGW("抓包文件已达上限或无法扩展，停止抓包: %s (%llu 字节)", ctx->capture_path.c_str(),
+             static_cast<unsigned long long>(ctx->capture_header.dataEnd));
+        ctx->capture_full = true;
+    }
+    if (ctx->capture_full) {
+        ctx->stat_capture_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint64_t offset = ctx->capture_header.dataEnd;
+    uint64_t now_ns = capture_now_ns();
+    uint8_t* p = ctx->capture_map + offset;
+    relay::writeCaptureRecordHeader(p, now_ns, conn.capture_id, type, len, cap_len);
+    if (cap_len > 0) {
+        std::memcpy(p + relay::CAPTURE_RECORD_HEADER_SIZE, data, cap_len);
+    }
+    std::memset(p + relay::CAPTURE_RECORD_HEADER_SIZE + cap_len, 0,
+                size - relay::CAPTURE_RECORD_HEADER_SIZE - cap_len);
+    ctx->capture_header.dataEnd = offset + size;
+    ctx->stat_capture_records.fetch_add(1, std::memory_order_relaxed);
+
+    relay::CaptureConn& entry = ctx->capture_conns[conn.capture_id - 1];
+    if (type == relay::CAPTURE_OPEN) {
+        entry.firstOffset = offset;
+        entry.openNs = now_ns;
+    } else if (type == relay::CAPTURE_FRAME) {
+        entry.frames++;
+        entry.bytes += len;
+    } else {
+        entry.closeNs = now_ns;
+    }
+}
+
+void capture_open(Connection& conn) {
+    relay::CaptureConn entry;
+    entry.id = static_cast<uint32_t>(ctx->capture_conns.size() + 1);
+    entry.flags = relay::CAPTURE_CONN_OPEN;
+    ctx->capture_conns.push_back(entry);
+    conn.capture_id = entry.id;
+    capture_record(conn, relay::CAPTURE_OPEN, nullptr, 0);
+}
+
+inline void capture_frame(Connection& conn, const uint8_t* data, uint32_t len) {
+    if (conn.capture_id != 0 && !conn.trunk) {
+        capture_record(conn, relay::CAPTURE_FRAME, data, len);
+    }
+}
+
+// 连接关闭（或退出时仍未关闭）：在索引中记下标记与链路类型
+void capture_finish(Connection& conn, bool closed) {
+    relay::CaptureConn& entry = ctx->capture_conns[conn.capture_id - 1];
+    if (conn.registered) {
+        entry.flags |= relay::CAPTURE_CONN_REGISTERED;
+        std::memcpy(entry.mark, conn.mark, 8);
+    }
+    if (conn.trunk) {
+        entry.flags |= relay::CAPTURE_CONN_TRUNK;
+    }
+    if (closed) {
+        entry.flags &= ~relay::CAPTURE_CONN_OPEN;
+        capture_record(conn, relay::CAPTURE_CLOSE, nullptr, 0);
+    }
+    if (entry.closeNs == 0) {
+        entry.closeNs = capture_now_ns();
+    }
+    conn.capture_id = 0;
+}
+
+bool start_capture(const std::string& path) {
+    ctx->capture_fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (ctx->capture_fd == -1 || ftruncate(ctx->capture_fd, static_cast<off_t>(CAPTURE_GROW_BYTES)) != 0) {
+        LOGE("无法创建抓包文件 %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    void* map = mmap(nullptr, CAPTURE_GROW_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->capture_fd, 0);
+    if (map == MAP_FAILED) {
+        LOGE("无法映射抓包文件 %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    ctx->capture_map = static_cast<uint8_t*>(map);
+    ctx->capture_mapped = CAPTURE_GROW_BYTES;
+    ctx->capture_path = path;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ctx->capture_header.snaplen = static_cast<uint32_t>(ctx->capture_snaplen);
+    ctx->capture_header.startRealtimeNs = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ctx->capture_start_ns = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+    relay::writeCaptureHeader(ctx->capture_map, ctx->capture_header);
+    LOGI("抓包文件: %s (snaplen=%d, 上限 %dMB)", path.c_str(), ctx->capture_snaplen, ctx->capture_max_mb);
+    return true;
+}
+
+// 退出时写入连接索引，把文件截到实际长度
+void finish_capture() {
+    for (auto& pair : ctx->connections) {
+        if (pair.second.capture_id != 0) {
+            capture_finish(pair.second, false);
+        }
+    }
+    // 索引不受 capture_max_mb 限制
+    size_t index_size = ctx->capture_conns.size() * relay::CAPTURE_INDEX_ENTRY_SIZE;
+    if (capture_reserve(index_size, SIZE_MAX)) {
+        ctx->capture_header.indexOffset = ctx->capture_header.dataEnd;
+        ctx->capture_header.indexCount = static_cast<uint32_t>(ctx->capture_conns.size());
+        for (size_t i = 0; i < ctx->capture_conns.size(); i++) {
+            relay::writeCaptureConn(ctx->capture_map + ctx->capture_header.indexOffset + i * relay::CAPTURE_INDEX_ENTRY_SIZE,
+                                    ctx->capture_conns[i]);
+        }
+    }
+    uint64_t file_size = ctx->capture_header.dataEnd + (ctx->capture_header.indexOffset != 0 ? index_size : 0);
+    relay::writeCaptureHeader(ctx->capture_map, ctx->capture_header);
+    munmap(ctx->capture_map, ctx->capture_mapped);
+    if (ftruncate(ctx->capture_fd, static_cast<off_t>(file_size)) != 0) {
+        LOGW("截断抓包文件失败: %s", strerror(errno));
+    }
+    close(ctx->capture_fd);
+    ctx->capture_fd = -1;
+    LOGI("抓包结束: %s, %zu 个连接, %llu 字节", ctx->capture_path.c_str(), ctx->capture_conns.size(),
+         static_cast<unsigned long long>(file_size));
+}
+
+void close_connection(int fd, int epfd, bool keep_session) {
+    auto it = ctx->connections.find(fd);
+    if (it != ctx->connections.end()) {
+        Connection& conn = it->second;
+        cancel_timer(conn.register_timer);
+        cancel_timer(conn.idle_timer);
+        cancel_timer(conn.ping_timer);
+        cancel_timer(conn.ingress_timer);
+        untrack_peer_ip(conn);
+        if (conn.mirror_fd != -1) {
+            flush_mirror(conn, epfd);   // 尽量送出积压，金丝雀随后看到连接关闭
+            release_mirror(conn, epfd);
+        }
+        if (conn.capture_id != 0) {
+            capture_finish(conn, true);
+        }
+        // 如果已注册，从标记映射中移除
+        release_slot(conn.slot);
+        if (conn.registered) {
+            uint64_t key = mark_to_key(conn.mark);
+            ctx->mark_to_fd.erase(key);
+            if (keep_session && (conn.caps & relay::CAP_RESUME) && !conn.resume.tx_log_overflow &&
+                ctx->resume_grace_ms > 0) {
+                schedule_egress(conn, SIZE_MAX);   // 子队列中的帧记入 tx_log，恢复会话时重放
+                ParkedSession& parked = ctx->parked[key];
+                std::memcpy(parked.mark, conn.mark, MARK_SIZE);
+                parked.state = std::move(conn.resume);
+                parked.expire_at_ms = now_ms() + static_cast<uint64_t>(ctx->resume_grace_ms);
+                ctx->stat_sessions_parked.fetch_add(1, std::memory_order_relaxed);
+                LOGI("连接断开，保留会话 fd=%d mark=%s unacked=%zu grace=%dms", fd,
+                     Logger::format_mark(conn.mark).c_str(), parked.state.tx_log.size(), ctx->resume_grace_ms);
+            } else {
+                LOGI("连接断开 fd=%d mark=%s", fd, Logger::format_mark(conn.mark).c_str());
+                notify_presence(relay::CTRL_PEER_LEAVE, conn.mark, epfd);
+            }
+        } else if (conn.tap) {
+            LOGI("观察连接断开 fd=%d dropped=%llu", fd, static_cast<unsigned long long>(conn.tap_dropped));
+            ctx->taps.erase(std::find(ctx->taps.begin(), ctx->taps.end(), fd));
+        } else if (conn.trunk) {
+            trunk_link_down(conn, epfd);
+            ctx->trunk_connections--;
+        } else {
+            LOGI("未注册连接断开 fd=%d", fd);
+        }
+        ctx->connections.erase(it);
+    }
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    LOGD("已清理fd=%d资源", fd);
+}
+
+// 清理超过宽限期的保留会话
+void expire_parked_sessions(uint64_t now, int epfd) {
+    for (auto it = ctx->parked.begin(); it != ctx->parked.end();) {
+        if (now >= it->second.expire_at_ms) {
+            LOGI("保留会话超时，释放标记 mark=%s dropped=%zu",
+                 Logger::format_mark(it->second.mark).c_str(), it->second.state.tx_log.size());
+            ctx->stat_sessions_expired.fetch_add(1, std::memory_order_relaxed);
+            notify_presence(relay::CTRL_PEER_LEAVE, it->second.mark, epfd);
+            it = ctx->parked.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// 客户端连接数（含未注册的），不含中继链路与观察连接；max_connections 与负载只按它计算
+size_t client_connection_count() {
+    return ctx->connections.size() - ctx->trunk_connections - ctx->taps.size();
+}
+
+// 注册新标记前检查客户端数：接受连接时为集群节点预留的位置只能由完成 CTRL_TRUNK 的连接使用，
+// 客户端在注册时仍按 max_connections 限制（接管仍在线的同一标记不增加客户端数）
+bool client_registration_full(uint64_t key) {
+    if (ctx->mark_to_fd.count(key) || ctx->mark_to_fd.size() < static_cast<size_t>(ctx->max_connections)) {
+        return false;
+    }
+    ctx->stat_register_full.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+// 处理新连接
+void handle_new_connection(int listen_fd, int epfd) {
+    struct sockaddr_in client_addr;
+    socklen_t addr_len = sizeof(client_addr);
+
+    int client_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &addr_len);
+    if (client_fd == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE("accept失败: %s", strerror(errno));
+        }
+        return;
+    }
+
+    // 检查连接数限制：为尚未建立链路的集群节点各留一个位置，客户端占满时节点之间仍能互联
+    size_t reserved = ctx->trunk_peers.size() - std::min(ctx->trunk_peers.size(), ctx->trunks.size());
+    if (client_connection_count() >= static_cast<size_t>(ctx->max_connections) + reserved) {
+        LOGW("连接数已满，拒绝新连接 fd=%d", client_fd);
+        close(client_fd);
+        return;
+    }
+
+    // 检查单IP连接数限制（同一来源大量建连会占满连接数与事件循环）
+    uint32_t peer_ip = client_addr.sin_addr.s_addr;
+    if (ctx->max_connections_per_ip > 0) {
+        auto ip_it = ctx->ip_connections.find(peer_ip);
+        if (ip_it != ctx->ip_connections.end() && ip_it->second >= ctx->max_connections_per_ip) {
+            char rejected_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, rejected_ip, sizeof(rejected_ip));
+            LOGW("同一IP连接数已满，拒绝新连接 fd=%d from %s (%d/%d)", client_fd, rejected_ip, ip_it->second,
+                 ctx->max_connections_per_ip);
+            ctx->stat_ip_limit_rejected.fetch_add(1, std::memory_order_relaxed);
+            close(client_fd);
+            return;
+        }
+    }
+
+    // 设置非阻塞
+    if (!set_nonblocking(client_fd)) {
+        close(client_fd);
+        return;
+    }
+
+    // 设置TCP_NODELAY，禁用Nagle算法，减少小包延迟
+    int flag = 1;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) == -1) {
+        LOGW("setsockopt TCP_NODELAY 失败 fd=%d: %s", client_fd, strerror(errno));
+        // 非致命错误，继续
+    }
+
+    // 设置TCP_NOTSENT_LOWAT，积压留在中继的出站子队列中，才能按来源调度、按截止时间丢弃
+    int lowat = EGRESS_NOTSENT_LOWAT;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) == -1) {
+        LOGW("setsockopt TCP_NOTSENT_LOWAT 失败 fd=%d: %s", client_fd, strerror(errno));
+        // 非致命错误，继续
+    }
+
+    // 设置SO_KEEPALIVE，检测死连接
+    if (setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag)) == -1) {
+        LOGW("setsockopt SO_KEEPALIVE 失败 fd=%d: %s", client_fd, strerror(errno));
+        // 非致命错误，继续
+    }
+
+    // 添加到epoll
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = client_fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+        LOGE("epoll_ctl ADD 失败: %s", strerror(errno));
+        close(client_fd);
+        return;
+    }
+
+    // 记录连接
+    char ip_str[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_addr.sin_addr, ip_str, sizeof(ip_str));
+
+    Connection& conn = ctx->connections[client_fd];
+    conn = Connection(client_fd);
+    conn.peer_addr = std::string(ip_str) + ":" + std::to_string(ntohs(client_addr.sin_port));
+    conn.last_rx_ms = ctx->now_ms;
+    track_peer_ip(conn, peer_ip);
+    conn.ingress_packets = static_cast<int64_t>(ctx->ingress_packets_per_sec) * INGRESS_UNIT;
+    conn.ingress_bytes = static_cast<int64_t>(ctx->ingress_bytes_per_sec) * INGRESS_UNIT;
+    conn.ingress_refill_ms = ctx->now_ms;
+    if (ctx->register_timeout_ms > 0) {
+        conn.register_timer = schedule_timer(TIMER_REGISTER, client_fd, static_cast<uint64_t>(ctx->register_timeout_ms));
+    }
+    if (ctx->mirror_enabled) {
+        start_mirror(conn, epfd);
+    }
+    if (ctx->capture_fd != -1) {
+        capture_open(conn);
+    }
+
+    LOGI("新连接 fd=%d from %s (当前客户端连接数: %zu/%d)",
+             client_fd, conn.peer_addr.c_str(),
+             client_connection_count(), ctx->max_connections);
+}
+
+// 紧凑帧连接：追加 [varint 长度][标签] 并预留帧体，返回帧体位置
+// reserve_body 为 false 时只写帧头（帧体为随后插入的共享负载）
+uint8_t* append_compact_frame(Connection& conn, uint8_t tag, uint32_t body_len, bool reserve_body = true) {
+    size_t prev_size = conn.send_buf.size();
+    uint8_t header[relay::COMPACT_HEADER_MAX];
+    uint32_t header_len = relay::writeVarint(header, body_len + 1);
+    header[header_len++] = tag;
+    conn.send_buf.resize(prev_size + header_len + (reserve_body ? body_len : 0));
+    std::memcpy(conn.send_buf.data() + prev_size, header, header_len);
+    return conn.send_buf.data() + prev_size + header_len;
+}
+
+// 在发送缓冲区末尾追加帧头并预留帧体，返回帧体位置（下次修改 send_buf 前有效）
+// 紧凑帧连接为 [varint 长度][标签]，其他连接为4字节帧头
+uint8_t* append_frame(Connection& conn, uint8_t type, uint32_t body_len, bool reserve_body = true) {
+    if (conn.compact) {
+        uint8_t tag = type == relay::FRAME_CTRL     ? relay::COMPACT_TAG_CTRL
+                      : type == relay::FRAME_BUNDLE ? relay::COMPACT_TAG_BUNDLE
+                                                    : relay::COMPACT_TAG_DATA;
+        return append_compact_frame(conn, tag, body_len, reserve_body);
+    }
+    size_t prev_size = conn.send_buf.size();
+    conn.send_buf.resize(prev_size + LENGTH_SIZE + (reserve_body ? body_len : 0));
+    relay::writeFrameHeader(conn.send_buf.data() + prev_size, body_len, type);
+    return conn.send_buf.data() + prev_size + LENGTH_SIZE;
+}
+
+// 把一个控制帧追加到发送缓冲区（调用方负责flush）
+void append_ctrl_frame(Connection& conn, const uint8_t* body, uint32_t body_len) {
+    std::memcpy(append_frame(conn, relay::FRAME_CTRL, body_len), body, body_len);
+}
+
+// 追加 CTRL_TRUNK_MARKS，标记数超过 TRUNK_MARKS_MAX 时拆成多个帧
+void append_trunk_marks(Connection& trunk, uint8_t state, const uint64_t* keys, size_t count) {
+    for (size_t i = 0; i < count; i += relay::TRUNK_MARKS_MAX) {
+        uint32_t n = static_cast<uint32_t>(std::min<size_t>(count - i, relay::TRUNK_MARKS_MAX));
+        uint8_t* body = append_frame(trunk, relay::FRAME_CTRL, relay::CTRL_TRUNK_MARKS_FIXED_SIZE + n * MARK_SIZE);
+        body[0] = relay::CTRL_TRUNK_MARKS;
+        body[1] = state;
+        relay::writeU16(body + 2, static_cast<uint16_t>(n));
+        std::memcpy(body + relay::CTRL_TRUNK_MARKS_FIXED_SIZE, keys + i, n * MARK_SIZE);
+    }
+}
+
+// 为紧凑帧连接分配（或查到已有的）短编号；用完时返回0
+uint8_t bind_peer_slot(Connection& conn, uint64_t key, int fd) {
+    auto it = conn.peer_slot_of.find(key);
+    if (it != conn.peer_slot_of.end()) {
+        conn.peer_slots[it->second - 1].fd = fd;
+        return it->second;
+    }
+    if (conn.peer_slots.size() >= relay::COMPACT_MAX_SLOT) {
+        return 0;
+    }
+    conn.peer_slots.push_back({key, fd});
+    uint8_t slot = static_cast<uint8_t>(conn.peer_slots.size());
+    conn.peer_slot_of[key] = slot;
+    return slot;
+}
+
+// 追加 CTRL_PEER_JOIN；紧凑帧连接同时分配短编号
+void append_peer_join(Connection& conn, const uint8_t* mark, int fd) {
+    uint8_t body[relay::CTRL_PEER_JOIN_COMPACT_SIZE];
+    body[0] = relay::CTRL_PEER_JOIN;
+    std::memcpy(body + 1, mark, MARK_SIZE);
+    uint32_t body_len = relay::CTRL_PEER_EVENT_SIZE;
+    if (conn.compact) {
+        body[body_len++] = bind_peer_slot(conn, mark_to_key(mark), fd);
+    }
+    append_ctrl_frame(conn, body, body_len);
+}
+
+// 标记是否在会话的在线通知范围内
+bool watches_presence(const Connection& conn, uint64_t key) {
+    const std::vector<uint64_t>& peers = conn.resume.presence_peers;
+    return std::find(peers.begin(), peers.end(), key) != peers.end();
+}
+
+// 把目标加入会话的队友（在线通知与广播范围）；CAP_PRESENCE 会话在目标在线时立即补发 CTRL_PEER_JOIN
+// （紧凑帧连接同时得到它的短编号），不在线时由调用方回复 NACK，之后上线再通知
+void watch_presence(Connection& conn, const uint8_t* target_mark, uint64_t key, int target_fd, bool online) {
+    std::vector<uint64_t>& peers = conn.resume.presence_peers;
+    if (conn.trunk || key == mark_to_key(conn.mark) || peers.size() >= PRESENCE_PEER_LIMIT ||
+        watches_presence(conn, key)) {
+        return;
+    }
+    peers.push_back(key);
+    if (online && (conn.caps & relay::CAP_PRESENCE)) {
+        append_peer_join(conn, target_mark, target_fd);
+        ctx->stat_presence_events.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// 向关注该标记的其他 CAP_PRESENCE 连接通知标记上线/下线；本节点的事件同时经中继链路告知其他节点，
+// remote 为真时事件来自其他节点 (CTRL_TRUNK_MARKS)，只通知本节点的客户端
+// 只追加到发送缓冲区并关注可写事件，不在这里写socket：调用方可能正在关闭连接或遍历连接表
+void notify_presence(uint8_t op, const uint8_t* mark, int epfd, int joined_fd, bool remote) {
+    uint8_t body[relay::CTRL_PEER_EVENT_SIZE];
+    body[0] = op;
+    std::memcpy(body + 1, mark, MARK_SIZE);
+    uint64_t key = mark_to_key(mark);
+    if (!remote) {
+        uint8_t state = op == relay::CTRL_PEER_JOIN ? relay::TRUNK_MARKS_UP : relay::TRUNK_MARKS_DOWN;
+        for (const auto& [node, trunk_fd] : ctx->trunks) {
+            auto it = ctx->connections.find(trunk_fd);
+            if (it != ctx->connections.end()) {
+                append_trunk_marks(it->second, state, &key, 1);
+                (void)update_epoll_events(epfd, it->second, true);
+            }
+        }
+    }
+    for (auto& pair : ctx->connections) {
+        Connection& conn = pair.second;
+        if (!conn.registered || !(conn.caps & relay::CAP_PRESENCE) || !watches_presence(conn, key)) {
+            continue;
+        }
+        if (op == relay::CTRL_PEER_JOIN) {
+            conn.nack_until.erase(key);
+            append_peer_join(conn, mark, joined_fd);
+        } else {
+            append_ctrl_frame(conn, body, sizeof(body));
+        }
+        (void)update_epoll_events(epfd, conn, true);
+        ctx->stat_presence_events.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// 注册成功后补发在线快照：续传或接管的会话对关注范围内在线（含断线保留中、在其他节点注册）的标记
+// 各发一个 CTRL_PEER_JOIN；新会话的关注范围为空，发送数据后逐个建立（中继不知道哪些标记属于同一局）
+void append_presence_snapshot(Connection& conn) {
+    for (uint64_t key : conn.resume.presence_peers) {
+        uint8_t mark[MARK_SIZE];
+        std::memcpy(mark, &key, MARK_SIZE);
+        auto live_it = ctx->mark_to_fd.find(key);
+        if (live_it != ctx->mark_to_fd.end()) {
+            append_peer_join(conn, mark, live_it->second);
+        } else if (ctx->parked.count(key) || ctx->remote_marks.count(key)) {
+            append_peer_join(conn, mark, -1);
+        }
+    }
+}
+
+// 目标不存在时告知发送方（随本轮读事件末尾一起发送）；同一目标在 nack_interval_ms 内只通知一次
+void append_nack(Connection& conn, uint8_t reason, const uint8_t* target) {
+    uint64_t key = mark_to_key(target);
+    auto it = conn.nack_until.find(key);
+    if (it != conn.nack_until.end() && ctx->now_ms < it->second) {
+        return;
+    }
+    if (it == conn.nack_until.end() && conn.nack_until.size() >= NACK_TRACK_LIMIT) {
+        // 发往大量不同的无效目标：先清理已过期的记录，仍然太多就整体重置（最多多发几次NACK）
+        for (auto i = conn.nack_until.begin(); i != conn.nack_until.end();) {
+            i = ctx->now_ms >= i->second ? conn.nack_until.erase(i) : std::next(i);
+        }
+        if (conn.nack_until.size() >= NACK_TRACK_LIMIT) {
+            conn.nack_until.clear();
+        }
+    }
+    conn.nack_until[key] = ctx->now_ms + static_cast<uint64_t>(ctx->nack_interval_ms);
+
+    uint8_t body[relay::CTRL_NACK_SIZE];
+    body[0] = relay::CTRL_NACK;
+    body[1] = reason;
+    std::memcpy(body + 2, target, MARK_SIZE);
+    append_ctrl_frame(conn, body, sizeof(body));
+    ctx->stat_nacks_sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 发送累计确认（告知客户端中继已收到的数据帧数）
+void append_ack_frame(Connection& conn) {
+    uint8_t body[relay::CTRL_ACK_SIZE];
+    body[0] = relay::CTRL_ACK;
+    relay::writeU64(body + 1, conn.resume.rx_seq);
+    append_ctrl_frame(conn, body, sizeof(body));
+    conn.resume.rx_acked = conn.resume.rx_seq;
+}
+
+// 丢弃已被对端确认的缓存帧（count 为对端累计收到的数据帧数）
+void trim_tx_log(ResumeState& state, uint64_t count) {
+    while (!state.tx_log.empty() && state.tx_base <= count) {
+        state.tx_log_bytes -= state.tx_log.front().size();
+        state.tx_log.pop_front();
+        state.tx_base++;
+    }
+    if (state.tx_log.empty() && state.tx_base <= count) {
+        state.tx_base = count + 1;
+    }
+}
+
+// 把负载追加到续传缓存（source 非空时前面补上来源标记）；超过上限返回false
+bool append_tx_log(ResumeState& state, const uint8_t* source, const uint8_t* payload, uint32_t payload_len) {
+    size_t frame_len = (source ? MARK_SIZE : 0) + payload_len;
+    if (state.tx_log_bytes + frame_len > static_cast<size_t>(ctx->resume_buffer_bytes)) {
+        return false;
+    }
+    state.tx_log.emplace_back();
+    std::vector<uint8_t>& frame = state.tx_log.back();
+    frame.reserve(frame_len);
+    if (source) {
+        frame.assign(source, source + MARK_SIZE);
+    }
+    frame.insert(frame.end(), payload, payload + payload_len);
+    state.tx_log_bytes += frame_len;
+    return true;
+}
+
+// 客户端长期不确认：放弃可恢复性，连接本身继续正常转发
+void overflow_tx_log(Connection& conn) {
+    LOGW("续传缓存超限，会话不再可恢复 fd=%d mark=%s", conn.fd, Logger::format_mark(conn.mark).c_str());
+    ctx->stat_resume_overflow.fetch_add(1, std::memory_order_relaxed);
+    conn.resume.tx_log_overflow = true;
+    conn.resume.tx_log.clear();
+    conn.resume.tx_log_bytes = 0;
+}
+
+// 续传客户端：把发出的负载记入 tx_log 直到被确认
+void log_tx_payload(Connection& conn, const uint8_t* source, const uint8_t* payload, uint32_t payload_len) {
+    if (!(conn.caps & relay::CAP_RESUME) || conn.resume.tx_log_overflow) {
+        return;
+    }
+    if (ctx->tx_capture) {
+        ctx->tx_capture->emplace_back();
+        std::vector<uint8_t>& frame = ctx->tx_capture->back();
+        frame.reserve((source ? MARK_SIZE : 0) + payload_len);
+        if (source) {
+            frame.assign(source, source + MARK_SIZE);
+        }
+        frame.insert(frame.end(), payload, payload + payload_len);
+        return;
+    }
+    if (!append_tx_log(conn.resume, source, payload, payload_len)) {
+        overflow_tx_log(conn);
+    }
+}
+
+// 排队的数据帧发出时补记 tx_log
+void commit_tx_log(Connection& conn, std::vector<std::vector<uint8_t>>& frames) {
+    ResumeState& state = conn.resume;
+    for (auto& frame : frames) {
+        if (state.tx_log_overflow) {
+            return;
+        }
+        if (state.tx_log_bytes + frame.size() > static_cast<size_t>(ctx->resume_buffer_bytes)) {
+            overflow_tx_log(conn);
+            return;
+        }
+        state.tx_log_bytes += frame.size();
+        state.tx_log.push_back(std::move(frame));
+    }
+}
+
+// 紧凑帧连接上来源标记的短编号，没有时返回0
+uint8_t source_slot(const Connection& conn, const uint8_t* source) {
+    if (!source || !conn.compact) {
+        return 0;
+    }
+    auto it = conn.peer_slot_of.find(mark_to_key(source));
+    return it != conn.peer_slot_of.end() ? it->second : 0;
+}
+
+// 追加一个发往客户端的数据帧；续传客户端同时记入 tx_log 直到被确认
+// source 非空（发送方声明了 CAP_SOURCE）时负载前补上来源标记；
+// 紧凑帧连接持有来源的短编号时改用短编号作为标签，不写标记（重放时仍写完整标记）
+void append_data_frame(Connection& conn, const uint8_t* source, const uint8_t* payload, uint32_t payload_len) {
+    uint8_t* body;
+    uint8_t slot = source_slot(conn, source);
+    if (!source) {
+        body = append_frame(conn, relay::FRAME_DATA, payload_len);
+    } else if (slot != 0) {
+        body = append_compact_frame(conn, slot, payload_len);
+    } else {
+        body = append_frame(conn, relay::FRAME_DATA, MARK_SIZE + payload_len);
+        std::memcpy(body, source, MARK_SIZE);
+        body += MARK_SIZE;
+    }
+    if (payload_len > 0) {
+        std::memcpy(body, payload, payload_len);
+    }
+    log_tx_payload(conn, source, payload, payload_len);
+}
+
+// 把发往同一目标的多条负载追加为打包帧，帧体超过上限时拆成多个；
+// 目标未声明 CAP_BUNDLE 或只剩一条时逐条追加普通数据帧
+void append_data_bundle(Connection& conn, const uint8_t* source, const std::vector<BundleRecord>& records) {
+    if (!(conn.caps & relay::CAP_BUNDLE)) {
+        for (const auto& record : records) {
+            append_data_frame(conn, source, record.payload, record.len);
+        }
+        return;
+    }
+
+    uint8_t slot = source_slot(conn, source);
+    uint8_t tag = slot != 0 ? slot : relay::COMPACT_TAG_DATA;
+    uint32_t mark_len = source && slot == 0 ? MARK_SIZE : 0;
+    size_t i = 0;
+    while (i < records.size()) {
+        size_t end = i;
+        uint32_t bundle_len = 0;
+        while (end < records.size()) {
+            uint32_t record_len = 1 + mark_len + records[end].len;
+            uint32_t size = relay::varintSize(record_len) + record_len;
+            if (end > i && bundle_len + size > relay::BUNDLE_MAX_SIZE) {
+                break;
+            }
+            bundle_len += size;
+            end++;
+        }
+        if (end - i == 1) {
+            append_data_frame(conn, source, records[i].payload, records[i].len);
+            i = end;
+            continue;
+        }
+
+        uint8_t* out = append_frame(conn, relay::FRAME_BUNDLE, bundle_len);
+        for (; i < end; i++) {
+            const BundleRecord& record = records[i];
+            out += relay::writeVarint(out, 1 + mark_len + record.len);
+            *out++ = tag;
+            if (mark_len > 0) {
+                std::memcpy(out, source, MARK_SIZE);
+                out += MARK_SIZE;
+            }
+            if (record.len > 0) {
+                std::memcpy(out, record.payload, record.len);
+                out += record.len;
+            }
+            log_tx_payload(conn, source, record.payload, record.len);
+        }
+        ctx->stat_bundles_out.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// 扇出负载：[来源标记][负载]（发送方未声明 CAP_SOURCE 时只有负载），所有目标共享
+using SharedPayload = std::shared_ptr<const std::vector<uint8_t>>;
+
+// 追加一个引用共享负载的数据帧，只写帧头；续传客户端的 tx_log 仍保存各自的副本
+void append_shared_data_frame(Connection& conn, const uint8_t* source, const SharedPayload& shared,
+                                     const uint8_t* payload, uint32_t payload_len) {
+    uint8_t slot = source_slot(conn, source);
+    size_t skip = slot != 0 ? MARK_SIZE : 0;
+    uint32_t body_len = static_cast<uint32_t>(shared->size() - skip);
+    if (slot != 0) {
+        append_compact_frame(conn, slot, body_len, false);
+    } else {
+        append_frame(conn, relay::FRAME_DATA, body_len, false);
+    }
+    conn.send_shared.push_back({conn.send_buf.size(), shared, skip});
+    conn.send_shared_bytes += body_len;
+    log_tx_payload(conn, source, payload, payload_len);
+}
+
+// 数据帧出站：发送队列没有积压时照常追加；否则追加后移入发送方所属的 (类别, 来源) 子队列
+// 用法: begin_egress -> append_* -> end_egress
+struct EgressAppend {
+    bool direct;
+    size_t buf_before;
+    size_t shared_before;
+};
+
+EgressAppend begin_egress(const Connection& target) {
+    EgressAppend e;
+    e.direct = target.egress_flows.empty() && target.send_bytes() < EGRESS_WIRE_BYTES;
+    e.buf_before = target.send_buf.size();
+    e.shared_before = target.send_shared.size();
+    if (!e.direct) {
+        ctx->tx_capture_buf.clear();
+        ctx->tx_capture = &ctx->tx_capture_buf;
+    }
+    return e;
+}
+
+// source 为发送方标记，lane 为发送方声明的类别（中继链路转来的记录由记录头给出）
+void end_egress(Connection& target, const EgressAppend& e, uint64_t source, uint8_t lane, uint32_t count) {
+    if (e.direct) {
+        return;
+    }
+    ctx->tx_capture = nullptr;
+
+    auto flow = std::find_if(target.egress_flows.begin(), target.egress_flows.end(),
+                             [&](const Connection::EgressFlow& f) { return f.source == source && f.lane == lane; });
+    if (flow == target.egress_flows.end()) {
+        target.egress_flows.emplace_back();
+        flow = target.egress_flows.end() - 1;
+        flow->source = source;
+        flow->lane = lane;
+    }
+
+    Connection::EgressFrame frame;
+    frame.len = static_cast<uint32_t>(target.send_buf.size() - e.buf_before);
+    frame.count = count;
+    frame.queued_ms = ctx->now_ms;
+    frame.begin = 0;
+    flow->bytes.insert(flow->bytes.end(), target.send_buf.begin() + e.buf_before, target.send_buf.end());
+    target.send_buf.resize(e.buf_before);
+    target.egress_bytes += frame.len;
+    if (target.send_shared.size() > e.shared_before) {
+        // 共享负载总是帧的最后一部分
+        Connection::SharedSegment& seg = target.send_shared.back();
+        size_t n = seg.data->size() - seg.begin;
+        frame.shared = std::move(seg.data);
+        frame.begin = seg.begin;
+        target.send_shared_bytes -= n;
+        target.egress_bytes += n;
+        target.send_shared.pop_back();
+    }
+    frame.tx_log.swap(ctx->tx_capture_buf);
+    flow->frames.push_back(std::move(frame));
+    ctx->stat_egress_queued.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 从子队列头部取出一帧：send 为真时移入发送队列（并补记 tx_log），否则丢弃
+void pop_egress_frame(Connection& conn, Connection::EgressFlow& flow, bool send) {
+    Connection::EgressFrame& frame = flow.frames.front();
+    size_t shared_len = frame.shared ? frame.shared->size() - frame.begin : 0;
+    if (send) {
+        conn.send_buf.insert(conn.send_buf.end(), flow.bytes.begin() + flow.head,
+                             flow.bytes.begin() + flow.head + frame.len);
+        if (frame.shared) {
+            conn.send_shared.push_back({conn.send_buf.size(), std::move(frame.shared), frame.begin});
+            conn.send_shared_bytes += shared_len;
+        }
+        commit_tx_log(conn, frame.tx_log);
+    } else {
+        conn.deadline_drops += frame.count;
+        ctx->stat_drop_send_eagain.fetch_add(frame.count, std::memory_order_relaxed);
+    }
+    flow.head += frame.len;
+    conn.egress_bytes -= frame.len + shared_len;
+    flow.frames.pop_front();
+    if (flow.frames.empty() || flow.head >= flow.bytes.size() / 2) {
+        flow.bytes.erase(flow.bytes.begin(), flow.bytes.begin() + flow.head);
+        flow.head = 0;
+    }
+}
+
+// 按差额轮询 (DRR) 从子队列补充发送队列，直到发送队列达到 budget；
+// 每个子队列每轮获得 egress_quantum_bytes 配额；不可靠类别排队超过截止时间的数据帧在这里丢弃，可靠类别从不丢弃
+void schedule_egress(Connection& conn, size_t budget) {
+    uint64_t deadline = data_deadline_ms(conn);
+    while (!conn.egress_flows.empty() && conn.send_bytes() < budget) {
+        if (conn.egress_cursor >= conn.egress_flows.size()) {
+            conn.egress_cursor = 0;
+        }
+        Connection::EgressFlow& flow = conn.egress_flows[conn.egress_cursor];
+        while (deadline > 0 && flow.lane == relay::CLASS_UNRELIABLE && !flow.frames.empty() &&
+               flow.frames.front().queued_ms + deadline <= ctx->now_ms) {
+            pop_egress_frame(conn, flow, false);
+        }
+        if (!flow.frames.empty()) {
+            if (!conn.egress_granted) {
+                flow.deficit += ctx->egress_quantum_bytes;
+                conn.egress_granted = true;
+            }
+            const Connection::EgressFrame& head = flow.frames.front();
+            int64_t size = head.len + (head.shared ? static_cast<int64_t>(head.shared->size() - head.begin) : 0);
+            if (size > flow.deficit) {
+                conn.egress_cursor++;
+                conn.egress_granted = false;
+                continue;
+            }
+            flow.deficit -= size;
+            pop_egress_frame(conn, flow, true);
+        }
+        if (flow.frames.empty()) {
+            conn.egress_flows.erase(conn.egress_flows.begin() + conn.egress_cursor);
+            conn.egress_granted = false;
+        }
+    }
+}
+
+// 注册标记（8字节注册包与 CTRL_HELLO 共用）；标记已被在线连接占用时返回false
+bool register_mark(Connection& conn, const uint8_t* mark) {
+    std::memcpy(conn.mark, mark, MARK_SIZE);
+    uint64_t key = mark_to_key(conn.mark);
+
+    // 检查标记是否已存在（扇出的保留标记同样不能注册）
+    if (ctx->mark_to_fd.find(key) != ctx->mark_to_fd.end() || relay::isFanoutMark(relay::readU64(conn.mark))) {
+        LOGW("标记已存在，拒绝注册 fd=%d mark=%s", conn.fd, Logger::format_mark(conn.mark).c_str());
+        return false;
+    }
+
+    conn.registered = true;
+    ctx->mark_to_fd[key] = conn.fd;
+    conn.slot = alloc_slot(conn.fd);
+    cancel_timer(conn.register_timer);
+    return true;
+}
+
+uint64_t idle_timeout_ms(const Connection& conn) {
+    return static_cast<uint64_t>((conn.caps & relay::CAP_HEARTBEAT) ? ctx->idle_timeout_ms : ctx->legacy_idle_timeout_ms);
+}
+
+// 注册完成（或热重启接管）后启动空闲超时与心跳定时器
+void start_session_timers(Connection& conn) {
+    cancel_timer(conn.idle_timer);
+    cancel_timer(conn.ping_timer);
+    // 空闲超时为0时也保留一个低频检查，运行时调大后对已有连接同样生效
+    uint64_t idle = idle_timeout_ms(conn);
+    conn.idle_timer = schedule_timer(TIMER_IDLE, conn.fd, idle > 0 ? idle : HOUSEKEEPING_INTERVAL_MS);
+    if (conn.caps & relay::CAP_HEARTBEAT) {
+        conn.ping_timer = schedule_timer(TIMER_PING, conn.fd, static_cast<uint64_t>(ctx->ping_interval_ms));
+    }
+}
+
+// 追加 CTRL_HELLO_ACK；失败状态的应答令牌、帧数与槽位均为0
+void append_hello_ack(Connection& conn, uint8_t status, uint32_t caps) {
+    bool failed = relay::helloFailed(status);
+    uint8_t ack[relay::HELLO_ACK_SIZE];
+    ack[0] = relay::CTRL_HELLO_ACK;
+    ack[1] = status;
+    relay::writeU64(ack + 2, failed ? 0 : conn.resume.token);
+    relay::writeU64(ack + 10, failed ? 0 : conn.resume.rx_seq);
+    relay::writeU32(ack + 18, failed ? 0 : caps);
+    ack[22] = relay::PROTOCOL_VERSION;
+    relay::writeU32(ack + 23, failed ? 0 : conn.slot);
+    relay::writeU32(ack + 27, SERVER_CAPS);
+    append_ctrl_frame(conn, ack, sizeof(ack));
+}
+
+// ----------------------------------------------------------------------------
+// 负载感知的会话放置 (CAP_REDIRECT)
+//
+// 节点负载为 连接数/连接上限、出站带宽/load_egress_bytes_per_sec、事件循环延迟/load_lag_ms 三项
+// 折算为千分比后的最大值；后两项在 TIMER_LOAD 中采样，连接数随时取当前值。
+// ----------------------------------------------------------------------------
+
+uint32_t load_permille(uint64_t connections, uint64_t capacity, uint32_t egress, uint32_t lag) {
+    uint64_t conn_load = capacity > 0 ? connections * 1000 / capacity : 1000;
+    return static_cast<uint32_t>(std::max<uint64_t>(conn_load, std::max(egress, lag)));
+}
+
+uint32_t local_load_permille() {
+    return load_permille(client_connection_count(), static_cast<uint64_t>(ctx->max_connections), ctx->load_egress_permille,
+                         ctx->load_lag_permille);
+}
+
+void sample_load() {
+    // 定时器在本轮事件全部处理完后才执行，晚于到期时间的部分即事件循环的排队延迟（不足一个tick的不计）
+    uint64_t due_us = ctx->load_due_ms * 1000 + TIMER_TICK_MS * 1000;
+    uint64_t now_us = ctx->clock ? ctx->now_ms * 1000 : precise_now_us();
+    uint64_t late_us = now_us > due_us ? now_us - due_us : 0;
+    ctx->loop_lag_us = (ctx->loop_lag_us * 3 + late_us) / 4;
+    ctx->load_lag_permille = ctx->load_lag_ms > 0 ? static_cast<uint32_t>(std::min<uint64_t>(
+                                                  ctx->loop_lag_us / static_cast<uint64_t>(ctx->load_lag_ms), UINT16_MAX))
+                                            : 0;
+
+    uint64_t bytes_out = ctx->stat_bytes_out.load(std::memory_order_relaxed);
+    ctx->load_egress_permille = 0;
+    if (ctx->load_egress_bytes_per_sec > 0 && ctx->now_ms > ctx->load_sampled_ms) {
+        uint64_t rate = (bytes_out - ctx->load_bytes_out) * 1000 / (ctx->now_ms - ctx->load_sampled_ms);
+        ctx->load_egress_permille = static_cast<uint32_t>(
+            std::min<uint64_t>(rate * 1000 / static_cast<uint64_t>(ctx->load_egress_bytes_per_sec), UINT16_MAX));
+    }
+    ctx->load_bytes_out = bytes_out;
+    ctx->load_sampled_ms = ctx->now_ms;
+}
+
+void append_trunk_load(Connection& trunk) {
+    uint8_t body[relay::CTRL_TRUNK_LOAD_SIZE];
+    body[0] = relay::CTRL_TRUNK_LOAD;
+    relay::writeU32(body + 1, static_cast<uint32_t>(client_connection_count()));
+    relay::writeU32(body + 5, static_cast<uint32_t>(ctx->max_connections));
+    relay::writeU16(body + 9, static_cast<uint16_t>(std::min<uint32_t>(ctx->load_egress_permille, UINT16_MAX)));
+    relay::writeU16(body + 11, static_cast<uint16_t>(std::min<uint32_t>(ctx->load_lag_permille, UINT16_MAX)));
+    append_ctrl_frame(trunk, body, sizeof(body));
+}
+
+// 为声明 CAP_REDIRECT 的新注册选择节点：标记已在其他节点上线时改连该节点（在线连接与续传状态都在那里）；
+// 否则本节点负载达到 redirect_load_permille 时，选加上这个连接后负载最低的节点，
+// 且须比留在本节点低 redirect_margin_permille，避免负载相近的节点之间来回重定向
+TrunkPeer* choose_redirect(uint64_t key, bool& hosted) {
+    auto remote = ctx->remote_marks.find(key);
+    hosted = remote != ctx->remote_marks.end();
+    if (hosted) {
+        for (auto& peer : ctx->trunk_peers) {
+            if (peer.node == remote->second) {
+                return &peer;
+            }
+        }
+        return nullptr;
+    }
+    uint32_t local = local_load_permille();
+    if (ctx->redirect_load_permille == 0 || local < static_cast<uint32_t>(ctx->redirect_load_permille)) {
+        return nullptr;
+    }
+    TrunkPeer* best = nullptr;
+    uint32_t best_load = UINT32_MAX;
+    for (auto& peer : ctx->trunk_peers) {
+        if (!peer.load_known || !ctx->trunks.count(peer.node)) {
+            continue;
+        }
+        uint32_t load = load_permille(peer.load_connections + 1, peer.load_capacity, peer.load_egress, peer.load_lag);
+        if (load < best_load) {
+            best = &peer;
+            best_load = load;
+        }
+    }
+    if (best == nullptr || best_load + static_cast<uint32_t>(ctx->redirect_margin_permille) > local) {
+        return nullptr;
+    }
+    // 下次通告之前的注册按已放到该节点估算，一批注册不会全部涌向同一个节点
+    best->load_connections++;
+    return best;
+}
+
+// 以 CTRL_REDIRECT 代替 HELLO_ACK 回复目标节点的地址，由调用方关闭连接
+bool redirect_hello(Connection& conn, const uint8_t* mark, const TrunkPeer& peer, bool hosted) {
+    uint8_t body[relay::CTRL_REDIRECT_SIZE];
+    body[0] = relay::CTRL_REDIRECT;
+    relay::writeU16(body + 1, peer.node);
+    std::memcpy(body + 3, &peer.sockaddr.sin_addr.s_addr, 4);
+    relay::writeU16(body + 7, ntohs(peer.sockaddr.sin_port));
+    append_ctrl_frame(conn, body, sizeof(body));
+    ctx->stat_redirects.fetch_add(1, std::memory_order_relaxed);
+    LOGI("重定向注册 fd=%d mark=%s -> node=%u addr=%s（%s）", conn.fd, Logger::format_mark(mark).c_str(), peer.node,
+         peer.addr.c_str(), hosted ? "标记在该节点上线" : "本节点负载较高");
+    return false;
+}
+
+// HELLO 被拒绝：回复失败原因，由调用方关闭连接
+bool reject_hello(Connection& conn, uint8_t status) {
+    ctx->stat_hello_rejected.fetch_add(1, std::memory_order_relaxed);
+    append_hello_ack(conn, status, 0);
+    return false;
+}
+
+// 处理 CTRL_HELLO：扩展注册，可携带 TLV_RESUME 恢复保留的会话或接管仍在线的旧连接
+bool handle_hello(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    int fd = conn.fd;
+    if (conn.registered || conn.tap) {
+        LOGE("重复注册 fd=%d", fd);
+        return reject_hello(conn, relay::HELLO_ERR_BAD_REQUEST);
+    }
+    if (data_len < relay::HELLO_FIXED_SIZE) {
+        LOGE("HELLO格式错误 fd=%d size=%u", fd, data_len);
+        return reject_hello(conn, relay::HELLO_ERR_BAD_REQUEST);
+    }
+    if (data[1] < relay::PROTOCOL_VERSION) {
+        LOGE("HELLO协议版本不受支持 fd=%d version=%u", fd, data[1]);
+        return reject_hello(conn, relay::HELLO_ERR_VERSION);
+    }
+
+    uint32_t caps = relay::readU32(data + 2) & SERVER_CAPS;
+    if (ctx->resume_grace_ms == 0) {
+        caps &= ~relay::CAP_RESUME;
+    }
+    if (!(caps & relay::CAP_PRESENCE)) {
+        caps &= ~relay::CAP_COMPACT;   // 短编号通过在线通知下发
+    }
+    const uint8_t* mark = data + 6;
+
+    // 解析TLV，未知类型跳过
+    bool has_token = false;
+    uint64_t session_token = 0;
+    uint64_t client_rx = 0;
+    uint32_t pos = relay::HELLO_FIXED_SIZE;
+    while (pos + relay::TLV_HEADER_SIZE <= data_len) {
+        uint8_t type = data[pos];
+        uint16_t len = relay::readU16(data + pos + 1);
+        pos += relay::TLV_HEADER_SIZE;
+        if (pos + len > data_len) {
+            LOGE("HELLO TLV越界 fd=%d", fd);
+            return reject_hello(conn, relay::HELLO_ERR_BAD_REQUEST);
+        }
+        if (type == relay::TLV_RESUME && len == relay::TLV_RESUME_SIZE) {
+            session_token = relay::readU64(data + pos);
+            has_token = session_token != 0;
+            client_rx = relay::readU64(data + pos + 8);
+        } else if (type == relay::TLV_DEADLINE && len == relay::TLV_DEADLINE_SIZE) {
+            conn.deadline_ms = relay::readU32(data + pos);
+        }
+        pos += len;
+    }
+
+    // 集群：不在本节点的标记可能被重定向到其他节点
+    uint64_t key = mark_to_key(mark);
+    if ((caps & relay::CAP_REDIRECT) && ctx->node_id != 0 && !ctx->mark_to_fd.count(key) && !ctx->parked.count(key)) {
+        bool hosted = false;
+        const TrunkPeer* target = choose_redirect(key, hosted);
+        if (target != nullptr) {
+            return redirect_hello(conn, mark, *target, hosted);
+        }
+    }
+
+    if (client_registration_full(key)) {
+        LOGW("客户端数已满，拒绝注册 fd=%d mark=%s", fd, Logger::format_mark(mark).c_str());
+        return reject_hello(conn, relay::HELLO_ERR_FULL);
+    }
+
+    // 之前的会话：断线保留的会话，或仍占用标记的在线连接
+    // 在线连接可能只是网络已断、尚未被keepalive回收；出示同一令牌即可立即接管
+    ResumeState prior;
+    bool has_prior = false;
+    bool was_present = false;   // 接管或续传：标记一直在线，不广播上线
+    auto live_it = ctx->mark_to_fd.find(key);
+    if (live_it != ctx->mark_to_fd.end()) {
+        auto stale_it = ctx->connections.find(live_it->second);
+        if (!has_token || stale_it == ctx->connections.end() || !stale_it->second.hello ||
+            stale_it->second.resume.token != session_token) {
+            LOGW("标记已存在且令牌不匹配，拒绝注册 fd=%d mark=%s", fd, Logger::format_mark(mark).c_str());
+            return reject_hello(conn, relay::HELLO_ERR_MARK_IN_USE);
+        }
+        Connection& stale = stale_it->second;
+        int stale_fd = stale.fd;
+        was_present = true;
+        schedule_egress(stale, SIZE_MAX);
+        prior = std::move(stale.resume);
+        has_prior = (stale.caps & relay::CAP_RESUME) && !prior.tx_log_overflow;
+        ctx->mark_to_fd.erase(live_it);
+        stale.registered = false;
+        close_connection(stale_fd, epfd, false);
+        ctx->stat_sessions_taken_over.fetch_add(1, std::memory_order_relaxed);
+        LOGI("令牌匹配，接管标记 fd=%d stale_fd=%d mark=%s", fd, stale_fd, Logger::format_mark(mark).c_str());
+    } else {
+        auto parked_it = ctx->parked.find(key);
+        if (parked_it != ctx->parked.end()) {
+            prior = std::move(parked_it->second.state);
+            has_prior = true;
+            was_present = true;
+            ctx->parked.erase(parked_it);
+        }
+    }
+
+    if (!register_mark(conn, mark)) {
+        return reject_hello(conn, relay::HELLO_ERR_MARK_IN_USE);
+    }
+    conn.hello = true;
+    conn.caps = caps;
+    start_session_timers(conn);
+
+    uint8_t status = relay::HELLO_OK;
+    if (has_prior) {
+        // 客户端声称收到的帧数必须落在中继仍缓存的范围内，否则无法无损恢复
+        bool resumable = has_token && (caps & relay::CAP_RESUME) && session_token == prior.token &&
+                         client_rx + 1 >= prior.tx_base && client_rx < prior.tx_next();
+        if (resumable) {
+            conn.resume = std::move(prior);
+            trim_tx_log(conn.resume, client_rx);
+            status = relay::HELLO_RESUMED;
+            ctx->stat_sessions_resumed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            LOGW("之前的会话无法恢复，丢弃 fd=%d mark=%s", fd, Logger::format_mark(conn.mark).c_str());
+        }
+    }
+    if (status == relay::HELLO_OK) {
+        conn.resume = ResumeState();
+        conn.resume.token = generate_token();
+    }
+
+    append_hello_ack(conn, status, caps);
+    conn.resume.rx_acked = conn.resume.rx_seq;
+    // HELLO_ACK 本身仍是v1帧，之后双向切换为紧凑帧
+    conn.compact = (caps & relay::CAP_COMPACT) != 0;
+    if (caps & relay::CAP_PRESENCE) {
+        append_presence_snapshot(conn);
+    }
+    if (!was_present) {
+        notify_presence(relay::CTRL_PEER_JOIN, conn.mark, epfd, fd);
+    }
+
+    if (status == relay::HELLO_RESUMED) {
+        // 重放客户端尚未收到的数据帧（仍保留在 tx_log 中直到被确认）
+        for (const auto& frame : conn.resume.tx_log) {
+            uint8_t* body = append_frame(conn, relay::FRAME_DATA, static_cast<uint32_t>(frame.size()));
+            if (!frame.empty()) {
+                std::memcpy(body, frame.data(), frame.size());
+            }
+        }
+        LOGI("会话恢复 fd=%d mark=%s replay=%zu relay_rx=%llu", fd, Logger::format_mark(conn.mark).c_str(),
+             conn.resume.tx_log.size(), static_cast<unsigned long long>(conn.resume.rx_seq));
+    } else {
+        LOGI("注册成功 fd=%d mark=%s caps=0x%x slot=%u", fd, Logger::format_mark(conn.mark).c_str(), caps, conn.slot);
+    }
+    return true;
+}
+
+// 处理控制帧
+// 返回值: true=继续处理, false=需要关闭连接
+// 处理 CTRL_TAP：出示观察密钥后注册为只读的观察连接，只订阅所列标记，不占用标记与槽位，不接收在线通知
+bool handle_tap(Connection& conn, const uint8_t* data, uint32_t data_len) {
+    int fd = conn.fd;
+    if (conn.registered || conn.tap) {
+        LOGE("重复注册 fd=%d", fd);
+        return reject_hello(conn, relay::HELLO_ERR_BAD_REQUEST);
+    }
+    uint8_t count = data_len >= relay::CTRL_TAP_FIXED_SIZE ? data[10] : 0;
+    if (count == 0 || count > relay::TAP_MAX_MARKS || data_len != relay::CTRL_TAP_FIXED_SIZE + count * MARK_SIZE) {
+        LOGE("TAP格式错误 fd=%d size=%u", fd, data_len);
+        return reject_hello(conn, relay::HELLO_ERR_BAD_REQUEST);
+    }
+    if (data[1] < relay::PROTOCOL_VERSION) {
+        LOGE("TAP协议版本不受支持 fd=%d version=%u", fd, data[1]);
+        return reject_hello(conn, relay::HELLO_ERR_VERSION);
+    }
+    if (!ctx->tap_key_set || relay::readU64(data + 2) != ctx->tap_key) {
+        LOGW("TAP未获授权 fd=%d%s", fd, ctx->tap_key_set ? "" : " (未配置 -k)");
+        return reject_hello(conn, relay::HELLO_ERR_DENIED);
+    }
+
+    conn.tap = true;
+    conn.hello = true;
+    for (uint32_t i = 0; i < count; i++) {
+        conn.tap_marks.push_back(mark_to_key(data + relay::CTRL_TAP_FIXED_SIZE + i * MARK_SIZE));
+    }
+    ctx->taps.push_back(fd);
+    // 观察连接不发送数据，不设空闲超时；卡住时只会丢弃镜像帧
+    cancel_timer(conn.register_timer);
+    append_hello_ack(conn, relay::HELLO_OK, 0);
+    LOGI("观察连接注册 fd=%d marks=%zu", fd, conn.tap_marks.size());
+    return true;
+}
+
+const TrunkPeer* find_trunk_peer(uint16_t node) {
+    for (const auto& peer : ctx->trunk_peers) {
+        if (peer.node == node) {
+            return &peer;
+        }
+    }
+    return nullptr;
+}
+
+// 对方节点的标记全部下线（链路断开或被替换）
+void drop_remote_marks(uint16_t node, int epfd) {
+    for (auto it = ctx->remote_marks.begin(); it != ctx->remote_marks.end();) {
+        if (it->second != node) {
+            ++it;
+            continue;
+        }
+        uint8_t mark[MARK_SIZE];
+        std::memcpy(mark, &it->first, MARK_SIZE);
+        bool local = ctx->mark_to_fd.count(it->first) || ctx->parked.count(it->first);
+        it = ctx->remote_marks.erase(it);
+        if (!local) {
+            notify_presence(relay::CTRL_PEER_LEAVE, mark, epfd, -1, true);
+        }
+    }
+}
+
+// CTRL_TRUNK：接受方校验节点编号后回复自己的 CTRL_TRUNK，发起方收到回复即完成握手，
+// 之后双方各发一次本节点标记的快照。两个节点之间同时有两条链路时只保留编号较小的节点发起的那条
+bool handle_trunk(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    int fd = conn.fd;
+    if (conn.registered || conn.tap || conn.trunk_up || data_len < relay::CTRL_TRUNK_SIZE) {
+        LOGE("中继链路握手格式错误 fd=%d size=%u", fd, data_len);
+        return false;
+    }
+    uint16_t node = relay::readU16(data + 2);
+    if (ctx->node_id == 0 || data[1] < relay::PROTOCOL_VERSION || !find_trunk_peer(node) ||
+        (conn.trunk_dialed && node != conn.trunk_node)) {
+        LOGE("拒绝中继链路 fd=%d node=%u version=%u（未配置的节点或编号不符）", fd, node, data[1]);
+        return false;
+    }
+
+    auto existing = ctx->trunks.find(node);
+    if (existing != ctx->trunks.end()) {
+        uint16_t preferred = std::min(ctx->node_id, node);
+        uint16_t initiator = conn.trunk_dialed ? ctx->node_id : node;
+        auto old = ctx->connections.find(existing->second);
+        bool old_preferred = old != ctx->connections.end() && (old->second.trunk_dialed ? ctx->node_id : node) == preferred;
+        if (initiator != preferred && old_preferred) {
+            LOGI("节点间已有中继链路，关闭重复链路 fd=%d node=%u", fd, node);
+            return false;
+        }
+        LOGI("替换节点间已有的中继链路 old_fd=%d new_fd=%d node=%u", existing->second, fd, node);
+        close_connection(existing->second, epfd, false);
+    }
+
+    if (!conn.trunk_dialed) {
+        uint8_t reply[relay::CTRL_TRUNK_SIZE] = {relay::CTRL_TRUNK, relay::PROTOCOL_VERSION};
+        relay::writeU16(reply + 2, ctx->node_id);
+        append_ctrl_frame(conn, reply, sizeof(reply));
+        ctx->trunk_connections++;   // 接入的链路握手前按客户端连接计数
+    }
+    conn.trunk = true;
+    conn.trunk_up = true;
+    conn.trunk_node = node;
+    cancel_timer(conn.register_timer);
+    release_mirror(conn, epfd);   // 节点之间的链路不镜像
+    ctx->trunks[node] = fd;
+
+    std::vector<uint64_t> keys;
+    keys.reserve(ctx->mark_to_fd.size() + ctx->parked.size());
+    for (const auto& pair : ctx->mark_to_fd) {
+        keys.push_back(pair.first);
+    }
+    for (const auto& pair : ctx->parked) {
+        keys.push_back(pair.first);
+    }
+    append_trunk_marks(conn, relay::TRUNK_MARKS_UP, keys.data(), keys.size());
+    append_trunk_load(conn);
+    LOGI("集群中继链路已建立 fd=%d node=%u addr=%s %s marks=%zu", fd, node, conn.peer_addr.c_str(),
+         conn.trunk_dialed ? "outbound" : "inbound", keys.size());
+    return true;
+}
+
+// CTRL_TRUNK_MARKS：更新标记目录，目录变化时通知本节点的在线通知客户端
+// 同一标记出现在多个节点时以最后的通告为准；本节点注册的标记总是优先
+bool handle_trunk_marks(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    if (!conn.trunk_up || data_len < relay::CTRL_TRUNK_MARKS_FIXED_SIZE || data[1] > relay::TRUNK_MARKS_UP ||
+        data_len != relay::CTRL_TRUNK_MARKS_FIXED_SIZE + relay::readU16(data + 2) * MARK_SIZE) {
+        LOGE("TRUNK_MARKS格式错误 fd=%d size=%u", conn.fd, data_len);
+        return false;
+    }
+    uint16_t node = conn.trunk_node;
+    uint32_t count = relay::readU16(data + 2);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* mark = data + relay::CTRL_TRUNK_MARKS_FIXED_SIZE + i * MARK_SIZE;
+        uint64_t key = mark_to_key(mark);
+        bool local = ctx->mark_to_fd.count(key) || ctx->parked.count(key);
+        if (data[1] == relay::TRUNK_MARKS_UP) {
+            auto [it, inserted] = ctx->remote_marks.emplace(key, node);
+            it->second = node;
+            if (inserted && !local) {
+                notify_presence(relay::CTRL_PEER_JOIN, mark, epfd, -1, true);
+            }
+        } else {
+            auto it = ctx->remote_marks.find(key);
+            if (it != ctx->remote_marks.end() && it->second == node) {
+                ctx->remote_marks.erase(it);
+                if (!local) {
+                    notify_presence(relay::CTRL_PEER_LEAVE, mark, epfd, -1, true);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// CTRL_TRUNK_LOAD：记录对方节点的负载，供重定向选择目标
+bool handle_trunk_load(Connection& conn, const uint8_t* data, uint32_t data_len) {
+    if (!conn.trunk_up || data_len < relay::CTRL_TRUNK_LOAD_SIZE) {
+        LOGE("TRUNK_LOAD格式错误 fd=%d size=%u", conn.fd, data_len);
+        return false;
+    }
+    for (auto& peer : ctx->trunk_peers) {
+        if (peer.node == conn.trunk_node) {
+            peer.load_known = true;
+            peer.load_connections = relay::readU32(data + 1);
+            peer.load_capacity = relay::readU32(data + 5);
+            peer.load_egress = relay::readU16(data + 9);
+            peer.load_lag = relay::readU16(data + 11);
+        }
+    }
+    return true;
+}
+
+// 采样本节点负载并通告给所有已建立的中继链路
+void report_load(int epfd) {
+    sample_load();
+    std::vector<int> fds;
+    fds.reserve(ctx->trunks.size());
+    for (const auto& pair : ctx->trunks) {
+        fds.push_back(pair.second);
+    }
+    for (int fd : fds) {
+        auto it = ctx->connections.find(fd);
+        if (it != ctx->connections.end()) {
+            append_trunk_load(it->second);
+            flush_send_buffer(it->second, epfd);   // 可能关闭连接
+        }
+    }
+}
+
+// 向 -j 配置的节点发起中继链路：非阻塞连接，CTRL_TRUNK 先放入发送队列，连接建立后随可写事件发出
+void dial_trunk(size_t index, int epfd) {
+    TrunkPeer& peer = ctx->trunk_peers[index];
+    if (peer.fd != -1 || ctx->trunks.count(peer.node)) {
+        return;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || !set_nonblocking(fd) ||
+        (connect(fd, reinterpret_cast<const sockaddr*>(&peer.sockaddr), sizeof(peer.sockaddr)) == -1 &&
+         errno != EINPROGRESS)) {
+        LOGW("连接集群节点失败 node=%u addr=%s: %s", peer.node, peer.addr.c_str(), strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        peer.retry_timer = schedule_timer(TIMER_TRUNK, static_cast<int>(index), static_cast<uint64_t>(ctx->trunk_retry_ms));
+        return;
+    }
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &flag, sizeof(flag));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        LOGE("epoll_ctl ADD 失败: %s", strerror(errno));
+        close(fd);
+        peer.retry_timer = schedule_timer(TIMER_TRUNK, static_cast<int>(index), static_cast<uint64_t>(ctx->trunk_retry_ms));
+        return;
+    }
+
+    Connection& conn = ctx->connections[fd];
+    conn = Connection(fd);
+    conn.peer_addr = peer.addr;
+    conn.last_rx_ms = ctx->now_ms;
+    conn.trunk = true;
+    conn.trunk_dialed = true;
+    ctx->trunk_connections++;
+    conn.trunk_node = peer.node;
+    if (ctx->register_timeout_ms > 0) {
+        conn.register_timer = schedule_timer(TIMER_REGISTER, fd, static_cast<uint64_t>(ctx->register_timeout_ms));
+    }
+    uint8_t hello[relay::CTRL_TRUNK_SIZE] = {relay::CTRL_TRUNK, relay::PROTOCOL_VERSION};
+    relay::writeU16(hello + 2, ctx->node_id);
+    append_ctrl_frame(conn, hello, sizeof(hello));
+    peer.fd = fd;
+    LOGI("连接集群节点 fd=%d node=%u addr=%s", fd, peer.node, peer.addr.c_str());
+}
+
+// 中继链路关闭：对方节点的标记全部下线；与该节点之间没有其他链路时按 trunk_retry_ms 重连
+void trunk_link_down(Connection& conn, int epfd) {
+    LOGI("集群中继链路断开 fd=%d node=%u records=%llu", conn.fd, conn.trunk_node,
+         static_cast<unsigned long long>(conn.trunk_records));
+    auto it = ctx->trunks.find(conn.trunk_node);
+    if (conn.trunk_up && it != ctx->trunks.end() && it->second == conn.fd) {
+        ctx->trunks.erase(it);
+        drop_remote_marks(conn.trunk_node, epfd);
+    }
+    for (size_t i = 0; i < ctx->trunk_peers.size(); i++) {
+        TrunkPeer& peer = ctx->trunk_peers[i];
+        if (peer.fd == conn.fd) {
+            peer.fd = -1;
+        }
+        if (peer.node == conn.trunk_node && !ctx->trunks.count(peer.node)) {
+            peer.load_known = false;
+        }
+        if (peer.node == conn.trunk_node && peer.fd == -1 && ctx->running && !ctx->trunks.count(peer.node) &&
+            peer.retry_timer == TimerWheel::INVALID_TIMER) {
+            peer.retry_timer = schedule_timer(TIMER_TRUNK, static_cast<int>(i), static_cast<uint64_t>(ctx->trunk_retry_ms));
+        }
+    }
+}
+
+bool process_control(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    // 中继链路只接受集群控制帧
+    if (conn.trunk && data[0] != relay::CTRL_TRUNK && data[0] != relay::CTRL_TRUNK_MARKS &&
+        data[0] != relay::CTRL_TRUNK_LOAD) {
+        LOGE("中继链路上的非法控制帧 fd=%d op=%u", conn.fd, data[0]);
+        return false;
+    }
+    switch (data[0]) {
+    case relay::CTRL_TRUNK:
+        return handle_trunk(conn, data, data_len, epfd);
+    case relay::CTRL_TRUNK_MARKS:
+        return handle_trunk_marks(conn, data, data_len, epfd);
+    case relay::CTRL_TRUNK_LOAD:
+        return handle_trunk_load(conn, data, data_len);
+    case relay::CTRL_HELLO:
+        return handle_hello(conn, data, data_len, epfd);
+    case relay::CTRL_TAP:
+        return handle_tap(conn, data, data_len);
+    case relay::CTRL_ACK:
+        if (data_len < relay::CTRL_ACK_SIZE) {
+            LOGE("ACK格式错误 fd=%d size=%u", conn.fd, data_len);
+            return false;
+        }
+        if (conn.caps & relay::CAP_RESUME) {
+            trim_tx_log(conn.resume, relay::readU64(data + 1));
+        }
+        return true;
+    case relay::CTRL_PING: {
+        // 客户端发起的心跳：原样带回时间戳（随本轮读事件末尾一起发送）
+        if (data_len < relay::CTRL_PING_SIZE) {
+            LOGE("PING格式错误 fd=%d size=%u", conn.fd, data_len);
+            return false;
+        }
+        uint8_t pong[relay::CTRL_PING_SIZE];
+        pong[0] = relay::CTRL_PONG;
+        std::memcpy(pong + 1, data + 1, 8);
+        append_ctrl_frame(conn, pong, sizeof(pong));
+        return true;
+    }
+    case relay::CTRL_CLASS:
+        if (data_len < relay::CTRL_CLASS_SIZE || data[1] >= relay::CLASS_COUNT) {
+            LOGE("CLASS格式错误 fd=%d size=%u", conn.fd, data_len);
+            return false;
+        }
+        if ((conn.caps & relay::CAP_LANES) && conn.rx_class != data[1]) {
+            conn.rx_class = data[1];
+            ctx->stat_class_switches.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    case relay::CTRL_PONG: {
+        if (data_len < relay::CTRL_PING_SIZE) {
+            LOGE("PONG格式错误 fd=%d size=%u", conn.fd, data_len);
+            return false;
+        }
+        uint64_t sent_us = relay::readU64(data + 1);
+        uint64_t now_us = precise_now_us();
+        if (sent_us <= now_us) {
+            conn.rtt_us = now_us - sent_us;
+            conn.srtt_us = conn.srtt_us == 0 ? conn.rtt_us : (conn.srtt_us * 7 + conn.rtt_us) / 8;
+        }
+        return true;
+    }
+    default:
+        // 未知操作码：忽略，便于以后扩展
+        LOGD("忽略未知控制帧 fd=%d op=%u", conn.fd, data[0]);
+        return true;
+    }
+}
+
+// FRAME_TRUNK：把本链路本轮的记录封为一个帧追加到发送队列
+void seal_trunk_batch(Connection& trunk) {
+    if (trunk.trunk_batch.empty()) {
+        return;
+    }
+    uint8_t* body = append_frame(trunk, relay::FRAME_TRUNK, static_cast<uint32_t>(trunk.trunk_batch.size()));
+    std::memcpy(body, trunk.trunk_batch.data(), trunk.trunk_batch.size());
+    trunk.trunk_batch.clear();
+    ctx->stat_trunk_frames_out.fetch_add(1, std::memory_order_relaxed);
+}
+
+// 发往其他节点标记的负载：追加为中继链路的一条记录，本轮事件处理完后由 flush_dirty_trunks 成帧发出，
+// 同一轮内各会话发往该节点的负载共用帧头与一次写系统调用。链路排队超过 trunk_queue_bytes 时丢弃
+void forward_to_trunk(uint16_t node, const Connection& sender, const uint8_t* source,
+                             const uint8_t* target_mark, const uint8_t* payload, uint32_t payload_len) {
+    auto trunk_it = ctx->trunks.find(node);
+    auto it = trunk_it != ctx->trunks.end() ? ctx->connections.find(trunk_it->second) : ctx->connections.end();
+    uint32_t record_len = relay::TRUNK_RECORD_HEADER_SIZE + payload_len;
+    uint32_t size = relay::varintSize(record_len) + record_len;
+    if (it == ctx->connections.end() ||
+        it->second.send_bytes() + it->second.trunk_batch.size() + size > static_cast<size_t>(ctx->trunk_queue_bytes)) {
+        ctx->stat_trunk_drops.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Connection& trunk = it->second;
+    if (trunk.trunk_batch.size() + size > TRUNK_FRAME_MAX) {
+        seal_trunk_batch(trunk);
+    }
+    size_t pos = trunk.trunk_batch.size();
+    trunk.trunk_batch.resize(pos + size);
+    uint8_t* out = trunk.trunk_batch.data() + pos;
+    out += relay::writeVarint(out, record_len);
+    *out++ = static_cast<uint8_t>((source ? relay::TRUNK_FLAG_SOURCE : 0) |
+                                  (sender.rx_class << relay::TRUNK_FLAG_CLASS_SHIFT));
+    std::memcpy(out, sender.mark, MARK_SIZE);
+    std::memcpy(out + MARK_SIZE, target_mark, MARK_SIZE);
+    if (payload_len > 0) {
+        std::memcpy(out + 2 * MARK_SIZE, payload, payload_len);
+    }
+    trunk.trunk_records++;
+    ctx->stat_trunk_records_out.fetch_add(1, std::memory_order_relaxed);
+    if (!trunk.trunk_dirty) {
+        trunk.trunk_dirty = true;
+        ctx->dirty_trunks.push_back(trunk.fd);
+    }
+}
+
+// 每轮事件与定时器处理完后，每条有新记录的中继链路成帧并 flush 一次
+void flush_dirty_trunks(int epfd) {
+    for (int fd : ctx->dirty_trunks) {
+        auto it = ctx->connections.find(fd);
+        if (it != ctx->connections.end() && it->second.trunk_dirty) {
+            it->second.trunk_dirty = false;
+            seal_trunk_batch(it->second);
+            flush_send_buffer(it->second, epfd);
+        }
+    }
+    ctx->dirty_trunks.clear();
+}
+
+// 查找负载的目标连接；fd_hint 为上次转发到的连接，校验标记一致后直接使用，省去按标记查找
+// 目标处于断线保留期时缓存负载（deliver 为真时），目标在其他节点时经中继链路转发（中继链路转来的负载
+// 不再转发），目标不存在时按需回复 NACK，这些情况都返回 nullptr
+Connection* resolve_target(Connection& conn, const uint8_t* target_mark, int& fd_hint, const uint8_t* source,
+                                  const uint8_t* payload, uint32_t payload_len, bool deliver, int epfd) {
+    uint64_t target_key = mark_to_key(target_mark);
+    auto t_it = fd_hint >= 0 ? ctx->connections.find(fd_hint) : ctx->connections.end();
+    if (t_it == ctx->connections.end() || !t_it->second.registered || mark_to_key(t_it->second.mark) != target_key) {
+        // 按标记查找时记下会话的队友（fd_hint 命中时之前已记下）
+        auto target_it = ctx->mark_to_fd.find(target_key);
+        if (target_it == ctx->mark_to_fd.end()) {
+            fd_hint = -1;
+            // 目标处于断线保留期：缓存数据，恢复会话后重放
+            auto parked_it = ctx->parked.find(target_key);
+            watch_presence(conn, target_mark, target_key, -1,
+                           parked_it != ctx->parked.end() || ctx->remote_marks.count(target_key) != 0);
+            if (parked_it != ctx->parked.end()) {
+                if (deliver && !append_tx_log(parked_it->second.state, source, payload, payload_len)) {
+                    LOGW("保留会话缓存超限，释放标记 mark=%s", Logger::format_mark(target_mark).c_str());
+                    ctx->stat_resume_overflow.fetch_add(1, std::memory_order_relaxed);
+                    notify_presence(relay::CTRL_PEER_LEAVE, parked_it->second.mark, epfd);
+                    ctx->parked.erase(parked_it);
+                }
+                return nullptr;
+            }
+
+            // 目标在集群的其他节点
+            if (!conn.trunk && !ctx->remote_marks.empty()) {
+                auto remote_it = ctx->remote_marks.find(target_key);
+                if (remote_it != ctx->remote_marks.end()) {
+                    if (deliver) {
+                        forward_to_trunk(remote_it->second, conn, source, target_mark, payload, payload_len);
+                    }
+                    return nullptr;
+                }
+            }
+
+            // 目标不存在，丢弃；在线通知客户端收到限速的NACK，可暂停发往该目标
+            LOGW("目标不存在，丢弃数据 from_fd=%d target_mark=%s data_size=%u",
+                     conn.fd, Logger::format_mark(target_mark).c_str(), payload_len);
+            ctx->stat_drop_no_target.fetch_add(1, std::memory_order_relaxed);
+            if (conn.caps & relay::CAP_PRESENCE) {
+                append_nack(conn, relay::NACK_NO_TARGET, target_mark);
+            }
+            return nullptr;
+        }
+        fd_hint = target_it->second;
+        t_it = ctx->connections.find(fd_hint);
+        watch_presence(conn, target_mark, target_key, fd_hint, true);
+    }
+    return t_it != ctx->connections.end() ? &t_it->second : nullptr;
+}
+
+// 观察连接是否订阅了这条流量
+bool tap_matches(const Connection& tap, uint64_t source_key, uint64_t target_key) {
+    for (uint64_t key : tap.tap_marks) {
+        if (key == source_key || key == target_key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 把一条转发的负载镜像给订阅的观察连接：帧头与来源/目标标记写入 send_buf，负载引用共享缓冲区
+// （shared 为空时在第一个订阅者处创建，begin 为负载在 shared 中的位置）。
+// 发送队列超过 tap_queue_bytes 时直接丢弃，慢速观察者不会反压玩家；本轮事件处理完后统一 flush
+void mirror_to_taps(const uint8_t* source, const uint8_t* target, const uint8_t* payload,
+                           uint32_t payload_len, SharedPayload shared = nullptr, size_t begin = 0) {
+    uint64_t source_key = mark_to_key(source);
+    uint64_t target_key = mark_to_key(target);
+    uint32_t body_len = relay::TAP_HEADER_SIZE + payload_len;
+    for (int fd : ctx->taps) {
+        auto it = ctx->connections.find(fd);
+        if (it == ctx->connections.end() || !tap_matches(it->second, source_key, target_key)) {
+            continue;
+        }
+        Connection& tap = it->second;
+        if (tap.send_bytes() + LENGTH_SIZE + body_len > static_cast<size_t>(ctx->tap_queue_bytes)) {
+            tap.tap_dropped++;
+            ctx->stat_tap_drops.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if (!shared) {
+            shared = std::make_shared<const std::vector<uint8_t>>(payload, payload + payload_len);
+            begin = 0;
+        }
+        append_frame(tap, relay::FRAME_TAP, body_len, false);
+        tap.send_buf.insert(tap.send_buf.end(), source, source + MARK_SIZE);
+        tap.send_buf.insert(tap.send_buf.end(), target, target + MARK_SIZE);
+        if (payload_len > 0) {
+            tap.send_shared.push_back({tap.send_buf.size(), shared, begin});
+            tap.send_shared_bytes += payload_len;
+        }
+        ctx->stat_tap_frames.fetch_add(1, std::memory_order_relaxed);
+        if (!tap.tap_dirty) {
+            tap.tap_dirty = true;
+            ctx->dirty_taps.push_back(fd);
+        }
+    }
+}
+
+// 每轮事件处理完后 flush 有新镜像帧的观察连接，每个连接最多一次写系统调用
+void flush_dirty_taps(int epfd) {
+    for (int fd : ctx->dirty_taps) {
+        auto it = ctx->connections.find(fd);
+        if (it != ctx->connections.end() && it->second.tap_dirty) {
+            it->second.tap_dirty = false;
+            flush_send_buffer(it->second, epfd);
+        }
+    }
+    ctx->dirty_taps.clear();
+}
+
+// 扇出 (CAP_FANOUT)：负载只保存一份，每个目标的发送队列引用同一缓冲区
+// 列表扇出的帧体以 [目标数][目标标记...] 开头；广播发给会话的队友 (presence_peers)，即会话发往过的标记
+void fanout_payload(Connection& conn, uint64_t fanout, const uint8_t* data, uint32_t data_len, int epfd) {
+    const uint8_t* source = (conn.caps & relay::CAP_SOURCE) ? conn.mark : nullptr;
+    uint64_t self_key = mark_to_key(conn.mark);
+    ctx->fanout_marks.clear();
+    if (fanout == relay::FANOUT_MULTICAST) {
+        uint32_t count = data_len > 0 ? data[0] : 0;
+        if (count == 0 || data_len < 1 + count * MARK_SIZE) {
+            LOGW("扇出目标列表格式错误 fd=%d size=%u", conn.fd, data_len);
+            ctx->stat_drop_small_packet.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        // 续传序号按目标数计数，与逐个发送时一致（调用方已计1）
+        if (conn.caps & relay::CAP_RESUME) {
+            conn.resume.rx_seq += count - 1;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            ctx->fanout_marks.emplace_back();
+            std::memcpy(ctx->fanout_marks.back().data(), data + 1 + i * MARK_SIZE, MARK_SIZE);
+        }
+        data += 1 + count * MARK_SIZE;
+        data_len -= 1 + count * MARK_SIZE;
+    } else {
+        // 广播计为一帧；先复制队友列表，查找目标时可能加入新的队友
+        for (uint64_t key : conn.resume.presence_peers) {
+            ctx->fanout_marks.emplace_back();
+            std::memcpy(ctx->fanout_marks.back().data(), &key, MARK_SIZE);
+        }
+        if (ctx->fanout_marks.empty()) {
+            LOGD("广播时会话还没有队友，丢弃 fd=%d size=%u", conn.fd, data_len);
+            ctx->stat_drop_no_target.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (data_len == 0 && !source) {
+        return;
+    }
+    ctx->stat_fanout_in.fetch_add(1, std::memory_order_relaxed);
+
+    auto buffer = std::make_shared<std::vector<uint8_t>>();
+    buffer->reserve((source ? MARK_SIZE : 0) + data_len);
+    if (source) {
+        buffer->assign(source, source + MARK_SIZE);
+    }
+    buffer->insert(buffer->end(), data, data + data_len);
+    SharedPayload shared = std::move(buffer);
+    if (!ctx->taps.empty()) {
+        uint8_t fanout_mark[MARK_SIZE];
+        relay::writeU64(fanout_mark, fanout);
+        mirror_to_taps(conn.mark, fanout_mark, data, data_len, shared, source ? MARK_SIZE : 0);
+    }
+
+    // 逐个查找目标：flush_send_buffer 可能关闭连接，不能持有 connections 的迭代器
+    for (const auto& mark : ctx->fanout_marks) {
+        if (mark_to_key(mark.data()) == self_key) {
+            continue;
+        }
+        int no_hint = -1;
+        Connection* target = resolve_target(conn, mark.data(), no_hint, source, data, data_len, true, epfd);
+        if (!target) {
+            continue;
+        }
+        EgressAppend egress = begin_egress(*target);
+        append_shared_data_frame(*target, source, shared, data, data_len);
+        end_egress(*target, egress, mark_to_key(conn.mark), conn.rx_class, 1);
+        ctx->stat_packets_out.fetch_add(1, std::memory_order_relaxed);
+        ctx->stat_fanout_out.fetch_add(1, std::memory_order_relaxed);
+        target->packets_out++;
+        flush_send_buffer(*target, epfd);
+    }
+}
+
+// 把负载转发给目标标记
+void route_payload(Connection& conn, const uint8_t* target_mark, int& fd_hint, const uint8_t* payload,
+                          uint32_t payload_len, int epfd) {
+    uint64_t fanout = relay::readU64(target_mark);
+    if ((conn.caps & relay::CAP_FANOUT) && relay::isFanoutMark(fanout)) {
+        fanout_payload(conn, fanout, payload, payload_len, epfd);
+        return;
+    }
+    // 声明 CAP_SOURCE 的发送方不在负载中附带自己的标记，由中继补上；只有标记的空负载同样转发
+    const uint8_t* source = (conn.caps & relay::CAP_SOURCE) ? conn.mark : nullptr;
+    bool deliver = payload_len > 0 || source;
+    Connection* target = resolve_target(conn, target_mark, fd_hint, source, payload, payload_len, deliver, epfd);
+    if (deliver && target) {
+        EgressAppend egress = begin_egress(*target);
+        append_data_frame(*target, source, payload, payload_len);
+        end_egress(*target, egress, mark_to_key(conn.mark), conn.rx_class, 1);
+        if (!ctx->taps.empty()) {
+            mirror_to_taps(conn.mark, target_mark, payload, payload_len);
+        }
+
+        ctx->stat_packets_out.fetch_add(1, std::memory_order_relaxed);
+        target->packets_out++;
+
+        flush_send_buffer(*target, epfd);
+    }
+}
+
+// FRAME_TRUNK：逐条投递其他节点转来的记录，只查找本节点的目标；观察连接在投递的节点上看到这些流量
+// 返回值: true=继续处理, false=需要关闭连接
+bool process_trunk_frame(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    ctx->stat_trunk_frames_in.fetch_add(1, std::memory_order_relaxed);
+    uint32_t pos = 0;
+    while (pos < data_len) {
+        uint32_t record_len = 0;
+        int varint_len = relay::readVarint(data + pos, data_len - pos, record_len);
+        if (varint_len <= 0 || record_len < relay::TRUNK_RECORD_HEADER_SIZE ||
+            record_len > data_len - pos - static_cast<uint32_t>(varint_len)) {
+            LOGE("中继帧记录格式错误 fd=%d offset=%u", conn.fd, pos);
+            return false;
+        }
+        const uint8_t* record = data + pos + varint_len;
+        pos += static_cast<uint32_t>(varint_len) + record_len;
+        uint8_t flags = record[0];
+        const uint8_t* source = record + 1;
+        const uint8_t* target_mark = source + MARK_SIZE;
+        const uint8_t* payload = target_mark + MARK_SIZE;
+        uint32_t payload_len = record_len - relay::TRUNK_RECORD_HEADER_SIZE;
+        uint8_t lane = static_cast<uint8_t>(flags >> relay::TRUNK_FLAG_CLASS_SHIFT);
+        if (lane >= relay::CLASS_COUNT) {
+            lane = relay::CLASS_RELIABLE;
+        }
+        const uint8_t* stamp = (flags & relay::TRUNK_FLAG_SOURCE) ? source : nullptr;
+
+        ctx->stat_trunk_records_in.fetch_add(1, std::memory_order_relaxed);
+        ctx->stat_packets_in.fetch_add(1, std::memory_order_relaxed);
+        conn.packets_in++;
+
+        int no_hint = -1;
+        Connection* target = resolve_target(conn, target_mark, no_hint, stamp, payload, payload_len, true, epfd);
+        if (!target) {
+            continue;
+        }
+        EgressAppend egress = begin_egress(*target);
+        append_data_frame(*target, stamp, payload, payload_len);
+        end_egress(*target, egress, mark_to_key(source), lane, 1);
+        if (!ctx->taps.empty()) {
+            mirror_to_taps(source, target_mark, payload, payload_len);
+        }
+        ctx->stat_packets_out.fetch_add(1, std::memory_order_relaxed);
+        target->packets_out++;
+        flush_send_buffer(*target, epfd);
+    }
+    return true;
+}
+
+// 处理单个完整的数据包
+// 返回值: true=继续处理, false=需要关闭连接
+bool process_packet(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    int fd = conn.fd;
+
+    ctx->stat_packets_in.fetch_add(1, std::memory_order_relaxed);
+    conn.packets_in++;
+
+    // 观察连接只读：发来的数据帧直接丢弃
+    if (conn.tap) {
+        LOGD("观察连接发送数据帧，丢弃 fd=%d size=%u", fd, data_len);
+        return true;
+    }
+
+    // 首次数据：注册标记
+    // 包格式: 4字节长度 + 8字节标记
+    if (!conn.registered) {
+        if (data_len != MARK_SIZE) {
+            LOGE("注册包长度错误 fd=%d expected=%d received=%u", fd, MARK_SIZE, data_len);
+            return false;
+        }
+
+        if (client_registration_full(mark_to_key(data))) {
+            LOGW("客户端数已满，拒绝注册 fd=%d mark=%s", fd, Logger::format_mark(data).c_str());
+            return false;
+        }
+
+        // 旧版注册不支持续传，同标记的保留会话直接丢弃（标记仍然在线，不广播上线）
+        auto parked_it = ctx->parked.find(mark_to_key(data));
+        bool was_parked = parked_it != ctx->parked.end();
+        if (was_parked) {
+            LOGI("旧版客户端注册，丢弃保留会话 mark=%s", Logger::format_mark(data).c_str());
+            ctx->parked.erase(parked_it);
+        }
+
+        // 注册
+        if (!register_mark(conn, data)) {
+            return false;
+        }
+        start_session_timers(conn);
+        if (!was_parked) {
+            notify_presence(relay::CTRL_PEER_JOIN, conn.mark, epfd, fd);
+        }
+
+        LOGI("注册成功 fd=%d mark=%s", fd, Logger::format_mark(conn.mark).c_str());
+        return true;
+    }
+
+    if (conn.caps & relay::CAP_RESUME) {
+        conn.resume.rx_seq++;
+    }
+
+    // 后续数据：转发
+    // 包格式: 4字节长度 + 8字节目标标记 + 实际数据
+    if (data_len < MARK_SIZE) {
+        LOGW("数据包过小，无法解析目标标记 fd=%d size=%u", fd, data_len);
+        ctx->stat_drop_small_packet.fetch_add(1, std::memory_order_relaxed);
+        return true;  // 丢弃但不断开连接
+    }
+
+    // 转发数据（去掉前8字节目标标记，但保留长度前缀格式）
+    int fd_hint = -1;
+    route_payload(conn, data, fd_hint, data + MARK_SIZE, data_len - MARK_SIZE, epfd);
+    return true;
+}
+
+// 紧凑帧：按短编号转发，负载前不带目标标记
+// 返回值: true=继续处理, false=需要关闭连接
+bool process_slot_packet(Connection& conn, uint8_t slot, const uint8_t* payload, uint32_t payload_len,
+                                int epfd) {
+    ctx->stat_packets_in.fetch_add(1, std::memory_order_relaxed);
+    conn.packets_in++;
+    if (slot > conn.peer_slots.size()) {
+        LOGE("未分配的短编号 fd=%d slot=%u", conn.fd, slot);
+        return false;
+    }
+    if (conn.caps & relay::CAP_RESUME) {
+        conn.resume.rx_seq++;
+    }
+    Connection::PeerSlot& peer = conn.peer_slots[slot - 1];
+    uint8_t target_mark[MARK_SIZE];
+    std::memcpy(target_mark, &peer.key, MARK_SIZE);
+    route_payload(conn, target_mark, peer.fd, payload, payload_len, epfd);
+    return true;
+}
+
+// 把已分组的记录发给各目标：每个目标一个打包帧、只flush一次
+void emit_bundle_routes(const Connection& conn, const uint8_t* source, size_t route_count, int epfd) {
+    for (size_t r = 0; r < route_count; r++) {
+        auto t_it = ctx->connections.find(ctx->bundle_routes[r].fd);
+        if (t_it == ctx->connections.end()) {
+            continue;
+        }
+        Connection& target_conn = t_it->second;
+        EgressAppend egress = begin_egress(target_conn);
+        append_data_bundle(target_conn, source, ctx->bundle_routes[r].records);
+        end_egress(target_conn, egress, mark_to_key(conn.mark), conn.rx_class,
+                   static_cast<uint32_t>(ctx->bundle_routes[r].records.size()));
+        ctx->stat_packets_out.fetch_add(ctx->bundle_routes[r].records.size(), std::memory_order_relaxed);
+        target_conn.packets_out += ctx->bundle_routes[r].records.size();
+        flush_send_buffer(target_conn, epfd);
+    }
+}
+
+// 打包帧：逐条解析记录并查找目标，按目标分组后每个目标追加一个打包帧、只flush一次
+// 扇出记录 (CAP_FANOUT) 不参与分组，直接发给各目标
+// 返回值: true=继续处理, false=需要关闭连接
+bool process_bundle(Connection& conn, const uint8_t* data, uint32_t data_len, int epfd) {
+    if (!(conn.caps & relay::CAP_BUNDLE)) {
+        LOGE("未协商打包帧 fd=%d", conn.fd);
+        return false;
+    }
+    ctx->stat_bundles_in.fetch_add(1, std::memory_order_relaxed);
+    const uint8_t* source = (conn.caps & relay::CAP_SOURCE) ? conn.mark : nullptr;
+    size_t route_count = 0;
+
+    uint32_t pos = 0;
+    while (pos < data_len) {
+        uint32_t record_len = 0;
+        int varint_len = relay::readVarint(data + pos, data_len - pos, record_len);
+        if (varint_len <= 0 || record_len == 0 || record_len > data_len - pos - static_cast<uint32_t>(varint_len)) {
+            LOGE("打包帧记录格式错误 fd=%d offset=%u", conn.fd, pos);
+            return false;
+        }
+        uint8_t tag = data[pos + varint_len];
+        const uint8_t* body = data + pos + varint_len + 1;
+        uint32_t body_len = record_len - 1;
+        pos += static_cast<uint32_t>(varint_len) + record_len;
+
+        ctx->stat_packets_in.fetch_add(1, std::memory_order_relaxed);
+        conn.packets_in++;
+        if (conn.caps & relay::CAP_RESUME) {
+            conn.resume.rx_seq++;
+        }
+
+        uint8_t slot_mark[MARK_SIZE];
+        const uint8_t* target_mark;
+        int no_hint = -1;
+        int* fd_hint = &no_hint;
+        if (tag == relay::COMPACT_TAG_DATA) {
+            if (body_len < static_cast<uint32_t>(MARK_SIZE)) {
+                ctx->stat_drop_small_packet.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            target_mark = body;
+            body += MARK_SIZE;
+            body_len -= MARK_SIZE;
+            uint64_t fanout = relay::readU64(target_mark);
+            if ((conn.caps & relay::CAP_FANOUT) && relay::isFanoutMark(fanout)) {
+                // 先发出之前的记录，保持每个目标收到的顺序
+                emit_bundle_routes(conn, source, route_count, epfd);
+                route_count = 0;
+                fanout_payload(conn, fanout, body, body_len, epfd);
+                continue;
+            }
+        } else if (tag != relay::COMPACT_TAG_CTRL && tag <= conn.peer_slots.size()) {
+            Connection::PeerSlot& peer = conn.peer_slots[tag - 1];
+            std::memcpy(slot_mark, &peer.key, MARK_SIZE);
+            target_mark = slot_mark;
+            fd_hint = &peer.fd;
+        } else {
+            LOGE("打包帧记录标签非法 fd=%d tag=%u", conn.fd, tag);
+            return false;
+        }
+
+        bool deliver = body_len > 0 || source;
+        Connection* target = resolve_target(conn, target_mark, *fd_hint, source, body, body_len, deliver, epfd);
+        if (!deliver || !target) {
+            continue;
+        }
+        if (!ctx->taps.empty()) {
+            mirror_to_taps(conn.mark, target_mark, body, body_len);
+        }
+        size_t r = 0;
+        while (r < route_count && ctx->bundle_routes[r].fd != target->fd) {
+            r++;
+        }
+        if (r == route_count) {
+            if (route_count == ctx->bundle_routes.size()) {
+                ctx->bundle_routes.emplace_back();
+            }
+            ctx->bundle_routes[r].fd = target->fd;
+            ctx->bundle_routes[r].records.clear();
+            route_count++;
+        }
+        ctx->bundle_routes[r].records.push_back({body, body_len});
+    }
+
+    emit_bundle_routes(conn, source, route_count, epfd);
+    return true;
+}
+
+// 协议错误：尽力发出已排队的应答（如 HELLO 失败原因），不等待可写，然后关闭连接
+void close_after_error(Connection& conn, int epfd) {
+    int fd = conn.fd;
+    if (conn.send_pending()) {
+        std::vector<uint8_t> pending = pending_send_bytes(conn);
+        ssize_t unused = write(fd, pending.data(), pending.size());
+        (void)unused;
+    }
+    close_connection(fd, epfd, false);
+}
+
+// 处理接收缓冲区开头的一个紧凑帧
+// 返回值: 消耗的字节数, 0=数据不完整, -1=连接已关闭
+int parse_compact_frame(Connection& conn, int epfd) {
+    uint32_t frame_len = 0;
+    int varint_len = relay::readVarint(conn.recv_buf, conn.recv_len, frame_len);
+    if (varint_len == 0) {
+        return 0;
+    }
+    if (varint_len < 0 || frame_len == 0 || frame_len > MAX_PACKET_SIZE ||
+        static_cast<size_t>(varint_len) + frame_len > BUFFER_SIZE) {
+        LOGE("非法紧凑帧长度 fd=%d frame_len=%u", conn.fd, frame_len);
+        close_connection(conn.fd, epfd, false);
+        return -1;
+    }
+    uint32_t total_len = static_cast<uint32_t>(varint_len) + frame_len;
+    if (conn.recv_len < total_len) {
+        return 0;
+    }
+
+    capture_frame(conn, conn.recv_buf, total_len);
+    const uint8_t* body = conn.recv_buf + varint_len + 1;
+    uint32_t body_len = frame_len - 1;
+    uint8_t tag = conn.recv_buf[varint_len];
+    bool ok;
+    if (tag == relay::COMPACT_TAG_CTRL) {
+        ok = body_len > 0 && process_control(conn, body, body_len, epfd);
+    } else if (tag == relay::COMPACT_TAG_DATA) {
+        ok = process_packet(conn, body, body_len, epfd);
+    } else if (tag == relay::COMPACT_TAG_BUNDLE) {
+        ok = process_bundle(conn, body, body_len, epfd);
+    } else {
+        ok = process_slot_packet(conn, tag, body, body_len, epfd);
+    }
+    if (!ok) {
+        close_after_error(conn, epfd);
+        return -1;
+    }
+    return static_cast<int>(total_len);
+}
+
+// 入站限速：按经过的时间补充令牌，最多补满一秒的配额；未启用的桶不参与
+void refill_ingress(Connection& conn) {
+    int64_t elapsed = static_cast<int64_t>(ctx->now_ms - conn.ingress_refill_ms);
+    conn.ingress_refill_ms = ctx->now_ms;
+    if (ctx->ingress_packets_per_sec > 0) {
+        conn.ingress_packets = std::min<int64_t>(conn.ingress_packets + elapsed * ctx->ingress_packets_per_sec,
+                                                 static_cast<int64_t>(ctx->ingress_packets_per_sec) * INGRESS_UNIT);
+    }
+    if (ctx->ingress_bytes_per_sec > 0) {
+        conn.ingress_bytes = std::min<int64_t>(conn.ingress_bytes + elapsed * ctx->ingress_bytes_per_sec,
+                                               static_cast<int64_t>(ctx->ingress_bytes_per_sec) * INGRESS_UNIT);
+    }
+}
+
+// 令牌耗尽：停止读取，等两个桶都攒够一个令牌后由 TIMER_INGRESS 恢复
+void pause_ingress(Connection& conn, int epfd) {
+    uint64_t wait_ms = TIMER_TICK_MS;
+    if (ctx->ingress_packets_per_sec > 0 && conn.ingress_packets < INGRESS_UNIT) {
+        wait_ms = std::max<uint64_t>(wait_ms, static_cast<uint64_t>(INGRESS_UNIT - conn.ingress_packets) /
+                                                  static_cast<uint64_t>(ctx->ingress_packets_per_sec) + 1);
+    }
+    if (ctx->ingress_bytes_per_sec > 0 && conn.ingress_bytes < INGRESS_UNIT) {
+        wait_ms = std::max<uint64_t>(wait_ms, static_cast<uint64_t>(INGRESS_UNIT - conn.ingress_bytes) /
+                                                  static_cast<uint64_t>(ctx->ingress_bytes_per_sec) + 1);
+    }
+    conn.ingress_paused = true;
+    conn.ingress_pauses++;
+    ctx->stat_ingress_paused.fetch_add(1, std::memory_order_relaxed);
+    conn.ingress_timer = schedule_timer(TIMER_INGRESS, conn.fd, wait_ms);
+    (void)update_epoll_events(epfd, conn, conn.send_pending());
+    LOGD("入站超出配额，暂停读取 fd=%d wait=%llums", conn.fd, static_cast<unsigned long long>(wait_ms));
+}
+
+// 处理接收缓冲区中所有完整的帧，之后发出发往本连接的控制帧
+// 返回 false 表示连接已关闭；返回 true 时连接也可能已在最后的发送中关闭，调用方不应再访问 conn
+bool process_recv_buffer(Connection& conn, int epfd) {
+    int fd = conn.fd;
+
+    // 循环处理所有完整的数据包
+    // 包格式: 4字节长度(网络字节序) + 数据；紧凑帧连接为 varint 长度 + 标签 + 数据
+    while (conn.recv_len > 0) {
+        // 包令牌耗尽：其余的帧留在缓冲区中，恢复时先处理（中继链路承载整个节点的流量，不限速）
+        if (ctx->ingress_packets_per_sec > 0 && !conn.trunk && conn.ingress_packets < INGRESS_UNIT) {
+            pause_ingress(conn, epfd);
+            break;
+        }
+        if (conn.compact) {
+            int consumed = parse_compact_frame(conn, epfd);
+            if (consumed < 0) {
+                return false;   // 连接已关闭
+            }
+            if (consumed == 0) {
+                break;    // 等待更多数据
+            }
+            conn.consume(static_cast<size_t>(consumed));
+            if (ctx->ingress_packets_per_sec > 0) {
+                conn.ingress_packets -= INGRESS_UNIT;
+            }
+            continue;
+        }
+        if (conn.recv_len < static_cast<size_t>(LENGTH_SIZE)) {
+            break;
+        }
+        // 读取帧头：低24位为包长度，高8位为帧类型（旧版客户端恒为0）
+        uint32_t header = read_packet_length(conn.recv_buf);
+        uint32_t packet_len = relay::frameLength(header);
+        uint8_t frame_type = relay::frameType(header);
+
+        // 检查包长度合法性
+        // 注意：total_len = LENGTH_SIZE + packet_len 必须 <= BUFFER_SIZE，否则永远无法接收完整包
+        // 中继链路的帧可以略长于 MAX_PACKET_SIZE（记录头在最大负载之外）
+        if (packet_len == 0 || packet_len > (conn.trunk ? TRUNK_FRAME_MAX : static_cast<uint32_t>(MAX_PACKET_SIZE)) ||
+            (LENGTH_SIZE + packet_len) > BUFFER_SIZE) {
+            LOGE("非法包长度 fd=%d packet_len=%u (max_allowed=%zu)",
+                 fd, packet_len, BUFFER_SIZE - LENGTH_SIZE);
+            close_connection(fd, epfd, false);
+            return false;
+        }
+        bool type_ok = conn.trunk ? frame_type == relay::FRAME_CTRL || (frame_type == relay::FRAME_TRUNK && conn.trunk_up)
+                                  : frame_type == relay::FRAME_DATA || frame_type == relay::FRAME_CTRL ||
+                                        frame_type == relay::FRAME_BUNDLE;
+        if (!type_ok) {
+            LOGE("未知帧类型 fd=%d type=%u", fd, frame_type);
+            close_connection(fd, epfd, false);
+            return false;
+        }
+
+        // 检查是否收到完整的包
+        uint32_t total_len = LENGTH_SIZE + packet_len;
+        if (conn.recv_len < total_len) {
+            LOGD("等待更多数据 fd=%d need=%u have=%zu", fd, total_len, conn.recv_len);
+            break;  // 等待更多数据
+        }
+
+        // 处理完整的数据包
+        capture_frame(conn, conn.recv_buf, total_len);
+        const uint8_t* packet_data = conn.recv_buf + LENGTH_SIZE;
+        bool ok = frame_type == relay::FRAME_CTRL     ? process_control(conn, packet_data, packet_len, epfd)
+                  : frame_type == relay::FRAME_BUNDLE ? process_bundle(conn, packet_data, packet_len, epfd)
+                  : frame_type == relay::FRAME_TRUNK  ? process_trunk_frame(conn, packet_data, packet_len, epfd)
+                                                      : process_packet(conn, packet_data, packet_len, epfd);
+        if (!ok) {
+            close_after_error(conn, epfd);
+            return false;
+        }
+
+        // 从缓冲区移除已处理的数据
+        conn.consume(total_len);
+        if (ctx->ingress_packets_per_sec > 0 && !conn.trunk) {
+            conn.ingress_packets -= INGRESS_UNIT;
+        }
+        LOGD("处理完成 fd=%d consumed=%u remaining=%zu", fd, total_len, conn.recv_len);
+    }
+
+    // 续传客户端：累计收到足够多的数据帧后发送确认
+    if ((conn.caps & relay::CAP_RESUME) && conn.resume.rx_seq - conn.resume.rx_acked >= relay::ACK_EVERY_FRAMES) {
+        append_ack_frame(conn);
+    }
+    // HELLO_ACK、ACK 等发往本连接的控制帧（可能关闭连接，放在最后）
+    if (conn.send_pending()) {
+        flush_send_buffer(conn, epfd);
+    }
+    return true;
+}
+
+// 处理客户端数据
+void handle_client_data(int fd, int epfd) {
+    auto it = ctx->connections.find(fd);
+    if (it == ctx->connections.end()) {
+        LOGE("未找到连接信息 fd=%d", fd);
+        close_connection(fd, epfd);
+        return;
+    }
+
+    Connection& conn = it->second;
+    if (conn.ingress_paused) {
+        return;   // 本轮已取出的事件，暂停期间不读取
+    }
+
+    // 读取数据到连接缓冲区
+    size_t available = BUFFER_SIZE - conn.recv_len;
+    if (available == 0) {
+        LOGE("接收缓冲区已满 fd=%d", fd);
+        close_connection(fd, epfd);
+        return;
+    }
+
+    // 入站限速：令牌耗尽时不读取，字节桶启用时最多读取剩余配额
+    if ((ctx->ingress_packets_per_sec > 0 || ctx->ingress_bytes_per_sec > 0) && !conn.trunk) {
+        refill_ingress(conn);
+        if ((ctx->ingress_packets_per_sec > 0 && conn.ingress_packets < INGRESS_UNIT) ||
+            (ctx->ingress_bytes_per_sec > 0 && conn.ingress_bytes < INGRESS_UNIT)) {
+            pause_ingress(conn, epfd);
+            return;
+        }
+        if (ctx->ingress_bytes_per_sec > 0) {
+            available = std::min(available, static_cast<size_t>(conn.ingress_bytes / INGRESS_UNIT));
+        }
+    }
+
+    ssize_t n = conn.mirror_fd != -1 ? read_mirrored(conn, epfd, conn.recv_buf + conn.recv_len, available)
+                                     : read(fd, conn.recv_buf + conn.recv_len, available);
+
+    if (n <= 0) {
+        if (n == 0) {
+            LOGD("连接关闭 fd=%d (对端关闭)", fd);
+            close_connection(fd, epfd);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE("read失败 fd=%d: %s", fd, strerror(errno));
+            close_connection(fd, epfd);
+        }
+        return;
+    }
+
+    conn.recv_len += n;
+    conn.last_rx_ms = ctx->now_ms;
+    conn.bytes_in += static_cast<uint64_t>(n);
+    if (ctx->ingress_bytes_per_sec > 0 && !conn.trunk) {
+        conn.ingress_bytes -= static_cast<int64_t>(n) * INGRESS_UNIT;
+    }
+    ctx->stat_bytes_in.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+    LOGD("收到数据 fd=%d size=%zd total_buffered=%zu", fd, n, conn.recv_len);
+
+    process_recv_buffer(conn, epfd);
+}
+
+PerfSnapshot capture_perf() {
+    PerfSnapshot snap;
+    snap.at_ms = ctx->now_ms;
+    snap.bytes_in = ctx->stat_bytes_in.load(std::memory_order_relaxed);
+    snap.bytes_out = ctx->stat_bytes_out.load(std::memory_order_relaxed);
+    snap.packets_in = ctx->stat_packets_in.load(std::memory_order_relaxed);
+    snap.packets_out = ctx->stat_packets_out.load(std::memory_order_relaxed);
+    snap.drop_no_target = ctx->stat_drop_no_target.load(std::memory_order_relaxed);
+    snap.drop_small_packet = ctx->stat_drop_small_packet.load(std::memory_order_relaxed);
+    snap.drop_send_eagain = ctx->stat_drop_send_eagain.load(std::memory_order_relaxed);
+    snap.partial_writes = ctx->stat_partial_writes.load(std::memory_order_relaxed);
+    snap.write_errors = ctx->stat_write_errors.load(std::memory_order_relaxed);
+    snap.event_loops = ctx->stat_event_loops.load(std::memory_order_relaxed);
+    snap.events = ctx->stat_events.load(std::memory_order_relaxed);
+    return snap;
+}
+
+
+void report_perf() {
+    PerfSnapshot cur = capture_perf();
+    const PerfSnapshot& last = ctx->last_perf;
+    if (cur.at_ms <= last.at_ms) {
+        return;
+    }
+
+    double secs = static_cast<double>(cur.at_ms - last.at_ms) / 1000.0;
+    uint64_t din = cur.bytes_in - last.bytes_in;
+    uint64_t dout = cur.bytes_out - last.bytes_out;
+    uint64_t pin = cur.packets_in - last.packets_in;
+    uint64_t pout = cur.packets_out - last.packets_out;
+    uint64_t d_drop_no_target = cur.drop_no_target - last.drop_no_target;
+    uint64_t d_drop_small_packet = cur.drop_small_packet - last.drop_small_packet;
+
+    LOGI("PERF dt=%.2fs in=%lluB(%.2fMB/s) out=%lluB(%.2fMB/s) pin=%llu(%.0f/s) pout=%llu(%.0f/s) eagain_drop=%llu partial=%llu werr=%llu loops=%llu events=%llu",
+         secs,
+         static_cast<unsigned long long>(din), (din / secs) / (1024.0 * 1024.0),
+         static_cast<unsigned long long>(dout), (dout / secs) / (1024.0 * 1024.0),
+         static_cast<unsigned long long>(pin), pin / secs,
+         static_cast<unsigned long long>(pout), pout / secs,
+         static_cast<unsigned long long>(cur.drop_send_eagain - last.drop_send_eagain),
+         static_cast<unsigned long long>(cur.partial_writes - last.partial_writes),
+         static_cast<unsigned long long>(cur.write_errors - last.write_errors),
+         static_cast<unsigned long long>(cur.event_loops - last.event_loops),
+         static_cast<unsigned long long>(cur.events - last.events));
+
+    if (d_drop_no_target > 0 || d_drop_small_packet > 0) {
+        LOGI("PERF_DROP no_target=%llu small_packet=%llu",
+             static_cast<unsigned long long>(d_drop_no_target),
+             static_cast<unsigned long long>(d_drop_small_packet));
+    }
+
+    for (auto& pair : ctx->connections) {
+        Connection& conn = pair.second;
+        conn.rate_in = (conn.bytes_in - conn.rate_snapshot_in) / secs;
+        conn.rate_out = (conn.bytes_out - conn.rate_snapshot_out) / secs;
+        conn.rate_snapshot_in = conn.bytes_in;
+        conn.rate_snapshot_out = conn.bytes_out;
+    }
+    ctx->last_perf = cur;
+}
+
+// 周期维护：流量较小的续传客户端凑不满 ACK_EVERY_FRAMES，在这里补发确认；清理超时的保留会话
+void housekeeping(int epfd) {
+    std::vector<int> ack_fds;
+    for (auto& pair : ctx->connections) {
+        const Connection& conn = pair.second;
+        if ((conn.caps & relay::CAP_RESUME) && conn.resume.rx_seq != conn.resume.rx_acked) {
+            ack_fds.push_back(pair.first);
+        }
+    }
+    for (int fd : ack_fds) {
+        auto it = ctx->connections.find(fd);
+        if (it != ctx->connections.end()) {
+            append_ack_frame(it->second);
+            flush_send_buffer(it->second, epfd);
+        }
+    }
+    if (!ctx->parked.empty()) {
+        expire_parked_sessions(ctx->now_ms, epfd);
+    }
+}
+
+void send_ping(Connection& conn, int epfd) {
+    uint8_t body[relay::CTRL_PING_SIZE];
+    body[0] = relay::CTRL_PING;
+    relay::writeU64(body + 1, precise_now_us());
+    append_ctrl_frame(conn, body, sizeof(body));
+    flush_send_buffer(conn, epfd);   // 可能关闭连接
+}
+
+void handle_timer(uint64_t user_data, int epfd) {
+    TimerKind kind = static_cast<TimerKind>(user_data >> 32);
+    int fd = static_cast<int>(user_data & 0xFFFFFFFFu);
+
+    if (kind == TIMER_PERF) {
+        report_perf();
+        schedule_timer(TIMER_PERF, -1, static_cast<uint64_t>(ctx->perf_interval_ms));
+        return;
+    }
+    if (kind == TIMER_HOUSEKEEPING) {
+        housekeeping(epfd);
+        schedule_timer(TIMER_HOUSEKEEPING, -1, HOUSEKEEPING_INTERVAL_MS);
+        return;
+    }
+    if (kind == TIMER_LOAD) {
+        report_load(epfd);
+        ctx->load_due_ms = ctx->now_ms + static_cast<uint64_t>(ctx->load_report_ms);
+        schedule_timer_at(TIMER_LOAD, -1, ctx->load_due_ms);
+        return;
+    }
+    if (kind == TIMER_TRUNK) {
+        if (static_cast<size_t>(fd) < ctx->trunk_peers.size()) {
+            ctx->trunk_peers[fd].retry_timer = TimerWheel::INVALID_TIMER;
+            dial_trunk(static_cast<size_t>(fd), epfd);
+        }
+        return;
+    }
+
+    auto it = ctx->connections.find(fd);
+    if (it == ctx->connections.end()) {
+        return;
+    }
+    Connection& conn = it->second;
+
+    switch (kind) {
+    case TIMER_REGISTER:
+        conn.register_timer = TimerWheel::INVALID_TIMER;
+        if (!conn.registered) {
+            LOGW("注册超时，断开连接 fd=%d addr=%s", fd, conn.peer_addr.c_str());
+            ctx->stat_register_timeouts.fetch_add(1, std::memory_order_relaxed);
+            close_connection(fd, epfd, false);
+        }
+        break;
+    case TIMER_IDLE: {
+        conn.idle_timer = TimerWheel::INVALID_TIMER;
+        uint64_t idle = idle_timeout_ms(conn);
+        if (idle == 0) {
+            conn.idle_timer = schedule_timer(TIMER_IDLE, fd, HOUSEKEEPING_INTERVAL_MS);
+        } else if (ctx->now_ms >= conn.last_rx_ms + idle) {
+            // 网络中断时对端通常不会发FIN；续传客户端的会话照常保留
+            LOGW("空闲超时，断开连接 fd=%d mark=%s idle=%llums", fd, Logger::format_mark(conn.mark).c_str(),
+                 static_cast<unsigned long long>(ctx->now_ms - conn.last_rx_ms));
+            ctx->stat_idle_timeouts.fetch_add(1, std::memory_order_relaxed);
+            close_connection(fd, epfd);
+        } else {
+            // 期间收到过数据：按最后收到数据的时间续期，收包路径上只记录时间，不操作定时器
+            conn.idle_timer = schedule_timer_at(TIMER_IDLE, fd, conn.last_rx_ms + idle);
+        }
+        break;
+    }
+    case TIMER_PING:
+        conn.ping_timer = schedule_timer(TIMER_PING, fd, static_cast<uint64_t>(ctx->ping_interval_ms));
+        send_ping(conn, epfd);
+        break;
+    case TIMER_INGRESS:
+        // 先处理暂停前已读入缓冲区的帧，仍有令牌时恢复读取
+        conn.ingress_timer = TimerWheel::INVALID_TIMER;
+        conn.ingress_paused = false;
+        refill_ingress(conn);
+        if (process_recv_buffer(conn, epfd)) {
+            auto resumed = ctx->connections.find(fd);
+            if (resumed != ctx->connections.end() && !resumed->second.ingress_paused) {
+                (void)update_epoll_events(epfd, resumed->second, resumed->second.send_pending());
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// 推进时间轮，执行所有到期的定时器
+void run_timers(int epfd) {
+    if (ctx->now_ms < ctx->timers.next_expiry_ms()) {
+        return;
+    }
+    size_t fired = ctx->timers.advance(ctx->now_ms, [epfd](TimerWheel::TimerId, uint64_t user_data) {
+        handle_timer(user_data, epfd);
+    });
+    ctx->stat_timers_fired.fetch_add(fired, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// 管理控制面 (Unix domain socket)
+//
+// 管理连接由事件循环与客户端socket一起轮询，但命令本身不在读事件里执行：
+// 解析出的命令行先进入命令队列，待本轮转发事件处理完毕后再按限额执行，
+// 因此管理流量（包括慢速或卡住的管理客户端）不会阻塞数据转发。
+// 队列满时暂停读取该管理连接，命令只是推迟执行，响应顺序与命令顺序一致。
+//
+// 协议: 每行一条文本命令，响应为若干行文本，以单独一行 "END" 结束。
+// ============================================================================
+
+constexpr size_t ADMIN_MAX_LINE = 1024;            // 单条命令最大长度
+constexpr size_t ADMIN_MAX_OUTPUT = 4 * 1024 * 1024; // 单个管理连接最大待发送字节数
+constexpr int ADMIN_COMMANDS_PER_LOOP = 16;        // 每轮事件循环最多执行的命令数
+
+// 解析16位十六进制字符串为8字节标记（字节顺序与 Logger::format_mark 一致）
+bool parse_mark(const std::string& hex, uint8_t* out) {
+    if (hex.size() != MARK_SIZE * 2) {
+        return false;
+    }
+    for (int i = 0; i < MARK_SIZE; i++) {
+        unsigned int byte = 0;
+        if (sscanf(hex.c_str() + i * 2, "%2x", &byte) != 1) {
+            return false;
+        }
+        out[i] = static_cast<uint8_t>(byte);
+    }
+    return true;
+}
+
+const RuntimeLimit* find_runtime_limit(const std::string& name) {
+    for (const auto& limit : g_runtime_limits) {
+        if (name == limit.name) {
+            return &limit;
+        }
+    }
+    return nullptr;
+}
+
+// 创建管理socket（若路径已存在则先删除残留文件）
+int create_admin_socket(const std::string& path) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOGE("管理socket路径过长: %s", path.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        LOGE("创建管理socket失败: %s", strerror(errno));
+        return -1;
+    }
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    unlink(path.c_str());
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        LOGE("管理socket bind失败 %s: %s", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    chmod(path.c_str(), 0600);
+
+    if (listen(fd, 8) == -1 || !set_nonblocking(fd)) {
+        LOGE("管理socket listen失败: %s", strerror(errno));
+        close(fd);
+        unlink(path.c_str());
+        return -1;
+    }
+    return fd;
+}
+
+void update_admin_events(int epfd, int fd, const AdminClient& client) {
+    struct epoll_event ev;
+    ev.data.fd = fd;
+    ev.events = (client.peer_closed || client.read_paused) ? 0u : static_cast<uint32_t>(EPOLLIN);
+    if (!client.out_buf.empty()) {
+        ev.events |= EPOLLOUT;
+    }
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        LOGE("epoll_ctl MOD 管理连接失败 fd=%d: %s", fd, strerror(errno));
+    }
+}
+
+void close_admin_client(int fd, int epfd) {
+    ctx->admin_clients.erase(fd);
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    LOGD("管理连接关闭 fd=%d", fd);
+}
+
+void handle_admin_accept(int epfd) {
+    while (true) {
+        int fd = accept(ctx->admin_listen_fd, nullptr, nullptr);
+        if (fd == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOGE("管理socket accept失败: %s", strerror(errno));
+            }
+            return;
+        }
+        if (!set_nonblocking(fd)) {
+            close(fd);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            LOGE("epoll_ctl ADD 管理连接失败: %s", strerror(errno));
+            close(fd);
+            continue;
+        }
+
+        AdminClient& client = ctx->admin_clients[fd];
+        client = AdminClient();
+        client.id = ctx->admin_next_id++;
+        LOGD("新管理连接 fd=%d", fd);
+    }
+}
+
+// 尽量发送管理连接的待发送数据；返回false表示连接已关闭
+bool flush_admin_client(int fd, int epfd) {
+    auto it = ctx->admin_clients.find(fd);
+    if (it == ctx->admin_clients.end()) {
+        return false;
+    }
+    AdminClient& client = it->second;
+
+    while (!client.out_buf.empty()) {
+        ssize_t sent = send(fd, client.out_buf.data(), client.out_buf.size(), MSG_NOSIGNAL);
+        if (sent > 0) {
+            client.out_buf.erase(0, static_cast<size_t>(sent));
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            close_admin_client(fd, epfd);
+            return false;
+        }
+    }
+
+    if (client.peer_closed && client.pending == 0 && client.out_buf.empty()) {
+        close_admin_client(fd, epfd);
+        return false;
+    }
+    update_admin_events(epfd, fd, client);
+    return true;
+}
+
+void handle_admin_write(int fd, int epfd) {
+    (void)flush_admin_client(fd, epfd);
+}
+
+// 把 in_buf 中完整的命令行依次放入命令队列；队列已满时其余的行留在 in_buf 中，返回false
+bool queue_admin_lines(int fd, AdminClient& client) {
+    size_t pos;
+    while ((pos = client.in_buf.find('\n')) != std::string::npos) {
+        if (ctx->admin_queue.size() >= ADMIN_QUEUE_CAPACITY) {
+            return false;
+        }
+        AdminCommand cmd;
+        cmd.fd = fd;
+        cmd.client_id = client.id;
+        cmd.line = client.in_buf.substr(0, pos);
+        client.in_buf.erase(0, pos + 1);
+        if (!cmd.line.empty() && cmd.line.back() == '\r') {
+            cmd.line.pop_back();
+        }
+        if (cmd.line.empty()) {
+            continue;
+        }
+        ctx->admin_queue.push_back(std::move(cmd));
+        client.pending++;
+    }
+    return true;
+}
+
+void handle_admin_read(int fd, int epfd) {
+    auto it = ctx->admin_clients.find(fd);
+    if (it == ctx->admin_clients.end()) {
+        return;
+    }
+    AdminClient& client = it->second;
+    if (client.read_paused) {
+        return;   // 等待 drain_admin_commands 腾出队列空位
+    }
+
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n == 0) {
+        client.peer_closed = true;
+        (void)flush_admin_client(fd, epfd);
+        return;
+    }
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_admin_client(fd, epfd);
+        }
+        return;
+    }
+
+    client.in_buf.append(buf, static_cast<size_t>(n));
+    if (!queue_admin_lines(fd, client)) {
+        client.read_paused = true;
+        update_admin_events(epfd, fd, client);
+        return;
+    }
+
+    // 完整的行都已入队，剩下的是未结束的一行
+    if (client.in_buf.size() > ADMIN_MAX_LINE) {
+        LOGW("管理命令过长，关闭管理连接 fd=%d", fd);
+        close_admin_client(fd, epfd);
+        return;
+    }
+
+    if (!client.out_buf.empty()) {
+        (void)flush_admin_client(fd, epfd);
+    }
+}
+
+// 连接占用的发送侧缓冲区容量（send_buf、子队列与中继链路批次，不含固定大小的 recv_buf 与共享负载）
+size_t connection_buffer_capacity(const Connection& conn) {
+    size_t bytes = conn.send_buf.capacity() + conn.trunk_batch.capacity();
+    for (const auto& flow : conn.egress_flows) {
+        bytes += flow.bytes.capacity();
+    }
+    return bytes;
+}
+
+void admin_cmd_list(std::ostringstream& out) {
+    char line[768];
+    snprintf(line, sizeof(line), "connections %zu clients %zu/%d registered %zu",
+             ctx->connections.size(), client_connection_count(), ctx->max_connections, ctx->mark_to_fd.size());
+    out << line << "\n";
+    for (const auto& pair : ctx->connections) {
+        const Connection& conn = pair.second;
+        snprintf(line, sizeof(line),
+                 "fd=%d slot=%u addr=%s mark=%s recv_buf=%zu send_buf=%zu send_cap=%zu flows=%zu in=%.0fB/s out=%.0fB/s "
+                 "bytes_in=%llu bytes_out=%llu pin=%llu pout=%llu caps=0x%x unacked=%zu/%zuB "
+                 "rtt=%.2fms srtt=%.2fms idle=%llums late_drops=%llu throttled=%llu%s",
+                 conn.fd, conn.slot, conn.peer_addr.c_str(),
+                 conn.registered ? Logger::format_mark(conn.mark).c_str() : "-",
+                 conn.recv_len, conn.queued_bytes(), connection_buffer_capacity(conn), conn.egress_flows.size(),
+                 conn.rate_in, conn.rate_out,
+                 static_cast<unsigned long long>(conn.bytes_in),
+                 static_cast<unsigned long long>(conn.bytes_out),
+                 static_cast<unsigned long long>(conn.packets_in),
+                 static_cast<unsigned long long>(conn.packets_out),
+                 conn.caps, conn.resume.tx_log.size(), conn.resume.tx_log_bytes,
+                 conn.rtt_us / 1000.0, conn.srtt_us / 1000.0,
+                 static_cast<unsigned long long>(ctx->now_ms - conn.last_rx_ms),
+                 static_cast<unsigned long long>(conn.deadline_drops),
+                 static_cast<unsigned long long>(conn.ingress_pauses), conn.ingress_paused ? " paused" : "");
+        out << line << "\n";
+    }
+    uint64_t now = now_ms();
+    for (const auto& pair : ctx->parked) {
+        const ParkedSession& parked = pair.second;
+        snprintf(line, sizeof(line), "parked mark=%s buffered=%zu/%zuB expire_in=%lldms",
+                 Logger::format_mark(parked.mark).c_str(), parked.state.tx_log.size(), parked.state.tx_log_bytes,
+                 static_cast<long long>(parked.expire_at_ms) - static_cast<long long>(now));
+        out << line << "\n";
+    }
+    for (const auto& peer : ctx->trunk_peers) {
+        auto trunk_it = ctx->trunks.find(peer.node);
+        auto conn_it = ctx->connections.find(trunk_it != ctx->trunks.end() ? trunk_it->second : peer.fd);
+        bool has_conn = conn_it != ctx->connections.end();
+        size_t marks = 0;
+        for (const auto& pair : ctx->remote_marks) {
+            marks += pair.second == peer.node ? 1 : 0;
+        }
+        const char* state = trunk_it != ctx->trunks.end() ? "up" : peer.fd != -1 ? "connecting" : "down";
+        char load[64] = "-";
+        if (peer.load_known) {
+            snprintf(load, sizeof(load), "%u‰(%u/%u)",
+                     load_permille(peer.load_connections, peer.load_capacity, peer.load_egress, peer.load_lag),
+                     peer.load_connections, peer.load_capacity);
+        }
+        snprintf(line, sizeof(line),
+                 "trunk node=%u addr=%s state=%s fd=%d remote_marks=%zu records=%llu queued=%zuB load=%s",
+                 peer.node, peer.addr.c_str(), state, has_conn ? conn_it->first : -1, marks,
+                 has_conn ? static_cast<unsigned long long>(conn_it->second.trunk_records) : 0ULL,
+                 has_conn ? conn_it->second.send_bytes() : 0, load);
+        out << line << "\n";
+    }
+}
+
+void admin_cmd_stats(std::ostringstream& out) {
+    struct StatEntry {
+        const char* name;
+        const std::atomic<uint64_t>* value;
+    };
+    const StatEntry entries[] = {
+        {"bytes_in", &ctx->stat_bytes_in},
+        {"bytes_out", &ctx->stat_bytes_out},
+        {"packets_in", &ctx->stat_packets_in},
+        {"packets_out", &ctx->stat_packets_out},
+        {"drop_no_target", &ctx->stat_drop_no_target},
+        {"drop_small_packet", &ctx->stat_drop_small_packet},
+        {"drop_send_eagain", &ctx->stat_drop_send_eagain},
+        {"partial_writes", &ctx->stat_partial_writes},
+        {"write_errors", &ctx->stat_write_errors},
+        {"event_loops", &ctx->stat_event_loops},
+        {"events", &ctx->stat_events},
+        {"sessions_parked", &ctx->stat_sessions_parked},
+        {"sessions_resumed", &ctx->stat_sessions_resumed},
+        {"sessions_expired", &ctx->stat_sessions_expired},
+        {"resume_overflow", &ctx->stat_resume_overflow},
+        {"sessions_taken_over", &ctx->stat_sessions_taken_over},
+        {"register_timeouts", &ctx->stat_register_timeouts},
+        {"hello_rejected", &ctx->stat_hello_rejected},
+        {"idle_timeouts", &ctx->stat_idle_timeouts},
+        {"timers_fired", &ctx->stat_timers_fired},
+        {"nacks_sent", &ctx->stat_nacks_sent},
+        {"presence_events", &ctx->stat_presence_events},
+        {"bundles_in", &ctx->stat_bundles_in},
+        {"bundles_out", &ctx->stat_bundles_out},
+        {"fanout_in", &ctx->stat_fanout_in},
+        {"fanout_out", &ctx->stat_fanout_out},
+        {"tap_frames", &ctx->stat_tap_frames},
+        {"tap_drops", &ctx->stat_tap_drops},
+        {"egress_queued", &ctx->stat_egress_queued},
+        {"class_switches", &ctx->stat_class_switches},
+        {"ingress_paused", &ctx->stat_ingress_paused},
+        {"ip_limit_rejected", &ctx->stat_ip_limit_rejected},
+        {"register_full", &ctx->stat_register_full},
+        {"trunk_frames_out", &ctx->stat_trunk_frames_out},
+        {"trunk_records_out", &ctx->stat_trunk_records_out},
+        {"trunk_frames_in", &ctx->stat_trunk_frames_in},
+        {"trunk_records_in", &ctx->stat_trunk_records_in},
+        {"trunk_drops", &ctx->stat_trunk_drops},
+        {"redirects", &ctx->stat_redirects},
+        {"mirror_bytes", &ctx->stat_mirror_bytes},
+        {"mirror_sent", &ctx->stat_mirror_sent},
+        {"mirror_drops", &ctx->stat_mirror_drops},
+        {"mirror_failed", &ctx->stat_mirror_failed},
+        {"capture_records", &ctx->stat_capture_records},
+        {"capture_truncated", &ctx->stat_capture_truncated},
+        {"capture_dropped", &ctx->stat_capture_dropped},
+        {"buf_released", &ctx->stat_buf_released},
+    };
+    for (const auto& entry : entries) {
+        out << entry.name << " " << entry.value->load(std::memory_order_relaxed) << "\n";
+    }
+    out << "connections " << ctx->connections.size() << "\n";
+    out << "clients " << client_connection_count() << "\n";
+    out << "registered " << ctx->mark_to_fd.size() << "\n";
+    out << "parked " << ctx->parked.size() << "\n";
+    out << "taps " << ctx->taps.size() << "\n";
+    out << "peer_ips " << ctx->ip_connections.size() << "\n";
+    out << "node " << ctx->node_id << "\n";
+    out << "trunks " << ctx->trunks.size() << "\n";
+    out << "remote_marks " << ctx->remote_marks.size() << "\n";
+    out << "load_permille " << local_load_permille() << "\n";
+    out << "mirrors " << ctx->mirrors.size() << "\n";
+    out << "capture_bytes " << (ctx->capture_fd != -1 ? ctx->capture_header.dataEnd : 0) << "\n";
+    out << "loop_lag_us " << ctx->loop_lag_us << "\n";
+    out << "timers " << ctx->timers.size() << "\n";
+}
+
+// 本进程的常驻内存 (/proc/self/statm)
+uint64_t process_rss_bytes() {
+    FILE* f = fopen("/proc/self/statm", "r");
+    unsigned long long pages = 0;
+    unsigned long long resident = 0;
+    if (f) {
+        if (fscanf(f, "%llu %llu", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+// 本进程打开的文件描述符数
+uint64_t process_open_fds() {
+    DIR* dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return 0;
+    }
+    uint64_t count = 0;
+    while (struct dirent* entry = readdir(dir)) {
+        count += entry->d_name[0] != '.' ? 1 : 0;
+    }
+    closedir(dir);
+    return count > 0 ? count - 1 : 0;   // 不计 opendir 自己的描述符
+}
+
+// 内存与资源占用，供长时间运行的泄漏检查（relay_soak）采样；嵌入进程时包含宿主进程的占用
+void admin_cmd_mem(std::ostringstream& out) {
+    struct mallinfo2 heap = mallinfo2();
+    size_t buffers = 0;
+    size_t buffer_max = 0;
+    size_t queued = 0;
+    size_t resume = 0;
+    for (const auto& pair : ctx->connections) {
+        size_t capacity = connection_buffer_capacity(pair.second);
+        buffers += capacity;
+        buffer_max = std::max(buffer_max, capacity);
+        queued += pair.second.queued_bytes();
+        resume += pair.second.resume.tx_log_bytes;
+    }
+    for (const auto& pair : ctx->parked) {
+        resume += pair.second.state.tx_log_bytes;
+    }
+    out << "rss_bytes " << process_rss_bytes() << "\n";
+    out << "heap_in_use_bytes " << heap.uordblks + heap.hblkhd << "\n";
+    out << "heap_free_bytes " << heap.fordblks << "\n";
+    out << "heap_mapped_bytes " << heap.hblkhd << "\n";
+    out << "open_fds " << process_open_fds() << "\n";
+    out << "connections " << ctx->connections.size() << "\n";
+    out << "buf_capacity_bytes " << buffers << "\n";
+    out << "buf_capacity_max " << buffer_max << "\n";
+    out << "buf_queued_bytes " << queued << "\n";
+    out << "resume_bytes " << resume << "\n";
+}
+
+std::string execute_admin_command(const std::string& line, int epfd) {
+    std::istringstream in(line);
+    std::string cmd;
+    in >> cmd;
+
+    std::ostringstream out;
+    if (cmd == "help") {
+        out << "list                  列出所有连接（标记、队列深度、速率）\n";
+        out << "kick <mark>           断开指定标记的连接并丢弃其续传会话（16位十六进制）\n";
+        out << "stats                 输出累计统计计数\n";
+        out << "mem                   输出内存、文件描述符与连接缓冲区占用\n";
+        out << "loglevel [level]      查看/设置日志级别 (debug|info|warn|error)\n";
+        out << "get [name]            查看运行时限制\n";
+        out << "set <name> <value>    修改运行时限制\n";
+    } else if (cmd == "list") {
+        admin_cmd_list(out);
+    } else if (cmd == "kick") {
+        std::string hex;
+        in >> hex;
+        uint8_t mark[MARK_SIZE];
+        if (!parse_mark(hex, mark)) {
+            out << "ERR 标记格式错误，需要16位十六进制\n";
+        } else {
+            auto it = ctx->mark_to_fd.find(mark_to_key(mark));
+            if (it != ctx->mark_to_fd.end()) {
+                int fd = it->second;
+                LOGI("管理命令踢出连接 fd=%d mark=%s", fd, hex.c_str());
+                close_connection(fd, epfd, false);
+                out << "OK kicked fd=" << fd << "\n";
+            } else if (ctx->parked.erase(mark_to_key(mark)) > 0) {
+                LOGI("管理命令丢弃保留会话 mark=%s", hex.c_str());
+                notify_presence(relay::CTRL_PEER_LEAVE, mark, epfd);
+                out << "OK dropped parked session\n";
+            } else {
+                out << "ERR 标记不存在\n";
+            }
+        }
+    } else if (cmd == "stats") {
+        admin_cmd_stats(out);
+    } else if (cmd == "mem") {
+        admin_cmd_mem(out);
+    } else if (cmd == "loglevel") {
+        std::string name;
+        if (in >> name) {
+            LogLevel level;
+            if (!Logger::parse_level(name, level)) {
+                out << "ERR 未知日志级别: " << name << "\n";
+            } else {
+                Logger::set_level(level);
+                LOGI("管理命令设置日志级别为 %s", log_level_names[static_cast<int>(level)]);
+                out << "OK\n";
+            }
+        } else {
+            out << log_level_names[static_cast<int>(Logger::level())] << "\n";
+        }
+#ifndef DEBUG_MODE
+        out << "NOTE debug级别日志仅在 DEBUG_MODE 编译时可用\n";
+#endif
+    } else if (cmd == "get") {
+        std::string name;
+        in >> name;
+        bool found = false;
+        for (const auto& limit : g_runtime_limits) {
+            if (name.empty() || name == limit.name) {
+                out << limit.name << " " << ctx->*limit.value << " [" << limit.min_value << ", "
+                    << limit.max_value << "] " << limit.desc << "\n";
+                found = true;
+            }
+        }
+        if (!found) {
+            out << "ERR 未知限制: " << name << "\n";
+        }
+    } else if (cmd == "set") {
+        std::string name;
+        long long value = 0;
+        if (!(in >> name >> value)) {
+            out << "ERR 用法: set <name> <value>\n";
+        } else {
+            const RuntimeLimit* limit = find_runtime_limit(name);
+            if (!limit) {
+                out << "ERR 未知限制: " << name << "\n";
+            } else if (value < limit->min_value || value > limit->max_value) {
+                out << "ERR 取值范围 [" << limit->min_value << ", " << limit->max_value << "]\n";
+            } else {
+                ctx->*limit->value = static_cast<int>(value);
+                LOGI("管理命令设置 %s=%lld", name.c_str(), value);
+                out << "OK\n";
+            }
+        }
+    } else {
+        out << "ERR 未知命令: " << cmd << " (输入 help 查看可用命令)\n";
+    }
+    out << "END\n";
+    return out.str();
+}
+
+// 在本轮转发事件处理完毕后执行排队的管理命令
+void drain_admin_commands(int epfd) {
+    for (int i = 0; i < ADMIN_COMMANDS_PER_LOOP && !ctx->admin_queue.empty(); i++) {
+        AdminCommand cmd = std::move(ctx->admin_queue.front());
+        ctx->admin_queue.pop_front();
+        auto it = ctx->admin_clients.find(cmd.fd);
+        if (it == ctx->admin_clients.end() || it->second.id != cmd.client_id) {
+            continue;  // 管理连接已关闭
+        }
+
+        std::string reply = execute_admin_command(cmd.line, epfd);
+
+        // 命令执行可能关闭了连接（例如踢出），需要重新查找
+        it = ctx->admin_clients.find(cmd.fd);
+        if (it == ctx->admin_clients.end() || it->second.id != cmd.client_id) {
+            continue;
+        }
+        AdminClient& client = it->second;
+        client.pending--;
+        if (client.out_buf.size() + reply.size() > ADMIN_MAX_OUTPUT) {
+            LOGW("管理连接输出积压过多，关闭 fd=%d", cmd.fd);
+            close_admin_client(cmd.fd, epfd);
+            continue;
+        }
+        client.out_buf += reply;
+        (void)flush_admin_client(cmd.fd, epfd);
+    }
+
+    // 队列有了空位：暂停读取的管理连接继续排入留在 in_buf 中的命令，全部入队后恢复读取
+    for (auto& pair : ctx->admin_clients) {
+        AdminClient& client = pair.second;
+        if (client.read_paused && queue_admin_lines(pair.first, client)) {
+            client.read_paused = false;
+            update_admin_events(epfd, pair.first, client);
+        }
+    }
+}
+
+// ============================================================================
+// 热重启 (fd handoff)
+//
+// 旧进程在 -H <path> 上等待接管请求；新进程以 -T 启动时连接该socket，
+// 旧进程通过 SCM_RIGHTS 依次传递监听fd与每个客户端fd，并附带连接状态
+// （标记、recv_buf中尚未组成完整包的字节、send_buf中尚未发出的字节）。
+//
+// 提交点是旧进程收到 HANDOFF_ACK：此后旧进程不再处理任何客户端fd（即使随后的提交记录发送失败），
+// 回复 HANDOFF_COMMIT 后退出；新进程只有收到 HANDOFF_COMMIT 才开始服务，否则关闭收到的fd副本并放弃接管。
+// 在此之前任何一步失败，新进程都不会开始服务，旧进程继续服务，同一时刻只有一个进程处理客户端fd。
+// 旧进程停止读取之后到达的数据留在内核socket缓冲区中，由新进程继续读取，客户端TCP连接不受影响。
+// ============================================================================
+
+constexpr uint32_t HANDOFF_MAGIC = 0x59524C48;     // "HLRY"
+constexpr uint16_t HANDOFF_VERSION = 9;            // 状态格式变化时递增，新旧进程必须一致
+constexpr int HANDOFF_IO_TIMEOUT_SEC = 5;
+constexpr uint32_t HANDOFF_MAX_BODY = 64 * 1024 * 1024;
+
+enum HandoffRecordType : uint16_t {
+    HANDOFF_HELLO = 1,    // 新进程 -> 旧进程: 请求接管
+    HANDOFF_LISTEN = 2,   // 监听socket（携带fd）
+    HANDOFF_CONN = 3,     // 客户端连接（携带fd + 状态）
+    HANDOFF_END = 4,      // 全部状态发送完毕
+    HANDOFF_ACK = 5,      // 新进程 -> 旧进程: 已收到全部状态，等待提交
+    HANDOFF_PARKED = 6,   // 断线保留的续传会话（无fd）
+    HANDOFF_COMMIT = 7,   // 旧进程 -> 新进程: 已停止服务，由新进程接管
+};
+
+struct HandoffHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t body_len;    // 紧随其后的状态数据长度
+};
+
+// 状态序列化（本机进程间传递，使用本机字节序）
+class HandoffWriter {
+public:
+    void u8(uint8_t v) { buf_.push_back(v); }
+    void u32(uint32_t v) { raw(&v, sizeof(v)); }
+    void u64(uint64_t v) { raw(&v, sizeof(v)); }
+    void raw(const void* data, size_t len) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        buf_.insert(buf_.end(), p, p + len);
+    }
+    void blob(const void* data, size_t len) {
+        u32(static_cast<uint32_t>(len));
+        raw(data, len);
+    }
+    void str(const std::string& s) { blob(s.data(), s.size()); }
+    const std::vector<uint8_t>& data() const { return buf_; }
+
+private:
+    std::vector<uint8_t> buf_;
+};
+
+class HandoffReader {
+public:
+    HandoffReader(const uint8_t* data, size_t len) : data_(data), len_(len) {}
+
+    bool ok() const { return ok_; }
+    uint8_t u8() { uint8_t v = 0; raw(&v, sizeof(v)); return v; }
+    uint32_t u32() { uint32_t v = 0; raw(&v, sizeof(v)); return v; }
+    uint64_t u64() { uint64_t v = 0; raw(&v, sizeof(v)); return v; }
+    void raw(void* out, size_t len) {
+        if (!ok_ || len_ - pos_ < len) {
+            ok_ = false;
+            return;
+        }
+        std::memcpy(out, data_ + pos_, len);
+        pos_ += len;
+    }
+    // 返回指向内部数据的指针，长度写入 out_len
+    const uint8_t* blob(uint32_t& out_len) {
+        out_len = u32();
+        if (!ok_ || len_ - pos_ < out_len) {
+            ok_ = false;
+            out_len = 0;
+            return nullptr;
+        }
+        const uint8_t* p = data_ + pos_;
+        pos_ += out_len;
+        return p;
+    }
+    std::string str() {
+        uint32_t len = 0;
+        const uint8_t* p = blob(len);
+        return p ? std::string(reinterpret_cast<const char*>(p), len) : std::string();
+    }
+
+private:
+    const uint8_t* data_;
+    size_t len_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+void set_io_timeout(int fd, int seconds) {
+    struct timeval tv;
+    tv.tv_sec = seconds;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+bool write_all(int fd, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t len) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// 发送一条记录；pass_fd >= 0 时通过 SCM_RIGHTS 附带该fd
+bool send_handoff_record(int sock, uint16_t type, const std::vector<uint8_t>& body, int pass_fd) {
+    HandoffHeader hdr;
+    hdr.magic = HANDOFF_MAGIC;
+    hdr.version = HANDOFF_VERSION;
+    hdr.type = type;
+    hdr.body_len = static_cast<uint32_t>(body.size());
+
+    struct iovec iov;
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    alignas(struct cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))];
+    if (pass_fd >= 0) {
+        std::memset(ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &pass_fd, sizeof(int));
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+    // 附带fd的首段发送成功后，剩余头部与状态数据按普通字节流发送
+    if (static_cast<size_t>(n) < sizeof(hdr) &&
+        !write_all(sock, reinterpret_cast<uint8_t*>(&hdr) + n, sizeof(hdr) - static_cast<size_t>(n))) {
+        return false;
+    }
+    return body.empty() || write_all(sock, body.data(), body.size());
+}
+
+// 接收一条记录；若附带fd则写入 out_fd，否则 out_fd = -1
+bool recv_handoff_record(int sock, HandoffHeader& hdr, std::vector<uint8_t>& body, int& out_fd) {
+    out_fd = -1;
+
+    struct iovec iov;
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof(hdr);
+
+    alignas(struct cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        return false;
+    }
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(&out_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+
+    if (static_cast<size_t>(n) < sizeof(hdr) &&
+        !read_all(sock, reinterpret_cast<uint8_t*>(&hdr) + n, sizeof(hdr) - static_cast<size_t>(n))) {
+        goto fail;
+    }
+    if (hdr.magic != HANDOFF_MAGIC || hdr.version != HANDOFF_VERSION || hdr.body_len > HANDOFF_MAX_BODY) {
+        LOGE("handoff记录不兼容 magic=0x%08x version=%u (本进程 version=%u)",
+             hdr.magic, hdr.version, HANDOFF_VERSION);
+        goto fail;
+    }
+
+    body.resize(hdr.body_len);
+    if (hdr.body_len > 0 && !read_all(sock, body.data(), hdr.body_len)) {
+        goto fail;
+    }
+    return true;
+
+fail:
+    if (out_fd >= 0) {
+        close(out_fd);
+        out_fd = -1;
+    }
+    return false;
+}
+
+void serialize_resume_state(const ResumeState& state, HandoffWriter& w) {
+    w.u64(state.token);
+    w.u64(state.rx_seq);
+    w.u64(state.rx_acked);
+    w.u64(state.tx_base);
+    w.u8(state.tx_log_overflow ? 1 : 0);
+    w.u32(static_cast<uint32_t>(state.tx_log.size()));
+    for (const auto& frame : state.tx_log) {
+        w.blob(frame.data(), frame.size());
+    }
+    size_t peer_count = std::min(state.presence_peers.size(), PRESENCE_PEER_LIMIT);
+    w.u32(static_cast<uint32_t>(peer_count));
+    for (size_t i = 0; i < peer_count; i++) {
+        w.u64(state.presence_peers[i]);
+    }
+}
+
+bool deserialize_resume_state(HandoffReader& r, ResumeState& state) {
+    state.token = r.u64();
+    state.rx_seq = r.u64();
+    state.rx_acked = r.u64();
+    state.tx_base = r.u64();
+    state.tx_log_overflow = r.u8() != 0;
+    uint32_t count = r.u32();
+    for (uint32_t i = 0; i < count && r.ok(); i++) {
+        uint32_t len = 0;
+        const uint8_t* frame = r.blob(len);
+        if (!r.ok()) {
+            break;
+        }
+        state.tx_log.emplace_back(frame, frame + len);
+        state.tx_log_bytes += len;
+    }
+    // 会话的队友：热重启后在线通知与广播扇出的范围不变
+    uint32_t peer_count = r.u32();
+    if (peer_count > PRESENCE_PEER_LIMIT) {
+        return false;
+    }
+    for (uint32_t i = 0; i < peer_count && r.ok(); i++) {
+        state.presence_peers.push_back(r.u64());
+    }
+    return r.ok();
+}
+
+void serialize_connection(const Connection& conn, HandoffWriter& w) {
+    w.u8(conn.registered ? 1 : 0);
+    w.u8(conn.hello ? 1 : 0);
+    w.u32(conn.caps);
+    w.u32(conn.slot);
+    w.u8(conn.compact ? 1 : 0);
+    w.u32(conn.deadline_ms);
+    w.u8(conn.rx_class);
+    w.u8(conn.tap ? 1 : 0);
+    w.u32(static_cast<uint32_t>(conn.tap_marks.size()));
+    for (uint64_t key : conn.tap_marks) {
+        w.u64(key);
+    }
+    w.u32(static_cast<uint32_t>(conn.peer_slots.size()));
+    for (const auto& peer : conn.peer_slots) {
+        w.u64(peer.key);
+    }
+    serialize_resume_state(conn.resume, w);
+    w.raw(conn.mark, MARK_SIZE);
+    w.str(conn.peer_addr);
+    w.u64(conn.bytes_in);
+    w.u64(conn.bytes_out);
+    w.u64(conn.packets_in);
+    w.u64(conn.packets_out);
+    w.blob(conn.recv_buf, conn.recv_len);
+    std::vector<uint8_t> pending = pending_send_bytes(conn);
+    w.blob(pending.data(), pending.size());
+}
+
+bool deserialize_connection(HandoffReader& r, Connection& conn) {
+    conn.registered = r.u8() != 0;
+    conn.hello = r.u8() != 0;
+    conn.caps = r.u32();
+    conn.slot = r.u32();
+    conn.compact = r.u8() != 0;
+    conn.deadline_ms = r.u32();
+    conn.rx_class = r.u8();
+    conn.tap = r.u8() != 0;
+    uint32_t tap_count = r.u32();
+    if (tap_count > relay::TAP_MAX_MARKS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < tap_count && r.ok(); i++) {
+        conn.tap_marks.push_back(r.u64());
+    }
+    uint32_t peer_count = r.u32();
+    for (uint32_t i = 0; i < peer_count && r.ok(); i++) {
+        // 新进程中的fd编号不同，转发提示在第一次使用时重新查找
+        uint64_t key = r.u64();
+        if (conn.peer_slots.size() >= relay::COMPACT_MAX_SLOT) {
+            return false;
+        }
+        conn.peer_slots.push_back({key, -1});
+        conn.peer_slot_of[key] = static_cast<uint8_t>(conn.peer_slots.size());
+    }
+    if (!deserialize_resume_state(r, conn.resume)) {
+        return false;
+    }
+    r.raw(conn.mark, MARK_SIZE);
+    conn.peer_addr = r.str();
+    conn.bytes_in = r.u64();
+    conn.bytes_out = r.u64();
+    conn.packets_in = r.u64();
+    conn.packets_out = r.u64();
+    conn.rate_snapshot_in = conn.bytes_in;
+    conn.rate_snapshot_out = conn.bytes_out;
+
+    uint32_t len = 0;
+    const uint8_t* recv_data = r.blob(len);
+    if (!r.ok() || len > BUFFER_SIZE) {
+        return false;
+    }
+    std::memcpy(conn.recv_buf, recv_data, len);
+    conn.recv_len = len;
+
+    const uint8_t* send_data = r.blob(len);
+    if (!r.ok()) {
+        return false;
+    }
+    conn.send_buf.assign(send_data, send_data + len);
+    return true;
+}
+
+// 创建等待接管请求的Unix socket
+int create_handoff_socket(const std::string& path) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOGE("handoff socket路径过长: %s", path.c_str());
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        LOGE("创建handoff socket失败: %s", strerror(errno));
+        return -1;
+    }
+
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    unlink(path.c_str());
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(fd, 1) == -1 || !set_nonblocking(fd)) {
+        LOGE("handoff socket初始化失败 %s: %s", path.c_str(), strerror(errno));
+        close(fd);
+        return -1;
+    }
+    chmod(path.c_str(), 0600);
+    return fd;
+}
+
+// 旧进程：把监听socket和全部连接移交给新进程
+// 返回true表示已过提交点，调用方必须立即停止处理任何客户端fd；返回false时新进程不会开始服务
+bool perform_handoff(int listen_fd, int epfd) {
+    int sock = accept(ctx->handoff_listen_fd, nullptr, nullptr);
+    if (sock == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE("handoff accept失败: %s", strerror(errno));
+        }
+        return false;
+    }
+    set_io_timeout(sock, HANDOFF_IO_TIMEOUT_SEC);
+
+    HandoffHeader hdr;
+    std::vector<uint8_t> body;
+    int unused_fd = -1;
+    if (!recv_handoff_record(sock, hdr, body, unused_fd) || hdr.type != HANDOFF_HELLO) {
+        LOGW("无效的handoff请求，忽略");
+        if (unused_fd >= 0) {
+            close(unused_fd);
+        }
+        close(sock);
+        return false;
+    }
+
+    LOGI("收到热重启接管请求，开始移交 %zu 个连接", ctx->connections.size());
+
+    // 先尽量把待发送数据直接发出去，减少需要移交的状态
+    std::vector<int> fds;
+    fds.reserve(ctx->connections.size());
+    for (auto& pair : ctx->connections) {
+        fds.push_back(pair.first);
+    }
+    for (int fd : fds) {
+        auto it = ctx->connections.find(fd);
+        if (it != ctx->connections.end() && (it->second.send_pending() || !it->second.egress_flows.empty())) {
+            flush_send_buffer(it->second, epfd);
+        }
+    }
+
+    bool ok = send_handoff_record(sock, HANDOFF_LISTEN, {}, listen_fd);
+    for (auto it = ctx->connections.begin(); ok && it != ctx->connections.end(); ++it) {
+        if (it->second.trunk) {
+            continue;   // 中继链路不移交：本进程退出时断开，新进程重新连接并同步标记目录
+        }
+        HandoffWriter w;
+        schedule_egress(it->second, SIZE_MAX);   // 子队列不移交，全部按调度顺序并入发送队列
+        serialize_connection(it->second, w);
+        ok = send_handoff_record(sock, HANDOFF_CONN, w.data(), it->first);
+    }
+    uint64_t now = now_ms();
+    for (auto it = ctx->parked.begin(); ok && it != ctx->parked.end(); ++it) {
+        HandoffWriter w;
+        w.raw(it->second.mark, MARK_SIZE);
+        w.u64(it->second.expire_at_ms > now ? it->second.expire_at_ms - now : 0);
+        serialize_resume_state(it->second.state, w);
+        ok = send_handoff_record(sock, HANDOFF_PARKED, w.data(), -1);
+    }
+    ok = ok && send_handoff_record(sock, HANDOFF_END, {}, -1);
+    ok = ok && recv_handoff_record(sock, hdr, body, unused_fd) && hdr.type == HANDOFF_ACK;
+    if (unused_fd >= 0) {
+        close(unused_fd);
+    }
+
+    if (!ok) {
+        // 未到提交点：新进程收不到 HANDOFF_COMMIT，不会开始服务，所有fd仍由本进程继续服务
+        close(sock);
+        LOGE("热重启移交失败，继续由当前进程提供服务");
+        return false;
+    }
+
+    // 提交点：从这里起本进程不再处理任何客户端fd
+    ctx->handed_off = true;
+    ctx->running = false;
+    if (send_handoff_record(sock, HANDOFF_COMMIT, {}, -1)) {
+        LOGI("热重启移交完成，当前进程退出");
+    } else {
+        // 新进程将放弃接管，客户端需要重连；本进程也不能恢复服务，否则可能与新进程同时处理同一批fd
+        LOGE("热重启提交记录发送失败，当前进程仍然退出");
+    }
+    close(sock);
+    return true;
+}
+
+// 新进程：从旧进程接管监听socket与全部连接，返回监听fd（失败返回-1）
+int takeover_from(const std::string& path, int epfd) {
+    struct sockaddr_un addr;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOGE("handoff socket路径过长: %s", path.c_str());
+        return -1;
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        LOGE("创建handoff socket失败: %s", strerror(errno));
+        return -1;
+    }
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        LOGE("连接旧进程handoff socket失败 %s: %s", path.c_str(), strerror(errno));
+        close(sock);
+        return -1;
+    }
+    set_io_timeout(sock, HANDOFF_IO_TIMEOUT_SEC);
+
+    int listen_fd = -1;
+    bool ok = send_handoff_record(sock, HANDOFF_HELLO, {}, -1);
+    while (ok) {
+        HandoffHeader hdr;
+        std::vector<uint8_t> body;
+        int fd = -1;
+        if (!recv_handoff_record(sock, hdr, body, fd)) {
+            ok = false;
+            break;
+        }
+
+        if (hdr.type == HANDOFF_END) {
+            break;
+        }
+
+        if (hdr.type == HANDOFF_PARKED) {
+            // 剩余宽限期按本进程时钟重新计算
+            ParkedSession parked;
+            HandoffReader r(body.data(), body.size());
+            r.raw(parked.mark, MARK_SIZE);
+            uint64_t remaining_ms = r.u64();
+            if (fd >= 0 || !deserialize_resume_state(r, parked.state)) {
+                LOGE("handoff保留会话解析失败");
+                if (fd >= 0) {
+                    close(fd);
+                }
+                ok = false;
+                break;
+            }
+            parked.expire_at_ms = now_ms() + remaining_ms;
+            ctx->parked[mark_to_key(parked.mark)] = std::move(parked);
+            continue;
+        }
+
+        if (fd < 0) {
+            LOGE("handoff记录缺少fd type=%u", hdr.type);
+            ok = false;
+            break;
+        }
+
+        if (hdr.type == HANDOFF_LISTEN) {
+            listen_fd = fd;
+            set_nonblocking(listen_fd);
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = listen_fd;
+            epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+            continue;
+        }
+
+        if (hdr.type != HANDOFF_CONN) {
+            close(fd);
+            ok = false;
+            break;
+        }
+
+        Connection& conn = ctx->connections[fd];
+        conn = Connection(fd);
+        HandoffReader r(body.data(), body.size());
+        if (!deserialize_connection(r, conn)) {
+            LOGE("handoff连接状态解析失败 fd=%d", fd);
+            ctx->connections.erase(fd);
+            close(fd);
+            ok = false;
+            break;
+        }
+        // 定时器不随handoff移交，按本进程时钟重新设置；入站令牌与IP计数同样在本进程重新开始
+        conn.last_rx_ms = ctx->now_ms;
+        conn.ingress_packets = static_cast<int64_t>(ctx->ingress_packets_per_sec) * INGRESS_UNIT;
+        conn.ingress_bytes = static_cast<int64_t>(ctx->ingress_bytes_per_sec) * INGRESS_UNIT;
+        conn.ingress_refill_ms = ctx->now_ms;
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getpeername(fd, reinterpret_cast<struct sockaddr*>(&peer), &peer_len) == 0 && peer.sin_family == AF_INET) {
+            track_peer_ip(conn, peer.sin_addr.s_addr);
+        }
+        if (conn.registered) {
+            ctx->mark_to_fd[mark_to_key(conn.mark)] = fd;
+            claim_slot(conn.slot, fd);
+            start_session_timers(conn);
+        } else if (conn.tap) {
+            ctx->taps.push_back(fd);
+        } else if (ctx->register_timeout_ms > 0) {
+            conn.register_timer = schedule_timer(TIMER_REGISTER, fd, static_cast<uint64_t>(ctx->register_timeout_ms));
+        }
+
+        set_nonblocking(fd);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | (!conn.send_pending() ? 0u : static_cast<uint32_t>(EPOLLOUT));
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        LOGD("接管连接 fd=%d mark=%s recv_buf=%zu send_buf=%zu", fd,
+             conn.registered ? Logger::format_mark(conn.mark).c_str() : "-",
+             conn.recv_len, conn.send_bytes());
+    }
+
+    ok = ok && listen_fd >= 0 && send_handoff_record(sock, HANDOFF_ACK, {}, -1);
+
+    // 收到提交记录之前旧进程可能仍在服务，已收到的fd只登记、不处理（事件循环尚未运行）
+    if (ok) {
+        HandoffHeader hdr;
+        std::vector<uint8_t> body;
+        int fd = -1;
+        ok = recv_handoff_record(sock, hdr, body, fd) && hdr.type == HANDOFF_COMMIT && fd < 0;
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!ok) {
+            LOGE("旧进程未提交移交");
+        }
+    }
+    close(sock);
+
+    if (!ok) {
+        // 旧进程未提交时会继续服务（或已停止），这里放弃已收到的fd副本
+        LOGE("热重启接管失败");
+        for (auto& pair : ctx->connections) {
+            close(pair.first);
+        }
+        ctx->connections.clear();
+        ctx->mark_to_fd.clear();
+        ctx->parked.clear();
+        ctx->taps.clear();
+        ctx->slot_to_fd.clear();
+        ctx->ip_connections.clear();
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        return -1;
+    }
+
+    rebuild_free_slots();
+    LOGI("热重启接管完成: %zu 个连接, %zu 个已注册标记, %zu 个保留会话",
+         ctx->connections.size(), ctx->mark_to_fd.size(), ctx->parked.size());
+    return listen_fd;
+}
+
+// 解析 <host>:<port>（IPv4，host 可为主机名）
+bool parse_host_port(const std::string& arg, sockaddr_in& out) {
+    size_t colon = arg.rfind(':');
+    int port = colon == std::string::npos ? 0 : std::atoi(arg.c_str() + colon + 1);
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (port <= 0 || port > 65535 || getaddrinfo(arg.substr(0, colon).c_str(), nullptr, &hints, &res) != 0) {
+        return false;
+    }
+    std::memcpy(&out, res->ai_addr, sizeof(out));
+    out.sin_port = htons(static_cast<uint16_t>(port));
+    freeaddrinfo(res);
+    return true;
+}
+
+// ============================================================================
+// 事件循环
+// ============================================================================
+
+// 按启动选项设置新建的中继状态（运行时限制从默认值开始），失败时 error 为原因
+bool apply_options(const RelayOptions& options, std::string& error) {
+    if (options.max_connections < 0) {
+        error = "无效最大连接数: " + std::to_string(options.max_connections);
+        return false;
+    }
+    if (options.max_connections > 0) {
+        ctx->max_connections = options.max_connections;
+    }
+    for (const auto& arg : options.limits) {
+        size_t eq = arg.find('=');
+        const RuntimeLimit* limit = eq == std::string::npos ? nullptr : find_runtime_limit(arg.substr(0, eq));
+        long long value = limit ? std::atoll(arg.c_str() + eq + 1) : 0;
+        if (!limit || value < limit->min_value || value > limit->max_value) {
+            error = "无效运行时限制: " + arg;
+            return false;
+        }
+        ctx->*limit->value = static_cast<int>(value);
+    }
+
+    if (options.node_id < 0 || options.node_id > 65535) {
+        error = "无效节点编号: " + std::to_string(options.node_id);
+        return false;
+    }
+    ctx->node_id = static_cast<uint16_t>(options.node_id);
+    ctx->trunk_peers.clear();
+    for (const auto& arg : options.peers) {
+        // <id>@<host>:<port>
+        size_t at = arg.find('@');
+        int node = at == std::string::npos ? 0 : std::atoi(arg.substr(0, at).c_str());
+        TrunkPeer peer;
+        if (node <= 0 || node > 65535 || find_trunk_peer(static_cast<uint16_t>(node)) ||
+            !parse_host_port(arg.substr(at + 1), peer.sockaddr)) {
+            error = "无效集群节点: " + arg;
+            return false;
+        }
+        peer.node = static_cast<uint16_t>(node);
+        peer.addr = arg.substr(at + 1);
+        ctx->trunk_peers.push_back(peer);
+    }
+    if ((!ctx->trunk_peers.empty() && ctx->node_id == 0) || find_trunk_peer(ctx->node_id)) {
+        error = "集群配置错误: -j 需要配合 -n，且不能包含本节点编号";
+        return false;
+    }
+
+    ctx->mirror_enabled = !options.mirror.empty();
+    ctx->mirror_target = options.mirror;
+    if (ctx->mirror_enabled && !parse_host_port(options.mirror, ctx->mirror_addr)) {
+        error = "无效金丝雀地址: " + options.mirror;
+        return false;
+    }
+
+    uint8_t tap_key[MARK_SIZE];
+    ctx->tap_key_set = !options.tap_key.empty();
+    if (ctx->tap_key_set && !parse_mark(options.tap_key, tap_key)) {
+        error = "无效观察连接密钥（应为16位十六进制）: " + options.tap_key;
+        return false;
+    }
+    ctx->tap_key = ctx->tap_key_set ? relay::readU64(tap_key) : 0;
+
+    if (options.takeover && options.handoff_path.empty()) {
+        error = "接管模式需要 handoff socket 路径 (-H)";
+        return false;
+    }
+    if (options.port < 0 || options.port > 65535) {
+        error = "无效端口号: " + std::to_string(options.port);
+        return false;
+    }
+    LogLevel level;
+    if (!options.log_level.empty() && !Logger::parse_level(options.log_level, level)) {
+        error = "无效日志级别: " + options.log_level;
+        return false;
+    }
+    ctx->admin_path = options.admin_path;
+    ctx->handoff_path = options.handoff_path;
+    ctx->capture_path = options.capture_path;
+    return true;
+}
+
+// 添加到epoll（只关心可读）
+bool watch_fd(int fd) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(ctx->epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+// 创建 epoll、timerfd、唤醒用 eventfd 与监听socket（或从旧进程接管），失败时 error 为原因
+bool open_event_loop(const RelayOptions& options, std::string& error) {
+    // 创建epoll实例
+    ctx->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctx->epfd == -1) {
+        LOGE("epoll_create1失败: %s", strerror(errno));
+        error = "epoll_create1失败";
+        return false;
+    }
+
+    // 时间轮的到期时间由timerfd通知
+    ctx->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    ctx->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->timer_fd == -1 || ctx->wake_fd == -1 || !watch_fd(ctx->timer_fd) || !watch_fd(ctx->wake_fd)) {
+        LOGE("timerfd初始化失败: %s", strerror(errno));
+        error = "timerfd初始化失败";
+        return false;
+    }
+
+    if (options.takeover) {
+        // 热重启：从旧进程接管监听socket与全部连接（已加入epoll）
+        ctx->listen_fd = takeover_from(ctx->handoff_path, ctx->epfd);
+        if (ctx->listen_fd == -1) {
+            error = "热重启接管失败";
+            return false;
+        }
+    } else {
+        // 创建监听socket并添加到epoll
+        ctx->listen_fd = create_listen_socket(options.port);
+        if (ctx->listen_fd == -1) {
+            error = "无法监听端口 " + std::to_string(options.port);
+            return false;
+        }
+        if (!watch_fd(ctx->listen_fd)) {
+            LOGE("epoll_ctl ADD listen_fd 失败: %s", strerror(errno));
+            error = "epoll_ctl ADD listen_fd 失败";
+            return false;
+        }
+    }
+
+    // 管理控制socket与handoff socket（可选）
+    // 接管模式下已经持有客户端连接，初始化失败只记录错误，不中断服务
+    struct UnixEndpoint {
+        const std::string& path;
+        int& fd;
+        int (*create)(const std::string&);
+        const char* name;
+    };
+    const UnixEndpoint endpoints[] = {
+        {ctx->admin_path, ctx->admin_listen_fd, create_admin_socket, "管理socket"},
+        {ctx->handoff_path, ctx->handoff_listen_fd, create_handoff_socket, "handoff socket"},
+    };
+    for (const auto& ep : endpoints) {
+        if (ep.path.empty()) {
+            continue;
+        }
+        ep.fd = ep.create(ep.path);
+        if (ep.fd != -1 && watch_fd(ep.fd)) {
+            continue;
+        }
+        LOGE("%s初始化失败: %s", ep.name, ep.path.c_str());
+        if (ep.fd != -1) {
+            close(ep.fd);
+            unlink(ep.path.c_str());
+            ep.fd = -1;
+        }
+        if (!options.takeover) {
+            error = std::string(ep.name) + "初始化失败: " + ep.path;
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace relay_detail
+
+using namespace relay_detail;
+
+// ============================================================================
+// RelayServer
+// ============================================================================
+
+RelayServer::RelayServer() = default;
+
+RelayServer::~RelayServer() {
+    shutdown();
+}
+
+bool RelayServer::start(const RelayOptions& options, std::string& error) {
+    if (started_) {
+        error = "中继已启动";
+        return false;
+    }
+    // 每次启动都从新的状态开始：运行时限制为默认值，统计计数从0开始
+    ctx_.reset(new RelayContext());
+    ContextScope scope(ctx_.get());
+    if (!apply_options(options, error)) {
+        return false;
+    }
+
+    // 初始化日志系统
+    Logger::init("relay_server");
+    LogLevel level;
+    if (Logger::parse_level(options.log_level, level)) {
+        Logger::set_level(level);
+    }
+    signal(SIGPIPE, SIG_IGN);  // 忽略SIGPIPE，避免写入关闭的socket导致进程退出
+
+    ctx->clock = options.clock;
+    ctx->now_ms = read_clock_ms();
+    ctx->timers.reset(ctx->now_ms);
+    started_ = true;
+
+    if (!ctx->capture_path.empty() && !start_capture(ctx->capture_path)) {
+        error = "无法创建抓包文件 " + ctx->capture_path;
+        shutdown();
+        return false;
+    }
+    if (!open_event_loop(options, error)) {
+        shutdown();
+        return false;
+    }
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    port_ = getsockname(ctx->listen_fd, reinterpret_cast<sockaddr*>(&addr), &addr_len) == 0 ? ntohs(addr.sin_port)
+                                                                                          : options.port;
+
+    LOGI("========================================");
+    LOGI("TCP P2P 中转服务器已启动");
+    LOGI("监听端口: %d", port_);
+    LOGI("最大连接数: %d", ctx->max_connections);
+    if (ctx->admin_listen_fd != -1) {
+        LOGI("管理socket: %s", ctx->admin_path.c_str());
+    }
+    if (ctx->handoff_listen_fd != -1) {
+        LOGI("热重启handoff socket: %s", ctx->handoff_path.c_str());
+    }
+    if (ctx->node_id != 0) {
+        LOGI("集群节点编号: %u，其他节点 %zu 个", ctx->node_id, ctx->trunk_peers.size());
+    }
+    if (ctx->mirror_enabled) {
+        LOGI("入站流量镜像到金丝雀中继: %s", ctx->mirror_target.c_str());
+    }
+#ifdef DEBUG_MODE
+    LOGI("DEBUG模式: 已启用");
+#endif
+    LOGI("========================================");
+
+    // 周期任务：PERF统计与维护（也保证收到退出信号后最迟1秒内醒来）
+    ctx->last_perf = capture_perf();
+    schedule_timer(TIMER_PERF, -1, static_cast<uint64_t>(ctx->perf_interval_ms));
+    schedule_timer(TIMER_HOUSEKEEPING, -1, HOUSEKEEPING_INTERVAL_MS);
+    for (size_t i = 0; i < ctx->trunk_peers.size(); i++) {
+        dial_trunk(i, ctx->epfd);
+    }
+    if (ctx->node_id != 0) {
+        ctx->load_sampled_ms = ctx->now_ms;
+        ctx->load_due_ms = ctx->now_ms + static_cast<uint64_t>(ctx->load_report_ms);
+        schedule_timer_at(TIMER_LOAD, -1, ctx->load_due_ms);
+    }
+    return true;
+}
+
+bool RelayServer::run_once(int timeout_ms) {
+    if (!started_ || !ctx_->running) {
+        return false;
+    }
+    ContextScope scope(ctx_.get());
+    int epfd = ctx->epfd;
+    struct epoll_event events[MAX_EVENTS];
+
+    arm_timerfd();
+    ctx->stat_event_loops.fetch_add(1, std::memory_order_relaxed);
+    int nfds = epoll_wait(epfd, events, MAX_EVENTS, timeout_ms);  // 超时全部由timerfd唤醒
+
+    if (nfds == -1) {
+        if (errno == EINTR) {
+            return ctx->running;  // 被信号中断
+        }
+        LOGE("epoll_wait失败: %s", strerror(errno));
+        ctx->running = false;
+        return false;
+    }
+
+    LOGD("epoll_wait返回 nfds=%d", nfds);
+
+    ctx->stat_events.fetch_add(static_cast<uint64_t>(nfds), std::memory_order_relaxed);
+    ctx->now_ms = read_clock_ms();
+
+    for (int i = 0; i < nfds; i++) {
+        int fd = events[i].data.fd;
+
+        if (fd == ctx->listen_fd) {
+            // 新连接
+            handle_new_connection(ctx->listen_fd, epfd);
+        } else if (fd == ctx->timer_fd) {
+            uint64_t expirations = 0;
+            if (read(ctx->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                // 粗粒度时钟可能略落后于timerfd，至少推进到已到期的时间，避免空转
+                if (ctx->timer_armed_ms != TimerWheel::NO_EXPIRY && ctx->now_ms < ctx->timer_armed_ms) {
+                    ctx->now_ms = ctx->timer_armed_ms;
+                }
+                ctx->timer_armed_ms = TimerWheel::NO_EXPIRY;   // 单次定时已消耗，需要重新设置
+            }
+        } else if (fd == ctx->wake_fd) {
+            uint64_t wakeups = 0;
+            (void)read(ctx->wake_fd, &wakeups, sizeof(wakeups));
+        } else if (fd == ctx->handoff_listen_fd) {
+            // 热重启：移交成功后本进程不得再触碰任何客户端fd
+            if (perform_handoff(ctx->listen_fd, epfd)) {
+                break;
+            }
+        } else if (fd == ctx->admin_listen_fd) {
+            handle_admin_accept(epfd);
+        } else if (!ctx->mirrors.empty() && ctx->mirrors.count(fd)) {
+            handle_mirror_event(fd, events[i].events, epfd);
+        } else if (!ctx->admin_clients.empty() && ctx->admin_clients.count(fd)) {
+            // 管理连接：读取到的命令只入队，稍后执行
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                handle_admin_read(fd, epfd);
+            }
+            if ((events[i].events & EPOLLOUT) && ctx->admin_clients.count(fd)) {
+                handle_admin_write(fd, epfd);
+            }
+        } else {
+            // 客户端数据
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                LOGD("fd=%d 收到 EPOLLERR/EPOLLHUP", fd);
+                close_connection(fd, epfd);
+            } else if (events[i].events & EPOLLIN) {
+                handle_client_data(fd, epfd);
+            }
+            if (events[i].events & EPOLLOUT) {
+                handle_client_write(fd, epfd);
+            }
+        }
+    }
+
+    // 观察连接的镜像帧攒到本轮结束再发
+    if (!ctx->handed_off && !ctx->dirty_taps.empty()) {
+        flush_dirty_taps(epfd);
+    }
+
+    // 转发事件处理完毕后再执行管理命令
+    if (!ctx->handed_off && !ctx->admin_queue.empty()) {
+        drain_admin_commands(epfd);
+    }
+
+    if (!ctx->handed_off) {
+        run_timers(epfd);
+    }
+
+    // 中继链路的记录攒到本轮结束（含定时器中处理的帧）再成帧发出
+    if (!ctx->handed_off && !ctx->dirty_trunks.empty()) {
+        flush_dirty_trunks(epfd);
+    }
+    return ctx->running;
+}
+
+void RelayServer::run() {
+    while (run_once(-1)) {
+    }
+}
+
+void RelayServer::stop() {
+    if (!ctx_) {
+        return;
+    }
+    ctx_->running = false;
+    if (ctx_->wake_fd != -1) {
+        uint64_t one = 1;
+        (void)write(ctx_->wake_fd, &one, sizeof(one));
+    }
+}
+
+void RelayServer::shutdown() {
+    if (!started_) {
+        return;
+    }
+    ContextScope scope(ctx_.get());
+    if (ctx->handed_off) {
+        LOGI("连接已移交给新进程，关闭本进程持有的fd副本...");
+    } else {
+        LOGI("正在停止，清理资源...");
+    }
+
+    // 抓包在本进程结束（移交出去的连接在索引中记为未关闭）
+    if (ctx->capture_fd != -1) {
+        finish_capture();
+    }
+    ctx->capture_conns.clear();
+    ctx->capture_header = relay::CaptureHeader();
+    ctx->capture_full = false;
+
+    // 关闭所有客户端连接（移交后仅关闭本进程的副本，连接本身由新进程继续持有）
+    for (auto& pair : ctx->connections) {
+        release_mirror(pair.second, ctx->epfd);
+        close(pair.first);
+    }
+    ctx->connections.clear();
+    ctx->mark_to_fd.clear();
+    ctx->parked.clear();
+    ctx->taps.clear();
+    ctx->dirty_taps.clear();
+    ctx->ip_connections.clear();
+    ctx->trunks.clear();
+    ctx->trunk_connections = 0;
+    ctx->remote_marks.clear();
+    ctx->dirty_trunks.clear();
+    ctx->mirrors.clear();
+    ctx->slot_to_fd.clear();
+    ctx->free_slots = decltype(ctx->free_slots)();
+    ctx->trunk_peers.clear();
+
+    for (auto& pair : ctx->admin_clients) {
+        close(pair.first);
+    }
+    ctx->admin_clients.clear();
+    ctx->admin_queue.clear();
+    // 移交后socket路径已由新进程重新绑定，不能删除
+    if (ctx->admin_listen_fd != -1) {
+        close(ctx->admin_listen_fd);
+        if (!ctx->handed_off) {
+            unlink(ctx->admin_path.c_str());
+        }
+    }
+    if (ctx->handoff_listen_fd != -1) {
+        close(ctx->handoff_listen_fd);
+        if (!ctx->handed_off) {
+            unlink(ctx->handoff_path.c_str());
+        }
+    }
+    ctx->admin_listen_fd = -1;
+    ctx->handoff_listen_fd = -1;
+
+    for (int* fd : {&ctx->timer_fd, &ctx->wake_fd, &ctx->listen_fd, &ctx->epfd}) {
+        if (*fd != -1) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+
+    LOGI("服务器已关闭");
+    Logger::close();
+    ctx->clock = nullptr;
+    started_ = false;
+    port_ = 0;
+}
+
+std::string RelayServer::admin(const std::string& command) {
+    if (!started_) {
+        return "ERR 中继未启动\nEND\n";
+    }
+    ContextScope scope(ctx_.get());
+    return execute_admin_command(command, ctx->epfd);
+}
+
+// 打印使用帮助
+void RelayServer::print_usage(const char* program) {
+    std::cout << "使用: " << program << " [选项] <port>" << std::endl;
+    std::cout << std::endl;
+    std::cout << "选项:" << std::endl;
+    std::cout << "  -c <n>     最大连接数 (默认" << DEFAULT_MAX_CONNECTIONS << ")" << std::endl;
+    std::cout << "  -a <path>  启用Unix domain管理socket (使用 relay_ctl <path> help 查看命令)" << std::endl;
+    std::cout << "  -H <path>  热重启handoff socket，新进程可通过它接管全部连接" << std::endl;
+    std::cout << "  -T         接管模式：从 -H 指定的旧进程接管监听socket与全部连接" << std::endl;
+    std::cout << "  -o <name>=<value>  设置运行时限制，可重复 (如 -o register_timeout_ms=5000)" << std::endl;
+    std::cout << "  -n <id>    集群节点编号 (1..65535)，与 -j 配置的节点组成集群" << std::endl;
+    std::cout << "  -j <id>@<host>:<port>  集群中的其他节点，可重复；各节点应配置全部其他节点" << std::endl;
+    std::cout << "  -m <host>:<port>       把每个客户端连接的入站流量镜像到金丝雀中继（跟不上时放弃镜像）" << std::endl;
+    std::cout << "  -w <path>  把客户端发来的帧写入抓包文件（用 relay_replay 重放）" << std::endl;
+    std::cout << "  -k <key>   观察连接密钥 (16位十六进制)，CTRL_TAP 须出示；未指定时不接受观察连接" << std::endl;
+    std::unique_ptr<RelayContext> defaults(new RelayContext());
+    for (const auto& limit : g_runtime_limits) {
+        std::cout << "             " << limit.name << ": " << limit.desc << " (默认" << defaults.get()->*limit.value << ")"
+                  << std::endl;
+    }
+    std::cout << std::endl;
+    std::cout << "协议说明 (4字节长度使用小端序):" << std::endl;
+    std::cout << "  包格式: [4字节长度] + [数据]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  1. 注册包 (首次发送):" << std::endl;
+    std::cout << "     [4字节长度=8] + [8字节标记]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  2. 转发包 (后续发送):" << std::endl;
+    std::cout << "     [4字节长度] + [8字节目标标记] + [实际数据]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  3. 接收包 (服务器转发给目标):" << std::endl;
+    std::cout << "     [4字节长度] + [实际数据] (目标标记已去除)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  4. 目标不存在时丢弃数据" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  5. 扩展注册 (帧头高8位为帧类型，详见 include/relay_protocol.h):" << std::endl;
+    std::cout << "     CTRL_HELLO 代替注册包，可启用断线续传；断线后标记保留 resume_grace_ms，" << std::endl;
+    std::cout << "     期间发往该标记的数据被缓存，重连后只重放未确认的数据" << std::endl;
+}
@@ -0,0 +1,89 @@
+/**
+ * 可嵌入的中继服务器
+ *
+ * relay_server 的事件循环与全部转发逻辑在 relay_server.cpp 中，main.cpp 只负责命令行与信号。
+ * 测试与基准可以直接在进程内启动中继：
+ * - 监听端口为0时由内核分配临时端口，port() 返回实际端口，测试之间不再争用固定端口
+ * - run_once() 执行一轮事件循环，调用方可以在自己的线程里逐轮驱动；run() 一直运行到 stop()
+ * - 可注入单调时钟，超时与定时器按注入的时间推进，不必真的等待
+ *
+ * 每个 RelayServer 拥有自己的中继状态（连接、会话、定时器、运行时限制与统计），同一进程可以同时运行多个
+ * （例如在测试中组成集群）；每次 start() 都从新的状态开始，运行时限制恢复默认值，统计计数从0开始。
+ * 日志级别与 syslog 是进程级的，由全部中继共享。
+ */
+
+#ifndef RELAY_SERVER_H
+#define RELAY_SERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace relay_detail {
+struct RelayContext;
+}
+
+// 单调时钟（毫秒）
+using RelayClock = std::function<uint64_t()>;
+
+// 启动选项，除 log_level 与 clock 外与 relay_server 的命令行参数一一对应
+struct RelayOptions {
+    int port = 0;                       // 监听端口，0 为临时端口（接管模式下忽略）
+    int max_connections = 0;            // -c，0 为默认值
+    std::string admin_path;             // -a 管理socket
+    std::string handoff_path;           // -H 热重启handoff socket
+    bool takeover = false;              // -T 从 handoff_path 上的旧进程接管
+    std::vector<std::string> limits;    // -o <name>=<value>
+    int node_id = 0;                    // -n 集群节点编号
+    std::vector<std::string> peers;     // -j <id>@<host>:<port>
+    std::string mirror;                 // -m <host>:<port>
+    std::string capture_path;           // -w 抓包文件
+    std::string tap_key;                // -k 观察连接密钥（16位十六进制），为空时不接受观察连接
+    std::string log_level;              // 日志级别 (debug|info|warn|error)，为空时不改变
+    // 为空时使用 CLOCK_MONOTONIC_COARSE。注入时钟时不使用 timerfd，
+    // 到期的定时器只在 run_once() 中按注入的时间执行（通常配合 run_once(0) 使用）
+    RelayClock clock;
+};
+
+class RelayServer {
+public:
+    RelayServer();
+    ~RelayServer();
+
+    RelayServer(const RelayServer&) = delete;
+    RelayServer& operator=(const RelayServer&) = delete;
+
+    // 校验选项，创建监听socket、epoll、timerfd 与管理/handoff socket；失败时 error 为原因
+    bool start(const RelayOptions& options, std::string& error);
+
+    // 执行一轮事件循环：最多等待 timeout_ms（-1 为一直等到有事件），处理事件、管理命令与到期的定时器
+    // 返回false表示服务器已停止（stop()、热重启移交或 epoll 出错）
+    bool run_once(int timeout_ms);
+
+    // 一直运行到停止
+    void run();
+
+    // 请求停止并唤醒事件循环；异步信号安全，可在信号处理函数或其他线程中调用（不能与 start() 并发）
+    void stop();
+
+    // 关闭全部连接与socket；析构时自动调用
+    void shutdown();
+
+    // 实际监听的端口
+    int port() const { return port_; }
+
+    // 执行一条管理命令（同 relay_ctl，响应以 "END" 行结束）；只能在事件循环线程中或 run() 返回后调用
+    std::string admin(const std::string& command);
+
+    // 打印命令行帮助
+    static void print_usage(const char* program);
+
+private:
+    std::unique_ptr<relay_detail::RelayContext> ctx_;  // 最近一次 start() 创建的中继状态
+    bool started_ = false;
+    int port_ = 0;
+};
+
+#endif // RELAY_SERVER_H
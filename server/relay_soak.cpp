@@ -0,0 +1,489 @@
+/**
+ * relay_server 长时间运行（soak）检查
+ *
+ * 泄漏与碎片化往往要运行几个小时才显现（例如突发后不再缩小的发送缓冲区）。本工具让一个运行中的中继
+ * 反复经历完整的会话生命周期，并通过管理socket 的 mem 命令采样其内存与资源占用：
+ *   每一轮 -n 个会话 x -p 人连接并注册，每个玩家在 -L 毫秒内的随机时刻向同会话的其他人各发一次
+ *   -b 帧的突发，之后保持连接空闲 -i 毫秒，然后全部断开；如此循环直到 -d 毫秒。
+ * 每 -I 毫秒采样一次 RSS、堆占用、打开的文件描述符与连接缓冲区容量。前 -w 轮为预热，
+ * 预热结束、全部连接断开后的占用作为基线；负载停止并等待 -D 毫秒后与基线比较：
+ *   - 堆占用增加超过 -M KiB、RSS 增加超过 -R KiB 或文件描述符多于基线 -F 个，判为未回到基线
+ *   - 空闲阶段（有连接但没有待发数据）的平均每连接缓冲区容量超过 -B KiB，判为突发后缓冲区未缩小
+ * 通过时退出码为0，未通过为2。
+ *
+ * 使用: ./relay_soak [选项] <admin_socket> <host> <port>
+ *   -d <ms>    总时长（默认600000）
+ *   -n <sessions>  每轮会话数（默认50）
+ *   -p <players>   每个会话的玩家数（默认4，2-256）
+ *   -t <threads>   线程数（默认1）
+ *   -b <frames>    每个玩家发往每个同伴的突发帧数（默认100）
+ *   -s <bytes>     负载长度，或 最小-最大（默认1200）
+ *   -L <ms>    突发阶段长度（默认1000）
+ *   -i <ms>    空闲阶段长度（默认2000）
+ *   -w <n>     预热轮数（默认1）
+ *   -I <ms>    采样间隔（默认1000）
+ *   -D <ms>    负载停止后等待多久再与基线比较（默认2000）
+ *   -M <KiB>   允许的堆占用增长（默认1024）
+ *   -R <KiB>   允许的 RSS 增长（默认4096）
+ *   -F <n>     允许多出的文件描述符（默认0）
+ *   -B <KiB>   空闲阶段允许的平均每连接缓冲区容量（默认64）
+ *   -C <csv>   把全部采样写入 CSV 文件
+ *   例: ./relay_server -c 512 -a /run/relay.sock 27015 &
+ *       ./relay_soak -d 3600000 -n 100 -C soak.csv /run/relay.sock 127.0.0.1 27015
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "load_engine.h"
+
+namespace {
+
+// 采样项，与中继 mem 命令的输出同名
+const char* const MEM_FIELDS[] = {
+    "rss_bytes", "heap_in_use_bytes", "heap_free_bytes", "open_fds", "connections",
+    "buf_capacity_bytes", "buf_capacity_max", "buf_queued_bytes",
+};
+
+enum Phase { PHASE_BASELINE, PHASE_WARMUP, PHASE_LOAD, PHASE_AFTER };
+const char* const PHASE_NAMES[] = {"baseline", "warmup", "load", "after"};
+
+struct MemSample {
+    uint64_t at_ms = 0;
+    int phase = PHASE_BASELINE;
+    int cycle = 0;
+    std::map<std::string, uint64_t> values;
+
+    uint64_t get(const char* name) const {
+        auto it = values.find(name);
+        return it == values.end() ? 0 : it->second;
+    }
+    // 空闲阶段：有连接但中继中没有待发数据
+    bool idle_with_connections() const { return get("connections") > 0 && get("buf_queued_bytes") == 0; }
+};
+
+void print_usage(const char* program) {
+    fprintf(stderr, "使用: %s [选项] <admin_socket> <host> <port>\n", program);
+    fprintf(stderr, "  -d <ms>        总时长（默认600000）\n");
+    fprintf(stderr, "  -n <sessions>  每轮会话数（默认50）\n");
+    fprintf(stderr, "  -p <players>   每个会话的玩家数（默认4，2-256）\n");
+    fprintf(stderr, "  -t <threads>   线程数（默认1）\n");
+    fprintf(stderr, "  -b <frames>    每个玩家发往每个同伴的突发帧数（默认100）\n");
+    fprintf(stderr, "  -s <bytes>     负载长度，或 最小-最大（默认1200）\n");
+    fprintf(stderr, "  -L <ms>        突发阶段长度（默认1000）\n");
+    fprintf(stderr, "  -i <ms>        空闲阶段长度（默认2000）\n");
+    fprintf(stderr, "  -w <n>         预热轮数（默认1）\n");
+    fprintf(stderr, "  -I <ms>        采样间隔（默认1000）\n");
+    fprintf(stderr, "  -D <ms>        负载停止后等待多久再与基线比较（默认2000）\n");
+    fprintf(stderr, "  -M <KiB>       允许的堆占用增长（默认1024）\n");
+    fprintf(stderr, "  -R <KiB>       允许的 RSS 增长（默认4096）\n");
+    fprintf(stderr, "  -F <n>         允许多出的文件描述符（默认0）\n");
+    fprintf(stderr, "  -B <KiB>       空闲阶段允许的平均每连接缓冲区容量（默认64）\n");
+    fprintf(stderr, "  -C <csv>       把全部采样写入 CSV 文件\n");
+}
+
+bool parse_size_range(const char* text, uint32_t& lo, uint32_t& hi) {
+    char* end = nullptr;
+    lo = static_cast<uint32_t>(std::strtoul(text, &end, 10));
+    hi = lo;
+    if (*end == '-') {
+        hi = static_cast<uint32_t>(std::strtoul(end + 1, &end, 10));
+    }
+    return *end == '\0' && lo > 0 && lo <= hi && hi <= LoadEngine::MAX_PAYLOAD;
+}
+
+uint64_t wall_ms() {
+    return load_now_ns() / 1000000ULL;
+}
+
+// 通过管理socket 执行 mem，解析 "<name> <value>" 行
+bool query_mem(const std::string& path, MemSample& sample) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return false;
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    const char command[] = "mem\n";
+    std::string reply;
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0 &&
+        write(fd, command, sizeof(command) - 1) == static_cast<ssize_t>(sizeof(command) - 1)) {
+        char buf[1024];
+        ssize_t n;
+        while (reply.find("END\n") == std::string::npos && (n = read(fd, buf, sizeof(buf))) > 0) {
+            reply.append(buf, static_cast<size_t>(n));
+        }
+    }
+    close(fd);
+
+    std::istringstream in(reply);
+    std::string name;
+    uint64_t value;
+    sample.values.clear();
+    while (in >> name >> value) {
+        sample.values[name] = value;
+    }
+    return sample.values.count("heap_in_use_bytes") > 0;
+}
+
+// 后台定时采样；负载线程阻塞在 run_load 中时也持续记录
+class Sampler {
+public:
+    Sampler(const std::string& path, int interval_ms, uint64_t origin_ms)
+        : path_(path), interval_ms_(interval_ms), origin_ms_(origin_ms) {}
+
+    void start() {
+        thread_ = std::thread([this] { loop(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    void set_phase(int phase, int cycle) {
+        phase_.store(phase);
+        cycle_.store(cycle);
+    }
+
+    // 立即采样一次并记录，返回该样本
+    bool sample_now(MemSample& sample) {
+        sample.at_ms = wall_ms() - origin_ms_;
+        sample.phase = phase_.load();
+        sample.cycle = cycle_.load();
+        if (!query_mem(path_, sample)) {
+            failures_++;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        samples_.push_back(sample);
+        return true;
+    }
+
+    const std::vector<MemSample>& samples() const { return samples_; }
+    int failures() const { return failures_.load(); }
+
+private:
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            wake_.wait_for(lock, std::chrono::milliseconds(interval_ms_));
+            if (stopping_) {
+                break;
+            }
+            lock.unlock();
+            MemSample sample;
+            sample_now(sample);
+            lock.lock();
+        }
+    }
+
+    std::string path_;
+    int interval_ms_;
+    uint64_t origin_ms_;
+    std::atomic<int> phase_{PHASE_BASELINE};
+    std::atomic<int> cycle_{0};
+    std::atomic<int> failures_{0};
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::vector<MemSample> samples_;
+    std::thread thread_;
+};
+
+double kib(uint64_t bytes) {
+    return bytes / 1024.0;
+}
+
+long long growth_kib(uint64_t after, uint64_t before) {
+    return (static_cast<long long>(after) - static_cast<long long>(before)) / 1024;
+}
+
+void print_sample_row(const MemSample& s) {
+    printf("  %8.1f  %-8s %5d  %10.0f  %10.0f  %6llu  %6llu  %10.1f  %10.1f\n", s.at_ms / 1000.0,
+           PHASE_NAMES[s.phase], s.cycle, kib(s.get("rss_bytes")), kib(s.get("heap_in_use_bytes")),
+           static_cast<unsigned long long>(s.get("open_fds")), static_cast<unsigned long long>(s.get("connections")),
+           kib(s.get("buf_capacity_bytes")), kib(s.get("buf_capacity_max")));
+}
+
+bool write_csv(const std::string& path, const std::vector<MemSample>& samples) {
+    FILE* csv = fopen(path.c_str(), "w");
+    if (!csv) {
+        return false;
+    }
+    fprintf(csv, "time_ms,phase,cycle");
+    for (const char* field : MEM_FIELDS) {
+        fprintf(csv, ",%s", field);
+    }
+    fprintf(csv, "\n");
+    for (const MemSample& s : samples) {
+        fprintf(csv, "%llu,%s,%d", static_cast<unsigned long long>(s.at_ms), PHASE_NAMES[s.phase], s.cycle);
+        for (const char* field : MEM_FIELDS) {
+            fprintf(csv, ",%llu", static_cast<unsigned long long>(s.get(field)));
+        }
+        fprintf(csv, "\n");
+    }
+    fclose(csv);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int duration_ms = 600000;
+    int sessions = 50;
+    int players = 4;
+    int threads = 1;
+    int burst = 100;
+    uint32_t size_min = 1200;
+    uint32_t size_max = 1200;
+    int burst_ms = 1000;
+    int idle_ms = 2000;
+    int warmup = 1;
+    int interval_ms = 1000;
+    int settle_ms = 2000;
+    long heap_tolerance_kib = 1024;
+    long rss_tolerance_kib = 4096;
+    long fd_tolerance = 0;
+    long idle_buffer_kib = 64;
+    std::string csv_path;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:n:p:t:b:s:L:i:w:I:D:M:R:F:B:C:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            duration_ms = std::atoi(optarg);
+            break;
+        case 'n':
+            sessions = std::atoi(optarg);
+            break;
+        case 'p':
+            players = std::atoi(optarg);
+            break;
+        case 't':
+            threads = std::atoi(optarg);
+            break;
+        case 'b':
+            burst = std::atoi(optarg);
+            break;
+        case 's':
+            if (!parse_size_range(optarg, size_min, size_max)) {
+                fprintf(stderr, "无效的负载长度: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'L':
+            burst_ms = std::atoi(optarg);
+            break;
+        case 'i':
+            idle_ms = std::atoi(optarg);
+            break;
+        case 'w':
+            warmup = std::atoi(optarg);
+            break;
+        case 'I':
+            interval_ms = std::atoi(optarg);
+            break;
+        case 'D':
+            settle_ms = std::atoi(optarg);
+            break;
+        case 'M':
+            heap_tolerance_kib = std::atol(optarg);
+            break;
+        case 'R':
+            rss_tolerance_kib = std::atol(optarg);
+            break;
+        case 'F':
+            fd_tolerance = std::atol(optarg);
+            break;
+        case 'B':
+            idle_buffer_kib = std::atol(optarg);
+            break;
+        case 'C':
+            csv_path = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (duration_ms <= 0 || sessions <= 0 || players < 2 || players > 256 || threads <= 0 || burst <= 0 ||
+        burst_ms <= 0 || idle_ms < 0 || warmup < 0 || interval_ms <= 0 || settle_ms < 0 || heap_tolerance_kib < 0 ||
+        rss_tolerance_kib < 0 || fd_tolerance < 0 || idle_buffer_kib < 0 || argc - optind != 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    std::string admin_path = argv[optind];
+    sockaddr_in addr;
+    if (!resolve_load_target(argv[optind + 1], argv[optind + 2], addr)) {
+        fprintf(stderr, "无效地址: %s:%s\n", argv[optind + 1], argv[optind + 2]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // 每个通道在突发阶段内的随机时刻发出一次 -b 帧的突发；空闲间隔不短于突发阶段，本轮不会再有第二次
+    LoadConfig config;
+    config.players = players;
+    config.tag = 'K';
+    ChannelModel channel;
+    channel.sizes() = TrafficDistribution::uniform(size_min, size_max);
+    channel.bursts() = TrafficDistribution::constant(static_cast<uint64_t>(burst));
+    channel.idle() = TrafficDistribution::constant(static_cast<uint64_t>(burst_ms) * 1000);
+    config.channels.assign(static_cast<size_t>(players - 1), channel);
+
+    uint64_t origin_ms = wall_ms();
+    Sampler sampler(admin_path, interval_ms, origin_ms);
+    MemSample initial;
+    if (!sampler.sample_now(initial)) {
+        fprintf(stderr, "无法通过管理socket %s 读取 mem（中继需以 -a 启动）\n", admin_path.c_str());
+        return 1;
+    }
+    sampler.start();
+
+    // 每轮: 连接注册 -> 突发 -> 空闲 -> 断开；每轮断开后的空载占用单独记录，用于观察增长趋势
+    MemSample baseline = initial;
+    std::vector<MemSample> cycle_ends;
+    LoadStats total;
+    size_t connections = 0;
+    int cycles = 0;
+    std::string error;
+    bool load_ok = true;
+    uint64_t load_end_ms = origin_ms + static_cast<uint64_t>(duration_ms);
+    while (cycles < warmup || wall_ms() < load_end_ms) {
+        int phase = cycles < warmup ? PHASE_WARMUP : PHASE_LOAD;
+        sampler.set_phase(phase, cycles + 1);
+        LoadStats stats;
+        if (!run_load(config, addr, sessions, threads, static_cast<uint64_t>(cycles) + 1, burst_ms, idle_ms, stats,
+                      connections, error)) {
+            load_ok = false;
+            break;
+        }
+        total.merge(stats);
+        cycles++;
+        usleep(200 * 1000);   // 等中继处理完断开
+        MemSample end;
+        if (sampler.sample_now(end)) {
+            cycle_ends.push_back(end);
+            if (cycles == warmup) {
+                baseline = end;
+            }
+        }
+    }
+
+    sampler.set_phase(PHASE_AFTER, cycles);
+    usleep(static_cast<useconds_t>(settle_ms) * 1000);
+    MemSample after;
+    bool after_ok = sampler.sample_now(after);
+    sampler.stop();
+    const std::vector<MemSample>& samples = sampler.samples();
+    if (!csv_path.empty() && !write_csv(csv_path, samples)) {
+        fprintf(stderr, "无法写入 CSV 文件 %s\n", csv_path.c_str());
+        return 1;
+    }
+    if (!load_ok) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    if (!after_ok) {
+        fprintf(stderr, "负载停止后无法读取 mem\n");
+        return 1;
+    }
+
+    // 空闲阶段（突发已送达、连接仍保持）的平均每连接缓冲区容量
+    double idle_per_conn_kib = 0;
+    size_t idle_samples = 0;
+    for (const MemSample& s : samples) {
+        if (s.idle_with_connections() && s.phase != PHASE_BASELINE) {
+            idle_per_conn_kib = std::max(idle_per_conn_kib, kib(s.get("buf_capacity_bytes")) / s.get("connections"));
+            idle_samples++;
+        }
+    }
+
+    printf("relay_soak: %.1f 秒，%d 轮（预热 %d 轮），每轮 %d 个会话 x %d 人（%zu 个连接），"
+           "突发 %d 帧 x %u-%u 字节，空闲 %d ms\n",
+           (wall_ms() - origin_ms) / 1000.0, cycles, warmup, sessions, players, connections, burst, size_min, size_max,
+           idle_ms);
+    printf("  负载: 发送 %llu 帧，接收 %llu 帧，发送积压丢弃 %llu，被中继断开 %llu，采样 %zu 次（失败 %d）\n",
+           static_cast<unsigned long long>(total.sent_frames), static_cast<unsigned long long>(total.recv_frames),
+           static_cast<unsigned long long>(total.send_dropped), static_cast<unsigned long long>(total.disconnected),
+           samples.size(), sampler.failures());
+    printf("  %8s  %-8s %5s  %10s  %10s  %6s  %6s  %10s  %10s\n", "时间(s)", "阶段", "轮", "RSS(KiB)", "堆(KiB)", "fd",
+           "连接", "缓冲(KiB)", "单连接最大");
+    // 长时间运行时采样很多，最多打印约20行，完整数据见 CSV
+    size_t step = std::max<size_t>(samples.size() / 20, 1);
+    for (size_t i = 0; i < samples.size(); i++) {
+        if (i % step == 0 || i + 1 == samples.size()) {
+            print_sample_row(samples[i]);
+        }
+    }
+    if (!cycle_ends.empty()) {
+        const MemSample& first = cycle_ends.front();
+        const MemSample& last = cycle_ends.back();
+        printf("  每轮断开后: 堆 %.0f -> %.0f KiB，RSS %.0f -> %.0f KiB，fd %llu -> %llu（第1轮 -> 第%d轮）\n",
+               kib(first.get("heap_in_use_bytes")), kib(last.get("heap_in_use_bytes")), kib(first.get("rss_bytes")),
+               kib(last.get("rss_bytes")), static_cast<unsigned long long>(first.get("open_fds")),
+               static_cast<unsigned long long>(last.get("open_fds")), last.cycle);
+    }
+
+    long long heap_growth = growth_kib(after.get("heap_in_use_bytes"), baseline.get("heap_in_use_bytes"));
+    long long rss_growth = growth_kib(after.get("rss_bytes"), baseline.get("rss_bytes"));
+    long long fd_growth = static_cast<long long>(after.get("open_fds")) - static_cast<long long>(baseline.get("open_fds"));
+    printf("  基线（预热后空载）: 堆 %.0f KiB，RSS %.0f KiB，fd %llu；启动时: 堆 %.0f KiB，RSS %.0f KiB\n",
+           kib(baseline.get("heap_in_use_bytes")), kib(baseline.get("rss_bytes")),
+           static_cast<unsigned long long>(baseline.get("open_fds")), kib(initial.get("heap_in_use_bytes")),
+           kib(initial.get("rss_bytes")));
+    printf("  负载停止 %d ms 后: 堆 %+lld KiB，RSS %+lld KiB，fd %+lld，连接 %llu，缓冲区 %.1f KiB\n", settle_ms,
+           heap_growth, rss_growth, fd_growth, static_cast<unsigned long long>(after.get("connections")),
+           kib(after.get("buf_capacity_bytes")));
+    printf("  空闲阶段平均每连接缓冲区容量: 最大 %.1f KiB（%zu 次采样）\n", idle_per_conn_kib, idle_samples);
+
+    std::vector<std::string> failures;
+    char reason[160];
+    if (heap_growth > heap_tolerance_kib) {
+        snprintf(reason, sizeof(reason), "堆占用未回到基线（%+lld KiB，允许 %ld）", heap_growth, heap_tolerance_kib);
+        failures.push_back(reason);
+    }
+    if (rss_growth > rss_tolerance_kib) {
+        snprintf(reason, sizeof(reason), "RSS 未回到基线（%+lld KiB，允许 %ld）", rss_growth, rss_tolerance_kib);
+        failures.push_back(reason);
+    }
+    if (fd_growth > fd_tolerance) {
+        snprintf(reason, sizeof(reason), "文件描述符未回到基线（%+lld，允许 %ld）", fd_growth, fd_tolerance);
+        failures.push_back(reason);
+    }
+    if (idle_per_conn_kib > idle_buffer_kib) {
+        snprintf(reason, sizeof(reason), "突发后缓冲区未缩小（空闲时每连接 %.1f KiB，允许 %ld）", idle_per_conn_kib,
+                 idle_buffer_kib);
+        failures.push_back(reason);
+    }
+    if (failures.empty()) {
+        printf("通过\n");
+        return 0;
+    }
+    for (const std::string& failure : failures) {
+        printf("未通过: %s\n", failure.c_str());
+    }
+    return 2;
+}
@@ -0,0 +1,268 @@
+/**
+ * 分层时间轮
+ *
+ * 用于注册超时、空闲超时、心跳与周期统计等大量低精度定时器：
+ * - 4层 x 64槽，tick 粒度由构造参数指定（relay_server 使用10ms，覆盖约46小时）
+ * - 定时器节点存放在连续数组中，通过下标组成双向链表，插入/取消均为 O(1)
+ * - TimerId 带代数，节点复用后旧 TimerId 的取消操作自动失效
+ * - 每层维护非空槽位图，next_expiry_ms() 为 O(1)，便于按需设置 timerfd
+ *
+ * 不是线程安全的，只在事件循环线程中使用。
+ */
+
+#ifndef RELAY_TIMER_WHEEL_H
+#define RELAY_TIMER_WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class TimerWheel {
+public:
+    using TimerId = uint64_t;                 // 0 表示无效
+    static constexpr TimerId INVALID_TIMER = 0;
+    static constexpr uint64_t NO_EXPIRY = UINT64_MAX;
+
+    TimerWheel(uint64_t tick_ms, uint64_t now_ms)
+        : tick_ms_(tick_ms == 0 ? 1 : tick_ms), current_tick_(now_ms / tick_ms_) {
+        for (auto& head : heads_) {
+            head = NIL;
+        }
+        for (auto& bits : occupied_) {
+            bits = 0;
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // 在 expire_ms（与构造时相同时钟的绝对毫秒）到期时回调 user_data；已过期的定时器在下一个tick触发
+    TimerId schedule(uint64_t expire_ms, uint64_t user_data) {
+        int32_t idx = alloc_node();
+        Node& node = nodes_[idx];
+        node.expire_tick = (expire_ms + tick_ms_ - 1) / tick_ms_;
+        node.user_data = user_data;
+        place(idx, current_tick_ + 1);
+        size_++;
+        return make_id(idx, node.gen);
+    }
+
+    // 取消未触发的定时器；已触发或已取消时返回false
+    bool cancel(TimerId id) {
+        if (id == INVALID_TIMER) {
+            return false;
+        }
+        uint32_t idx = static_cast<uint32_t>(id & 0xFFFFFFFFu) - 1;
+        uint32_t gen = static_cast<uint32_t>(id >> 32);
+        if (idx >= nodes_.size() || nodes_[idx].gen != gen || nodes_[idx].slot == FREE_SLOT) {
+            return false;
+        }
+        unlink(static_cast<int32_t>(idx));
+        free_node(static_cast<int32_t>(idx));
+        size_--;
+        return true;
+    }
+
+    // 推进到 now_ms，对每个到期定时器调用 on_expire(TimerId, user_data)
+    // 回调中可以安全地 schedule/cancel 任意定时器（包括同一批中尚未触发的）
+    template <typename F>
+    size_t advance(uint64_t now_ms, F&& on_expire) {
+        uint64_t target = now_ms / tick_ms_;
+        size_t fired = 0;
+        while (current_tick_ < target) {
+            // 第0层在本轮剩余部分没有定时器时，直接跳到下一个进位点
+            uint32_t cur = static_cast<uint32_t>(current_tick_ & SLOT_MASK);
+            uint64_t ahead = cur == SLOT_MASK ? 0 : (occupied_[0] >> (cur + 1));
+            if (ahead == 0) {
+                uint64_t boundary = (current_tick_ | SLOT_MASK) + 1;
+                if (boundary > target) {
+                    current_tick_ = target;
+                    break;
+                }
+                current_tick_ = boundary;
+            } else {
+                current_tick_ += static_cast<uint64_t>(__builtin_ctzll(ahead)) + 1;
+                if (current_tick_ > target) {
+                    current_tick_ = target;
+                    break;
+                }
+            }
+
+            // 低层转完一圈时，把上层对应槽位的定时器重新分配到下层
+            for (int level = 1; level < LEVELS; level++) {
+                if ((current_tick_ & ((1ULL << (SLOT_BITS * level)) - 1)) != 0) {
+                    break;
+                }
+                cascade(level, static_cast<uint32_t>((current_tick_ >> (SLOT_BITS * level)) & SLOT_MASK));
+            }
+
+            // 先把到期槽位整体移到待触发链表，再逐个触发，回调中的取消操作同样有效
+            int32_t slot = static_cast<int32_t>(current_tick_ & SLOT_MASK);
+            while (heads_[slot] != NIL) {
+                int32_t idx = heads_[slot];
+                unlink(idx);
+                link(idx, PENDING_SLOT);
+            }
+            while (heads_[PENDING_SLOT] != NIL) {
+                int32_t idx = heads_[PENDING_SLOT];
+                TimerId id = make_id(idx, nodes_[idx].gen);
+                uint64_t data = nodes_[idx].user_data;
+                unlink(idx);
+                free_node(idx);
+                size_--;
+                fired++;
+                on_expire(id, data);
+            }
+        }
+        return fired;
+    }
+
+    // 下一次需要调用 advance 的时间（可能早于实际最早到期时间，但不会晚于它）
+    uint64_t next_expiry_ms() const {
+        if (size_ == 0) {
+            return NO_EXPIRY;
+        }
+        uint32_t cur = static_cast<uint32_t>(current_tick_ & SLOT_MASK);
+        uint64_t ahead = cur == SLOT_MASK ? 0 : (occupied_[0] >> (cur + 1));
+        if (ahead != 0) {
+            return (current_tick_ + static_cast<uint64_t>(__builtin_ctzll(ahead)) + 1) * tick_ms_;
+        }
+        return ((current_tick_ | SLOT_MASK) + 1) * tick_ms_;
+    }
+
+    // 取消全部定时器并把当前时间设为 now_ms（时钟可以换成另一个来源）；旧 TimerId 全部失效
+    void reset(uint64_t now_ms) {
+        for (size_t i = 0; i < nodes_.size(); i++) {
+            if (nodes_[i].slot != FREE_SLOT) {
+                free_node(static_cast<int32_t>(i));
+            }
+        }
+        for (auto& head : heads_) {
+            head = NIL;
+        }
+        for (auto& bits : occupied_) {
+            bits = 0;
+        }
+        size_ = 0;
+        current_tick_ = now_ms / tick_ms_;
+    }
+
+    size_t size() const { return size_; }
+    uint64_t tick_ms() const { return tick_ms_; }
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr uint32_t SLOTS = 1u << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+    static constexpr int32_t NIL = -1;
+    static constexpr int32_t PENDING_SLOT = LEVELS * SLOTS;   // 本tick待触发链表
+    static constexpr int32_t FREE_SLOT = -1;
+
+    struct Node {
+        uint64_t expire_tick = 0;
+        uint64_t user_data = 0;
+        int32_t prev = NIL;
+        int32_t next = NIL;
+        int32_t slot = FREE_SLOT;   // 所在链表（层*64+槽），FREE_SLOT 表示空闲
+        uint32_t gen = 0;
+    };
+
+    static TimerId make_id(int32_t idx, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | (static_cast<uint64_t>(idx) + 1);
+    }
+
+    int32_t alloc_node() {
+        int32_t idx;
+        if (free_head_ != NIL) {
+            idx = free_head_;
+            free_head_ = nodes_[idx].next;
+        } else {
+            idx = static_cast<int32_t>(nodes_.size());
+            nodes_.emplace_back();
+        }
+        nodes_[idx].gen++;
+        if (nodes_[idx].gen == 0) {
+            nodes_[idx].gen = 1;
+        }
+        return idx;
+    }
+
+    void free_node(int32_t idx) {
+        nodes_[idx].slot = FREE_SLOT;
+        nodes_[idx].prev = NIL;
+        nodes_[idx].next = free_head_;
+        free_head_ = idx;
+    }
+
+    // 按剩余tick数选择层级：第 L 层覆盖 [64^L, 64^(L+1)) 个tick
+    // min_tick: 新定时器最早在下一个tick触发；进位重新分配时可以落在当前tick（随后立即处理）
+    void place(int32_t idx, uint64_t min_tick) {
+        uint64_t expire = nodes_[idx].expire_tick;
+        if (expire < min_tick) {
+            expire = min_tick;
+        }
+        uint64_t delta = expire - current_tick_;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+            level++;
+        }
+        if (delta >= (1ULL << (SLOT_BITS * LEVELS))) {
+            // 超出时间轮范围：放在最上层最远的槽，转到时再重新分配
+            expire = current_tick_ + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+        }
+        uint32_t slot = static_cast<uint32_t>((expire >> (SLOT_BITS * level)) & SLOT_MASK);
+        link(idx, static_cast<int32_t>(level * SLOTS + slot));
+    }
+
+    void cascade(int level, uint32_t slot) {
+        int32_t list = static_cast<int32_t>(level * SLOTS + slot);
+        while (heads_[list] != NIL) {
+            int32_t idx = heads_[list];
+            unlink(idx);
+            place(idx, current_tick_);
+        }
+    }
+
+    void link(int32_t idx, int32_t list) {
+        Node& node = nodes_[idx];
+        node.slot = list;
+        node.prev = NIL;
+        node.next = heads_[list];
+        if (node.next != NIL) {
+            nodes_[node.next].prev = idx;
+        }
+        heads_[list] = idx;
+        if (list < PENDING_SLOT) {
+            occupied_[list / SLOTS] |= 1ULL << (list % SLOTS);
+        }
+    }
+
+    void unlink(int32_t idx) {
+        Node& node = nodes_[idx];
+        int32_t list = node.slot;
+        if (node.prev != NIL) {
+            nodes_[node.prev].next = node.next;
+        } else {
+            heads_[list] = node.next;
+        }
+        if (node.next != NIL) {
+            nodes_[node.next].prev = node.prev;
+        }
+        node.prev = NIL;
+        node.next = NIL;
+        if (list < PENDING_SLOT && heads_[list] == NIL) {
+            occupied_[list / SLOTS] &= ~(1ULL << (list % SLOTS));
+        }
+    }
+
+    uint64_t tick_ms_;
+    uint64_t current_tick_;
+    size_t size_ = 0;
+    std::vector<Node> nodes_;
+    int32_t free_head_ = NIL;
+    int32_t heads_[LEVELS * SLOTS + 1];
+    uint64_t occupied_[LEVELS];
+};
+
+#endif // RELAY_TIMER_WHEEL_H
@@ -1,4 +1,5 @@
 #include "connection_manager.h"
+#include <relay_protocol.h>
 #include <cstring>
 #include <algorithm>
 #include <chrono>
@@ -11,7 +12,8 @@ uint64_t ConnectionManager::nowMs() {
     return static_cast<uint64_t>(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
 }
 
-SocketHandle ConnectionManager::connectWithTimeout(const char* ip, uint16_t port, uint32_t timeoutMs) {
+SocketHandle ConnectionManager::startConnect(const char* ip, uint16_t port, bool& inProgress) {
+    inProgress = false;
     if (!ip) {
         return INVALID_SOCKET_HANDLE;
     }
@@ -43,6 +45,26 @@ SocketHandle ConnectionManager::connectWithTimeout(const char* ip, uint16_t port
         return INVALID_SOCKET_HANDLE;
     }
 
+    inProgress = true;
+    return sock;
+}
+
+bool ConnectionManager::connectSucceeded(SocketHandle sock) {
+    int soError = 0;
+    socklen_t soErrorLen = sizeof(soError);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&soError), &soErrorLen) != 0) {
+        return false;
+    }
+    return soError == 0;
+}
+
+SocketHandle ConnectionManager::connectWithTimeout(const char* ip, uint16_t port, uint32_t timeoutMs) {
+    bool inProgress = false;
+    SocketHandle sock = startConnect(ip, port, inProgress);
+    if (sock == INVALID_SOCKET_HANDLE || !inProgress) {
+        return sock;
+    }
+
     fd_set writeSet;
     fd_set exceptSet;
     FD_ZERO(&writeSet);
@@ -55,24 +77,7 @@ SocketHandle ConnectionManager::connectWithTimeout(const char* ip, uint16_t port
     timeout.tv_usec = static_cast<long>((timeoutMs % 1000) * 1000);
 
     int sel = select(static_cast<int>(sock + 1), nullptr, &writeSet, &exceptSet, &timeout);
-    if (sel <= 0) {
-        closeSocket(sock);
-        return INVALID_SOCKET_HANDLE;
-    }
-
-    if (FD_ISSET(sock, &exceptSet)) {
-        closeSocket(sock);
-        return INVALID_SOCKET_HANDLE;
-    }
-
-    int soError = 0;
-    socklen_t soErrorLen = sizeof(soError);
-    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&soError), &soErrorLen) != 0) {
-        closeSocket(sock);
-        return INVALID_SOCKET_HANDLE;
-    }
-
-    if (soError != 0) {
+    if (sel <= 0 || FD_ISSET(sock, &exceptSet) || !connectSucceeded(sock)) {
         closeSocket(sock);
         return INVALID_SOCKET_HANDLE;
     }
@@ -87,6 +92,7 @@ ConnectionManager::~ConnectionManager() {
 }
 
 bool ConnectionManager::initialize() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (m_initialized) {
         return true;
     }
@@ -100,6 +106,7 @@ bool ConnectionManager::initialize() {
 }
 
 void ConnectionManager::shutdown() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (!m_initialized) {
         return;
     }
@@ -108,6 +115,8 @@ void ConnectionManager::shutdown() {
 
     for (auto& [peerID, conn] : m_connections) {
         closeSocket(conn.socket);
+        closeSocket(conn.relay.redirectSocket);
+        closeSocket(conn.reconnectSocket);
     }
     m_connections.clear();
     m_pendingRemove.clear();
@@ -117,6 +126,7 @@ void ConnectionManager::shutdown() {
 }
 
 bool ConnectionManager::listen(uint16_t port) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (!m_initialized) {
         return false;
     }
@@ -158,6 +168,7 @@ bool ConnectionManager::listen(uint16_t port) {
 }
 
 void ConnectionManager::stopListen() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (m_listenSocket != INVALID_SOCKET_HANDLE) {
         closeSocket(m_listenSocket);
         m_listenSocket = INVALID_SOCKET_HANDLE;
@@ -170,10 +181,17 @@ bool ConnectionManager::connect(const char* ip, uint16_t port, P2PPeerID& outPee
         return false;
     }
 
+    // 等待连接完成时不持锁，其他线程的事件泵与发送不受影响
     SocketHandle sock = connectWithTimeout(ip, port, 2000);
     if (sock == INVALID_SOCKET_HANDLE) {
         return false;
     }
+
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (!m_initialized) {
+        closeSocket(sock);
+        return false;
+    }
      
     // 分配 PeerID 并创建连接
     P2PPeerID peerID = allocatePeerID();
@@ -196,6 +214,7 @@ bool ConnectionManager::connect(const char* ip, uint16_t port, P2PPeerID& outPee
 }
 
 void ConnectionManager::setAutoReconnect(P2PPeerID peerID, bool enable, uint32_t baseDelayMs, uint32_t maxDelayMs) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     auto it = m_connections.find(peerID);
     if (it == m_connections.end()) {
         return;
@@ -209,7 +228,27 @@ void ConnectionManager::setAutoReconnect(P2PPeerID peerID, bool enable, uint32_t
     conn.nextReconnectAtMs = 0;
 }
 
+bool ConnectionManager::enableRelaySession(P2PPeerID peerID, uint64_t localMark, uint32_t flags) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto it = m_connections.find(peerID);
+    if (it == m_connections.end()) {
+        return false;
+    }
+
+    Connection& conn = it->second;
+    conn.relay = RelaySession();
+    conn.relay.enabled = true;
+    conn.relay.localMark = localMark;
+    conn.relay.flags = flags;
+
+    if (conn.connected) {
+        sendRelayHello(conn);
+    }
+    return true;
+}
+
 void ConnectionManager::disconnect(P2PPeerID peerID) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     auto it = m_connections.find(peerID);
     if (it == m_connections.end()) {
         return;
@@ -218,10 +257,15 @@ void ConnectionManager::disconnect(P2PPeerID peerID) {
     Connection& conn = it->second;
     closeSocket(conn.socket);
     conn.socket = INVALID_SOCKET_HANDLE;
+    closeSocket(conn.relay.redirectSocket);
+    conn.relay.redirectSocket = INVALID_SOCKET_HANDLE;
+    closeSocket(conn.reconnectSocket);
+    conn.reconnectSocket = INVALID_SOCKET_HANDLE;
     conn.connected = false;
     conn.recvBuffer.clear();
     conn.receiveQueue.clear();
     conn.sendBuffer.clear();
+    conn.relay.established = false;
     notifyConnectionEvent(peerID, ConnectionEvent::Disconnected);
 
     if (conn.autoReconnect) {
@@ -233,41 +277,554 @@ void ConnectionManager::disconnect(P2PPeerID peerID) {
     m_connections.erase(it);
 }
 
-bool ConnectionManager::sendPacket(P2PPeerID peerID, const void* data, uint32_t size) {
+bool ConnectionManager::sendPacket(P2PPeerID peerID, const void* data, uint32_t size, uint8_t trafficClass) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (!data || size == 0) {
         return false;
     }
 
     auto it = m_connections.find(peerID);
-    if (it == m_connections.end() || !it->second.connected) {
+    if (it == m_connections.end()) {
         return false;
     }
 
     Connection& conn = it->second;
+    RelaySession& session = conn.relay;
+
+    // 续传会话：断线重连期间或 HELLO_ACK 之前先缓存，会话建立后按序发送
+    // 请求紧凑帧或来源标记时 HELLO_ACK 之前同样先缓存：帧格式取决于中继应答的能力位
+    if (session.enabled && (conn.connected || conn.autoReconnect) &&
+        (session.resumable() || (session.defersUntilAck() && !session.established))) {
+        if (session.unackedBytes + size > RELAY_MAX_UNACKED_BYTES) {
+            return false;
+        }
+        session.unacked.push_back({createSendFrame(data, size), trafficClass});
+        session.unackedBytes += session.unacked.back().frame.size();
+        if (!conn.connected || !session.established) {
+            return true;
+        }
+        session.unackedSent = session.unacked.size();
+        const std::vector<uint8_t>& frame = session.unacked.back().frame;
+        return selectTrafficClass(conn, trafficClass) && writeDataFrame(conn, frame.data(), frame.size());
+    }
+
+    if (!conn.connected) {
+        return false;
+    }
 
     std::vector<uint8_t> frame = createSendFrame(data, size);
+    return selectTrafficClass(conn, trafficClass) && writeDataFrame(conn, frame.data(), frame.size());
+}
+
+bool ConnectionManager::isRelayTargetAvailable(P2PPeerID peerID, uint64_t mark) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    auto it = m_connections.find(peerID);
+    if (it == m_connections.end()) {
+        return false;
+    }
+
+    RelaySession& session = it->second.relay;
+    if (!session.enabled || !session.presence) {
+        return true;
+    }
+    // 超过试探时间后放行：目标仍不在线时中继会再回复 NACK，重新开始计时
+    auto absent = session.absentTargets.find(mark);
+    return absent == session.absentTargets.end() || nowMs() >= absent->second;
+}
+
+bool ConnectionManager::isRelayTargetAvailable(P2PPeerID peerID, const void* data, uint32_t size) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    if (!data || size < sizeof(uint64_t)) {
+        return true;
+    }
+    uint64_t mark;
+    std::memcpy(&mark, data, sizeof(mark));
+    return isRelayTargetAvailable(peerID, mark);
+}
+
+const std::vector<uint8_t>& ConnectionManager::encodeRelayFrame(const RelaySession& session,
+                                                                const uint8_t* frame, size_t size,
+                                                                bool compactHeader) {
+    uint32_t header = relay::readU32(frame);
+    const uint8_t* body = frame + relay::FRAME_HEADER_SIZE;
+    uint32_t bodySize = static_cast<uint32_t>(size - relay::FRAME_HEADER_SIZE);
+    bool data = relay::frameType(header) == relay::FRAME_DATA && bodySize >= sizeof(uint64_t);
+    bool insertSource = data && session.insertsSource();
+    uint8_t tag = relay::frameType(header) == relay::FRAME_CTRL ? relay::COMPACT_TAG_CTRL : relay::COMPACT_TAG_DATA;
+    bool slotted = false;
+    if (data && session.compact) {
+        uint64_t mark;
+        std::memcpy(&mark, body, sizeof(mark));
+        auto it = session.peerSlots.find(mark);
+        if (it != session.peerSlots.end()) {
+            tag = it->second;
+            slotted = true;
+        }
+    }
+
+    // 帧体: [目标标记 (有短编号时省略)][本地标记 (需要时)][负载]
+    uint32_t outSize = bodySize - (slotted ? sizeof(uint64_t) : 0) + (insertSource ? sizeof(uint64_t) : 0);
+    uint8_t prefix[relay::COMPACT_HEADER_MAX];
+    uint32_t prefixSize;
+    if (compactHeader) {
+        prefixSize = relay::writeVarint(prefix, outSize + 1);
+        prefix[prefixSize++] = tag;
+    } else {
+        relay::writeFrameHeader(prefix, outSize, relay::frameType(header));
+        prefixSize = relay::FRAME_HEADER_SIZE;
+    }
+    m_frameScratch.assign(prefix, prefix + prefixSize);
+    if (!slotted && insertSource) {
+        m_frameScratch.insert(m_frameScratch.end(), body, body + sizeof(uint64_t));
+    }
+    if (insertSource) {
+        const uint8_t* local = reinterpret_cast<const uint8_t*>(&session.localMark);
+        m_frameScratch.insert(m_frameScratch.end(), local, local + sizeof(uint64_t));
+    }
+    const uint8_t* rest = body + (slotted || insertSource ? sizeof(uint64_t) : 0);
+    m_frameScratch.insert(m_frameScratch.end(), rest, body + bodySize);
+    return m_frameScratch;
+}
+
+bool ConnectionManager::writeFrame(Connection& conn, const uint8_t* frame, size_t size) {
+    if (size >= relay::FRAME_HEADER_SIZE &&
+        (conn.relay.compact ||
+         (conn.relay.insertsSource() && relay::frameType(relay::readU32(frame)) == relay::FRAME_DATA))) {
+        const std::vector<uint8_t>& encoded = encodeRelayFrame(conn.relay, frame, size, conn.relay.compact);
+        return writeRaw(conn, encoded.data(), encoded.size());
+    }
+    return writeRaw(conn, frame, size);
+}
+
+bool ConnectionManager::writeDataFrame(Connection& conn, const uint8_t* frame, size_t size) {
+    RelaySession& session = conn.relay;
+    if (!session.bundle || size < relay::FRAME_HEADER_SIZE) {
+        return writeFrame(conn, frame, size);
+    }
+    constexpr size_t prefixSize = relay::FRAME_HEADER_SIZE + sizeof(uint64_t);
+    if (!session.fanout || size < prefixSize) {
+        return appendHeldFanout(conn) && appendBundleRecord(conn, frame, size);
+    }
+
+    // 扇出：与暂存帧负载相同、发往另一个目标时只记下目标（游戏把同一状态逐个发给每个队友）
+    uint64_t target;
+    std::memcpy(&target, frame + relay::FRAME_HEADER_SIZE, sizeof(target));
+    const std::vector<uint8_t>& held = session.fanoutFrame;
+    if (!session.fanoutTargets.empty() && !relay::isFanoutMark(target) &&
+        !relay::isFanoutMark(session.fanoutTargets.front()) &&
+        session.fanoutTargets.size() < relay::FANOUT_MAX_TARGETS && held.size() == size &&
+        size + (session.fanoutTargets.size() + 2) * sizeof(uint64_t) + relay::COMPACT_HEADER_MAX <=
+            relay::BUNDLE_MAX_SIZE &&
+        std::memcmp(held.data() + prefixSize, frame + prefixSize, size - prefixSize) == 0 &&
+        std::find(session.fanoutTargets.begin(), session.fanoutTargets.end(), target) ==
+            session.fanoutTargets.end()) {
+        session.fanoutTargets.push_back(target);
+        return true;
+    }
+    if (!appendHeldFanout(conn)) {
+        return false;
+    }
+    session.fanoutFrame.assign(frame, frame + size);
+    session.fanoutTargets.assign(1, target);
+    return true;
+}
+
+bool ConnectionManager::appendHeldFanout(Connection& conn) {
+    RelaySession& session = conn.relay;
+    size_t count = session.fanoutTargets.size();
+    if (count == 0) {
+        return true;
+    }
+    if (count == 1) {
+        // appendBundleRecord 可能调用 flushBundle，先清空暂存状态
+        session.fanoutTargets.clear();
+        return appendBundleRecord(conn, session.fanoutFrame.data(), session.fanoutFrame.size());
+    }
+
+    // [帧头][FANOUT_MULTICAST][目标数][目标标记...][负载]
+    constexpr size_t prefixSize = relay::FRAME_HEADER_SIZE + sizeof(uint64_t);
+    const std::vector<uint8_t>& held = session.fanoutFrame;
+    size_t bodySize = sizeof(uint64_t) + 1 + count * sizeof(uint64_t) + (held.size() - prefixSize);
+    m_fanoutScratch.resize(relay::FRAME_HEADER_SIZE + bodySize);
+    uint8_t* out = m_fanoutScratch.data();
+    relay::writeFrameHeader(out, static_cast<uint32_t>(bodySize), relay::FRAME_DATA);
+    out += relay::FRAME_HEADER_SIZE;
+    relay::writeU64(out, relay::FANOUT_MULTICAST);
+    out += sizeof(uint64_t);
+    *out++ = static_cast<uint8_t>(count);
+    std::memcpy(out, session.fanoutTargets.data(), count * sizeof(uint64_t));
+    out += count * sizeof(uint64_t);
+    std::memcpy(out, held.data() + prefixSize, held.size() - prefixSize);
+    session.fanoutTargets.clear();
+    return appendBundleRecord(conn, m_fanoutScratch.data(), m_fanoutScratch.size());
+}
+
+bool ConnectionManager::appendBundleRecord(Connection& conn, const uint8_t* frame, size_t size) {
+    RelaySession& session = conn.relay;
+    // 记录最多比原帧多出本地标记与记录头；装不下时先发出已有记录（flushBundle 会复用编码缓冲区，须在编码前）
+    size_t maxRecord = size - relay::FRAME_HEADER_SIZE + sizeof(uint64_t) + relay::COMPACT_HEADER_MAX;
+    if (session.bundleBuf.size() + maxRecord > relay::BUNDLE_MAX_SIZE && !flushBundle(conn)) {
+        return false;
+    }
+    const std::vector<uint8_t>& record = encodeRelayFrame(session, frame, size, true);
+    session.bundleBuf.insert(session.bundleBuf.end(), record.begin(), record.end());
+    session.bundleRecords++;
+    return true;
+}
+
+bool ConnectionManager::flushBundle(Connection& conn) {
+    RelaySession& session = conn.relay;
+    if (!appendHeldFanout(conn)) {
+        return false;
+    }
+    if (session.bundleRecords == 0) {
+        return true;
+    }
+
+    uint8_t header[relay::COMPACT_HEADER_MAX];
+    uint32_t headerSize;
+    const uint8_t* body = session.bundleBuf.data();
+    uint32_t bodySize = static_cast<uint32_t>(session.bundleBuf.size());
+    if (session.bundleRecords == 1 && session.compact) {
+        // 单条记录本身就是紧凑数据帧
+        headerSize = 0;
+    } else if (session.bundleRecords == 1) {
+        // v1：去掉记录头，帧体即 [目标标记][负载]
+        uint32_t recordSize = 0;
+        int varintSize = relay::readVarint(body, bodySize, recordSize);
+        body += varintSize + 1;
+        bodySize = recordSize - 1;
+        relay::writeFrameHeader(header, bodySize, relay::FRAME_DATA);
+        headerSize = relay::FRAME_HEADER_SIZE;
+    } else if (session.compact) {
+        headerSize = relay::writeVarint(header, bodySize + 1);
+        header[headerSize++] = relay::COMPACT_TAG_BUNDLE;
+    } else {
+        relay::writeFrameHeader(header, bodySize, relay::FRAME_BUNDLE);
+        headerSize = relay::FRAME_HEADER_SIZE;
+    }
+
+    // 帧头与记录一次写出
+    m_frameScratch.assign(header, header + headerSize);
+    m_frameScratch.insert(m_frameScratch.end(), body, body + bodySize);
+    session.bundleBuf.clear();
+    session.bundleRecords = 0;
+    return writeRaw(conn, m_frameScratch.data(), m_frameScratch.size());
+}
+
+bool ConnectionManager::selectTrafficClass(Connection& conn, uint8_t trafficClass) {
+    RelaySession& session = conn.relay;
+    if (!session.lanes || trafficClass == session.txClass) {
+        return true;
+    }
+    // 类别对之后的数据帧生效：已打包的记录仍按原类别发出
+    if (session.bundlePending() && !flushBundle(conn)) {
+        return false;
+    }
+    uint8_t body[relay::CTRL_CLASS_SIZE] = {relay::CTRL_CLASS, trafficClass};
+    std::vector<uint8_t> frame = createSendFrame(body, sizeof(body), relay::FRAME_CTRL);
+    session.txClass = trafficClass;
+    return writeFrame(conn, frame.data(), frame.size());
+}
+
+bool ConnectionManager::writeRaw(Connection& conn, const uint8_t* frame, size_t size) {
+    // 已有积压数据时直接排在后面，避免新帧越过旧帧乱序
+    if (!conn.sendBuffer.empty()) {
+        conn.sendBuffer.insert(conn.sendBuffer.end(), frame, frame + size);
+        return true;
+    }
 
-    int sent = send(conn.socket, reinterpret_cast<const char*>(frame.data()),
-                    static_cast<int>(frame.size()), 0);
+    int sent = send(conn.socket, reinterpret_cast<const char*>(frame),
+                    static_cast<int>(size), SEND_FLAGS);
 
     if (sent < 0) {
         if (wouldBlock()) {
-            conn.sendBuffer.insert(conn.sendBuffer.end(), frame.begin(), frame.end());
+            conn.sendBuffer.insert(conn.sendBuffer.end(), frame, frame + size);
             return true;
         }
         conn.connected = false;
-        m_pendingRemove.push_back(peerID);
+        m_pendingRemove.push_back(conn.peerID);
         return false;
     }
 
-    if (static_cast<size_t>(sent) < frame.size()) {
-        conn.sendBuffer.insert(conn.sendBuffer.end(), frame.begin() + sent, frame.end());
+    if (static_cast<size_t>(sent) < size) {
+        conn.sendBuffer.insert(conn.sendBuffer.end(), frame + sent, frame + size);
     }
 
     return true;
 }
 
+void ConnectionManager::sendRelayHello(Connection& conn) {
+    RelaySession& session = conn.relay;
+    session.established = false;
+
+    // 重定向次数用完时不再声明 CAP_REDIRECT，由当前节点直接注册，避免在节点之间来回跳转
+    uint32_t caps = relay::CAP_HEARTBEAT | (session.redirects < RELAY_MAX_REDIRECTS ? relay::CAP_REDIRECT : 0) |
+                    (session.resumable() ? relay::CAP_RESUME : 0) |
+                    (session.wantsPresence() ? relay::CAP_PRESENCE : 0) |
+                    (session.wantsCompact() ? relay::CAP_COMPACT : 0) |
+                    (session.wantsSource() ? relay::CAP_SOURCE : 0) |
+                    (session.wantsBundle() ? relay::CAP_BUNDLE : 0) |
+                    (session.wantsFanout() ? relay::CAP_FANOUT : 0) |
+                    (session.wantsLanes() ? relay::CAP_LANES : 0);
+    // HELLO 与 HELLO_ACK 总是 v1 帧
+    session.compact = false;
+    session.peerSlots.clear();
+    session.slotMarks.clear();
+    session.sourceStamped = false;
+    // 未发出的记录随旧连接作废（续传会话的数据帧仍在 unacked 中，会话恢复后重发）
+    session.bundle = false;
+    session.bundleBuf.clear();
+    session.bundleRecords = 0;
+    session.fanout = false;
+    session.fanoutTargets.clear();
+    // 新连接上中继从 CLASS_RELIABLE 开始
+    session.lanes = false;
+    session.txClass = relay::CLASS_RELIABLE;
+    conn.recvBuffer.setCompact(false);
+    session.lastRxMs = nowMs();
+    session.lastPingMs = session.lastRxMs;
+    // 出示上次的会话令牌：旧连接若仍占用标记可被立即接管，启用续传时同时恢复会话
+    bool resume = session.token != 0;
+
+    uint8_t body[relay::HELLO_FIXED_SIZE + relay::TLV_HEADER_SIZE + relay::TLV_RESUME_SIZE];
+    uint32_t bodySize = relay::HELLO_FIXED_SIZE;
+    body[0] = relay::CTRL_HELLO;
+    body[1] = relay::PROTOCOL_VERSION;
+    relay::writeU32(body + 2, caps);
+    std::memcpy(body + 6, &session.localMark, sizeof(session.localMark));
+    if (resume) {
+        uint8_t* tlv = body + bodySize;
+        tlv[0] = relay::TLV_RESUME;
+        relay::writeU16(tlv + 1, static_cast<uint16_t>(relay::TLV_RESUME_SIZE));
+        relay::writeU64(tlv + 3, session.token);
+        relay::writeU64(tlv + 11, session.rxCount);
+        bodySize += relay::TLV_HEADER_SIZE + relay::TLV_RESUME_SIZE;
+    }
+
+    std::vector<uint8_t> frame = createSendFrame(body, bodySize, relay::FRAME_CTRL);
+    writeFrame(conn, frame.data(), frame.size());
+    session.rxAcked = session.rxCount;
+}
+
+void ConnectionManager::handleRelayControl(Connection& conn, const Packet& packet) {
+    RelaySession& session = conn.relay;
+    if (!session.enabled || packet.empty()) {
+        return;
+    }
+
+    const uint8_t* body = packet.data.data();
+    if (body[0] == relay::CTRL_HELLO_ACK && packet.size() >= relay::HELLO_ACK_SIZE) {
+        uint8_t status = body[1];
+        uint64_t token = relay::readU64(body + 2);
+        uint64_t relayRx = relay::readU64(body + 10);
+        uint32_t caps = relay::readU32(body + 18);
+
+        if (relay::helloFailed(status)) {
+            // 注册被拒绝（如标记被占用）：中继随后关闭连接，按断线处理，自动重连时再试
+            session.lastError = status;
+            conn.connected = false;
+            m_pendingRemove.push_back(conn.peerID);
+            return;
+        }
+        session.lastError = 0;
+        session.redirects = 0;
+        session.slot = relay::readU32(body + 23);
+        session.serverCaps = relay::readU32(body + 27);
+
+        if (status == relay::HELLO_RESUMED) {
+            // 中继已收到 relayRx 帧：丢弃这些帧，其余按序重发
+            while (!session.unacked.empty() && session.unackedBase <= relayRx) {
+                session.unackedBytes -= session.unacked.front().frame.size();
+                session.unacked.pop_front();
+                session.unackedBase++;
+            }
+        } else {
+            // 新会话：旧会话已无法恢复，断线前已写出的帧不再重发，其余帧重新从1编号
+            size_t drop = (std::min)(session.unackedSent, session.unacked.size());
+            for (size_t i = 0; i < drop; i++) {
+                session.unackedBytes -= session.unacked.front().frame.size();
+                session.unacked.pop_front();
+            }
+            session.unackedBase = 1;
+            session.rxCount = 0;
+            session.rxAcked = 0;
+        }
+
+        session.token = token;
+        session.established = true;
+        session.heartbeat = (caps & relay::CAP_HEARTBEAT) != 0;
+        // 中继随后下发在线快照，之前记录的离线目标以新快照与 NACK 为准
+        session.presence = (caps & relay::CAP_PRESENCE) != 0;
+        session.absentTargets.clear();
+        // 之后收发的帧都是紧凑帧（本次解析循环中的下一帧起生效）
+        session.compact = (caps & relay::CAP_COMPACT) != 0;
+        conn.recvBuffer.setCompact(session.compact);
+        session.sourceStamped = (caps & relay::CAP_SOURCE) != 0;
+        session.bundle = (caps & relay::CAP_BUNDLE) != 0;
+        session.fanout = (caps & relay::CAP_FANOUT) != 0;
+        // 新连接上中继按 CLASS_RELIABLE 记录上行类别；重发的缓存帧按各自发送时的类别发出
+        session.lanes = (caps & relay::CAP_LANES) != 0;
+        session.txClass = relay::CLASS_RELIABLE;
+        if (!(caps & relay::CAP_RESUME)) {
+            // 中继未启用续传：直接发出缓存的帧，之后不再保留
+            session.flags &= ~P2P_RELAY_FLAG_RESUME;
+            for (const auto& pending : session.unacked) {
+                if (selectTrafficClass(conn, pending.trafficClass)) {
+                    writeDataFrame(conn, pending.frame.data(), pending.frame.size());
+                }
+            }
+            session.unacked.clear();
+            session.unackedBytes = 0;
+            session.unackedSent = 0;
+            return;
+        }
+        for (const auto& pending : session.unacked) {
+            if (!selectTrafficClass(conn, pending.trafficClass) ||
+                !writeDataFrame(conn, pending.frame.data(), pending.frame.size())) {
+                break;
+            }
+        }
+        session.unackedSent = session.unacked.size();
+    } else if (body[0] == relay::CTRL_REDIRECT && packet.size() >= relay::CTRL_REDIRECT_SIZE) {
+        followRelayRedirect(conn, body);
+    } else if (body[0] == relay::CTRL_PING && packet.size() >= relay::CTRL_PING_SIZE) {
+        // 原样带回时间戳，中继据此测量RTT
+        uint8_t pong[relay::CTRL_PING_SIZE];
+        pong[0] = relay::CTRL_PONG;
+        std::memcpy(pong + 1, body + 1, 8);
+        std::vector<uint8_t> frame = createSendFrame(pong, sizeof(pong), relay::FRAME_CTRL);
+        writeFrame(conn, frame.data(), frame.size());
+    } else if ((body[0] == relay::CTRL_PEER_JOIN || body[0] == relay::CTRL_PEER_LEAVE) &&
+               packet.size() >= relay::CTRL_PEER_EVENT_SIZE) {
+        uint64_t mark;
+        std::memcpy(&mark, body + 1, sizeof(mark));
+        bool online = body[0] == relay::CTRL_PEER_JOIN;
+        if (online) {
+            session.absentTargets.erase(mark);
+            if (session.compact && packet.size() >= relay::CTRL_PEER_JOIN_COMPACT_SIZE &&
+                body[relay::CTRL_PEER_EVENT_SIZE] != 0) {
+                session.peerSlots[mark] = body[relay::CTRL_PEER_EVENT_SIZE];
+                session.slotMarks[body[relay::CTRL_PEER_EVENT_SIZE]] = mark;
+            }
+        } else {
+            session.absentTargets[mark] = nowMs() + RELAY_ABSENT_RETRY_MS;
+        }
+        if (m_presenceCallback) {
+            m_presenceCallback(conn.peerID, mark, online);
+        }
+    } else if (body[0] == relay::CTRL_NACK && packet.size() >= relay::CTRL_NACK_SIZE) {
+        // 目标未注册（对方尚未上线或已离开）：暂停发送，等待上线通知或下次试探
+        uint64_t mark;
+        std::memcpy(&mark, body + 2, sizeof(mark));
+        bool known = session.absentTargets.count(mark) != 0;
+        session.absentTargets[mark] = nowMs() + RELAY_ABSENT_RETRY_MS;
+        if (!known && m_presenceCallback) {
+            m_presenceCallback(conn.peerID, mark, false);
+        }
+    } else if (body[0] == relay::CTRL_ACK && packet.size() >= relay::CTRL_ACK_SIZE) {
+        uint64_t count = relay::readU64(body + 1);
+        while (!session.unacked.empty() && session.unackedBase <= count) {
+            session.unackedBytes -= session.unacked.front().frame.size();
+            session.unacked.pop_front();
+            session.unackedBase++;
+            if (session.unackedSent > 0) {
+                session.unackedSent--;
+            }
+        }
+    }
+}
+
+void ConnectionManager::followRelayRedirect(Connection& conn, const uint8_t* body) {
+    RelaySession& session = conn.relay;
+    if (session.established || session.redirects >= RELAY_MAX_REDIRECTS || session.redirectPending()) {
+        return;
+    }
+    // 只发起连接，由 processEvents 在 socket 可写后完成切换；连不上时保持原连接，中继随后关闭它，
+    // 按断线处理（自动重连时回到原节点）
+    std::string ip = std::to_string(body[3]) + "." + std::to_string(body[4]) + "." + std::to_string(body[5]) + "." +
+                     std::to_string(body[6]);
+    uint16_t port = relay::readU16(body + 7);
+    bool inProgress = false;
+    SocketHandle sock = startConnect(ip.c_str(), port, inProgress);
+    if (sock == INVALID_SOCKET_HANDLE) {
+        return;
+    }
+    session.redirectSocket = sock;
+    session.redirectIP = ip;
+    session.redirectPort = port;
+    session.redirectDeadlineMs = nowMs() + RELAY_REDIRECT_TIMEOUT_MS;
+    if (!inProgress) {
+        finishRelayRedirect(conn, true);
+    }
+}
+
+void ConnectionManager::finishRelayRedirect(Connection& conn, bool connected) {
+    RelaySession& session = conn.relay;
+    SocketHandle sock = session.redirectSocket;
+    session.redirectSocket = INVALID_SOCKET_HANDLE;
+    if (!connected) {
+        closeSocket(sock);
+        // 原连接已被中继关闭（见 removeDisconnected）：现在按断线处理
+        if (conn.socket == INVALID_SOCKET_HANDLE) {
+            m_pendingRemove.push_back(conn.peerID);
+        }
+        return;
+    }
+    // PeerID 与会话状态不变：续传会话的缓存帧在新节点注册成功后照常重发；
+    // 旧连接上 HELLO_ACK 之前写出的其他数据随旧连接丢弃（与注册被拒绝时相同）
+    closeSocket(conn.socket);
+    conn.socket = sock;
+    conn.connected = true;
+    conn.remoteIP = session.redirectIP;
+    conn.remotePort = session.redirectPort;
+    conn.recvBuffer.clear();
+    conn.sendBuffer.clear();
+    session.redirects++;
+    sendRelayHello(conn);
+}
+
+void ConnectionManager::sendRelayAck(Connection& conn, uint64_t now) {
+    RelaySession& session = conn.relay;
+    if (!session.enabled || !session.established || !session.resumable() || session.rxCount == session.rxAcked) {
+        return;
+    }
+    if (session.rxCount - session.rxAcked < relay::ACK_EVERY_FRAMES && now - session.lastAckMs < RELAY_ACK_INTERVAL_MS) {
+        return;
+    }
+
+    uint8_t body[relay::CTRL_ACK_SIZE];
+    body[0] = relay::CTRL_ACK;
+    relay::writeU64(body + 1, session.rxCount);
+    std::vector<uint8_t> frame = createSendFrame(body, sizeof(body), relay::FRAME_CTRL);
+    writeFrame(conn, frame.data(), frame.size());
+    session.rxAcked = session.rxCount;
+    session.lastAckMs = now;
+}
+
+void ConnectionManager::checkRelayHeartbeat(Connection& conn, uint64_t now) {
+    RelaySession& session = conn.relay;
+    if (!session.enabled || !session.established || !session.heartbeat || now < session.lastRxMs) {
+        return;
+    }
+    if (now - session.lastRxMs >= RELAY_IDLE_TIMEOUT_MS) {
+        // 网络中断时通常收不到 FIN/RST，这里主动断开
+        conn.connected = false;
+        m_pendingRemove.push_back(conn.peerID);
+        return;
+    }
+    if (now - session.lastRxMs >= RELAY_PING_INTERVAL_MS && now - session.lastPingMs >= RELAY_PING_INTERVAL_MS) {
+        uint8_t body[relay::CTRL_PING_SIZE];
+        body[0] = relay::CTRL_PING;
+        relay::writeU64(body + 1, now);
+        std::vector<uint8_t> frame = createSendFrame(body, sizeof(body), relay::FRAME_CTRL);
+        writeFrame(conn, frame.data(), frame.size());
+        session.lastPingMs = now;
+    }
+}
+
 bool ConnectionManager::isPacketAvailable(P2PPeerID peerID, uint32_t* outSize, P2PPeerID* outPeerID) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (peerID != P2P_INVALID_PEER_ID) {
         auto it = m_connections.find(peerID);
         if (it == m_connections.end()) {
@@ -305,6 +862,7 @@ bool ConnectionManager::isPacketAvailable(P2PPeerID peerID, uint32_t* outSize, P
 
 bool ConnectionManager::readPacket(P2PPeerID peerID, void* buffer, uint32_t bufferSize,
                                   uint32_t* outReadSize, P2PPeerID* outPeerID) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (!buffer || bufferSize == 0) {
         return false;
     }
@@ -356,6 +914,7 @@ bool ConnectionManager::readPacket(P2PPeerID peerID, void* buffer, uint32_t buff
 }
 
 void ConnectionManager::processEvents() {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (!m_initialized) {
         return;
     }
@@ -365,6 +924,13 @@ void ConnectionManager::processEvents() {
     // 接受新连接
     acceptNewConnections();
     
+    // 上次 processEvents 之后发送的数据包合并为打包帧发出
+    for (auto& [peerID, conn] : m_connections) {
+        if (conn.connected && conn.relay.bundlePending()) {
+            flushBundle(conn);
+        }
+    }
+    
     // 处理现有连接
     fd_set readSet, writeSet, exceptSet;
     FD_ZERO(&readSet);
@@ -372,8 +938,31 @@ void ConnectionManager::processEvents() {
     FD_ZERO(&exceptSet);
     
     SocketHandle maxFd = 0;
+    const uint64_t now = nowMs();
     
     for (auto& [peerID, conn] : m_connections) {
+        // 正在进行的重连：可写（或异常）时连接完成，超时则按失败处理
+        if (conn.reconnectPending()) {
+            if (now >= conn.reconnectDeadlineMs) {
+                finishReconnect(conn, false);
+            } else {
+                FD_SET(conn.reconnectSocket, &writeSet);
+                FD_SET(conn.reconnectSocket, &exceptSet);
+                maxFd = (std::max)(maxFd, conn.reconnectSocket);
+            }
+        }
+
+        // 正在连接的重定向目标：可写（或异常）时连接完成，超时则放弃
+        if (conn.relay.redirectPending()) {
+            if (now >= conn.relay.redirectDeadlineMs) {
+                finishRelayRedirect(conn, false);
+            } else {
+                FD_SET(conn.relay.redirectSocket, &writeSet);
+                FD_SET(conn.relay.redirectSocket, &exceptSet);
+                maxFd = (std::max)(maxFd, conn.relay.redirectSocket);
+            }
+        }
+
         if (conn.socket != INVALID_SOCKET_HANDLE && conn.connected) {
             FD_SET(conn.socket, &readSet);
             FD_SET(conn.socket, &exceptSet);
@@ -404,6 +993,22 @@ void ConnectionManager::processEvents() {
     
     if (result > 0) {
         for (auto& [peerID, conn] : m_connections) {
+            SocketHandle reconnect = conn.reconnectSocket;
+            if (reconnect != INVALID_SOCKET_HANDLE &&
+                (FD_ISSET(reconnect, &writeSet) || FD_ISSET(reconnect, &exceptSet))) {
+                // 重连期间没有当前连接，本轮不再处理
+                finishReconnect(conn, !FD_ISSET(reconnect, &exceptSet) && connectSucceeded(reconnect));
+                continue;
+            }
+
+            SocketHandle redirect = conn.relay.redirectSocket;
+            if (redirect != INVALID_SOCKET_HANDLE &&
+                (FD_ISSET(redirect, &writeSet) || FD_ISSET(redirect, &exceptSet))) {
+                // 切换后本轮不再处理该连接（集合中的位属于旧 socket 或新 socket 的连接事件）
+                finishRelayRedirect(conn, !FD_ISSET(redirect, &exceptSet) && connectSucceeded(redirect));
+                continue;
+            }
+
             if (conn.socket == INVALID_SOCKET_HANDLE || !conn.connected) {
                 continue;
             }
@@ -427,21 +1032,37 @@ void ConnectionManager::processEvents() {
         }
     }
     
+    // 续传会话的累计确认与心跳
+    for (auto& [peerID, conn] : m_connections) {
+        if (conn.connected && conn.relay.enabled) {
+            sendRelayAck(conn, now);
+            checkRelayHeartbeat(conn, now);
+        }
+    }
+    
     // 移除断开的连接
     removeDisconnected();
 
     attemptReconnects();
 }
 
+void ConnectionManager::setPresenceCallback(PresenceCallback callback) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
+    m_presenceCallback = std::move(callback);
+}
+
 void ConnectionManager::setConnectionCallback(ConnectionCallback callback) {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     m_connectionCallback = std::move(callback);
 }
 
 uint32_t ConnectionManager::getPeerCount() const {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     return static_cast<uint32_t>(m_connections.size());
 }
 
 uint32_t ConnectionManager::getConnectedPeers(P2PPeerID* outPeerIDs, uint32_t maxCount) const {
+    std::lock_guard<std::recursive_mutex> lock(m_mutex);
     if (!outPeerIDs || maxCount == 0) {
         return 0;
     }
@@ -467,7 +1088,7 @@ void ConnectionManager::acceptNewConnections() {
     
     while (true) {
         sockaddr_in clientAddr{};
-        int addrLen = sizeof(clientAddr);
+        socklen_t addrLen = sizeof(clientAddr);
         
         SocketHandle clientSocket = accept(m_listenSocket, 
                                            reinterpret_cast<sockaddr*>(&clientAddr),
@@ -511,11 +1132,22 @@ void ConnectionManager::processRead(Connection& conn) {
         if (received > 0) {
             // 追加到接收缓冲区
             conn.recvBuffer.append(buffer, static_cast<uint32_t>(received));
+            if (conn.relay.enabled) {
+                conn.relay.lastRxMs = nowMs();
+            }
             
             // 尝试解析完整数据包
             Packet packet;
             while (conn.recvBuffer.tryParsePacket(packet)) {
-                conn.receiveQueue.push(std::move(packet));
+                if (packet.type == relay::FRAME_CTRL) {
+                    handleRelayControl(conn, packet);
+                    continue;
+                }
+                if (packet.type == relay::FRAME_BUNDLE) {
+                    unpackBundle(conn, packet);
+                    continue;
+                }
+                deliverDataPacket(conn, packet);
             }
         } else if (received == 0) {
             // 连接正常关闭
@@ -535,6 +1167,46 @@ void ConnectionManager::processRead(Connection& conn) {
     }
 }
 
+void ConnectionManager::deliverDataPacket(Connection& conn, Packet& packet) {
+    if (conn.relay.enabled) {
+        conn.relay.rxCount++;
+    }
+    if (packet.slot != 0) {
+        // 中继以短编号标识来源：还原为 [来源标记][负载]
+        auto source = conn.relay.slotMarks.find(packet.slot);
+        if (source == conn.relay.slotMarks.end()) {
+            return;
+        }
+        const uint8_t* mark = reinterpret_cast<const uint8_t*>(&source->second);
+        packet.data.insert(packet.data.begin(), mark, mark + sizeof(uint64_t));
+        packet.slot = 0;
+    }
+    conn.receiveQueue.push(std::move(packet));
+}
+
+void ConnectionManager::unpackBundle(Connection& conn, const Packet& packet) {
+    const uint8_t* data = packet.data.data();
+    uint32_t size = packet.size();
+    uint32_t pos = 0;
+    while (pos < size) {
+        uint32_t recordSize = 0;
+        int varintSize = relay::readVarint(data + pos, size - pos, recordSize);
+        if (varintSize <= 0 || recordSize == 0 || recordSize > size - pos - static_cast<uint32_t>(varintSize)) {
+            return;
+        }
+        uint8_t tag = data[pos + varintSize];
+        const uint8_t* body = data + pos + varintSize + 1;
+        pos += static_cast<uint32_t>(varintSize) + recordSize;
+        if (tag == relay::COMPACT_TAG_CTRL || tag == relay::COMPACT_TAG_BUNDLE) {
+            continue;
+        }
+        Packet record(body, recordSize - 1);
+        record.type = relay::FRAME_DATA;
+        record.slot = tag == relay::COMPACT_TAG_DATA ? 0 : tag;
+        deliverDataPacket(conn, record);
+    }
+}
+
 void ConnectionManager::processWrite(Connection& conn) {
     if (conn.sendBuffer.empty()) {
         return;
@@ -542,7 +1214,7 @@ void ConnectionManager::processWrite(Connection& conn) {
     
     int sent = send(conn.socket, 
                     reinterpret_cast<const char*>(conn.sendBuffer.data()),
-                    static_cast<int>(conn.sendBuffer.size()), 0);
+                    static_cast<int>(conn.sendBuffer.size()), SEND_FLAGS);
     
     if (sent > 0) {
         conn.sendBuffer.erase(conn.sendBuffer.begin(), 
@@ -568,8 +1240,16 @@ void ConnectionManager::removeDisconnected() {
             conn.socket = INVALID_SOCKET_HANDLE;
             conn.connected = false;
             conn.recvBuffer.clear();
-            conn.receiveQueue.clear();
             conn.sendBuffer.clear();
+            if (conn.relay.redirectPending()) {
+                // 中继发出重定向后关闭原连接：等待目标节点的连接结果，失败时再按断线处理
+                continue;
+            }
+            conn.relay.established = false;
+            // 续传会话中已收到的数据包已计入确认序号，不能丢弃
+            if (!conn.relay.enabled || !conn.relay.resumable() || !conn.autoReconnect) {
+                conn.receiveQueue.clear();
+            }
             notifyConnectionEvent(peerID, ConnectionEvent::Disconnected);
 
             if (conn.autoReconnect) {
@@ -598,34 +1278,49 @@ void ConnectionManager::attemptReconnects() {
         if (conn.remoteIP.empty() || conn.remotePort == 0) {
             continue;
         }
-        if (conn.nextReconnectAtMs == 0 || now < conn.nextReconnectAtMs) {
+        if (conn.reconnectPending() || conn.nextReconnectAtMs == 0 || now < conn.nextReconnectAtMs) {
             continue;
         }
 
-        SocketHandle sock = connectWithTimeout(conn.remoteIP.c_str(), conn.remotePort, 2000);
-        if (sock != INVALID_SOCKET_HANDLE) {
-            conn.socket = sock;
-            conn.connected = true;
-            conn.reconnectAttempt = 0;
-            conn.nextReconnectAtMs = 0;
-            notifyConnectionEvent(peerID, ConnectionEvent::Connected);
-            continue;
+        // 在持锁的事件泵中不能阻塞等待连接完成（游戏线程的发送与读取都要等这把锁）
+        bool inProgress = false;
+        conn.reconnectSocket = startConnect(conn.remoteIP.c_str(), conn.remotePort, inProgress);
+        conn.reconnectDeadlineMs = now + RECONNECT_TIMEOUT_MS;
+        if (!conn.reconnectPending() || !inProgress) {
+            finishReconnect(conn, conn.reconnectPending());
         }
+    }
+}
 
-        const uint32_t attempt = conn.reconnectAttempt;
-        conn.reconnectAttempt = (attempt == (std::numeric_limits<uint32_t>::max)()) ? attempt : (attempt + 1);
-
-        uint64_t delay = static_cast<uint64_t>(conn.reconnectBaseDelayMs);
-        for (uint32_t i = 0; i < attempt; i++) {
-            delay *= 2;
-            if (delay >= conn.reconnectMaxDelayMs) {
-                delay = conn.reconnectMaxDelayMs;
-                break;
-            }
+void ConnectionManager::finishReconnect(Connection& conn, bool connected) {
+    SocketHandle sock = conn.reconnectSocket;
+    conn.reconnectSocket = INVALID_SOCKET_HANDLE;
+    if (connected) {
+        conn.socket = sock;
+        conn.connected = true;
+        conn.reconnectAttempt = 0;
+        conn.nextReconnectAtMs = 0;
+        if (conn.relay.enabled) {
+            sendRelayHello(conn);
         }
+        notifyConnectionEvent(conn.peerID, ConnectionEvent::Connected);
+        return;
+    }
+    closeSocket(sock);
+
+    const uint32_t attempt = conn.reconnectAttempt;
+    conn.reconnectAttempt = (attempt == (std::numeric_limits<uint32_t>::max)()) ? attempt : (attempt + 1);
 
-        conn.nextReconnectAtMs = now + delay;
+    uint64_t delay = static_cast<uint64_t>(conn.reconnectBaseDelayMs);
+    for (uint32_t i = 0; i < attempt; i++) {
+        delay *= 2;
+        if (delay >= conn.reconnectMaxDelayMs) {
+            delay = conn.reconnectMaxDelayMs;
+            break;
+        }
     }
+
+    conn.nextReconnectAtMs = nowMs() + delay;
 }
 
 void ConnectionManager::notifyConnectionEvent(P2PPeerID peerID, ConnectionEvent event) {
@@ -634,15 +1329,13 @@ void ConnectionManager::notifyConnectionEvent(P2PPeerID peerID, ConnectionEvent
     }
 }
 
-std::vector<uint8_t> ConnectionManager::createSendFrame(const void* data, uint32_t size) {
+std::vector<uint8_t> ConnectionManager::createSendFrame(const void* data, uint32_t size, uint8_t type) {
     std::vector<uint8_t> frame;
     frame.reserve(4 + size);
     
-    // 写入长度头 (小端序)
-    frame.push_back(static_cast<uint8_t>(size & 0xFF));
-    frame.push_back(static_cast<uint8_t>((size >> 8) & 0xFF));
-    frame.push_back(static_cast<uint8_t>((size >> 16) & 0xFF));
-    frame.push_back(static_cast<uint8_t>((size >> 24) & 0xFF));
+    // 写入帧头 (小端序): 低24位长度，高8位帧类型
+    frame.resize(relay::FRAME_HEADER_SIZE);
+    relay::writeFrameHeader(frame.data(), size, type);
     
     // 写入数据
     const uint8_t* bytes = static_cast<const uint8_t*>(data);
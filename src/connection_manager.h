@@ -2,17 +2,105 @@
 #define CONNECTION_MANAGER_H
 
 #include "platform_win.h"
+#include "platform_posix.h"
 #include "packet_queue.h"
 #include <p2p_network.h>
 
 #include <unordered_map>
+#include <deque>
 #include <vector>
 #include <string>
 #include <functional>
+#include <mutex>
+#include <atomic>
 #include <cstdint>
 
 namespace p2p {
 
+/**
+ * 中继尚未确认的数据帧：重发时按原类别发出
+ */
+struct UnackedFrame {
+    std::vector<uint8_t> frame;  // 含帧头
+    uint8_t trafficClass = 0;    // 发送时的类别 (relay::TrafficClass)
+};
+
+/**
+ * 中继会话 - 连接到 relay_server 时使用扩展注册 (CTRL_HELLO)
+ *
+ * 启用断线续传后，双向数据帧按序编号：发出的帧保留到中继确认为止，
+ * 断线重连时携带会话令牌恢复会话，只重发中继尚未收到的帧。
+ * 中继支持心跳时，长时间收不到任何数据即视为断线（触发自动重连并接管旧连接）。
+ * 启用在线通知后，根据中继的上线/下线事件与 NACK 记录不在线的目标标记，不再向其发送。
+ * 启用紧凑帧后，HELLO_ACK 之后的帧使用变长帧头，数据包前8字节目标标记换成中继分配的短编号。
+ * 启用来源标记后，发出的数据包不带本地标记，由中继补上；中继不支持时在发出前由库补上。
+ * 启用打包帧后，两次 processEvents 之间发送的数据包先编码为记录，在下一次 processEvents 开始时合并为一帧发出。
+ * 启用出站调度后，数据包类别变化时先发出已打包的记录，再以 CTRL_CLASS 通知中继。
+ */
+struct RelaySession {
+    bool enabled = false;
+    uint64_t localMark = 0;
+    uint32_t flags = 0;          // P2P_RELAY_FLAG_*
+    bool established = false;    // 当前连接已收到 HELLO_ACK
+    uint64_t token = 0;          // 会话令牌 (重连时出示，用于接管旧连接/恢复会话)
+    uint32_t slot = 0;           // 中继分配的槽位号
+    uint32_t serverCaps = 0;     // 中继支持的全部能力位
+    uint8_t lastError = 0;       // 最近一次注册失败的状态 (relay::HELLO_ERR_*)，0为无
+    uint32_t redirects = 0;      // 本次注册已跟随的 CTRL_REDIRECT 次数（注册成功后清零）
+    SocketHandle redirectSocket = INVALID_SOCKET_HANDLE;  // 正在连接的重定向目标，连上后替换当前连接
+    std::string redirectIP;
+    uint16_t redirectPort = 0;
+    uint64_t redirectDeadlineMs = 0;
+
+    uint64_t rxCount = 0;        // 已收到的中继数据帧数
+    uint64_t rxAcked = 0;        // 已确认给中继的 rxCount
+    uint64_t lastAckMs = 0;
+
+    bool heartbeat = false;      // 中继支持心跳 (HELLO_ACK 能力位含 CAP_HEARTBEAT)
+    uint64_t lastRxMs = 0;       // 最近一次从中继收到数据的时间
+    uint64_t lastPingMs = 0;     // 最近一次主动发送 CTRL_PING 的时间
+
+    bool presence = false;       // 中继支持在线通知 (HELLO_ACK 能力位含 CAP_PRESENCE)
+    std::unordered_map<uint64_t, uint64_t> absentTargets;  // 已知不在线的目标标记 -> 下次放行试探的时间
+
+    bool compact = false;        // 当前连接已切换为紧凑帧 (HELLO_ACK 能力位含 CAP_COMPACT)
+    std::unordered_map<uint64_t, uint8_t> peerSlots;  // 目标标记 -> 中继分配的短编号 (CTRL_PEER_JOIN)
+    std::unordered_map<uint8_t, uint64_t> slotMarks;  // 短编号 -> 标记（还原以短编号标识来源的数据帧）
+
+    bool sourceStamped = false;  // 中继代为补上来源标记 (HELLO_ACK 能力位含 CAP_SOURCE)
+
+    bool bundle = false;         // 中继支持打包帧 (HELLO_ACK 能力位含 CAP_BUNDLE)
+    std::vector<uint8_t> bundleBuf;   // 待合并发出的记录 ([varint 长度][标签][帧体]...)
+    uint32_t bundleRecords = 0;
+
+    bool fanout = false;         // 中继支持扇出 (HELLO_ACK 能力位含 CAP_FANOUT，仅在打包时合并)
+    std::vector<uint8_t> fanoutFrame;      // 最近一个数据帧，后续发往其他目标的相同数据并入它
+    std::vector<uint64_t> fanoutTargets;   // fanoutFrame 的全部目标，空表示没有暂存的帧
+
+    bool lanes = false;          // 中继支持出站调度 (HELLO_ACK 能力位含 CAP_LANES)
+    uint8_t txClass = 0;         // 中继当前记录的上行数据帧类别 (relay::TrafficClass)
+
+    // 中继尚未确认的数据帧：游戏线程 sendPacket 追加，泵线程收到确认后移除，均持 m_mutex
+    std::deque<UnackedFrame> unacked;
+    uint64_t unackedBase = 1;    // unacked 第一帧的序号
+    size_t unackedBytes = 0;
+    size_t unackedSent = 0;      // unacked 前多少帧已写入过 socket
+
+    bool resumable() const { return (flags & P2P_RELAY_FLAG_RESUME) != 0; }
+    bool wantsCompact() const { return (flags & P2P_RELAY_FLAG_COMPACT) != 0; }
+    bool wantsPresence() const { return (flags & (P2P_RELAY_FLAG_PRESENCE | P2P_RELAY_FLAG_COMPACT)) != 0; }
+    bool wantsSource() const { return (flags & P2P_RELAY_FLAG_SOURCE) != 0; }
+    bool wantsBundle() const { return (flags & P2P_RELAY_FLAG_BUNDLE) != 0; }
+    bool wantsFanout() const { return (flags & P2P_RELAY_FLAG_FANOUT) != 0; }
+    bool wantsLanes() const { return (flags & P2P_RELAY_FLAG_LANES) != 0; }
+    bool bundlePending() const { return bundleRecords > 0 || !fanoutTargets.empty(); }
+    // 数据帧的编码取决于中继应答的能力位：HELLO_ACK 之前先缓存
+    bool defersUntilAck() const { return (flags & (P2P_RELAY_FLAG_COMPACT | P2P_RELAY_FLAG_SOURCE)) != 0; }
+    // 中继不支持来源标记：发出数据帧前由库补上本地标记
+    bool insertsSource() const { return wantsSource() && !sourceStamped; }
+    bool redirectPending() const { return redirectSocket != INVALID_SOCKET_HANDLE; }
+};
+
 /**
  * 连接信息
  */
@@ -28,10 +116,15 @@ struct Connection {
     uint32_t reconnectMaxDelayMs = 10 * 1000;
     uint32_t reconnectAttempt = 0;
     uint64_t nextReconnectAtMs = 0;
+    SocketHandle reconnectSocket = INVALID_SOCKET_HANDLE;  // 正在进行的重连，连上后成为当前连接
+    uint64_t reconnectDeadlineMs = 0;
+    
+    bool reconnectPending() const { return reconnectSocket != INVALID_SOCKET_HANDLE; }
     
     PacketQueue receiveQueue;    // 接收到的完整数据包队列
     ReceiveBuffer recvBuffer;    // 接收缓冲区 (用于 TCP 流解析)
     std::vector<uint8_t> sendBuffer;  // 待发送数据缓冲区
+    RelaySession relay;               // 中继会话 (P2P_EnableRelaySession)
     
     Connection() = default;
     ~Connection() = default;
@@ -54,11 +147,12 @@ enum class ConnectionEvent {
 };
 
 /**
- * 连接管理器 - 管理所有 P2P 连接
+ * 连接管理器 - 管理所有 P2P 连接（公开接口可在多个线程中调用）
  */
 class ConnectionManager {
 public:
     using ConnectionCallback = std::function<void(P2PPeerID, ConnectionEvent)>;
+    using PresenceCallback = std::function<void(P2PPeerID, uint64_t, bool)>;
     
     ConnectionManager();
     ~ConnectionManager();
@@ -108,6 +202,15 @@ public:
      */
     void setAutoReconnect(P2PPeerID peerID, bool enable, uint32_t baseDelayMs = 500, uint32_t maxDelayMs = 10 * 1000);
     
+    /**
+     * 在指定连接上启用中继会话 (扩展注册，可选断线续传)
+     * @param peerID 对端 ID (到 relay_server 的连接)
+     * @param localMark 本地标记
+     * @param flags P2P_RELAY_FLAG_*
+     * @return true 成功
+     */
+    bool enableRelaySession(P2PPeerID peerID, uint64_t localMark, uint32_t flags);
+    
     /**
      * 断开指定连接
      * @param peerID 对端 ID
@@ -119,9 +222,22 @@ public:
      * @param peerID 对端 ID
      * @param data 数据
      * @param size 大小
+     * @param trafficClass 数据帧类别 (relay::TrafficClass)，仅在中继支持出站调度时发出
      * @return true 成功
      */
-    bool sendPacket(P2PPeerID peerID, const void* data, uint32_t size);
+    bool sendPacket(P2PPeerID peerID, const void* data, uint32_t size, uint8_t trafficClass = 0);
+    
+    /**
+     * 中继目标标记是否可能在线 (未启用在线通知时总是 true)
+     * @param peerID 到中继的连接 ID
+     * @param mark 目标标记
+     */
+    bool isRelayTargetAvailable(P2PPeerID peerID, uint64_t mark);
+    
+    /**
+     * 按数据包前8字节的目标标记检查，不足8字节时视为可发送
+     */
+    bool isRelayTargetAvailable(P2PPeerID peerID, const void* data, uint32_t size);
     
     /**
      * 检查是否有数据包可读
@@ -154,6 +270,11 @@ public:
      */
     void setConnectionCallback(ConnectionCallback callback);
     
+    /**
+     * 设置中继标记在线状态回调
+     */
+    void setPresenceCallback(PresenceCallback callback);
+    
     /**
      * 获取连接数量
      */
@@ -169,6 +290,11 @@ public:
      */
     bool isInitialized() const { return m_initialized; }
 
+    /**
+     * 创建发送帧 (添加长度头)，微基准测试直接调用
+     */
+    static std::vector<uint8_t> createSendFrame(const void* data, uint32_t size, uint8_t type = 0);
+
 private:
     /**
      * 分配新的 PeerID
@@ -196,26 +322,122 @@ private:
     void removeDisconnected();
     
     /**
-     * 尝试重连
+     * 写入一帧数据；已有积压时追加到 sendBuffer 保证顺序
+     * @return false 连接已出错
      */
-    void attemptReconnects();
+    bool writeFrame(Connection& conn, const uint8_t* frame, size_t size);
     
     /**
-     * 通知连接事件
+     * 写入已编码的字节；已有积压时追加到 sendBuffer
+     * @return false 连接已出错
      */
-    void notifyConnectionEvent(P2PPeerID peerID, ConnectionEvent event);
+    bool writeRaw(Connection& conn, const uint8_t* data, size_t size);
+    
+    /**
+     * 写入一个 v1 数据帧；中继支持打包帧时只编码为记录，等待 flushBundle
+     */
+    bool writeDataFrame(Connection& conn, const uint8_t* frame, size_t size);
+    
+    /**
+     * 把一个 v1 数据帧编码为记录追加到 bundleBuf，装不下时先发出已有记录
+     */
+    bool appendBundleRecord(Connection& conn, const uint8_t* frame, size_t size);
+    
+    /**
+     * 把暂存的数据帧追加为记录；有多个目标时编码为列表扇出 (relay::FANOUT_MULTICAST)
+     */
+    bool appendHeldFanout(Connection& conn);
+    
+    /**
+     * 把待合并的记录作为一个打包帧发出（只有一条时作为普通数据帧发出）
+     */
+    bool flushBundle(Connection& conn);
+    
+    /**
+     * 切换之后发出的数据帧的类别：先发出已打包的记录，再写出 CTRL_CLASS
+     */
+    bool selectTrafficClass(Connection& conn, uint8_t trafficClass);
+    
+    /**
+     * 按会话协商结果转换 v1 帧：数据帧的目标标记有短编号时替换为短编号；
+     * 中继不支持来源标记时在目标标记之后补上本地标记
+     * @param compactHeader true 时输出 [varint 长度][标签][帧体]（紧凑帧或打包帧记录），否则为 v1 帧
+     * @return 转换后的帧 (指向 m_frameScratch)
+     */
+    const std::vector<uint8_t>& encodeRelayFrame(const RelaySession& session, const uint8_t* frame, size_t size,
+                                                 bool compactHeader);
+    
+    /**
+     * 收到的数据帧入队：计入续传序号，以短编号标识来源时还原来源标记
+     */
+    void deliverDataPacket(Connection& conn, Packet& packet);
+    
+    /**
+     * 拆开中继发来的打包帧，逐条入队
+     */
+    void unpackBundle(Connection& conn, const Packet& packet);
+    
+    /**
+     * 发送 CTRL_HELLO (若有会话令牌则请求恢复会话)
+     */
+    void sendRelayHello(Connection& conn);
+    
+    /**
+     * 处理中继发来的控制帧
+     */
+    void handleRelayControl(Connection& conn, const Packet& packet);
+    
+    /**
+     * 跟随 CTRL_REDIRECT：改连中继指定的集群节点并重新发送 HELLO，之后的自动重连也连到该节点
+     */
+    void followRelayRedirect(Connection& conn, const uint8_t* body);
+
+    /**
+     * 结束正在进行的重定向连接：成功时换用新连接并重新注册，失败时保留原连接
+     */
+    void finishRelayRedirect(Connection& conn, bool connected);
+    
+    /**
+     * 按需发送累计确认
+     */
+    void sendRelayAck(Connection& conn, uint64_t now);
+    
+    /**
+     * 心跳: 空闲时主动 PING，超时未收到任何数据则按断线处理
+     */
+    void checkRelayHeartbeat(Connection& conn, uint64_t now);
     
     /**
-     * 创建发送帧 (添加长度头)
+     * 尝试重连：只发起非阻塞连接，由 processEvents 在 socket 可写后完成，不在持锁时等待
      */
-    static std::vector<uint8_t> createSendFrame(const void* data, uint32_t size);
+    void attemptReconnects();
 
+    /**
+     * 结束正在进行的重连：成功时启用新连接（中继会话重新注册），失败时按退避时间安排下一次
+     */
+    void finishReconnect(Connection& conn, bool connected);
+    
+    /**
+     * 通知连接事件
+     */
+    void notifyConnectionEvent(P2PPeerID peerID, ConnectionEvent event);
+    
     static uint64_t nowMs();
 
     static SocketHandle connectWithTimeout(const char* ip, uint16_t port, uint32_t timeoutMs);
 
+    /**
+     * 发起非阻塞连接，不等待完成
+     * @param inProgress 输出连接是否仍在进行（完成后 socket 可写，结果见 connectSucceeded）
+     */
+    static SocketHandle startConnect(const char* ip, uint16_t port, bool& inProgress);
+    static bool connectSucceeded(SocketHandle sock);
+
 private:
-    bool m_initialized = false;
+    // 公开接口都持有该锁：游戏线程的发送与读取、泵线程的 processEvents 共用会话的打包/扇出缓冲区、
+    // 未确认队列和帧转换缓冲区；回调在持锁时调用，可重入公开接口，因此用递归锁
+    mutable std::recursive_mutex m_mutex;
+    std::atomic<bool> m_initialized{false};
     SocketHandle m_listenSocket = INVALID_SOCKET_HANDLE;
     uint16_t m_listenPort = 0;
     
@@ -224,8 +446,19 @@ private:
     std::vector<P2PPeerID> m_pendingRemove;  // 待移除的连接
     
     ConnectionCallback m_connectionCallback;
+    PresenceCallback m_presenceCallback;
+    std::vector<uint8_t> m_frameScratch;     // 帧转换缓冲区 (encodeRelayFrame)
+    std::vector<uint8_t> m_fanoutScratch;    // 列表扇出帧 (appendHeldFanout)
     
     static constexpr size_t RECV_BUFFER_SIZE = 65536;  // 接收缓冲区大小
+    static constexpr size_t RELAY_MAX_UNACKED_BYTES = 4 * 1024 * 1024;  // 续传会话最多缓存的未确认字节数
+    static constexpr uint64_t RELAY_ACK_INTERVAL_MS = 100;             // 有未确认数据时最长确认间隔
+    static constexpr uint64_t RELAY_PING_INTERVAL_MS = 5 * 1000;       // 空闲多久后主动发送心跳
+    static constexpr uint64_t RELAY_IDLE_TIMEOUT_MS = 15 * 1000;       // 多久收不到任何数据视为断线
+    static constexpr uint64_t RELAY_ABSENT_RETRY_MS = 2 * 1000;        // 不在线的目标多久放行一次试探
+    static constexpr uint32_t RELAY_MAX_REDIRECTS = 2;                 // 一次注册最多跟随的重定向次数
+    static constexpr uint32_t RELAY_REDIRECT_TIMEOUT_MS = 2000;        // 连接重定向目标的超时
+    static constexpr uint32_t RECONNECT_TIMEOUT_MS = 2000;             // 单次重连的超时
 };
 
 } // namespace p2p
@@ -1,5 +1,6 @@
 #include <p2p_network.h>
 #include "connection_manager.h"
+#include <relay_protocol.h>
 
 #include <memory>
 
@@ -10,6 +11,10 @@ static std::unique_ptr<p2p::ConnectionManager> g_manager;
 static P2PConnectionCallback g_userCallback = nullptr;
 static void* g_userCallbackData = nullptr;
 
+// 用户在线状态回调
+static P2PPresenceCallback g_presenceCallback = nullptr;
+static void* g_presenceCallbackData = nullptr;
+
 // 内部连接回调，转发给用户回调
 static void internalConnectionCallback(P2PPeerID peerID, p2p::ConnectionEvent event) {
     if (g_userCallback) {
@@ -18,6 +23,12 @@ static void internalConnectionCallback(P2PPeerID peerID, p2p::ConnectionEvent ev
     }
 }
 
+static void internalPresenceCallback(P2PPeerID peerID, uint64_t mark, bool online) {
+    if (g_presenceCallback) {
+        g_presenceCallback(peerID, mark, online, g_presenceCallbackData);
+    }
+}
+
 P2PResult P2P_Init(void) {
     if (g_manager) {
         return P2P_ERROR_ALREADY_INITIALIZED;
@@ -31,6 +42,7 @@ P2PResult P2P_Init(void) {
     }
     
     g_manager->setConnectionCallback(internalConnectionCallback);
+    g_manager->setPresenceCallback(internalPresenceCallback);
     
     return P2P_OK;
 }
@@ -89,6 +101,22 @@ void P2P_SetAutoReconnect(P2PPeerID peerID, bool enable, uint32_t baseDelayMs, u
     g_manager->setAutoReconnect(peerID, enable, baseDelayMs, maxDelayMs);
 }
 
+P2PResult P2P_EnableRelaySession(P2PPeerID peerID, uint64_t localMark, uint32_t flags) {
+    if (!g_manager || !g_manager->isInitialized()) {
+        return P2P_ERROR_NOT_INITIALIZED;
+    }
+    
+    if (peerID == P2P_INVALID_PEER_ID) {
+        return P2P_ERROR_INVALID_PEER;
+    }
+    
+    if (!g_manager->enableRelaySession(peerID, localMark, flags)) {
+        return P2P_ERROR_INVALID_PEER;
+    }
+    
+    return P2P_OK;
+}
+
 void P2P_Disconnect(P2PPeerID peerID) {
     if (g_manager && peerID != P2P_INVALID_PEER_ID) {
         g_manager->disconnect(peerID);
@@ -96,6 +124,10 @@ void P2P_Disconnect(P2PPeerID peerID) {
 }
 
 P2PResult P2P_SendPacket(P2PPeerID peerID, const void* data, uint32_t size) {
+    return P2P_SendPacketEx(peerID, data, size, 0);
+}
+
+P2PResult P2P_SendPacketEx(P2PPeerID peerID, const void* data, uint32_t size, uint32_t flags) {
     if (!g_manager || !g_manager->isInitialized()) {
         return P2P_ERROR_NOT_INITIALIZED;
     }
@@ -108,7 +140,12 @@ P2PResult P2P_SendPacket(P2PPeerID peerID, const void* data, uint32_t size) {
         return P2P_ERROR_INVALID_PARAM;
     }
     
-    if (!g_manager->sendPacket(peerID, data, size)) {
+    if (!g_manager->isRelayTargetAvailable(peerID, data, size)) {
+        return P2P_ERROR_TARGET_UNAVAILABLE;
+    }
+    
+    uint8_t trafficClass = (flags & P2P_SEND_UNRELIABLE) ? relay::CLASS_UNRELIABLE : relay::CLASS_RELIABLE;
+    if (!g_manager->sendPacket(peerID, data, size, trafficClass)) {
         return P2P_ERROR_SEND_FAILED;
     }
     
@@ -178,3 +215,16 @@ uint32_t P2P_GetConnectedPeers(P2PPeerID* outPeerIDs, uint32_t maxCount) {
     
     return g_manager->getConnectedPeers(outPeerIDs, maxCount);
 }
+
+bool P2P_IsRelayTargetAvailable(P2PPeerID peerID, uint64_t mark) {
+    if (!g_manager || !g_manager->isInitialized()) {
+        return false;
+    }
+    
+    return g_manager->isRelayTargetAvailable(peerID, mark);
+}
+
+void P2P_SetPresenceCallback(P2PPresenceCallback callback, void* userData) {
+    g_presenceCallback = callback;
+    g_presenceCallbackData = userData;
+}
@@ -1,4 +1,5 @@
 #include "packet_queue.h"
+#include <relay_protocol.h>
 #include <cstring>
 #include <algorithm>
 
@@ -63,17 +64,18 @@ void ReceiveBuffer::append(const void* data, uint32_t size) {
 }
 
 bool ReceiveBuffer::tryParsePacket(Packet& outPacket) {
+    if (m_compact) {
+        return tryParseCompactPacket(outPacket);
+    }
+    
     // 检查是否有足够的数据来读取包头
     if (m_buffer.size() < HEADER_SIZE) {
         return false;
     }
     
-    // 读取包长度 (小端序)
-    uint32_t packetSize = 0;
-    packetSize |= static_cast<uint32_t>(m_buffer[0]);
-    packetSize |= static_cast<uint32_t>(m_buffer[1]) << 8;
-    packetSize |= static_cast<uint32_t>(m_buffer[2]) << 16;
-    packetSize |= static_cast<uint32_t>(m_buffer[3]) << 24;
+    // 读取帧头 (小端序): 低24位为包长度，高8位为帧类型
+    uint32_t header = relay::readU32(m_buffer.data());
+    uint32_t packetSize = relay::frameLength(header);
     
     // 检查包大小是否合法
     if (packetSize == 0 || packetSize > MAX_PACKET_SIZE) {
@@ -93,6 +95,8 @@ bool ReceiveBuffer::tryParsePacket(Packet& outPacket) {
         m_buffer.begin() + HEADER_SIZE,
         m_buffer.begin() + totalSize
     );
+    outPacket.type = relay::frameType(header);
+    outPacket.slot = 0;
     
     // 从缓冲区中移除已解析的数据
     m_buffer.erase(m_buffer.begin(), m_buffer.begin() + totalSize);
@@ -100,4 +104,33 @@ bool ReceiveBuffer::tryParsePacket(Packet& outPacket) {
     return true;
 }
 
+bool ReceiveBuffer::tryParseCompactPacket(Packet& outPacket) {
+    uint32_t frameSize = 0;
+    int varintSize = relay::readVarint(m_buffer.data(), m_buffer.size(), frameSize);
+    if (varintSize == 0) {
+        return false;
+    }
+    if (varintSize < 0 || frameSize == 0 || frameSize > MAX_PACKET_SIZE) {
+        m_buffer.clear();
+        return false;
+    }
+    
+    uint32_t totalSize = static_cast<uint32_t>(varintSize) + frameSize;
+    if (m_buffer.size() < totalSize) {
+        return false;
+    }
+    
+    // 标签之后即为数据内容；短编号标签表示来源标记被省略，由调用方按短编号还原
+    uint8_t tag = m_buffer[varintSize];
+    outPacket.data.assign(m_buffer.begin() + varintSize + 1, m_buffer.begin() + totalSize);
+    outPacket.type = tag == relay::COMPACT_TAG_CTRL     ? relay::FRAME_CTRL
+                     : tag == relay::COMPACT_TAG_BUNDLE ? relay::FRAME_BUNDLE
+                                                        : relay::FRAME_DATA;
+    outPacket.slot = outPacket.type == relay::FRAME_DATA && tag != relay::COMPACT_TAG_DATA ? tag : 0;
+    
+    m_buffer.erase(m_buffer.begin(), m_buffer.begin() + totalSize);
+    
+    return true;
+}
+
 } // namespace p2p
@@ -13,6 +13,8 @@ namespace p2p {
  */
 struct Packet {
     std::vector<uint8_t> data;
+    uint8_t type = 0;    // 帧类型 (relay::FRAME_DATA / relay::FRAME_CTRL / relay::FRAME_BUNDLE)
+    uint8_t slot = 0;    // 紧凑数据帧的来源短编号，0为无（来源标记在负载中或不适用）
     
     Packet() = default;
     explicit Packet(const void* src, uint32_t size) 
@@ -103,7 +105,8 @@ private:
 
 /**
  * 接收缓冲区 - 用于从 TCP 流中解析完整数据包
- * 数据包格式: [4字节长度][数据内容]
+ * 数据包格式: [4字节帧头][数据内容]，帧头低24位为长度、高8位为帧类型（见 relay_protocol.h）
+ * 切换到紧凑帧后为 [varint 长度][1字节标签][数据内容]
  */
 class ReceiveBuffer {
 public:
@@ -124,6 +127,12 @@ public:
      */
     bool tryParsePacket(Packet& outPacket);
     
+    /**
+     * 切换帧格式，对之后解析的数据包生效
+     * @param compact true 为紧凑帧 (v2)
+     */
+    void setCompact(bool compact) { m_compact = compact; }
+    
     /**
      * 获取缓冲区大小
      */
@@ -135,9 +144,12 @@ public:
     void clear() { m_buffer.clear(); }
 
 private:
+    bool tryParseCompactPacket(Packet& outPacket);
+    
     std::vector<uint8_t> m_buffer;
+    bool m_compact = false;
     
-    static constexpr uint32_t HEADER_SIZE = 4;  // 包头大小 (4字节长度)
+    static constexpr uint32_t HEADER_SIZE = 4;  // 包头大小 (4字节帧头)
     static constexpr uint32_t MAX_PACKET_SIZE = 1024 * 1024;  // 最大包大小 1MB
 };
 
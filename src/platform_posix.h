@@ -0,0 +1,64 @@
+#ifndef PLATFORM_POSIX_H
+#define PLATFORM_POSIX_H
+
+#ifndef _WIN32
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+namespace p2p {
+
+using SocketHandle = int;
+constexpr SocketHandle INVALID_SOCKET_HANDLE = -1;
+
+// 对端关闭后 send 不产生 SIGPIPE
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+
+inline int getLastError() {
+    return errno;
+}
+
+inline void closeSocket(SocketHandle sock) {
+    if (sock != INVALID_SOCKET_HANDLE) {
+        close(sock);
+    }
+}
+
+inline bool setNonBlocking(SocketHandle sock) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+inline bool setReuseAddr(SocketHandle sock) {
+    int opt = 1;
+    return setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == 0;
+}
+
+inline bool setNoDelay(SocketHandle sock) {
+    int opt = 1;
+    return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == 0;
+}
+
+inline bool wouldBlock() {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS;
+}
+
+inline bool initializeSockets() {
+    return true;
+}
+
+inline void cleanupSockets() {
+}
+
+} // namespace p2p
+
+#endif // !_WIN32
+
+#endif // PLATFORM_POSIX_H
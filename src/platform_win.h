@@ -15,6 +15,8 @@ namespace p2p {
 using SocketHandle = SOCKET;
 constexpr SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
 
+constexpr int SEND_FLAGS = 0;
+
 inline int getLastError() {
     return WSAGetLastError();
 }
@@ -0,0 +1,86 @@
+/**
+ * 客户端库热路径微基准
+ * - ReceiveBuffer: 一次 recv 收到的一批帧 append 后逐个 tryParsePacket
+ * - PacketQueue: 一批包 push 后逐个 pop（带锁）
+ * - ConnectionManager::createSendFrame: 为一个负载加帧头
+ * 每项按负载长度与批量深度分别测量，报告的时间为每次调用（一批）的耗时。
+ */
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch2/catch.hpp"
+#include "packet_queue.h"
+#include "connection_manager.h"
+#include "relay_protocol.h"
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint32_t BENCH_SIZES[] = {32, 256, 1200, 4096};
+const int BENCH_BATCHES[] = {1, 8, 32};
+
+std::string shape_name(const char* what, uint32_t size, int batch) {
+    return std::string(what) + " size=" + std::to_string(size) + " batch=" + std::to_string(batch);
+}
+
+}  // namespace
+
+TEST_CASE("Client ReceiveBuffer::tryParsePacket", "[client]") {
+    for (uint32_t size : BENCH_SIZES) {
+        for (int batch : BENCH_BATCHES) {
+            std::vector<uint8_t> frames;
+            for (int i = 0; i < batch; i++) {
+                size_t off = frames.size();
+                frames.resize(off + relay::FRAME_HEADER_SIZE + size, static_cast<uint8_t>(i));
+                relay::writeFrameHeader(frames.data() + off, size, relay::FRAME_DATA);
+            }
+            p2p::ReceiveBuffer buffer;
+            p2p::Packet packet;
+            BENCHMARK(shape_name("ReceiveBuffer::tryParsePacket", size, batch)) {
+                buffer.append(frames.data(), static_cast<uint32_t>(frames.size()));
+                int parsed = 0;
+                while (buffer.tryParsePacket(packet)) {
+                    parsed++;
+                }
+                return parsed;
+            };
+            REQUIRE(buffer.size() == 0);
+        }
+    }
+}
+
+TEST_CASE("Client PacketQueue push/pop", "[client]") {
+    for (uint32_t size : BENCH_SIZES) {
+        for (int batch : BENCH_BATCHES) {
+            std::vector<uint8_t> payload(size, 0x5A);
+            p2p::PacketQueue queue;
+            p2p::Packet packet;
+            BENCHMARK(shape_name("PacketQueue push/pop", size, batch)) {
+                for (int i = 0; i < batch; i++) {
+                    queue.push(payload.data(), size);
+                }
+                uint32_t bytes = 0;
+                while (queue.pop(packet)) {
+                    bytes += packet.size();
+                }
+                return bytes;
+            };
+            REQUIRE(queue.empty());
+        }
+    }
+}
+
+TEST_CASE("Client ConnectionManager::createSendFrame", "[client]") {
+    for (uint32_t size : BENCH_SIZES) {
+        for (int batch : BENCH_BATCHES) {
+            std::vector<uint8_t> payload(size, 0x5A);
+            BENCHMARK(shape_name("ConnectionManager::createSendFrame", size, batch)) {
+                size_t bytes = 0;
+                for (int i = 0; i < batch; i++) {
+                    bytes += p2p::ConnectionManager::createSendFrame(payload.data(), size, relay::FRAME_DATA).size();
+                }
+                return bytes;
+            };
+        }
+    }
+}
@@ -0,0 +1,5 @@
+// 微基准测试入口（p2p_bench，与 p2p_tests 分开构建）
+// 运行: make bench，或 ./p2p_bench [server] / [client] 只测一部分
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch2/catch.hpp"
@@ -0,0 +1,245 @@
+/**
+ * 中继服务端热路径微基准
+ *
+ * 解析、缓冲区与发送路径都是 relay_server.cpp 中 relay_detail 命名空间内的函数，由 relay_internal.h 声明；
+ * 这里与中继链接在一起，在同一进程内直接测量：
+ * - read_packet_length: 逐帧读取帧头
+ * - process_recv_buffer: 接收缓冲区中的一批帧 -> process_packet -> 追加到目标 -> flush_send_buffer -> consume
+ * - Connection::consume: 逐帧移除已处理的数据（剩余数据前移）
+ * - append_data_frame + flush_send_buffer: 一批帧追加到目标的发送缓冲区后一次写出
+ * - RelayServer: 进程内中继经 TCP 回环转发一批帧的完整耗时
+ * 目标连接是 socketpair 的一端，每次调用后读空另一端，避免发送缓冲区积压。
+ * 每项按负载长度与批量深度（一次 recv 中的帧数）分别测量，报告的时间为每次调用（一批）的耗时。
+ */
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch2/catch.hpp"
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "relay_internal.h"
+
+using namespace relay_detail;
+
+namespace {
+
+// 两个已注册的连接：源连接只用来承载接收缓冲区，目标连接的发送端是 socketpair
+struct BenchRelay {
+    RelayContext state;              // 基准自己的中继状态，BenchRelay 存在期间作为当前线程的 ctx
+    ContextScope scope{&state};
+    int epfd = -1;
+    int src_pair[2] = {-1, -1};
+    int dst_pair[2] = {-1, -1};
+    Connection* src = nullptr;
+    Connection* dst = nullptr;
+    uint8_t src_mark[MARK_SIZE] = {0xB1, 1, 1, 1, 1, 1, 1, 1};
+    uint8_t dst_mark[MARK_SIZE] = {0xB2, 2, 2, 2, 2, 2, 2, 2};
+
+    BenchRelay() {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, src_pair);
+        socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, dst_pair);
+        int size = 4 * 1024 * 1024;
+        setsockopt(dst_pair[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(dst_pair[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        src = &add(src_pair[0], src_mark);
+        dst = &add(dst_pair[0], dst_mark);
+    }
+
+    ~BenchRelay() {
+        for (int fd : {src_pair[0], dst_pair[0]}) {
+            ctx->mark_to_fd.erase(mark_to_key(ctx->connections[fd].mark));
+            ctx->connections.erase(fd);
+        }
+        for (int fd : {src_pair[0], src_pair[1], dst_pair[0], dst_pair[1], epfd}) {
+            close(fd);
+        }
+    }
+
+    Connection& add(int fd, const uint8_t* mark) {
+        Connection& conn = ctx->connections[fd];
+        conn.fd = fd;
+        register_mark(conn, mark);
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        return conn;
+    }
+
+    // 读空目标连接的对端，返回读到的字节数
+    size_t drain() {
+        static uint8_t buf[256 * 1024];
+        size_t total = 0;
+        ssize_t n;
+        while ((n = read(dst_pair[1], buf, sizeof(buf))) > 0) {
+            total += static_cast<size_t>(n);
+        }
+        return total;
+    }
+};
+
+// batch 个发往 dst 的 v1 数据帧：[帧头][8字节目标标记][负载]
+std::vector<uint8_t> make_frames(const uint8_t* target, uint32_t payload_len, int batch) {
+    std::vector<uint8_t> frames;
+    for (int i = 0; i < batch; i++) {
+        size_t off = frames.size();
+        frames.resize(off + LENGTH_SIZE + MARK_SIZE + payload_len, static_cast<uint8_t>(i));
+        relay::writeFrameHeader(frames.data() + off, MARK_SIZE + payload_len, relay::FRAME_DATA);
+        std::memcpy(frames.data() + off + LENGTH_SIZE, target, MARK_SIZE);
+    }
+    return frames;
+}
+
+// (负载长度, 批量深度)：一批帧必须放得进接收缓冲区
+std::vector<std::pair<uint32_t, int>> bench_shapes() {
+    std::vector<std::pair<uint32_t, int>> shapes;
+    for (uint32_t size : {32u, 256u, 1200u, 4096u}) {
+        for (int batch : {1, 8, 32}) {
+            if (static_cast<size_t>(batch) * (LENGTH_SIZE + MARK_SIZE + size) <= BUFFER_SIZE) {
+                shapes.emplace_back(size, batch);
+            }
+        }
+    }
+    return shapes;
+}
+
+std::string shape_name(const char* what, uint32_t size, int batch) {
+    return std::string(what) + " size=" + std::to_string(size) + " batch=" + std::to_string(batch);
+}
+
+}  // namespace
+
+TEST_CASE("Server read_packet_length", "[server]") {
+    for (auto shape : bench_shapes()) {
+        BenchRelay relay;
+        std::vector<uint8_t> frames = make_frames(relay.dst_mark, shape.first, shape.second);
+        BENCHMARK(shape_name("read_packet_length", shape.first, shape.second)) {
+            size_t off = 0;
+            uint32_t frames_seen = 0;
+            while (off < frames.size()) {
+                off += LENGTH_SIZE + relay::frameLength(read_packet_length(frames.data() + off));
+                frames_seen++;
+            }
+            return frames_seen;
+        };
+    }
+}
+
+TEST_CASE("Server process_recv_buffer forwarding", "[server]") {
+    for (auto shape : bench_shapes()) {
+        BenchRelay relay;
+        std::vector<uint8_t> frames = make_frames(relay.dst_mark, shape.first, shape.second);
+        BENCHMARK(shape_name("process_recv_buffer", shape.first, shape.second)) {
+            std::memcpy(relay.src->recv_buf, frames.data(), frames.size());
+            relay.src->recv_len = frames.size();
+            bool ok = process_recv_buffer(*relay.src, relay.epfd);
+            return ok ? relay.drain() : 0;
+        };
+        // 每个负载都原样转发到了目标
+        REQUIRE(relay.src->recv_len == 0);
+        REQUIRE(relay.dst->send_bytes() == 0);
+    }
+}
+
+TEST_CASE("Server Connection::consume", "[server]") {
+    for (auto shape : bench_shapes()) {
+        BenchRelay relay;
+        size_t frame_len = LENGTH_SIZE + MARK_SIZE + shape.first;
+        BENCHMARK(shape_name("Connection::consume", shape.first, shape.second)) {
+            relay.src->recv_len = frame_len * static_cast<size_t>(shape.second);
+            while (relay.src->recv_len > 0) {
+                relay.src->consume(frame_len);
+            }
+            return relay.src->recv_len;
+        };
+    }
+}
+
+TEST_CASE("Server append_data_frame + flush_send_buffer", "[server]") {
+    for (auto shape : bench_shapes()) {
+        BenchRelay relay;
+        std::vector<uint8_t> payload(shape.first, 0x5A);
+        BENCHMARK(shape_name("append+flush_send_buffer", shape.first, shape.second)) {
+            for (int i = 0; i < shape.second; i++) {
+                append_data_frame(*relay.dst, nullptr, payload.data(), shape.first);
+            }
+            flush_send_buffer(*relay.dst, relay.epfd);
+            return relay.drain();
+        };
+        REQUIRE(relay.dst->send_bytes() == 0);
+    }
+}
+
+// 完整路径：进程内 RelayServer（临时端口）经 TCP 回环转发一个包，同一线程用 run_once(0) 驱动事件循环，
+// 没有进程与线程调度带来的噪声
+TEST_CASE("Server RelayServer loopback forward", "[server]") {
+    RelayServer server;
+    RelayOptions options;
+    options.max_connections = 8;
+    options.log_level = "warn";   // PERF 日志会打断基准输出
+    std::string error;
+    REQUIRE(server.start(options, error));
+
+    auto connect_client = [&server]() {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(server.port()));
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return fd;
+    };
+    int fd_a = connect_client();
+    int fd_b = connect_client();
+    uint8_t mark_a[MARK_SIZE] = {0xC1, 1, 1, 1, 1, 1, 1, 1};
+    uint8_t mark_b[MARK_SIZE] = {0xC2, 2, 2, 2, 2, 2, 2, 2};
+    for (auto client : {std::make_pair(fd_a, mark_a), std::make_pair(fd_b, mark_b)}) {
+        uint8_t reg[LENGTH_SIZE + MARK_SIZE];
+        relay::writeFrameHeader(reg, MARK_SIZE, relay::FRAME_DATA);
+        std::memcpy(reg + LENGTH_SIZE, client.second, MARK_SIZE);
+        REQUIRE(write(client.first, reg, sizeof(reg)) == static_cast<ssize_t>(sizeof(reg)));
+    }
+    while (server.admin("stats").find("\nregistered 2\n") == std::string::npos) {
+        server.run_once(10);
+    }
+
+    // 一次读完 B 收到的字节，直到凑够 expect 字节
+    std::vector<uint8_t> rx(BUFFER_SIZE * 2);
+    auto receive = [&](size_t expect) {
+        size_t got = 0;
+        while (got < expect) {
+            server.run_once(0);
+            ssize_t n = recv(fd_b, rx.data(), rx.size(), MSG_DONTWAIT);
+            if (n > 0) {
+                got += static_cast<size_t>(n);
+            }
+        }
+        return got;
+    };
+
+    for (auto shape : bench_shapes()) {
+        std::vector<uint8_t> frames = make_frames(mark_b, shape.first, shape.second);
+        size_t expect = static_cast<size_t>(shape.second) * (LENGTH_SIZE + shape.first);
+        BENCHMARK(shape_name("RelayServer loopback", shape.first, shape.second)) {
+            if (write(fd_a, frames.data(), frames.size()) != static_cast<ssize_t>(frames.size())) {
+                return static_cast<size_t>(0);
+            }
+            return receive(expect);
+        };
+    }
+    close(fd_a);
+    close(fd_b);
+    server.shutdown();
+}
@@ -0,0 +1,147 @@
+#include "test_helpers.h"
+#include <unistd.h>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// 运行 relay_bench；路径默认为 ../server/relay_bench，可通过 RELAY_BENCH_BIN 覆盖
+static bool run_bench(const std::string& args, std::string& output) {
+    const char* bin = std::getenv("RELAY_BENCH_BIN");
+    std::string command = std::string(bin ? bin : "../server/relay_bench") + " " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return false;
+    }
+    char line[1024];
+    output.clear();
+    while (fgets(line, sizeof(line), pipe)) {
+        output += line;
+    }
+    return pclose(pipe) == 0;
+}
+
+static std::vector<std::string> split_csv(const std::string& line) {
+    std::vector<std::string> fields;
+    std::istringstream in(line);
+    std::string field;
+    while (std::getline(in, field, ',')) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+// 读取 CSV：每行一个 列名 -> 值 的映射，表头不计入
+static std::vector<std::map<std::string, std::string>> read_csv(const std::string& path) {
+    std::vector<std::map<std::string, std::string>> rows;
+    std::ifstream in(path);
+    std::string line;
+    std::vector<std::string> header;
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields = split_csv(line);
+        if (header.empty()) {
+            header = fields;
+            continue;
+        }
+        std::map<std::string, std::string> row;
+        for (size_t i = 0; i < fields.size() && i < header.size(); i++) {
+            row[header[i]] = fields[i];
+        }
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+static double csv_value(std::map<std::string, std::string>& row, const std::string& key) {
+    return row.count(key) ? std::atof(row[key].c_str()) : -1;
+}
+
+// 两次运行追加到同一个 CSV：只有一行表头，每行的帧数与中继计数一致，发送速率符合参数
+bool test_bench_csv_report() {
+    std::cout << "Testing relay_bench text and CSV reports..." << std::endl;
+
+    std::string admin = test_temp_path("bench");
+    std::string csv = test_temp_path("bench", ".csv");
+    TestRelay relay({"-c", "64", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    // 10个3人会话，每人每秒100个32-64字节的包
+    std::string args = "-n 10 -p 3 -r 100 -s 32-64 -d 1000 -D 300 -C " + csv + " ";
+    std::string text[2];
+    bool ran = run_bench(args + "-l first 127.0.0.1 " + std::to_string(port), text[0]) &&
+               run_bench(args + "-t 2 -l second 127.0.0.1 " + std::to_string(port), text[1]);
+    uint64_t packets_in = admin_stat(admin, "packets_in");
+    uint64_t packets_out = admin_stat(admin, "packets_out");
+    relay.stop();
+    std::cout << text[0] << text[1];
+
+    std::ifstream in(csv);
+    std::string first_line;
+    std::getline(in, first_line);
+    auto rows = read_csv(csv);
+    bool rows_ok = ran && first_line.rfind("time,label,", 0) == 0 && rows.size() == 2;
+    double sent_total = 0;
+    for (size_t i = 0; rows_ok && i < rows.size(); i++) {
+        auto& row = rows[i];
+        double sent = csv_value(row, "sent_frames");
+        sent_total += sent;
+        std::cout << row["label"] << ": sent " << sent << " recv " << row["recv_frames"] << " p99 "
+                  << row["lat_p99_us"] << "us" << std::endl;
+        rows_ok = row["label"] == (i == 0 ? "first" : "second") && csv_value(row, "connections") == 30 &&
+                  csv_value(row, "threads") == (i == 0 ? 1 : 2) && sent > 30 * 100 * 0.9 && sent < 30 * 100 * 1.1 &&
+                  csv_value(row, "recv_frames") == sent && csv_value(row, "lost") == 0 &&
+                  csv_value(row, "lat_p50_us") > 0 && csv_value(row, "lat_p999_us") >= csv_value(row, "lat_p99_us") &&
+                  csv_value(row, "recv_mbps") > 0 && csv_value(row, "reconnects") == 0;
+    }
+    bool text_ok = text[0].find("延迟(us): p50") != std::string::npos &&
+                   text[1].find("30 个连接") != std::string::npos;
+
+    std::remove(csv.c_str());
+    return rows_ok && text_ok && packets_in == sent_total && packets_out == sent_total;
+}
+
+// 连接变动：按 -k 的速率断开重连，重连都注册成功；发出的包要么送达、要么由中继计入 drop_no_target
+bool test_bench_connection_churn() {
+    std::cout << "Testing relay_bench connection churn..." << std::endl;
+
+    std::string admin = test_temp_path("bench_churn");
+    std::string csv = test_temp_path("bench_churn", ".csv");
+    TestRelay relay({"-c", "128", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    // 80个连接，每秒重连50个：每个连接的重连间隔1.6秒，1秒内约62%的连接重连一次
+    std::string text;
+    bool ran = run_bench("-n 20 -r 50 -d 1000 -D 300 -k 50 -C " + csv + " 127.0.0.1 " + std::to_string(port), text);
+    uint64_t packets_in = admin_stat(admin, "packets_in");
+    uint64_t dropped = admin_stat(admin, "drop_no_target");
+    relay.stop();
+    std::cout << text;
+
+    auto rows = read_csv(csv);
+    bool ok = ran && rows.size() == 1;
+    if (ok) {
+        auto& row = rows[0];
+        double sent = csv_value(row, "sent_frames");
+        double recv = csv_value(row, "recv_frames");
+        double reconnects = csv_value(row, "reconnects");
+        std::cout << "reconnects " << reconnects << " (" << row["churn_per_s"] << "/s, p99 " << row["reconnect_p99_us"]
+                  << "us), relay dropped " << dropped << std::endl;
+        ok = reconnects >= 25 && reconnects <= 75 && csv_value(row, "churn_per_s") == reconnects &&
+             csv_value(row, "reconnect_p50_us") > 0 && csv_value(row, "disconnected") == 0 &&
+             csv_value(row, "register_failed") == 0 && csv_value(row, "connections") == 80 && sent > 80 * 50 * 0.8 && packets_in == sent &&
+             recv + dropped == sent;
+    }
+
+    std::remove(csv.c_str());
+    return ok;
+}
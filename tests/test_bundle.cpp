@@ -0,0 +1,446 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <unistd.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 打包帧记录: [varint 长度][标签][帧体]
+static void append_record(std::vector<uint8_t>& bundle, uint8_t tag, const uint8_t* mark, const void* data,
+                          size_t len) {
+    size_t body_len = (mark ? 8 : 0) + len;
+    uint8_t header[relay::COMPACT_HEADER_MAX];
+    uint32_t header_len = relay::writeVarint(header, static_cast<uint32_t>(body_len + 1));
+    header[header_len++] = tag;
+    bundle.insert(bundle.end(), header, header + header_len);
+    if (mark) {
+        bundle.insert(bundle.end(), mark, mark + 8);
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    bundle.insert(bundle.end(), bytes, bytes + len);
+}
+
+static bool send_bundle(int fd, const std::vector<uint8_t>& bundle) {
+    std::vector<uint8_t> frame(relay::FRAME_HEADER_SIZE + bundle.size());
+    relay::writeFrameHeader(frame.data(), static_cast<uint32_t>(bundle.size()), relay::FRAME_BUNDLE);
+    std::memcpy(frame.data() + relay::FRAME_HEADER_SIZE, bundle.data(), bundle.size());
+    return send_all(fd, frame.data(), frame.size());
+}
+
+static std::vector<std::pair<uint8_t, std::vector<uint8_t>>> parse_records(const std::vector<uint8_t>& bundle) {
+    std::vector<std::pair<uint8_t, std::vector<uint8_t>>> records;
+    size_t pos = 0;
+    while (pos < bundle.size()) {
+        uint32_t record_len = 0;
+        int n = relay::readVarint(bundle.data() + pos, bundle.size() - pos, record_len);
+        if (n <= 0 || record_len == 0 || pos + n + record_len > bundle.size()) {
+            records.clear();
+            break;
+        }
+        const uint8_t* record = bundle.data() + pos + n;
+        records.emplace_back(record[0], std::vector<uint8_t>(record + 1, record + record_len));
+        pos += n + record_len;
+    }
+    return records;
+}
+
+// 接收下一个数据帧或打包帧（跳过控制帧）
+static bool recv_data_or_bundle(int fd, uint8_t& type, std::vector<uint8_t>& body) {
+    while (recv_typed_frame(fd, type, body)) {
+        if (type != relay::FRAME_CTRL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 一个打包帧发往多个目标：中继按目标分组，支持打包帧的目标收到一个打包帧，旧版目标逐条收到
+bool test_bundle_routing() {
+    std::cout << "Testing bundle frame splitting and regrouping..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x11, 0x21, 0x31, 0x41, 0x51, 0x61, 0x71, 0x81};
+    uint8_t mark_b[8] = {0x12, 0x22, 0x32, 0x42, 0x52, 0x62, 0x72, 0x82};
+    uint8_t mark_c[8] = {0x13, 0x23, 0x33, 0x43, 0x53, 0x63, 0x73, 0x83};
+    uint8_t mark_x[8] = {0x14, 0x24, 0x34, 0x44, 0x54, 0x64, 0x74, 0x84};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    int bad = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && c >= 0 && bad >= 0;
+    if (ok) {
+        set_recv_timeout(a, 3000);
+        set_recv_timeout(b, 3000);
+        set_recv_timeout(c, 3000);
+        set_recv_timeout(bad, 3000);
+    }
+
+    // A: 打包帧 + 来源标记；B: 打包帧；C: 旧版
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    ok = ok && send_hello(a, mark_a, relay::CAP_BUNDLE | relay::CAP_SOURCE) &&
+         recv_hello_ack(a, status, token, relay_rx) && status == relay::HELLO_OK &&
+         send_hello(b, mark_b, relay::CAP_BUNDLE) && recv_hello_ack(b, status, token, relay_rx) &&
+         status == relay::HELLO_OK && send_register(c, mark_c);
+
+    // 交错的记录：B 三条、C 两条、不存在的目标一条
+    std::vector<uint8_t> bundle;
+    for (int i = 0; i < 3; i++) {
+        append_record(bundle, relay::COMPACT_TAG_DATA, mark_b, &i, sizeof(i));
+        if (i < 2) {
+            int v = 100 + i;
+            append_record(bundle, relay::COMPACT_TAG_DATA, mark_c, &v, sizeof(v));
+        }
+    }
+    int lost = -1;
+    append_record(bundle, relay::COMPACT_TAG_DATA, mark_x, &lost, sizeof(lost));
+    ok = ok && send_bundle(a, bundle);
+
+    // B：一个打包帧，三条记录都带 A 的来源标记
+    uint8_t type = 0;
+    std::vector<uint8_t> body;
+    bool b_one_bundle = false;
+    if (ok && recv_data_or_bundle(b, type, body) && type == relay::FRAME_BUNDLE) {
+        auto records = parse_records(body);
+        b_one_bundle = records.size() == 3;
+        for (size_t i = 0; i < records.size() && b_one_bundle; i++) {
+            int v = static_cast<int>(i);
+            b_one_bundle = records[i].first == relay::COMPACT_TAG_DATA && records[i].second.size() == 8 + sizeof(v) &&
+                           std::memcmp(records[i].second.data(), mark_a, 8) == 0 &&
+                           std::memcmp(records[i].second.data() + 8, &v, sizeof(v)) == 0;
+        }
+    }
+
+    // C：两个普通数据帧
+    int c_frames = 0;
+    for (int i = 0; i < 2 && ok; i++) {
+        int v = 100 + i;
+        if (recv_frame(c, body) && body.size() == 8 + sizeof(v) && std::memcmp(body.data(), mark_a, 8) == 0 &&
+            std::memcmp(body.data() + 8, &v, sizeof(v)) == 0) {
+            c_frames++;
+        }
+    }
+
+    // 未协商打包帧的连接发送打包帧、或记录长度越界：协议错误，连接被关闭
+    std::vector<uint8_t> broken;
+    append_record(broken, relay::COMPACT_TAG_DATA, mark_b, &lost, sizeof(lost));
+    broken[0] = 0x7F;
+    bool unnegotiated_closed = ok && register_with_ack(bad, mark_x) && send_bundle(bad, bundle) &&
+                               !recv_typed_frame(bad, type, body);
+    bool malformed_closed = ok && send_bundle(a, broken) && !recv_data_or_bundle(a, type, body);
+
+    std::cout << "B one bundle " << b_one_bundle << ", C frames " << c_frames << "/2, unnegotiated closed "
+              << unnegotiated_closed << ", malformed closed " << malformed_closed << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    if (c >= 0) close(c);
+    if (bad >= 0) close(bad);
+    relay.stop();
+    return b_one_bundle && c_frames == 2 && unnegotiated_closed && malformed_closed;
+}
+
+// 客户端库：一次 P2P_RunCallbacks 之间发送的数据包合并为一个打包帧；收到的打包帧拆开逐条读取
+bool test_connection_manager_bundle() {
+    std::cout << "Testing ConnectionManager bundling..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint64_t mark_a = 0x0A0B0C0D0E0F0001ULL;
+    uint64_t mark_b = 0x0A0B0C0D0E0F0002ULL;
+    uint8_t mark_a_bytes[8];
+    uint8_t mark_b_bytes[8];
+    std::memcpy(mark_a_bytes, &mark_a, 8);
+    std::memcpy(mark_b_bytes, &mark_b, 8);
+
+    int b = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    if (b < 0 || !send_hello(b, mark_b_bytes, relay::CAP_BUNDLE) || !recv_hello_ack(b, status, token, relay_rx) ||
+        P2P_Init() != P2P_OK || P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) != P2P_OK) {
+        std::cerr << "Setup failed" << std::endl;
+        P2P_Shutdown();
+        if (b >= 0) close(b);
+        relay.stop();
+        return false;
+    }
+    set_recv_timeout(b, 3000);
+    P2P_EnableRelaySession(peer, mark_a, P2P_RELAY_FLAG_BUNDLE);
+
+    // 等待 HELLO_ACK：之前两个探测包逐条发出，之后合并为一个打包帧
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    bool established = false;
+    while (!established && std::chrono::steady_clock::now() < deadline) {
+        uint8_t probe[9] = {};
+        std::memcpy(probe, &mark_b, 8);
+        P2P_SendPacket(peer, probe, sizeof(probe));
+        P2P_SendPacket(peer, probe, sizeof(probe));
+        P2P_RunCallbacks();
+        P2P_RunCallbacks();
+        size_t probes = 0;
+        uint8_t type = 0;
+        std::vector<uint8_t> body;
+        while (probes < 2 && recv_data_or_bundle(b, type, body)) {
+            established = type == relay::FRAME_BUNDLE;
+            probes += established ? parse_records(body).size() : 1;
+        }
+        if (probes < 2) {
+            break;
+        }
+    }
+
+    // 一个游戏帧内的6个数据包
+    const int per_tick = 6;
+    for (int i = 0; i < per_tick; i++) {
+        uint8_t packet[8 + sizeof(int)];
+        std::memcpy(packet, &mark_b, 8);
+        std::memcpy(packet + 8, &i, sizeof(i));
+        P2P_SendPacket(peer, packet, sizeof(packet));
+    }
+    P2P_RunCallbacks();
+
+    uint8_t type = 0;
+    std::vector<uint8_t> body;
+    bool one_bundle = false;
+    if (established && recv_data_or_bundle(b, type, body) && type == relay::FRAME_BUNDLE) {
+        auto records = parse_records(body);
+        one_bundle = records.size() == per_tick;
+        for (int i = 0; i < per_tick && one_bundle; i++) {
+            one_bundle = records[i].second.size() == sizeof(int) &&
+                         std::memcmp(records[i].second.data(), &i, sizeof(int)) == 0;
+        }
+    }
+
+    // B -> A 的打包帧拆成逐条数据包
+    std::vector<uint8_t> bundle;
+    for (int i = 0; i < per_tick; i++) {
+        append_record(bundle, relay::COMPACT_TAG_DATA, mark_a_bytes, &i, sizeof(i));
+    }
+    int received = 0;
+    if (established && send_bundle(b, bundle)) {
+        deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+        while (received < per_tick && std::chrono::steady_clock::now() < deadline) {
+            P2P_RunCallbacks();
+            uint8_t buf[64];
+            uint32_t size = 0;
+            while (P2P_ReadPacket(peer, buf, sizeof(buf), &size, nullptr) == P2P_OK) {
+                if (size == sizeof(int) && std::memcmp(buf, &received, sizeof(int)) == 0) {
+                    received++;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    std::cout << "established " << established << ", " << per_tick << " packets in one bundle " << one_bundle
+              << ", unpacked " << received << "/" << per_tick << std::endl;
+
+    P2P_Shutdown();
+    close(b);
+    relay.stop();
+    return established && one_bundle && received == per_tick;
+}
+
+// 游戏线程发送的同时泵线程调用 P2P_RunCallbacks 发出打包帧：记录不丢失、不重复、不乱序
+bool test_connection_manager_bundle_threads() {
+    std::cout << "Testing ConnectionManager bundling across threads..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint64_t mark_a = 0x0A0B0C0D0E0F0011ULL;
+    uint64_t mark_b = 0x0A0B0C0D0E0F0012ULL;
+    uint8_t mark_b_bytes[8];
+    std::memcpy(mark_b_bytes, &mark_b, 8);
+
+    int b = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    if (b < 0 || !send_hello(b, mark_b_bytes, relay::CAP_BUNDLE) || !recv_hello_ack(b, status, token, relay_rx) ||
+        P2P_Init() != P2P_OK || P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) != P2P_OK) {
+        std::cerr << "Setup failed" << std::endl;
+        P2P_Shutdown();
+        if (b >= 0) close(b);
+        relay.stop();
+        return false;
+    }
+    set_recv_timeout(b, 3000);
+    P2P_EnableRelaySession(peer, mark_a, P2P_RELAY_FLAG_BUNDLE);
+    for (int i = 0; i < 50; i++) {
+        P2P_RunCallbacks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    std::atomic<bool> stop{false};
+    std::thread pump([&] {
+        while (!stop.load()) {
+            P2P_RunCallbacks();
+        }
+    });
+
+    const int total = 20000;
+    std::thread game([&] {
+        for (int i = 0; i < total; i++) {
+            uint8_t packet[8 + sizeof(int)];
+            std::memcpy(packet, &mark_b, 8);
+            std::memcpy(packet + 8, &i, sizeof(i));
+            P2P_SendPacket(peer, packet, sizeof(packet));
+            if (i % 64 == 63) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    // 数据帧与打包帧中的记录按发送顺序依次为 0..total-1
+    int next = 0;
+    bool in_order = true;
+    uint8_t type = 0;
+    std::vector<uint8_t> body;
+    while (in_order && next < total && recv_data_or_bundle(b, type, body)) {
+        if (type == relay::FRAME_BUNDLE) {
+            auto records = parse_records(body);
+            in_order = !records.empty();
+            for (size_t i = 0; i < records.size() && in_order; i++) {
+                in_order = records[i].second.size() == sizeof(int) &&
+                           std::memcmp(records[i].second.data(), &next, sizeof(int)) == 0;
+                next++;
+            }
+        } else {
+            in_order = body.size() == sizeof(int) && std::memcmp(body.data(), &next, sizeof(int)) == 0;
+            next++;
+        }
+    }
+    game.join();
+    stop = true;
+    pump.join();
+
+    std::cout << "received " << next << "/" << total << " in order " << in_order << std::endl;
+
+    P2P_Shutdown();
+    close(b);
+    relay.stop();
+    return in_order && next == total;
+}
+
+// 基准：每个游戏帧6条小消息，逐条发送 vs 打包发送
+// 统计每条消息的帧头字节、发送方 send 次数、接收方解析的帧数与每帧耗时
+bool test_bundle_benchmark() {
+    std::cout << "Benchmarking per-message framing vs bundles..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    const int ticks = 2000;
+    const int per_tick = 6;
+    const size_t msg_size = 24;
+    struct Result {
+        double uplink_header = 0;
+        double downlink_header = 0;
+        double sends = 0;
+        double frames_parsed = 0;
+        double us_per_tick = 0;
+        bool ok = false;
+    } results[2];
+
+    for (int bundled = 0; bundled < 2; bundled++) {
+        uint8_t mark_s[8] = {0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, static_cast<uint8_t>(bundled)};
+        uint8_t mark_r[8] = {0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, static_cast<uint8_t>(bundled)};
+        uint32_t caps = relay::CAP_SOURCE | (bundled ? relay::CAP_BUNDLE : 0);
+        int s = connect_to_relay(port);
+        int r = connect_to_relay(port);
+        uint8_t status = 0;
+        uint64_t token = 0;
+        uint64_t relay_rx = 0;
+        bool ok = s >= 0 && r >= 0 && send_hello(s, mark_s, caps) && recv_hello_ack(s, status, token, relay_rx) &&
+                  send_hello(r, mark_r, caps) && recv_hello_ack(r, status, token, relay_rx);
+        if (ok) {
+            set_recv_timeout(r, 3000);
+        }
+
+        uint8_t msg[msg_size];
+        std::memset(msg, 0x5A, sizeof(msg));
+        uint64_t up_bytes = 0;
+        uint64_t down_bytes = 0;
+        uint64_t sends = 0;
+        uint64_t frames = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < ticks && ok; t++) {
+            if (bundled) {
+                std::vector<uint8_t> bundle;
+                for (int i = 0; i < per_tick; i++) {
+                    append_record(bundle, relay::COMPACT_TAG_DATA, mark_r, msg, sizeof(msg));
+                }
+                ok = send_bundle(s, bundle);
+                up_bytes += relay::FRAME_HEADER_SIZE + bundle.size();
+                sends++;
+            } else {
+                for (int i = 0; i < per_tick && ok; i++) {
+                    ok = send_forward(s, mark_r, msg, sizeof(msg));
+                    up_bytes += relay::FRAME_HEADER_SIZE + 8 + sizeof(msg);
+                    sends++;
+                }
+            }
+
+            int got = 0;
+            while (got < per_tick && ok) {
+                uint8_t type = 0;
+                std::vector<uint8_t> body;
+                ok = recv_data_or_bundle(r, type, body);
+                frames++;
+                down_bytes += relay::FRAME_HEADER_SIZE + body.size();
+                got += type == relay::FRAME_BUNDLE ? static_cast<int>(parse_records(body).size()) : 1;
+            }
+        }
+        double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        double messages = static_cast<double>(ticks) * per_tick;
+        results[bundled].ok = ok;
+        results[bundled].uplink_header = static_cast<double>(up_bytes) / messages - msg_size;
+        results[bundled].downlink_header = static_cast<double>(down_bytes) / messages - msg_size;
+        results[bundled].sends = static_cast<double>(sends) / messages;
+        results[bundled].frames_parsed = static_cast<double>(frames) / messages;
+        results[bundled].us_per_tick = elapsed_us / ticks;
+
+        if (s >= 0) close(s);
+        if (r >= 0) close(r);
+    }
+    relay.stop();
+
+    const char* names[2] = {"per-message", "bundled"};
+    for (int i = 0; i < 2; i++) {
+        std::cout << names[i] << ": header bytes/msg up=" << results[i].uplink_header
+                  << " down=" << results[i].downlink_header << " (incl. 8B source mark), sends/msg="
+                  << results[i].sends << ", frames parsed/msg=" << results[i].frames_parsed << ", "
+                  << results[i].us_per_tick << "us/tick" << std::endl;
+    }
+
+    return results[0].ok && results[1].ok && results[1].uplink_header < results[0].uplink_header &&
+           results[1].downlink_header < results[0].downlink_header && results[1].sends < results[0].sends &&
+           results[1].frames_parsed < results[0].frames_parsed;
+}
@@ -0,0 +1,253 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include "relay_capture.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+static bool read_file(const std::string& path, std::vector<uint8_t>& out) {
+    std::ifstream in(path, std::ios::binary);
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return in.good() || in.eof();
+}
+
+static uint64_t wait_connections_closed(const std::string& admin) {
+    uint64_t value = UINT64_MAX;
+    for (int i = 0; i < 100 && value != 0; i++) {
+        value = admin_stat(admin, "connections");
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return value;
+}
+
+// 运行 relay_replay 并取得汇总行；路径默认为 ../server/relay_replay，可通过 RELAY_REPLAY_BIN 覆盖
+static bool run_replay(const std::string& args, std::string& summary) {
+    const char* bin = std::getenv("RELAY_REPLAY_BIN");
+    std::string command = std::string(bin ? bin : "../server/relay_replay") + " " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return false;
+    }
+    char line[1024];
+    summary.clear();
+    while (fgets(line, sizeof(line), pipe)) {
+        summary += line;
+    }
+    return pclose(pipe) == 0 && summary.rfind("replay ", 0) == 0;
+}
+
+// 汇总行中 key=value 的值
+static double summary_value(const std::string& summary, const std::string& key) {
+    size_t pos = summary.find(" " + key + "=");
+    return pos == std::string::npos ? -1 : std::atof(summary.c_str() + pos + key.size() + 2);
+}
+
+// 抓包文件：每个帧原样记录（超出 snaplen 的部分截断），退出时写入的索引与顺序扫描重建的一致
+bool test_capture_file_index() {
+    std::cout << "Testing binary traffic capture and its connection index..." << std::endl;
+
+    std::string admin = test_temp_path("capture");
+    std::string path = test_temp_path("capture", ".cap");
+    TestRelay relay({"-c", "16", "-a", admin, "-w", path, "-o", "capture_snaplen=64"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xD1, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xD2, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);   // 不注册就断开
+    bool ok = a >= 0 && b >= 0 && c >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b);
+    if (ok) {
+        set_recv_timeout(a, 1000);
+        set_recv_timeout(b, 1000);
+    }
+    if (c >= 0) close(c);
+
+    // A->B 50个1000字节的包（被截断），B->A 10个20字节的包（完整保存）
+    std::vector<uint8_t> big(1000, 0xAB);
+    std::vector<uint8_t> small(20, 0xCD);
+    std::vector<uint8_t> body;
+    for (int i = 0; i < 50 && ok; i++) {
+        ok = send_forward(a, mark_b, big.data(), big.size()) && recv_frame(b, body) && body.size() == big.size();
+    }
+    for (int i = 0; i < 10 && ok; i++) {
+        ok = send_forward(b, mark_a, small.data(), small.size()) && recv_frame(a, body) && body.size() == small.size();
+    }
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    uint64_t remaining = wait_connections_closed(admin);
+    uint64_t records = admin_stat(admin, "capture_records");
+    uint64_t truncated = admin_stat(admin, "capture_truncated");
+    relay.stop();
+
+    std::vector<uint8_t> file;
+    relay::CaptureHeader header;
+    std::vector<relay::CaptureConn> index;
+    bool parsed = read_file(path, file) && relay::readCaptureHeader(file.data(), file.size(), header) &&
+                  header.indexOffset != 0 && relay::loadCaptureIndex(file.data(), header, index);
+
+    // 连接编号从1开始，A、B、C 依次为1、2、3
+    // 逐条检查记录：时间单调，数据帧截断到 snaplen，A 的第一个帧是 HELLO，其后的数据帧都以目标标记开头
+    const uint32_t hello_len = relay::FRAME_HEADER_SIZE + relay::HELLO_FIXED_SIZE;
+    const uint32_t big_len = relay::FRAME_HEADER_SIZE + 8 + 1000;
+    const uint32_t small_len = relay::FRAME_HEADER_SIZE + 8 + 20;
+    bool records_ok = parsed;
+    size_t record_count = 0;
+    uint64_t last_ns = 0;
+    int a_frames = 0;
+    uint64_t offset = relay::CAPTURE_HEADER_SIZE;
+    relay::CaptureRecord rec;
+    while (parsed && relay::readCaptureRecord(file.data(), header.dataEnd, offset, rec)) {
+        record_count++;
+        records_ok = records_ok && rec.timeNs >= last_ns && rec.capLen == std::min<uint32_t>(rec.origLen, 64);
+        last_ns = rec.timeNs;
+        if (rec.conn == 1 && rec.type == relay::CAPTURE_FRAME) {
+            const uint8_t* frame_body = rec.data + relay::FRAME_HEADER_SIZE;
+            records_ok = records_ok && (a_frames == 0 ? rec.origLen == hello_len && frame_body[0] == relay::CTRL_HELLO &&
+                                                            std::memcmp(frame_body + 6, mark_a, 8) == 0
+                                                      : rec.origLen == big_len && std::memcmp(frame_body, mark_b, 8) == 0);
+            a_frames++;
+        }
+    }
+    records_ok = records_ok && offset == header.dataEnd;
+
+    // 没有索引时顺序扫描重建：帧数、字节数与首条记录偏移一致
+    relay::CaptureHeader scan_header = header;
+    scan_header.indexOffset = 0;
+    std::vector<relay::CaptureConn> scanned;
+    bool scan_ok = parsed && relay::loadCaptureIndex(file.data(), scan_header, scanned) && scanned.size() == index.size();
+    for (size_t i = 0; scan_ok && i < index.size(); i++) {
+        scan_ok = scanned[i].frames == index[i].frames && scanned[i].bytes == index[i].bytes &&
+                  scanned[i].firstOffset == index[i].firstOffset && scanned[i].closeNs == index[i].closeNs &&
+                  !(scanned[i].flags & relay::CAPTURE_CONN_OPEN);
+    }
+
+    bool index_ok = parsed && header.snaplen == 64 && index.size() == 3 &&
+                    index[0].flags == relay::CAPTURE_CONN_REGISTERED && std::memcmp(index[0].mark, mark_a, 8) == 0 &&
+                    index[0].frames == 51 && index[0].bytes == hello_len + 50ULL * big_len &&
+                    index[1].flags == relay::CAPTURE_CONN_REGISTERED && std::memcmp(index[1].mark, mark_b, 8) == 0 &&
+                    index[1].frames == 11 && index[1].bytes == hello_len + 10ULL * small_len &&
+                    index[2].flags == 0 && index[2].frames == 0;
+
+    std::cout << "capture " << file.size() << " bytes, " << record_count << " records (relay counted " << records
+              << ", truncated " << truncated << "), " << index.size() << " indexed connections, A frames "
+              << (index.empty() ? 0 : index[0].frames) << "; records ok " << records_ok << ", index ok " << index_ok
+              << ", rebuilt index matches " << scan_ok << std::endl;
+
+    // 每个连接另有建立与关闭两条记录：A 51帧、B 11帧、C 没有帧，共68条
+    std::remove(path.c_str());
+    return ok && remaining == 0 && parsed && records_ok && index_ok && scan_ok && record_count == 68 &&
+           records == 68 && truncated == 50;
+}
+
+// 抓一段带节奏的流量，重放到新的中继：按原速重放时两边的计数完全一致，加速重放时耗时按倍数缩短
+bool test_capture_replay() {
+    std::cout << "Testing deterministic replay of a captured session..." << std::endl;
+
+    std::string admin = test_temp_path("replay_src");
+    std::string path = test_temp_path("replay", ".cap");
+    TestRelay relay({"-c", "16", "-a", admin, "-w", path});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xD3, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xD4, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t nobody[8] = {0xDF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b);
+    if (ok) {
+        set_recv_timeout(a, 1000);
+        set_recv_timeout(b, 1000);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // 约400ms：A 每毫秒一个大小不一的包，B 每10个回一个，夹带发往不存在目标的包
+    std::vector<uint8_t> payload(1400);
+    std::vector<uint8_t> body;
+    for (int i = 0; i < 400 && ok; i++) {
+        size_t len = 32 + static_cast<size_t>(i * 37) % 1300;
+        relay::writeU32(payload.data(), static_cast<uint32_t>(i));
+        ok = send_forward(a, mark_b, payload.data(), len) && recv_frame(b, body) && body.size() == len;
+        if (ok && i % 10 == 9) {
+            ok = send_forward(b, mark_a, payload.data(), 64) && recv_frame(a, body) &&
+                 send_forward(a, nobody, payload.data(), 16);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    wait_connections_closed(admin);
+
+    const char* names[] = {"packets_in", "bytes_in", "packets_out", "bytes_out", "drop_no_target"};
+    uint64_t original[5];
+    for (int i = 0; i < 5; i++) {
+        original[i] = admin_stat(admin, names[i]);
+    }
+    relay.stop();
+
+    std::vector<uint8_t> file;
+    relay::CaptureHeader header;
+    std::vector<relay::CaptureConn> index;
+    bool parsed = read_file(path, file) && relay::readCaptureHeader(file.data(), file.size(), header) &&
+                  relay::loadCaptureIndex(file.data(), header, index) && index.size() == 2;
+    // A 为编号1
+    double captured_ms = parsed ? (index[0].closeNs - index[0].openNs) / 1e6 : 0;
+
+    // 按原速、不探测重放到新的中继：计数与抓包时相同
+    bool replay_ok[2] = {false, false};
+    std::string summary[2];
+    uint64_t replayed[5];
+    for (int run = 0; run < 2 && parsed; run++) {
+        std::string replay_admin = test_temp_path("replay");
+        TestRelay replay_relay({"-c", "16", "-a", replay_admin});
+        if (!replay_relay.started()) {
+            break;
+        }
+        int replay_port = replay_relay.port();
+        std::string args = (run == 0 ? "-s 1 -p 0 -d 200 " : "-s 4 -p 5 -d 200 ") + path + " 127.0.0.1 " +
+                           std::to_string(replay_port);
+        replay_ok[run] = run_replay(args, summary[run]) && summary_value(summary[run], "frames") ==
+                                                                 static_cast<double>(index[0].frames + index[1].frames) &&
+                         summary_value(summary[run], "connect_failed") == 0 &&
+                         summary_value(summary[run], "closed_by_relay") == 0;
+        if (run == 0) {
+            wait_connections_closed(replay_admin);
+            for (int i = 0; i < 5; i++) {
+                replayed[i] = admin_stat(replay_admin, names[i]);
+            }
+        }
+        replay_relay.stop();
+        std::cout << (run == 0 ? "1x: " : "4x: ") << summary[run];
+    }
+
+    bool counters_equal = replay_ok[0];
+    for (int i = 0; i < 5 && counters_equal; i++) {
+        std::cout << names[i] << " captured " << original[i] << " replayed " << replayed[i] << "; ";
+        counters_equal = original[i] != UINT64_MAX && original[i] == replayed[i];
+    }
+    double duration_1x = summary_value(summary[0], "duration_ms");
+    double duration_4x = summary_value(summary[1], "duration_ms");
+    std::cout << "captured " << captured_ms << "ms, replayed in " << duration_1x << "ms at 1x and " << duration_4x
+              << "ms at 4x" << std::endl;
+
+    std::remove(path.c_str());
+    return ok && parsed && counters_equal && replay_ok[1] && duration_1x > captured_ms * 0.8 &&
+           duration_1x < captured_ms + 200 && duration_4x > captured_ms / 4 * 0.8 &&
+           duration_4x < captured_ms / 4 + 100 && summary_value(summary[1], "probes") > 10 &&
+           summary_value(summary[1], "probes_lost") == 0 && summary_value(summary[1], "rtt_p99_us") > 0;
+}
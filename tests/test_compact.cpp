@@ -0,0 +1,193 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 收取下一个紧凑数据帧或指定操作码的控制帧（心跳等其他控制帧跳过）
+static bool recv_compact_until(int fd, uint8_t want_tag, uint8_t want_op, std::vector<uint8_t>& body) {
+    uint8_t tag = 0;
+    while (recv_compact(fd, tag, body)) {
+        if (tag == relay::COMPACT_TAG_CTRL) {
+            if (want_tag == relay::COMPACT_TAG_CTRL && !body.empty() && body[0] == want_op) {
+                return true;
+            }
+            continue;
+        }
+        return tag == want_tag;
+    }
+    return false;
+}
+
+static bool compact_hello(int fd, const uint8_t* mark) {
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    return send_hello(fd, mark, relay::CAP_PRESENCE | relay::CAP_COMPACT) &&
+           recv_hello_ack(fd, status, token, relay_rx) && status == relay::HELLO_OK;
+}
+
+// 紧凑帧与 v1 客户端在同一端口互通：短编号寻址、标记寻址、双向转换
+bool test_compact_framing() {
+    std::cout << "Testing compact v2 framing with peer slots..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38};
+    uint8_t mark_b[8] = {0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48};
+    uint8_t mark_c[8] = {0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && c >= 0;
+    if (ok) {
+        set_recv_timeout(a, 3000);
+        set_recv_timeout(b, 3000);
+        set_recv_timeout(c, 3000);
+    }
+
+    uint8_t payload[100];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = static_cast<uint8_t>(i * 7);
+    }
+    // 以8字节标记寻址发出第一个包后，发送方收到目标的上线通知与短编号
+    std::vector<uint8_t> body;
+    auto first_send = [&](int from, const uint8_t* to, uint8_t& slot) {
+        std::vector<uint8_t> marked(to, to + 8);
+        marked.insert(marked.end(), payload, payload + sizeof(payload));
+        slot = 0;
+        if (!send_compact(from, relay::COMPACT_TAG_DATA, marked.data(), marked.size()) ||
+            !recv_compact_until(from, relay::COMPACT_TAG_CTRL, relay::CTRL_PEER_JOIN, body) ||
+            body.size() != relay::CTRL_PEER_JOIN_COMPACT_SIZE || std::memcmp(body.data() + 1, to, 8) != 0) {
+            return false;
+        }
+        slot = body[relay::CTRL_PEER_EVENT_SIZE];
+        return true;
+    };
+
+    // A 发给 C（v1 客户端）与 B，B 发给 A：各自得到对方的短编号
+    std::vector<uint8_t> frame;
+    uint8_t a_slot_c = 0;
+    uint8_t a_slot_b = 0;
+    uint8_t b_slot_a = 0;
+    ok = ok && compact_hello(a, mark_a) && send_register(c, mark_c) && compact_hello(b, mark_b) &&
+         first_send(a, mark_c, a_slot_c) && recv_frame(c, frame) && first_send(a, mark_b, a_slot_b) &&
+         recv_compact_until(b, relay::COMPACT_TAG_DATA, 0, body) && first_send(b, mark_a, b_slot_a) &&
+         recv_compact_until(a, relay::COMPACT_TAG_DATA, 0, body);
+    bool slots_ok = ok && a_slot_c != 0 && a_slot_b != 0 && a_slot_b != a_slot_c && b_slot_a != 0;
+
+    // A -> B 短编号寻址，B 收到紧凑数据帧
+    bool slot_to_compact = slots_ok && send_compact(a, a_slot_b, payload, sizeof(payload)) &&
+                           recv_compact_until(b, relay::COMPACT_TAG_DATA, 0, body) && body.size() == sizeof(payload) &&
+                           std::memcmp(body.data(), payload, sizeof(payload)) == 0;
+
+    // A -> C 短编号寻址，v1 客户端收到4字节帧头的数据帧
+    bool slot_to_v1 = slots_ok && send_compact(a, a_slot_c, payload, sizeof(payload)) && recv_frame(c, frame) &&
+                      frame.size() == sizeof(payload) && std::memcmp(frame.data(), payload, sizeof(payload)) == 0;
+
+    // C (v1) -> A，以及 A 用8字节标记寻址 B
+    std::vector<uint8_t> marked(mark_b, mark_b + 8);
+    marked.insert(marked.end(), payload, payload + sizeof(payload));
+    bool v1_to_compact = ok && send_forward(c, mark_a, payload, sizeof(payload)) &&
+                         recv_compact_until(a, relay::COMPACT_TAG_DATA, 0, body) && body.size() == sizeof(payload);
+    bool mark_addressed = ok && send_compact(a, relay::COMPACT_TAG_DATA, marked.data(), marked.size()) &&
+                          recv_compact_until(b, relay::COMPACT_TAG_DATA, 0, body) && body.size() == sizeof(payload);
+
+    // 未分配的短编号是协议错误，连接被关闭
+    uint8_t type = 0;
+    bool bad_slot_closed = ok && send_compact(b, 200, payload, sizeof(payload)) && !recv_typed_frame(b, type, body);
+
+    std::cout << "slots " << slots_ok << ", slot->v2 " << slot_to_compact << ", slot->v1 " << slot_to_v1
+              << ", v1->v2 " << v1_to_compact << ", mark addressed " << mark_addressed << ", bad slot closed "
+              << bad_slot_closed << "; ingress header for a " << sizeof(payload) << "-byte packet: v1 "
+              << relay::FRAME_HEADER_SIZE + 8 << "B, v2 2B" << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    if (c >= 0) close(c);
+    relay.stop();
+    return slots_ok && slot_to_compact && slot_to_v1 && v1_to_compact && mark_addressed && bad_slot_closed;
+}
+
+// 客户端库：启用紧凑帧后与 v1 对端双向收发
+bool test_connection_manager_compact() {
+    std::cout << "Testing ConnectionManager compact framing..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint64_t mark_a = 0x5566778899AABB01ULL;
+    uint64_t mark_b = 0x5566778899AABB02ULL;
+    uint8_t mark_a_bytes[8];
+    uint8_t mark_b_bytes[8];
+    std::memcpy(mark_a_bytes, &mark_a, 8);
+    std::memcpy(mark_b_bytes, &mark_b, 8);
+
+    int b = connect_to_relay(port);
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    if (b < 0 || !register_with_ack(b, mark_b_bytes) || P2P_Init() != P2P_OK ||
+        P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) != P2P_OK) {
+        std::cerr << "Setup failed" << std::endl;
+        P2P_Shutdown();
+        if (b >= 0) close(b);
+        relay.stop();
+        return false;
+    }
+    set_recv_timeout(b, 3000);
+    P2P_EnableRelaySession(peer, mark_a, P2P_RELAY_FLAG_COMPACT);
+
+    // HELLO_ACK 之前发出的包先缓存，之后按紧凑帧发出；收到目标的上线通知后改用短编号
+    const int count = 50;
+    int received_by_b = 0;
+    int received_by_a = 0;
+    for (int i = 0; i < count; i++) {
+        uint8_t packet[8 + sizeof(int)];
+        std::memcpy(packet, &mark_b, 8);
+        std::memcpy(packet + 8, &i, sizeof(i));
+        P2P_SendPacket(peer, packet, sizeof(packet));
+        P2P_RunCallbacks();
+
+        std::vector<uint8_t> frame;
+        uint8_t type = 0;
+        while (received_by_b <= i && recv_typed_frame(b, type, frame)) {
+            if (type == relay::FRAME_DATA && frame.size() == sizeof(int) &&
+                std::memcmp(frame.data(), &received_by_b, sizeof(int)) == 0) {
+                received_by_b++;
+            }
+        }
+        send_forward(b, mark_a_bytes, &i, sizeof(i));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (received_by_a < count && std::chrono::steady_clock::now() < deadline) {
+        P2P_RunCallbacks();
+        uint8_t buf[64];
+        uint32_t size = 0;
+        while (P2P_ReadPacket(peer, buf, sizeof(buf), &size, nullptr) == P2P_OK) {
+            if (size == sizeof(int) && std::memcmp(buf, &received_by_a, sizeof(int)) == 0) {
+                received_by_a++;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::cout << "B received " << received_by_b << "/" << count << ", A received " << received_by_a << "/" << count
+              << std::endl;
+
+    P2P_Shutdown();
+    close(b);
+    relay.stop();
+    return received_by_b == count && received_by_a == count;
+}
@@ -0,0 +1,218 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+struct CongestedResult {
+    int delivered = 0;
+    uint64_t dropped = UINT64_MAX;
+    double p50_ms = 0;
+    double p99_ms = 0;
+    bool in_order = true;
+};
+
+// 发送方以 CAP_LANES 注册并以 CTRL_CLASS 声明之后的数据帧类别
+static bool register_sender(int fd, const uint8_t* mark, uint8_t traffic_class) {
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    return send_hello(fd, mark, relay::CAP_LANES) && recv_hello_ack(fd, status, token, relay_rx) &&
+           status == relay::HELLO_OK && send_class(fd, traffic_class);
+}
+
+// 拥塞的目标：A 以约 50MB/s 发出 traffic_class 类别的 1000 字节的包（负载带发送时间与序号），B 只以约 20MB/s 读取
+// deadline_ms 非0时 B 在 HELLO 中带 TLV_DEADLINE；统计 B 收到的每个包从发送到收到的时间
+static bool run_congested_target(uint32_t deadline_ms, uint8_t traffic_class, int count, CongestedResult& result) {
+    std::string admin = test_temp_path("deadline");
+    TestRelay relay({"-c", "16", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x81, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0x82, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = a >= 0 && b >= 0;
+    if (ok) {
+        int rcvbuf = 256 * 1024;
+        setsockopt(b, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        set_recv_timeout(b, 500);
+    }
+    ok = ok && send_hello(b, mark_b, 0, 0, 0, deadline_ms) && recv_hello_ack(b, status, token, relay_rx) &&
+         status == relay::HELLO_OK && register_sender(a, mark_a, traffic_class);
+
+    std::thread sender([&]() {
+        std::vector<uint8_t> payload(1000);
+        for (int i = 0; i < count && ok; i++) {
+            relay::writeU64(payload.data(), steady_us());
+            relay::writeU32(payload.data() + 8, static_cast<uint32_t>(i));
+            if (!send_forward(a, mark_b, payload.data(), payload.size())) {
+                break;
+            }
+            if (i % 50 == 49) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    });
+
+    std::vector<double> ages;
+    std::vector<uint8_t> body;
+    int64_t last_seq = -1;
+    while (ok && recv_frame(b, body)) {
+        if (body.size() != 1000) {
+            result.in_order = false;
+            break;
+        }
+        ages.push_back((steady_us() - relay::readU64(body.data())) / 1000.0);
+        int64_t seq = relay::readU32(body.data() + 8);
+        result.in_order = result.in_order && seq > last_seq;
+        last_seq = seq;
+        if (ages.size() % 20 == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    sender.join();
+    result.dropped = admin_stat(admin, "drop_send_eagain");
+
+    result.delivered = static_cast<int>(ages.size());
+    if (!ages.empty()) {
+        std::sort(ages.begin(), ages.end());
+        result.p50_ms = ages[ages.size() / 2];
+        result.p99_ms = ages[std::min(ages.size() - 1, ages.size() * 99 / 100)];
+    }
+
+    close(a);
+    close(b);
+    relay.stop();
+    return ok;
+}
+
+// 数据帧截止时间：拥塞目标收到的不可靠包的 p99 延迟受截止时间约束，过期的包被丢弃并计数
+bool test_data_deadline_p99() {
+    std::cout << "Testing per-packet deadlines on a congested target..." << std::endl;
+
+    const int count = 20000;
+    const uint32_t deadline_ms = 100;
+    CongestedResult baseline;
+    CongestedResult limited;
+    bool ok = run_congested_target(0, relay::CLASS_UNRELIABLE, count, baseline) &&
+              run_congested_target(deadline_ms, relay::CLASS_UNRELIABLE, count, limited);
+
+    std::cout << "no deadline: delivered " << baseline.delivered << "/" << count << " p50 " << baseline.p50_ms
+              << "ms p99 " << baseline.p99_ms << "ms dropped " << baseline.dropped << std::endl;
+    std::cout << "deadline " << deadline_ms << "ms: delivered " << limited.delivered << "/" << count << " p50 "
+              << limited.p50_ms << "ms p99 " << limited.p99_ms << "ms dropped " << limited.dropped << std::endl;
+
+    // 除截止时间外，包还可能在内核缓冲区中等待（TCP_NOTSENT_LOWAT 与接收窗口）
+    bool baseline_ok = baseline.delivered == count && baseline.dropped == 0 && baseline.in_order &&
+                       baseline.p99_ms > 2.0 * deadline_ms;
+    bool limited_ok = limited.dropped != UINT64_MAX && limited.dropped > 0 &&
+                      static_cast<uint64_t>(limited.delivered) + limited.dropped == static_cast<uint64_t>(count) &&
+                      limited.in_order && limited.p99_ms < deadline_ms + 150.0;
+    return ok && baseline_ok && limited_ok;
+}
+
+// 截止时间不丢弃可靠类别：同样拥塞的目标收到全部可靠包，尽管它们排队远超截止时间
+bool test_data_deadline_reliable() {
+    std::cout << "Testing that deadlines keep reliable packets on a congested target..." << std::endl;
+
+    const int count = 20000;
+    const uint32_t deadline_ms = 100;
+    CongestedResult reliable;
+    bool ok = run_congested_target(deadline_ms, relay::CLASS_RELIABLE, count, reliable);
+
+    std::cout << "deadline " << deadline_ms << "ms, reliable: delivered " << reliable.delivered << "/" << count
+              << " p99 " << reliable.p99_ms << "ms dropped " << reliable.dropped << std::endl;
+
+    return ok && reliable.delivered == count && reliable.dropped == 0 && reliable.in_order &&
+           reliable.p99_ms > 2.0 * deadline_ms;
+}
+
+// 续传客户端：丢弃的帧不计入帧序号，恢复会话后中继不会重放它们
+bool test_data_deadline_resume() {
+    std::cout << "Testing per-packet deadlines with session resume..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x83, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0x84, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = a >= 0 && b >= 0;
+    if (ok) {
+        int small = 8192;
+        setsockopt(b, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+        set_recv_timeout(b, 300);
+    }
+    ok = ok && send_hello(b, mark_b, relay::CAP_RESUME, 0, 0, 50) && recv_hello_ack(b, status, token, relay_rx) &&
+         status == relay::HELLO_OK && register_sender(a, mark_a, relay::CLASS_UNRELIABLE);
+
+    // B 不读取期间 A 发出 300 个包，等到它们全部过期后 B 才开始读
+    const int count = 300;
+    std::vector<uint8_t> payload(1000);
+    for (int i = 0; i < count && ok; i++) {
+        relay::writeU32(payload.data(), static_cast<uint32_t>(i));
+        ok = send_forward(a, mark_b, payload.data(), payload.size());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    int received = 0;
+    std::vector<uint8_t> body;
+    uint8_t type = 0;
+    while (ok && recv_typed_frame(b, type, body)) {
+        if (type == relay::FRAME_DATA) {
+            received++;
+        }
+    }
+
+    // 以实际收到的帧数恢复会话：不应有任何重放，之后的新包正常到达
+    close(b);
+    int b2 = connect_to_relay(port);
+    bool resumed = false;
+    int replayed = 0;
+    bool fresh_ok = false;
+    if (ok && b2 >= 0) {
+        set_recv_timeout(b2, 300);
+        resumed = send_hello(b2, mark_b, relay::CAP_RESUME, token, static_cast<uint64_t>(received), 50) &&
+                  recv_hello_ack(b2, status, token, relay_rx) && status == relay::HELLO_RESUMED;
+        while (resumed && recv_typed_frame(b2, type, body)) {
+            if (type == relay::FRAME_DATA) {
+                replayed++;
+            }
+        }
+        const char fresh[] = "fresh";
+        fresh_ok = send_forward(a, mark_b, fresh, sizeof(fresh));
+        bool got = false;
+        while (fresh_ok && !got && recv_typed_frame(b2, type, body)) {
+            got = type == relay::FRAME_DATA;
+        }
+        fresh_ok = got && body.size() == sizeof(fresh) && std::memcmp(body.data(), fresh, sizeof(fresh)) == 0;
+    }
+
+    std::cout << "received " << received << "/" << count << " before resume, resumed " << resumed << ", replayed "
+              << replayed << ", fresh packet " << fresh_ok << std::endl;
+
+    close(a);
+    if (b2 >= 0) close(b2);
+    relay.stop();
+    return ok && received > 0 && received < count && resumed && replayed == 0 && fresh_ok;
+}
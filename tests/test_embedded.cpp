@@ -0,0 +1,283 @@
+#include "test_helpers.h"
+#include "relay_server.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 在进程内的中继上执行 stats，返回指定计数（不存在时返回 UINT64_MAX）
+static uint64_t embedded_stat(RelayServer& server, const std::string& name) {
+    std::istringstream in(server.admin("stats"));
+    std::string key;
+    uint64_t value;
+    while (in >> key >> value) {
+        if (key == name) {
+            return value;
+        }
+    }
+    return UINT64_MAX;
+}
+
+// 连接是否已被中继关闭（非阻塞读到 EOF）
+static bool peer_closed(int fd) {
+    uint8_t byte;
+    return recv(fd, &byte, 1, MSG_DONTWAIT) == 0;
+}
+
+// 进程内中继：临时端口上转发，同一进程中的第二个中继同时运行，stop() 立即唤醒另一线程中的 run()，
+// shutdown() 之后可以再次启动且统计从0开始
+bool test_embedded_relay_forwarding() {
+    std::cout << "Testing in-process RelayServer on an ephemeral port..." << std::endl;
+
+    RelayServer server;
+    RelayOptions options;
+    options.max_connections = 8;
+    std::string error;
+    if (!server.start(options, error) || server.port() <= 0) {
+        std::cerr << "Failed to start RelayServer: " << error << std::endl;
+        return false;
+    }
+    RelayServer second;
+    bool second_started = second.start(options, error) && second.port() > 0 && second.port() != server.port();
+    std::thread loop([&server] { server.run(); });
+    std::thread second_loop([&second] { second.run(); });
+
+    uint8_t mark_a[8] = {0xE1, 1, 2, 3, 4, 5, 6, 7};
+    uint8_t mark_b[8] = {0xE2, 1, 2, 3, 4, 5, 6, 7};
+    int fd_a = connect_to_relay(server.port());
+    int fd_b = connect_to_relay(server.port());
+    bool ok = fd_a >= 0 && fd_b >= 0 && register_with_ack(fd_a, mark_a) && register_with_ack(fd_b, mark_b);
+
+    const char payload[] = "embedded relay";
+    std::vector<uint8_t> frame;
+    if (ok) {
+        set_recv_timeout(fd_b, 2000);
+    }
+    ok = ok && send_forward(fd_a, mark_b, payload, sizeof(payload)) &&
+         recv_frame(fd_b, frame) && frame.size() == sizeof(payload) &&
+         std::memcmp(frame.data(), payload, sizeof(payload)) == 0;
+
+    // 第二个中继上的同名标记互不影响
+    int fd_c = connect_to_relay(second.port());
+    int fd_d = connect_to_relay(second.port());
+    bool second_ok = second_started && fd_c >= 0 && fd_d >= 0 && register_with_ack(fd_c, mark_a) &&
+                     register_with_ack(fd_d, mark_b);
+    if (second_ok) {
+        set_recv_timeout(fd_d, 2000);
+    }
+    second_ok = second_ok && send_forward(fd_c, mark_b, payload, sizeof(payload)) && recv_frame(fd_d, frame) &&
+                frame.size() == sizeof(payload);
+    second.stop();
+    second_loop.join();
+    uint64_t second_packets = embedded_stat(second, "packets_in");
+    second.shutdown();
+    if (fd_c >= 0) close(fd_c);
+    if (fd_d >= 0) close(fd_d);
+
+    auto stop_start = std::chrono::steady_clock::now();
+    server.stop();
+    loop.join();
+    long stop_ms = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                          std::chrono::steady_clock::now() - stop_start).count());
+    uint64_t packets = embedded_stat(server, "packets_in");
+    server.shutdown();
+    bool clients_closed = ok && peer_closed(fd_b);
+    std::cout << "forwarded " << packets << " packet(s), run() returned " << stop_ms << " ms after stop()"
+              << std::endl;
+    if (fd_a >= 0) close(fd_a);
+    if (fd_b >= 0) close(fd_b);
+
+    // 同一进程内再次启动：统计不带上一次运行的计数
+    bool restarted = server.start(options, error) && server.port() > 0 && embedded_stat(server, "packets_in") == 0;
+    server.shutdown();
+
+    return ok && second_ok && second_packets == 1 && packets == 1 && stop_ms < 500 && clients_closed && restarted;
+}
+
+// 一次写入远多于命令队列容量的管理命令：队列满时暂停读取，每条命令都执行且响应按命令顺序返回
+bool test_embedded_admin_pipelining() {
+    std::cout << "Testing pipelined admin commands beyond the command queue..." << std::endl;
+
+    RelayServer server;
+    RelayOptions options;
+    options.admin_path = "/tmp/p2p_test_embedded_admin_" + std::to_string(getpid()) + ".sock";
+    options.log_level = "warn";
+    std::string error;
+    if (!server.start(options, error)) {
+        std::cerr << "Failed to start RelayServer: " << error << std::endl;
+        return false;
+    }
+    std::thread loop([&server] { server.run(); });
+
+    // 每个值一对 set/get，300 个值共 600 条命令
+    const int values = 300;
+    std::string batch;
+    std::string expected;
+    for (int i = 0; i < values; i++) {
+        std::string value = std::to_string(1000 + i);
+        batch += "set perf_interval_ms " + value + "\nget perf_interval_ms\n";
+        expected += "OK\nEND\nperf_interval_ms " + value + "\nEND\n";
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, options.admin_path.c_str(), sizeof(addr.sun_path) - 1);
+    bool ok = fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    if (ok) {
+        set_recv_timeout(fd, 3000);
+    }
+    ok = ok && send_all(fd, batch.data(), batch.size());
+
+    std::string out;
+    size_t ends = 0;
+    char buf[4096];
+    while (ok && ends < 2 * values) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        out.append(buf, static_cast<size_t>(n));
+        ends = 0;
+        for (size_t pos = 0; (pos = out.find("END\n", pos)) != std::string::npos; pos += 4) {
+            ends++;
+        }
+    }
+    if (fd >= 0) close(fd);
+    server.stop();
+    loop.join();
+    server.shutdown();
+
+    // 去掉 get 响应中的取值范围与说明，只比较顺序
+    std::string replies;
+    std::istringstream in(out);
+    std::string line;
+    while (std::getline(in, line)) {
+        replies += line.substr(0, line.find(" [")) + "\n";
+    }
+    std::cout << ends << " replies for " << 2 * values << " commands" << std::endl;
+    return ok && out.find("ERR") == std::string::npos && replies == expected;
+}
+
+// 同一进程中的两个中继组成集群：各自在自己的线程中运行，A(节点1) 经链路发给 B(节点2)
+bool test_embedded_federation() {
+    std::cout << "Testing two in-process relays joined by a trunk..." << std::endl;
+
+    int ports[2] = {get_available_port(), 0};
+    do {
+        ports[1] = get_available_port();
+    } while (ports[1] == ports[0]);
+    std::string admins[2];
+    RelayServer nodes[2];
+    bool ok = true;
+    std::string error;
+    for (int i = 0; i < 2 && ok; i++) {
+        admins[i] = "/tmp/p2p_test_embedded_fed_" + std::to_string(ports[i]) + ".sock";
+        RelayOptions options;
+        options.port = ports[i];
+        options.max_connections = 8;
+        options.admin_path = admins[i];
+        options.node_id = i + 1;
+        options.peers = {std::to_string(2 - i) + "@127.0.0.1:" + std::to_string(ports[1 - i])};
+        options.limits = {"trunk_retry_ms=100"};
+        options.log_level = "warn";
+        ok = nodes[i].start(options, error);
+    }
+    if (!ok) {
+        std::cerr << "Failed to start RelayServer: " << error << std::endl;
+        return false;
+    }
+    std::thread loops[2] = {std::thread([&nodes] { nodes[0].run(); }), std::thread([&nodes] { nodes[1].run(); })};
+
+    // 运行中的中继只能经管理socket查询
+    auto wait_stat = [](const std::string& admin, const std::string& name, uint64_t expected) {
+        for (int waited = 0; waited < 5000; waited += 20) {
+            if (admin_stat(admin, name) == expected) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        return false;
+    };
+    ok = wait_stat(admins[0], "trunks", 1) && wait_stat(admins[1], "trunks", 1);
+
+    uint8_t mark_a[8] = {0xE5, 1, 2, 3, 4, 5, 6, 7};
+    uint8_t mark_b[8] = {0xE6, 1, 2, 3, 4, 5, 6, 7};
+    int fd_a = connect_to_relay(nodes[0].port());
+    int fd_b = connect_to_relay(nodes[1].port());
+    ok = ok && fd_a >= 0 && fd_b >= 0 && register_with_ack(fd_a, mark_a) && register_with_ack(fd_b, mark_b) &&
+         wait_stat(admins[0], "remote_marks", 1);
+
+    const char payload[] = "across the trunk";
+    std::vector<uint8_t> frame;
+    if (ok) {
+        set_recv_timeout(fd_b, 3000);
+    }
+    ok = ok && send_forward(fd_a, mark_b, payload, sizeof(payload)) && recv_frame(fd_b, frame) &&
+         frame.size() >= sizeof(payload) &&
+         std::memcmp(frame.data() + frame.size() - sizeof(payload), payload, sizeof(payload)) == 0;
+    uint64_t trunk_out = admin_stat(admins[0], "trunk_records_out");
+    std::cout << "trunk records out on node 1: " << trunk_out << std::endl;
+
+    if (fd_a >= 0) close(fd_a);
+    if (fd_b >= 0) close(fd_b);
+    for (int i = 0; i < 2; i++) {
+        nodes[i].stop();
+        loops[i].join();
+        nodes[i].shutdown();
+    }
+    return ok && trunk_out == 1;
+}
+
+// 注入时钟：注册截止按注入的时间触发，run_once(0) 逐轮驱动，不需要真的等待
+bool test_embedded_injected_clock() {
+    std::cout << "Testing RelayServer with an injected clock..." << std::endl;
+
+    uint64_t fake_ms = 1000;
+    RelayServer server;
+    RelayOptions options;
+    options.limits = {"register_timeout_ms=5000"};
+    options.clock = [&fake_ms] { return fake_ms; };
+    std::string error;
+    if (!server.start(options, error)) {
+        std::cerr << "Failed to start RelayServer: " << error << std::endl;
+        return false;
+    }
+    uint64_t timeouts_before = embedded_stat(server, "register_timeouts");
+
+    auto wall_start = std::chrono::steady_clock::now();
+    int fd = connect_to_relay(server.port());
+    for (int i = 0; i < 20 && fd >= 0 && server.admin("list").find("fd=") == std::string::npos; i++) {
+        server.run_once(50);   // 接受连接
+    }
+
+    // 注册截止前连接保持打开
+    fake_ms += 4900;
+    for (int i = 0; i < 3; i++) {
+        server.run_once(0);
+    }
+    bool open_before = fd >= 0 && !peer_closed(fd) && errno == EAGAIN;
+
+    fake_ms += 200;
+    for (int i = 0; i < 3; i++) {
+        server.run_once(0);
+    }
+    bool closed_after = fd >= 0 && peer_closed(fd);
+    uint64_t timeouts = embedded_stat(server, "register_timeouts") - timeouts_before;
+    long wall_ms = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                          std::chrono::steady_clock::now() - wall_start).count());
+    server.shutdown();
+    if (fd >= 0) close(fd);
+
+    std::cout << "register timeout after 5100 injected ms, " << wall_ms << " ms wall clock" << std::endl;
+    return open_before && closed_after && timeouts == 1 && wall_ms < 2000;
+}
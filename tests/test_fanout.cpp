@@ -0,0 +1,249 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+static bool is_from(const std::vector<uint8_t>& body, const uint8_t* source, const void* payload, size_t len) {
+    return body.size() == 8 + len && std::memcmp(body.data(), source, 8) == 0 &&
+           std::memcmp(body.data() + 8, payload, len) == 0;
+}
+
+// 列表扇出帧体: [FANOUT_MULTICAST][目标数][目标标记...][负载]
+static std::vector<uint8_t> multicast_body(const std::vector<const uint8_t*>& targets, const void* payload,
+                                           size_t len) {
+    std::vector<uint8_t> body(8);
+    relay::writeU64(body.data(), relay::FANOUT_MULTICAST);
+    body.push_back(static_cast<uint8_t>(targets.size()));
+    for (const uint8_t* mark : targets) {
+        body.insert(body.end(), mark, mark + 8);
+    }
+    const uint8_t* bytes = static_cast<const uint8_t*>(payload);
+    body.insert(body.end(), bytes, bytes + len);
+    return body;
+}
+
+// 广播与列表扇出：一份上行负载发给多个目标（含紧凑帧短编号目标），大负载在发送队列中共享；
+// 广播只发给会话的队友（发往过的标记），不会发给同一中继上的其他标记
+bool test_fanout_routing() {
+    std::cout << "Testing broadcast and multicast fan-out..." << std::endl;
+
+    std::string admin = test_temp_path("fanout");
+    TestRelay relay({"-c", "16", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x61, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0x62, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t mark_c[8] = {0x63, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    uint8_t mark_d[8] = {0x64, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44};
+    uint8_t mark_x[8] = {0x65, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55};
+    uint8_t mark_e[8] = {0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66};
+    uint8_t broadcast[8];
+    relay::writeU64(broadcast, relay::FANOUT_BROADCAST);
+
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    int d = connect_to_relay(port);
+    int e = connect_to_relay(port);
+    int bad = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && c >= 0 && d >= 0 && e >= 0 && bad >= 0;
+    if (ok) {
+        set_recv_timeout(e, 3000);
+        set_recv_timeout(a, 3000);
+        set_recv_timeout(b, 3000);
+        set_recv_timeout(c, 3000);
+        set_recv_timeout(d, 3000);
+        set_recv_timeout(bad, 3000);
+    }
+
+    // A: 扇出 + 来源标记；B: HELLO；C: 旧版；D: 紧凑帧（持有 A 的短编号，出站不带标记）
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    ok = ok && send_hello(a, mark_a, relay::CAP_FANOUT | relay::CAP_SOURCE | relay::CAP_BUNDLE) &&
+         recv_hello_ack(a, status, token, relay_rx) && status == relay::HELLO_OK && register_with_ack(b, mark_b) &&
+         send_register(c, mark_c) && send_hello(d, mark_d, relay::CAP_PRESENCE | relay::CAP_COMPACT) &&
+         recv_hello_ack(d, status, token, relay_rx) && status == relay::HELLO_OK && register_with_ack(e, mark_e);
+
+    // D 先发给 A 一个包（A 收到），之后收到 A 的上线通知与短编号
+    uint8_t d_slot_a = 0;
+    std::vector<uint8_t> body;
+    uint8_t tag = 0;
+    const char hi[] = "hi";
+    std::vector<uint8_t> marked(mark_a, mark_a + 8);
+    marked.insert(marked.end(), hi, hi + sizeof(hi));
+    ok = ok && send_compact(d, relay::COMPACT_TAG_DATA, marked.data(), marked.size()) && recv_data(a, body) &&
+         recv_compact(d, tag, body) && tag == relay::COMPACT_TAG_CTRL && body[0] == relay::CTRL_PEER_JOIN &&
+         body.size() == relay::CTRL_PEER_JOIN_COMPACT_SIZE && std::memcmp(body.data() + 1, mark_a, 8) == 0;
+    if (ok) {
+        d_slot_a = body[relay::CTRL_PEER_EVENT_SIZE];
+    }
+    ok = ok && d_slot_a != 0;
+
+    // A 还没有发往过任何标记：广播没有队友，丢弃；B、D 收到的下一帧应是后面的列表扇出
+    const char p0[] = "early";
+    uint64_t dropped_before = admin_stat(admin, "drop_no_target");
+    ok = ok && send_forward(a, broadcast, p0, sizeof(p0));
+
+    // 列表扇出：发往 B、D 与不存在的 X；C 不在列表中，下一帧应是后面的单播
+    const char p1[] = "broadcast";
+    const char p2[] = "multicast";
+    const char p3[] = "unicast";
+    std::vector<uint8_t> mc = multicast_body({mark_b, mark_d, mark_x}, p2, sizeof(p2));
+    std::vector<uint8_t> frame(relay::FRAME_HEADER_SIZE + mc.size());
+    relay::writeFrameHeader(frame.data(), static_cast<uint32_t>(mc.size()), relay::FRAME_DATA);
+    std::memcpy(frame.data() + relay::FRAME_HEADER_SIZE, mc.data(), mc.size());
+    ok = ok && send_all(a, frame.data(), frame.size()) && send_forward(a, mark_c, p3, sizeof(p3));
+    bool multicast_ok = ok && recv_data(b, body) && is_from(body, mark_a, p2, sizeof(p2)) && recv_compact(d, tag, body) &&
+                        tag == d_slot_a && body.size() == sizeof(p2) && recv_frame(c, body) &&
+                        is_from(body, mark_a, p3, sizeof(p3));
+
+    // 广播：队友 B、C、D 各收到一份（X 不在线），A 自己与未发往过的 E 收不到；E 的下一帧应是后面的单播
+    const char p4[] = "to-e";
+    ok = ok && send_forward(a, broadcast, p1, sizeof(p1)) && send_forward(a, mark_e, p4, sizeof(p4));
+    bool broadcast_ok = ok && recv_data(b, body) && is_from(body, mark_a, p1, sizeof(p1)) && recv_frame(c, body) &&
+                        is_from(body, mark_a, p1, sizeof(p1)) && recv_compact(d, tag, body) && tag == d_slot_a &&
+                        body.size() == sizeof(p1) && std::memcmp(body.data(), p1, sizeof(p1)) == 0 &&
+                        recv_frame(e, body) && is_from(body, mark_a, p4, sizeof(p4));
+
+    // 丢弃计数：无队友的广播，以及列表扇出与广播中各一次不在线的 X
+    bool dropped_ok = ok && admin_stat(admin, "drop_no_target") == dropped_before + 3;
+
+    // 大负载扇出到 B、C、D：接收方暂不读取，发送队列积压时各目标共享同一缓冲区，之后完整按序收到
+    const int big_count = 40;
+    std::vector<uint8_t> big(30000);
+    for (int i = 0; i < big_count && ok; i++) {
+        for (size_t j = 0; j < big.size(); j++) {
+            big[j] = static_cast<uint8_t>(i * 31 + j);
+        }
+        mc = multicast_body({mark_b, mark_c, mark_d}, big.data(), big.size());
+        frame.resize(relay::FRAME_HEADER_SIZE + mc.size());
+        relay::writeFrameHeader(frame.data(), static_cast<uint32_t>(mc.size()), relay::FRAME_DATA);
+        std::memcpy(frame.data() + relay::FRAME_HEADER_SIZE, mc.data(), mc.size());
+        ok = send_all(a, frame.data(), frame.size());
+    }
+    int big_received = 0;
+    for (int i = 0; i < big_count && ok; i++) {
+        for (size_t j = 0; j < big.size(); j++) {
+            big[j] = static_cast<uint8_t>(i * 31 + j);
+        }
+        if (recv_data(b, body) && is_from(body, mark_a, big.data(), big.size()) && recv_frame(c, body) &&
+            is_from(body, mark_a, big.data(), big.size()) && recv_compact(d, tag, body) && tag == d_slot_a &&
+            body == big) {
+            big_received++;
+        }
+    }
+
+    // 保留标记不能注册
+    bool reserved_rejected = ok && send_hello(bad, broadcast, 0) && recv_hello_ack(bad, status, token, relay_rx) &&
+                             status != relay::HELLO_OK;
+
+    uint64_t fanout_in = admin_stat(admin, "fanout_in");
+    uint64_t fanout_out = admin_stat(admin, "fanout_out");
+    std::cout << "broadcast " << broadcast_ok << ", multicast " << multicast_ok << ", drops " << dropped_ok
+              << ", large shared payloads "
+              << big_received << "/" << big_count << ", reserved mark rejected " << reserved_rejected
+              << "; fanout_in=" << fanout_in << " fanout_out=" << fanout_out << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    if (c >= 0) close(c);
+    if (d >= 0) close(d);
+    if (e >= 0) close(e);
+    if (bad >= 0) close(bad);
+    relay.stop();
+    return broadcast_ok && multicast_ok && dropped_ok && big_received == big_count && reserved_rejected &&
+           fanout_in == 2 + big_count && fanout_out == 2 + 3 + 3 * big_count;
+}
+
+// 运行 ticks 个游戏帧，每帧把相同的状态逐个发给三个队友；返回中继收到的上行字节数，失败返回0
+static uint64_t run_library_ticks(int port, const std::string& admin, uint32_t flags, int ticks, size_t state_size,
+                                  bool& all_received) {
+    uint64_t local = 0x7000000000000001ULL + flags;
+    uint64_t marks[3] = {0x7100000000000001ULL + flags, 0x7200000000000001ULL + flags, 0x7300000000000001ULL + flags};
+    int peers[3];
+    bool ok = true;
+    for (int i = 0; i < 3; i++) {
+        uint8_t mark[8];
+        std::memcpy(mark, &marks[i], 8);
+        peers[i] = connect_to_relay(port);
+        ok = ok && peers[i] >= 0 && register_with_ack(peers[i], mark);
+        if (peers[i] >= 0) {
+            set_recv_timeout(peers[i], 3000);
+        }
+    }
+
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    ok = ok && P2P_Init() == P2P_OK && P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) == P2P_OK &&
+         P2P_EnableRelaySession(peer, local, flags) == P2P_OK;
+
+    // 等待 HELLO_ACK（之前发出的包会先缓存，不影响结果，只是不参与合并）
+    std::vector<uint8_t> body;
+    for (int i = 0; i < 20 && ok; i++) {
+        P2P_RunCallbacks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    uint64_t before = admin_stat(admin, "bytes_in");
+    std::vector<uint8_t> packet(8 + state_size);
+    int received = 0;
+    for (int t = 0; t < ticks && ok; t++) {
+        std::memset(packet.data() + 8, t & 0xFF, state_size);
+        for (int i = 0; i < 3; i++) {
+            std::memcpy(packet.data(), &marks[i], 8);
+            P2P_SendPacket(peer, packet.data(), static_cast<uint32_t>(packet.size()));
+        }
+        P2P_RunCallbacks();
+        for (int i = 0; i < 3 && ok; i++) {
+            ok = recv_data(peers[i], body) && body.size() == 8 + state_size &&
+                 std::memcmp(body.data(), &local, 8) == 0 && body[8] == (t & 0xFF);
+            received += ok ? 1 : 0;
+        }
+    }
+    // 各队友都已收到最后一帧，中继的统计已包含全部上行数据
+    uint64_t after = admin_stat(admin, "bytes_in");
+
+    P2P_Shutdown();
+    for (int i = 0; i < 3; i++) {
+        if (peers[i] >= 0) close(peers[i]);
+    }
+    all_received = received == ticks * 3;
+    return ok && before != UINT64_MAX && after != UINT64_MAX ? after - before : 0;
+}
+
+// 客户端库：同一帧内发给多个队友的相同数据合并为一条列表扇出记录，上行字节约降为 1/3
+bool test_connection_manager_fanout() {
+    std::cout << "Testing ConnectionManager fan-out coalescing..." << std::endl;
+
+    std::string admin = test_temp_path("fanout");
+    TestRelay relay({"-c", "16", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    const int ticks = 200;
+    const size_t state_size = 200;
+    uint32_t base = P2P_RELAY_FLAG_SOURCE | P2P_RELAY_FLAG_BUNDLE;
+    bool separate_ok = false;
+    bool fanout_ok = false;
+    uint64_t separate = run_library_ticks(port, admin, base, ticks, state_size, separate_ok);
+    uint64_t fanout = run_library_ticks(port, admin, base | P2P_RELAY_FLAG_FANOUT, ticks, state_size, fanout_ok);
+    uint64_t fanout_in = admin_stat(admin, "fanout_in");
+    relay.stop();
+
+    double ratio = fanout > 0 ? static_cast<double>(separate) / static_cast<double>(fanout) : 0.0;
+    std::cout << "4-player session, " << state_size << "-byte state x " << ticks << " ticks: uplink "
+              << separate << "B separate vs " << fanout << "B fan-out (" << ratio << "x), delivered "
+              << separate_ok << "/" << fanout_ok << ", fanout_in=" << fanout_in << std::endl;
+    return separate_ok && fanout_ok && fanout_in >= static_cast<uint64_t>(ticks) && ratio > 2.5;
+}
@@ -0,0 +1,635 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// 本机上的集群：每个节点以 -n/-j 配置其他全部节点。节点之间需要事先知道彼此的端口，
+// 因此端口预先分配，节点重启时沿用原来的端口
+struct ClusterNode {
+    int port = 0;
+    std::string admin;
+    std::unique_ptr<TestRelay> relay;
+    std::vector<std::string> extra;   // 额外的启动参数（如 -o 运行时限制）
+};
+
+static std::vector<std::string> node_args(const std::vector<ClusterNode>& nodes, size_t index) {
+    std::vector<std::string> args = {"-c", "64", "-a", nodes[index].admin, "-n", std::to_string(index + 1),
+                                     "-o", "trunk_retry_ms=100"};
+    args.insert(args.end(), nodes[index].extra.begin(), nodes[index].extra.end());
+    for (size_t j = 0; j < nodes.size(); j++) {
+        if (j != index) {
+            args.push_back("-j");
+            args.push_back(std::to_string(j + 1) + "@127.0.0.1:" + std::to_string(nodes[j].port));
+        }
+    }
+    return args;
+}
+
+static bool start_node(std::vector<ClusterNode>& nodes, size_t index) {
+    nodes[index].relay.reset(new TestRelay(node_args(nodes, index), nodes[index].port));
+    return nodes[index].relay->started();
+}
+
+// 节点宕机：关闭监听socket与全部连接
+static void stop_node(ClusterNode& node) {
+    node.relay.reset();
+}
+
+// 等待某个节点的统计项达到期望值（集群链路与标记目录异步收敛）
+static bool wait_stat(const ClusterNode& node, const std::string& name, uint64_t expected, int timeout_ms) {
+    for (int waited = 0; waited < timeout_ms; waited += 20) {
+        if (admin_stat(node.admin, name) == expected) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return false;
+}
+
+static bool start_cluster(std::vector<ClusterNode>& nodes, const std::string& name) {
+    for (auto& node : nodes) {
+        node.port = get_available_port();
+        node.admin = test_temp_path(name);
+    }
+    bool ok = true;
+    for (size_t i = 0; i < nodes.size() && ok; i++) {
+        ok = start_node(nodes, i);
+    }
+    for (size_t i = 0; i < nodes.size() && ok; i++) {
+        ok = wait_stat(nodes[i], "trunks", nodes.size() - 1, 5000);
+    }
+    if (!ok) {
+        std::cerr << "Failed to start relay cluster" << std::endl;
+    }
+    return ok;
+}
+
+static void stop_cluster(std::vector<ClusterNode>& nodes) {
+    for (auto& node : nodes) {
+        stop_node(node);
+    }
+}
+
+// 读取控制帧直到出现给定的在线通知（期间的数据帧被忽略）
+static bool wait_peer_event(int fd, uint8_t op, const uint8_t* mark) {
+    uint8_t type = 0;
+    std::vector<uint8_t> body;
+    while (recv_typed_frame(fd, type, body)) {
+        if (type == relay::FRAME_CTRL && body.size() >= relay::CTRL_PEER_EVENT_SIZE && body[0] == op &&
+            std::memcmp(body.data() + 1, mark, 8) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 三个节点：跨节点单播与来源标记、在线通知、同一链路上的批量转发、节点宕机后的目录清理与恢复
+bool test_federation_routing() {
+    std::cout << "Testing relay federation across three nodes..." << std::endl;
+
+    std::vector<ClusterNode> nodes(3);
+    if (!start_cluster(nodes, "federation")) {
+        stop_cluster(nodes);
+        return false;
+    }
+
+    uint8_t mark_a[8] = {0xC1, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xC2, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t mark_c[8] = {0xC3, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    int a = connect_to_relay(nodes[0].port);
+    int b = connect_to_relay(nodes[1].port);
+    int c = connect_to_relay(nodes[2].port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = a >= 0 && b >= 0 && c >= 0;
+    if (ok) {
+        for (int fd : {a, b, c}) {
+            set_recv_timeout(fd, 3000);
+        }
+    }
+    ok = ok && send_hello(a, mark_a, relay::CAP_SOURCE | relay::CAP_PRESENCE) &&
+         recv_hello_ack(a, status, token, relay_rx) && status == relay::HELLO_OK && register_with_ack(b, mark_b);
+    ok = ok && wait_stat(nodes[2], "remote_marks", 2, 3000);
+
+    // C 发给其他节点上的 A 后收到 A 的上线通知（A 收到 [C][数据]）
+    const char hello_a[] = "hello a";
+    std::vector<uint8_t> body;
+    ok = ok && send_hello(c, mark_c, relay::CAP_PRESENCE) && recv_hello_ack(c, status, token, relay_rx) &&
+         status == relay::HELLO_OK && send_forward(c, mark_a, hello_a, sizeof(hello_a)) && recv_data(a, body);
+    bool presence_ok = ok && wait_peer_event(c, relay::CTRL_PEER_JOIN, mark_a);
+    ok = ok && wait_stat(nodes[0], "remote_marks", 2, 3000) && wait_stat(nodes[1], "remote_marks", 2, 3000);
+
+    // A(节点1) -> B(节点2) 带来源标记；B -> A 原样
+    const char to_b[] = "cross-node to b";
+    const char to_a[] = "cross-node to a";
+    bool unicast_ok = ok && send_forward(a, mark_b, to_b, sizeof(to_b)) && recv_frame(b, body) &&
+                      body.size() == 8 + sizeof(to_b) && std::memcmp(body.data(), mark_a, 8) == 0 &&
+                      std::memcmp(body.data() + 8, to_b, sizeof(to_b)) == 0;
+    unicast_ok = unicast_ok && send_forward(b, mark_a, to_a, sizeof(to_a)) && recv_data(a, body) &&
+                 body.size() == sizeof(to_a) && std::memcmp(body.data(), to_a, sizeof(to_a)) == 0;
+
+    // A 一次写出交替发往 B 与 C 的 4000 个小包：节点1 的两条链路各自批量成帧，到达顺序不变
+    const int count = 2000;
+    uint64_t records_before = admin_stat(nodes[0].admin, "trunk_records_out");
+    uint64_t frames_before = admin_stat(nodes[0].admin, "trunk_frames_out");
+    std::vector<uint8_t> burst;
+    for (int i = 0; i < count; i++) {
+        for (const uint8_t* target : {mark_b, mark_c}) {
+            uint8_t frame[4 + 8 + 4];
+            relay::writeFrameHeader(frame, 8 + 4, relay::FRAME_DATA);
+            std::memcpy(frame + 4, target, 8);
+            relay::writeU32(frame + 12, static_cast<uint32_t>(i));
+            burst.insert(burst.end(), frame, frame + sizeof(frame));
+        }
+    }
+    bool burst_ok = ok && send_all(a, burst.data(), burst.size());
+    for (int fd : {b, c}) {
+        for (int i = 0; i < count && burst_ok; i++) {
+            burst_ok = recv_data(fd, body) && body.size() == 8 + 4 && std::memcmp(body.data(), mark_a, 8) == 0 &&
+                       relay::readU32(body.data() + 8) == static_cast<uint32_t>(i);
+        }
+    }
+    uint64_t records = admin_stat(nodes[0].admin, "trunk_records_out") - records_before;
+    uint64_t frames = admin_stat(nodes[0].admin, "trunk_frames_out") - frames_before;
+
+    // 节点3 宕机：其余节点删除 C 并通知发往过 C 的 A；节点3 重启后链路自动重连，C 重新注册后再次可达
+    stop_node(nodes[2]);
+    close(c);
+    c = -1;
+    bool failover_ok = ok && wait_peer_event(a, relay::CTRL_PEER_LEAVE, mark_c) &&
+                       wait_stat(nodes[0], "remote_marks", 1, 3000) && wait_stat(nodes[1], "remote_marks", 1, 3000);
+    bool recovered = failover_ok && start_node(nodes, 2) && wait_stat(nodes[0], "trunks", 2, 5000) &&
+                     wait_stat(nodes[2], "trunks", 2, 5000);
+    if (recovered) {
+        c = connect_to_relay(nodes[2].port);
+        recovered = c >= 0 && register_with_ack(c, mark_c) && wait_peer_event(a, relay::CTRL_PEER_JOIN, mark_c);
+        const char again[] = "after restart";
+        if (recovered) {
+            set_recv_timeout(c, 3000);
+        }
+        recovered = recovered && send_forward(a, mark_c, again, sizeof(again)) && recv_frame(c, body) &&
+                    body.size() == 8 + sizeof(again) && std::memcmp(body.data() + 8, again, sizeof(again)) == 0;
+    }
+
+    std::cout << "presence " << presence_ok << ", unicast " << unicast_ok << ", burst " << burst_ok << " ("
+              << records << " records in " << frames << " trunk frames), failover " << failover_ok
+              << ", recovered " << recovered << std::endl;
+
+    for (int fd : {a, b, c}) {
+        if (fd >= 0) close(fd);
+    }
+    stop_cluster(nodes);
+    return presence_ok && unicast_ok && burst_ok && records == 2 * count && frames > 0 && frames * 20 < records &&
+           failover_ok && recovered;
+}
+
+// 多个会话同时跨节点收发：两个节点之间只有一条链路，记录来自不同会话也共用帧
+bool test_federation_trunk_multiplexing() {
+    std::cout << "Testing one trunk carrying many sessions..." << std::endl;
+
+    std::vector<ClusterNode> nodes(2);
+    if (!start_cluster(nodes, "trunk")) {
+        stop_cluster(nodes);
+        return false;
+    }
+
+    const int pairs = 16;
+    const int count = 500;
+    std::vector<int> senders(pairs, -1);
+    std::vector<int> receivers(pairs, -1);
+    bool ok = true;
+    for (int p = 0; p < pairs && ok; p++) {
+        uint8_t from[8] = {0xD1, static_cast<uint8_t>(p), 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+        uint8_t to[8] = {0xD2, static_cast<uint8_t>(p), 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+        senders[p] = connect_to_relay(nodes[0].port);
+        receivers[p] = connect_to_relay(nodes[1].port);
+        ok = senders[p] >= 0 && receivers[p] >= 0 && register_with_ack(senders[p], from) &&
+             register_with_ack(receivers[p], to);
+        if (ok) {
+            set_recv_timeout(receivers[p], 3000);
+        }
+    }
+    ok = ok && wait_stat(nodes[0], "remote_marks", pairs, 3000) && wait_stat(nodes[1], "remote_marks", pairs, 3000);
+
+    uint64_t records_before = admin_stat(nodes[0].admin, "trunk_records_out");
+    uint64_t frames_before = admin_stat(nodes[0].admin, "trunk_frames_out");
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    std::vector<int> received(pairs, 0);
+    for (int p = 0; p < pairs && ok; p++) {
+        threads.emplace_back([&, p]() {
+            uint8_t to[8] = {0xD2, static_cast<uint8_t>(p), 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+            uint8_t payload[64] = {};
+            for (int i = 0; i < count; i++) {
+                relay::writeU32(payload, static_cast<uint32_t>(i));
+                if (!send_forward(senders[p], to, payload, sizeof(payload))) {
+                    break;
+                }
+            }
+        });
+        threads.emplace_back([&, p]() {
+            std::vector<uint8_t> body;
+            while (received[p] < count && recv_frame(receivers[p], body) && body.size() == 64 &&
+                   relay::readU32(body.data()) == static_cast<uint32_t>(received[p])) {
+                received[p]++;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uint64_t records = admin_stat(nodes[0].admin, "trunk_records_out") - records_before;
+    uint64_t frames = admin_stat(nodes[0].admin, "trunk_frames_out") - frames_before;
+    uint64_t trunks = admin_stat(nodes[0].admin, "trunks");
+
+    int delivered = 0;
+    for (int n : received) {
+        delivered += n;
+    }
+    std::cout << "delivered " << delivered << "/" << pairs * count << " in order across " << trunks << " trunk in "
+              << elapsed_ms << "ms; " << records << " records in " << frames << " trunk frames" << std::endl;
+
+    for (int p = 0; p < pairs; p++) {
+        if (senders[p] >= 0) close(senders[p]);
+        if (receivers[p] >= 0) close(receivers[p]);
+    }
+    stop_cluster(nodes);
+    return ok && delivered == pairs * count && trunks == 1 && records == static_cast<uint64_t>(pairs * count) &&
+           frames > 0 && frames < records;
+}
+
+// 连接数上限只计客户端：-c 1 的两个节点之间照常建立链路，各自仍能接入一个客户端，链路不计入负载；
+// 链路断开时为对端预留的接入位置只能用于链路，客户端连上后注册被拒绝
+bool test_federation_client_limit() {
+    std::cout << "Testing client limit excluding trunk links..." << std::endl;
+
+    std::vector<ClusterNode> nodes(2);
+    for (auto& node : nodes) {
+        node.extra = {"-c", "1"};
+    }
+    if (!start_cluster(nodes, "limit")) {
+        stop_cluster(nodes);
+        return false;
+    }
+    uint64_t idle_load = admin_stat(nodes[0].admin, "load_permille");
+    uint64_t idle_clients = admin_stat(nodes[0].admin, "clients");
+
+    uint8_t mark_a[8] = {0xD6, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xD7, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int a = connect_to_relay(nodes[0].port);
+    int b = connect_to_relay(nodes[1].port);
+    bool ok = a >= 0 && b >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b) &&
+              wait_stat(nodes[0], "remote_marks", 1, 3000);
+    if (ok) {
+        set_recv_timeout(b, 3000);
+    }
+
+    // 第二个客户端超过上限被关闭
+    int extra = connect_to_relay(nodes[0].port);
+    bool rejected = false;
+    if (extra >= 0) {
+        set_recv_timeout(extra, 2000);
+        uint8_t byte = 0;
+        rejected = recv(extra, &byte, 1, 0) == 0;
+        close(extra);
+    }
+
+    const char hello[] = "within limit";
+    std::vector<uint8_t> body;
+    bool routed = ok && send_forward(a, mark_b, hello, sizeof(hello)) && recv_data(b, body) &&
+                  body.size() == sizeof(hello) && std::memcmp(body.data(), hello, sizeof(hello)) == 0;
+    uint64_t clients = admin_stat(nodes[0].admin, "clients");
+    uint64_t connections = admin_stat(nodes[0].admin, "connections");
+    uint64_t full_load = admin_stat(nodes[0].admin, "load_permille");
+
+    // 节点2宕机：节点1为它预留一个接入位置，客户端可以连上，但 HELLO 与旧版注册都被拒绝
+    uint8_t mark_c[8] = {0xD8, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    stop_node(nodes[1]);
+    bool reserved_ok = wait_stat(nodes[0], "trunks", 0, 3000);
+    int squatter = reserved_ok ? connect_to_relay(nodes[0].port) : -1;
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    reserved_ok = squatter >= 0 && send_hello(squatter, mark_c, 0) && recv_hello_ack(squatter, status, token, relay_rx) &&
+                  status == relay::HELLO_ERR_FULL;
+    if (squatter >= 0) close(squatter);
+    squatter = connect_to_relay(nodes[0].port);
+    if (reserved_ok && squatter >= 0) {
+        set_recv_timeout(squatter, 2000);
+        uint8_t byte = 0;
+        reserved_ok = send_register(squatter, mark_c) && recv(squatter, &byte, 1, 0) == 0;
+    }
+    if (squatter >= 0) close(squatter);
+    uint64_t register_full = admin_stat(nodes[0].admin, "register_full");
+
+    // 节点2重启后仍能用预留的位置重新建立链路
+    bool relinked = reserved_ok && start_node(nodes, 1) && wait_stat(nodes[0], "trunks", 1, 5000);
+
+    std::cout << "idle load " << idle_load << " (clients " << idle_clients << "), extra rejected " << rejected
+              << ", routed " << routed << ", clients " << clients << "/" << connections << " connections, load "
+              << full_load << "; reserved slot refused clients " << reserved_ok << " (register_full=" << register_full
+              << "), relinked " << relinked << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    stop_cluster(nodes);
+    return ok && idle_load == 0 && idle_clients == 0 && rejected && routed && clients == 1 && connections == 2 &&
+           full_load == 1000 && reserved_ok && register_full == 2 && relinked;
+}
+
+// 读取 CTRL_REDIRECT（之前不应有 HELLO_ACK）
+static bool recv_redirect(int fd, uint16_t& node, int& port) {
+    uint8_t type = 0;
+    std::vector<uint8_t> body;
+    while (recv_typed_frame(fd, type, body)) {
+        if (type != relay::FRAME_CTRL || body.empty() || body[0] == relay::CTRL_PING) {
+            continue;
+        }
+        if (body[0] != relay::CTRL_REDIRECT || body.size() < relay::CTRL_REDIRECT_SIZE) {
+            return false;
+        }
+        node = relay::readU16(body.data() + 1);
+        port = relay::readU16(body.data() + 7);
+        return body[3] == 127 && body[4] == 0 && body[5] == 0 && body[6] == 1;
+    }
+    return false;
+}
+
+// 注册时的重定向：标记已在其他节点上线时改连该节点；本节点负载超过阈值时改连较空闲的节点；
+// 未声明 CAP_REDIRECT 的客户端与负载未超过阈值时照常注册
+bool test_redirect_on_register() {
+    std::cout << "Testing redirect-on-register between two nodes..." << std::endl;
+
+    std::vector<ClusterNode> nodes(2);
+    for (auto& node : nodes) {
+        node.extra = {"-o", "redirect_load_permille=300", "-o", "redirect_margin_permille=100"};
+    }
+    nodes[0].extra.insert(nodes[0].extra.end(), {"-c", "16"});
+    if (!start_cluster(nodes, "redirect")) {
+        stop_cluster(nodes);
+        return false;
+    }
+
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    uint16_t node = 0;
+    int port = 0;
+    std::vector<int> fds;
+    auto open_client = [&](int relay_port) {
+        int fd = connect_to_relay(relay_port);
+        if (fd >= 0) {
+            set_recv_timeout(fd, 3000);
+            fds.push_back(fd);
+        }
+        return fd;
+    };
+
+    // H 在节点2上线后，同一标记向节点1注册被重定向到节点2（出示令牌即可接管）
+    uint8_t mark_h[8] = {0xD1, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    int h = open_client(nodes[1].port);
+    bool ok = h >= 0 && send_hello(h, mark_h, relay::CAP_REDIRECT) && recv_hello_ack(h, status, token, relay_rx) &&
+              status == relay::HELLO_OK && wait_stat(nodes[0], "remote_marks", 1, 3000);
+    int h2 = open_client(nodes[0].port);
+    bool hosted_ok = ok && h2 >= 0 && send_hello(h2, mark_h, relay::CAP_REDIRECT, token) &&
+                     recv_redirect(h2, node, port) && node == 2 && port == nodes[1].port;
+    int h3 = open_client(nodes[1].port);
+    hosted_ok = hosted_ok && h3 >= 0 && send_hello(h3, mark_h, relay::CAP_REDIRECT, token) &&
+                recv_hello_ack(h3, status, token, relay_rx) && status == relay::HELLO_OK;
+
+    // 节点1: 1个客户端连接 = 62‰（链路不计入），未超过阈值，照常注册
+    uint8_t mark_n[8] = {0xD2, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int n = open_client(nodes[0].port);
+    bool local_ok = n >= 0 && send_hello(n, mark_n, relay::CAP_REDIRECT) &&
+                    recv_hello_ack(n, status, token, relay_rx) && status == relay::HELLO_OK;
+
+    // 再注册4个旧版客户端后节点1为 5/16；新连接计入后 375‰，节点2（64个连接上限）远低于它
+    for (uint8_t i = 0; i < 4 && local_ok; i++) {
+        uint8_t mark[8] = {0xD3, i, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+        int fd = open_client(nodes[0].port);
+        local_ok = fd >= 0 && register_with_ack(fd, mark);
+    }
+    uint8_t mark_r[8] = {0xD4, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44};
+    int r = open_client(nodes[0].port);
+    bool load_ok = local_ok && r >= 0 && send_hello(r, mark_r, relay::CAP_REDIRECT) && recv_redirect(r, node, port) &&
+                   node == 2 && port == nodes[1].port;
+    // 未声明 CAP_REDIRECT 的客户端不受影响
+    uint8_t mark_l[8] = {0xD5, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55};
+    int l = open_client(nodes[0].port);
+    bool legacy_ok = load_ok && l >= 0 && register_with_ack(l, mark_l);
+
+    // 按重定向改连节点2后注册成功，并能与节点1上的客户端互通
+    int r2 = open_client(nodes[1].port);
+    bool follow_ok = legacy_ok && r2 >= 0 && send_hello(r2, mark_r, relay::CAP_REDIRECT) &&
+                     recv_hello_ack(r2, status, token, relay_rx) && status == relay::HELLO_OK &&
+                     wait_stat(nodes[0], "remote_marks", 2, 3000);
+    const char hello[] = "after redirect";
+    std::vector<uint8_t> body;
+    follow_ok = follow_ok && send_forward(r2, mark_l, hello, sizeof(hello)) && recv_data(l, body) &&
+                body.size() == sizeof(hello) && std::memcmp(body.data(), hello, sizeof(hello)) == 0;
+    uint64_t redirects = admin_stat(nodes[0].admin, "redirects");
+
+    std::cout << "hosted mark redirected " << hosted_ok << ", under threshold kept " << local_ok
+              << ", overloaded redirected " << load_ok << ", legacy kept " << legacy_ok << ", followed " << follow_ok
+              << " (redirects=" << redirects << ")" << std::endl;
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    stop_cluster(nodes);
+    return ok && hosted_ok && local_ok && load_ok && legacy_ok && follow_ok && redirects == 2;
+}
+
+// 客户端库跟随重定向：全部会话都连到节点1，按负载分散到三个节点后仍能互相收发
+bool test_connection_manager_redirect() {
+    std::cout << "Testing ConnectionManager load-aware placement across three nodes..." << std::endl;
+
+    std::vector<ClusterNode> nodes(3);
+    for (auto& node : nodes) {
+        node.extra = {"-o", "redirect_load_permille=1", "-o", "redirect_margin_permille=50", "-o",
+                      "load_report_ms=100"};
+    }
+    if (!start_cluster(nodes, "placement")) {
+        stop_cluster(nodes);
+        return false;
+    }
+
+    const int sessions = 36;
+    std::vector<P2PPeerID> peers(sessions, P2P_INVALID_PEER_ID);
+    std::vector<uint64_t> marks(sessions);
+    bool ok = P2P_Init() == P2P_OK;
+    for (int i = 0; i < sessions && ok; i++) {
+        marks[i] = 0xE100000000000001ULL + static_cast<uint64_t>(i);
+        ok = P2P_Connect("127.0.0.1", static_cast<uint16_t>(nodes[0].port), &peers[i]) == P2P_OK &&
+             P2P_EnableRelaySession(peers[i], marks[i], 0) == P2P_OK;
+        for (int k = 0; k < 5 && ok; k++) {
+            P2P_RunCallbacks();
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+    // 等待全部会话注册完成，目录同步到每个节点
+    std::vector<uint64_t> registered(nodes.size(), 0);
+    for (int waited = 0; ok && waited < 5000; waited += 20) {
+        P2P_RunCallbacks();
+        uint64_t total = 0;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            registered[n] = admin_stat(nodes[n].admin, "registered");
+            total += registered[n];
+        }
+        if (total == static_cast<uint64_t>(sessions) &&
+            admin_stat(nodes[0].admin, "remote_marks") == static_cast<uint64_t>(sessions) - registered[0]) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    uint64_t redirects = admin_stat(nodes[0].admin, "redirects");
+
+    // 会话 i 发给会话 i+1：大部分跨节点
+    for (int i = 0; i < sessions && ok; i++) {
+        uint8_t packet[8 + sizeof(int)];
+        uint64_t target = marks[(i + 1) % sessions];
+        std::memcpy(packet, &target, 8);
+        std::memcpy(packet + 8, &i, sizeof(i));
+        ok = P2P_SendPacket(peers[i], packet, sizeof(packet)) == P2P_OK;
+    }
+    int delivered = 0;
+    std::vector<bool> got(sessions, false);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (ok && delivered < sessions && std::chrono::steady_clock::now() < deadline) {
+        P2P_RunCallbacks();
+        for (int i = 0; i < sessions; i++) {
+            uint8_t buf[64];
+            uint32_t size = 0;
+            int expected = (i + sessions - 1) % sessions;
+            while (P2P_ReadPacket(peers[i], buf, sizeof(buf), &size, nullptr) == P2P_OK) {
+                if (!got[i] && size == sizeof(int) && std::memcmp(buf, &expected, sizeof(int)) == 0) {
+                    got[i] = true;
+                    delivered++;
+                }
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint32_t peer_count = P2P_GetPeerCount();
+    P2P_Shutdown();
+
+    uint64_t lowest = *std::min_element(registered.begin(), registered.end());
+    uint64_t highest = *std::max_element(registered.begin(), registered.end());
+    std::cout << "sessions per node " << registered[0] << "/" << registered[1] << "/" << registered[2]
+              << " (redirects=" << redirects << "), peers " << peer_count << ", delivered " << delivered << "/"
+              << sessions << std::endl;
+
+    stop_cluster(nodes);
+    // 余量 50‰ 约为3个连接，加上负载通告的延迟
+    return ok && registered[0] + registered[1] + registered[2] == static_cast<uint64_t>(sessions) && lowest >= 8 &&
+           highest - lowest <= 8 && peer_count == static_cast<uint32_t>(sessions) && delivered == sessions;
+}
+
+// 本机监听 socket（backlog 为0时接受队列只容纳一个连接）
+static int listen_local(int port, int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(port));
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, backlog) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 重定向目标迟迟连不上时不阻塞 P2P_RunCallbacks：连接在后台进行，超时后放弃并保留原连接，
+// 原连接随后关闭时按断线处理
+bool test_connection_manager_redirect_nonblocking() {
+    std::cout << "Testing ConnectionManager redirect to an unresponsive node..." << std::endl;
+
+    // 假中继：收到 HELLO 后回复 CTRL_REDIRECT；目标节点的接受队列已满，SYN 被丢弃，连接一直不完成
+    int relay_port = get_available_port();
+    int hole_port = get_available_port();
+    int relay = listen_local(relay_port, 4);
+    int hole = listen_local(hole_port, 0);
+    std::vector<int> fillers;
+    for (int i = 0; i < 2 && hole >= 0; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<uint16_t>(hole_port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        fillers.push_back(fd);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    bool ok = relay >= 0 && hole >= 0 && P2P_Init() == P2P_OK &&
+              P2P_Connect("127.0.0.1", static_cast<uint16_t>(relay_port), &peer) == P2P_OK &&
+              P2P_EnableRelaySession(peer, 0xE200000000000001ULL, 0) == P2P_OK;
+    int link = ok ? accept(relay, nullptr, nullptr) : -1;
+    uint8_t type = 0;
+    std::vector<uint8_t> body;
+    if (link >= 0) {
+        set_recv_timeout(link, 3000);
+        P2P_RunCallbacks();
+        ok = recv_typed_frame(link, type, body) && type == relay::FRAME_CTRL && body[0] == relay::CTRL_HELLO;
+        uint8_t redirect[relay::FRAME_HEADER_SIZE + relay::CTRL_REDIRECT_SIZE];
+        relay::writeFrameHeader(redirect, relay::CTRL_REDIRECT_SIZE, relay::FRAME_CTRL);
+        uint8_t* out = redirect + relay::FRAME_HEADER_SIZE;
+        out[0] = relay::CTRL_REDIRECT;
+        relay::writeU16(out + 1, 2);
+        out[3] = 127;
+        out[4] = 0;
+        out[5] = 0;
+        out[6] = 1;
+        relay::writeU16(out + 7, static_cast<uint16_t>(hole_port));
+        ok = ok && send_all(link, redirect, sizeof(redirect));
+    } else {
+        ok = false;
+    }
+
+    // 超过重定向超时 (2s) 期间持续调用，单次调用不应等待连接
+    double slowest_ms = 0;
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(2500);
+    while (ok && std::chrono::steady_clock::now() < until) {
+        auto begin = std::chrono::steady_clock::now();
+        P2P_RunCallbacks();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+        slowest_ms = (std::max)(slowest_ms, ms);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    // 放弃重定向后原连接仍在，中继关闭它后按断线处理
+    uint32_t peers_kept = P2P_GetPeerCount();
+    if (link >= 0) close(link);
+    for (int i = 0; ok && i < 100 && P2P_GetPeerCount() > 0; i++) {
+        P2P_RunCallbacks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    uint32_t peers_after = P2P_GetPeerCount();
+    P2P_Shutdown();
+
+    std::cout << "slowest P2P_RunCallbacks " << slowest_ms << " ms, peers kept " << peers_kept << ", after close "
+              << peers_after << std::endl;
+
+    for (int fd : fillers) close(fd);
+    if (hole >= 0) close(hole);
+    if (relay >= 0) close(relay);
+    return ok && slowest_ms < 500 && peers_kept == 1 && peers_after == 0;
+}
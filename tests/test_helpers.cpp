@@ -0,0 +1,398 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+TestRelay::TestRelay(const std::vector<std::string>& args, int port) {
+    RelayOptions options;
+    options.port = port;
+    options.log_level = std::getenv("RELAY_TEST_VERBOSE") ? "" : "error";
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& flag = args[i];
+        if (flag == "-T") {
+            options.takeover = true;
+            continue;
+        }
+        const std::string value = i + 1 < args.size() ? args[++i] : "";
+        if (flag == "-c") {
+            options.max_connections = std::atoi(value.c_str());
+        } else if (flag == "-a") {
+            options.admin_path = value;
+        } else if (flag == "-H") {
+            options.handoff_path = value;
+        } else if (flag == "-o") {
+            options.limits.push_back(value);
+        } else if (flag == "-n") {
+            options.node_id = std::atoi(value.c_str());
+        } else if (flag == "-j") {
+            options.peers.push_back(value);
+        } else if (flag == "-m") {
+            options.mirror = value;
+        } else if (flag == "-w") {
+            options.capture_path = value;
+        } else if (flag == "-k") {
+            options.tap_key = value;
+        } else {
+            std::cerr << "TestRelay: unknown option " << flag << std::endl;
+            return;
+        }
+    }
+
+    std::string error;
+    if (!server_.start(options, error)) {
+        std::cerr << "Failed to start RelayServer: " << error << std::endl;
+        return;
+    }
+    started_ = true;
+    loop_ = std::thread([this] { server_.run(); });
+}
+
+TestRelay::~TestRelay() {
+    stop();
+}
+
+void TestRelay::stop() {
+    if (!started_) {
+        return;
+    }
+    server_.stop();
+    loop_.join();
+    server_.shutdown();
+    started_ = false;
+}
+
+std::string test_temp_path(const std::string& name, const std::string& suffix) {
+    static std::atomic<int> next{0};
+    return "/tmp/p2p_test_" + name + "_" + std::to_string(getpid()) + "_" + std::to_string(next++) + suffix;
+}
+
+pid_t spawn_relay_server(const std::vector<std::string>& args) {
+    const char* bin = std::getenv("RELAY_SERVER_BIN");
+    std::string path = bin ? bin : "../server/relay_server";
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -1;
+    }
+    if (pid == 0) {
+        // 子进程：默认丢弃服务器日志，设置 RELAY_TEST_VERBOSE 时保留
+        if (!std::getenv("RELAY_TEST_VERBOSE")) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                dup2(devnull, STDOUT_FILENO);
+                dup2(devnull, STDERR_FILENO);
+                close(devnull);
+            }
+        }
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(path.c_str()));
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(path.c_str(), argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+bool wait_for_port(int port, int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        int fd = connect_to_relay(port);
+        if (fd >= 0) {
+            close(fd);
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return false;
+}
+
+bool wait_process_exit(pid_t pid, int timeout_ms, int* exit_status) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (std::chrono::steady_clock::now() < deadline) {
+        int status = 0;
+        pid_t r = waitpid(pid, &status, WNOHANG);
+        if (r == pid) {
+            if (exit_status) {
+                *exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            }
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+void stop_process(pid_t pid) {
+    if (pid <= 0) {
+        return;
+    }
+    kill(pid, SIGTERM);
+    if (!wait_process_exit(pid, 3000, nullptr)) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+int connect_to_relay(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    return fd;
+}
+
+bool send_all(int fd, const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool recv_all(int fd, void* data, size_t len) {
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool send_register(int fd, const uint8_t* mark) {
+    uint8_t buf[12];
+    write_packet_length(buf, 8);
+    std::memcpy(buf + 4, mark, 8);
+    return send_all(fd, buf, sizeof(buf));
+}
+
+bool send_forward(int fd, const uint8_t* target_mark, const void* data, size_t len) {
+    std::vector<uint8_t> buf(4);
+    write_packet_length(buf.data(), static_cast<uint32_t>(8 + len));
+    buf.insert(buf.end(), target_mark, target_mark + 8);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    buf.insert(buf.end(), bytes, bytes + len);
+    return send_all(fd, buf.data(), buf.size());
+}
+
+bool recv_frame(int fd, std::vector<uint8_t>& out) {
+    uint8_t len_buf[4];
+    if (!recv_all(fd, len_buf, 4)) {
+        return false;
+    }
+    uint32_t len = read_packet_length(len_buf);
+    out.resize(len);
+    return len == 0 || recv_all(fd, out.data(), len);
+}
+
+bool recv_typed_frame(int fd, uint8_t& type, std::vector<uint8_t>& out) {
+    uint8_t header[4];
+    if (!recv_all(fd, header, 4)) {
+        return false;
+    }
+    uint32_t value = relay::readU32(header);
+    uint32_t len = relay::frameLength(value);
+    type = relay::frameType(value);
+    out.resize(len);
+    return len == 0 || recv_all(fd, out.data(), len);
+}
+
+bool send_hello(int fd, const uint8_t* mark, uint32_t caps, uint64_t token, uint64_t client_rx,
+                uint32_t deadline_ms) {
+    std::vector<uint8_t> frame(relay::FRAME_HEADER_SIZE + relay::HELLO_FIXED_SIZE);
+    uint8_t* body = frame.data() + relay::FRAME_HEADER_SIZE;
+    body[0] = relay::CTRL_HELLO;
+    body[1] = relay::PROTOCOL_VERSION;
+    relay::writeU32(body + 2, caps);
+    std::memcpy(body + 6, mark, 8);
+    if (token != 0) {
+        uint8_t tlv[relay::TLV_HEADER_SIZE + relay::TLV_RESUME_SIZE];
+        tlv[0] = relay::TLV_RESUME;
+        relay::writeU16(tlv + 1, static_cast<uint16_t>(relay::TLV_RESUME_SIZE));
+        relay::writeU64(tlv + 3, token);
+        relay::writeU64(tlv + 11, client_rx);
+        frame.insert(frame.end(), tlv, tlv + sizeof(tlv));
+    }
+    if (deadline_ms != 0) {
+        uint8_t tlv[relay::TLV_HEADER_SIZE + relay::TLV_DEADLINE_SIZE];
+        tlv[0] = relay::TLV_DEADLINE;
+        relay::writeU16(tlv + 1, static_cast<uint16_t>(relay::TLV_DEADLINE_SIZE));
+        relay::writeU32(tlv + 3, deadline_ms);
+        frame.insert(frame.end(), tlv, tlv + sizeof(tlv));
+    }
+    relay::writeFrameHeader(frame.data(), static_cast<uint32_t>(frame.size() - relay::FRAME_HEADER_SIZE),
+                            relay::FRAME_CTRL);
+    return send_all(fd, frame.data(), frame.size());
+}
+
+bool recv_hello_ack(int fd, uint8_t& status, uint64_t& token, uint64_t& relay_rx) {
+    std::vector<uint8_t> body;
+    uint8_t type = 0;
+    while (recv_typed_frame(fd, type, body)) {
+        if (type != relay::FRAME_CTRL || body.empty() || body[0] == relay::CTRL_ACK || body[0] == relay::CTRL_PING) {
+            continue;
+        }
+        if (body[0] != relay::CTRL_HELLO_ACK || body.size() < relay::HELLO_ACK_SIZE) {
+            return false;
+        }
+        status = body[1];
+        token = relay::readU64(body.data() + 2);
+        relay_rx = relay::readU64(body.data() + 10);
+        return true;
+    }
+    return false;
+}
+
+bool register_with_ack(int fd, const uint8_t* mark) {
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    return send_hello(fd, mark, 0) && recv_hello_ack(fd, status, token, relay_rx) && status == relay::HELLO_OK;
+}
+
+bool send_class(int fd, uint8_t traffic_class) {
+    uint8_t frame[relay::FRAME_HEADER_SIZE + relay::CTRL_CLASS_SIZE];
+    relay::writeFrameHeader(frame, relay::CTRL_CLASS_SIZE, relay::FRAME_CTRL);
+    frame[relay::FRAME_HEADER_SIZE] = relay::CTRL_CLASS;
+    frame[relay::FRAME_HEADER_SIZE + 1] = traffic_class;
+    return send_all(fd, frame, sizeof(frame));
+}
+
+bool send_compact(int fd, uint8_t tag, const void* body, size_t len) {
+    std::vector<uint8_t> frame(relay::COMPACT_HEADER_MAX + len);
+    uint32_t header_len = relay::writeVarint(frame.data(), static_cast<uint32_t>(len + 1));
+    frame[header_len++] = tag;
+    if (len > 0) {
+        std::memcpy(frame.data() + header_len, body, len);
+    }
+    return send_all(fd, frame.data(), header_len + len);
+}
+
+bool recv_compact(int fd, uint8_t& tag, std::vector<uint8_t>& body) {
+    uint8_t varint[relay::VARINT_MAX_SIZE];
+    uint32_t frame_len = 0;
+    for (uint32_t i = 0; i < relay::VARINT_MAX_SIZE; i++) {
+        if (!recv_all(fd, varint + i, 1)) {
+            return false;
+        }
+        int n = relay::readVarint(varint, i + 1, frame_len);
+        if (n < 0) {
+            return false;
+        }
+        if (n > 0) {
+            break;
+        }
+    }
+    if (frame_len == 0 || !recv_all(fd, &tag, 1)) {
+        return false;
+    }
+    body.resize(frame_len - 1);
+    return body.empty() || recv_all(fd, body.data(), body.size());
+}
+
+void set_recv_timeout(int fd, int timeout_ms) {
+    struct timeval tv;
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+bool admin_query(const std::string& path, const std::string& command, std::string& out) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    set_recv_timeout(fd, 3000);
+    std::string line = command + "\n";
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        !send_all(fd, line.data(), line.size())) {
+        close(fd);
+        return false;
+    }
+
+    out.clear();
+    char buf[4096];
+    while (out.size() < 4 || out.compare(out.size() - 4, 4, "END\n") != 0) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        out.append(buf, static_cast<size_t>(n));
+    }
+    close(fd);
+    out.resize(out.size() - 4);
+    return true;
+}
+
+uint64_t admin_stat(const std::string& path, const std::string& name) {
+    std::string out;
+    if (!admin_query(path, "stats", out)) {
+        return UINT64_MAX;
+    }
+    std::istringstream in(out);
+    std::string key;
+    uint64_t value;
+    while (in >> key >> value) {
+        if (key == name) {
+            return value;
+        }
+    }
+    return UINT64_MAX;
+}
+
+uint64_t steady_us() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+bool recv_data(int fd, std::vector<uint8_t>& body) {
+    uint8_t type = 0;
+    while (recv_typed_frame(fd, type, body)) {
+        if (type == relay::FRAME_DATA) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -7,7 +7,12 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <vector>
+#include <string>
+#include <thread>
 #include <cstdint>
+#include <sys/types.h>
+
+#include "relay_server.h"
 
 // 获取可用端口的函数
 int get_available_port();
@@ -21,4 +26,110 @@ uint32_t read_packet_length(const uint8_t* buf);
 // 实现包长度读取
 uint32_t read_packet_length_impl(const uint8_t* buf);
 
+// ---------------------------------------------------------------------------
+// 进程内中继（RelayServer，见 server/relay_server.h）
+// ---------------------------------------------------------------------------
+
+// 以 relay_server 的命令行参数（不含端口）在进程内启动中继，事件循环在后台线程运行；
+// port 为0时监听临时端口。默认只输出错误日志，设置 RELAY_TEST_VERBOSE 时保留全部日志
+class TestRelay {
+public:
+    explicit TestRelay(const std::vector<std::string>& args = {}, int port = 0);
+    ~TestRelay();
+
+    TestRelay(const TestRelay&) = delete;
+    TestRelay& operator=(const TestRelay&) = delete;
+
+    // 启动失败时已输出原因
+    bool started() const { return started_; }
+    int port() const { return server_.port(); }
+
+    // 停止事件循环并关闭全部连接（相当于中继进程退出）；析构时自动调用
+    void stop();
+
+private:
+    RelayServer server_;
+    std::thread loop_;
+    bool started_ = false;
+};
+
+// 测试用的临时文件路径 /tmp/p2p_test_<name>_<pid>_<序号><suffix>（管理socket、抓包文件等），同一进程内不重复
+std::string test_temp_path(const std::string& name, const std::string& suffix = ".sock");
+
+// ---------------------------------------------------------------------------
+// 独立 relay_server 进程（热重启等需要真实进程的测试）
+// 可执行文件路径默认为 ../server/relay_server，可通过环境变量 RELAY_SERVER_BIN 覆盖
+// ---------------------------------------------------------------------------
+
+// 启动 relay_server，args 为除程序名外的全部参数；失败返回-1
+pid_t spawn_relay_server(const std::vector<std::string>& args);
+
+// 等待端口可连接，超时返回false
+bool wait_for_port(int port, int timeout_ms);
+
+// 等待进程退出，超时返回false；exit_status 输出退出码
+bool wait_process_exit(pid_t pid, int timeout_ms, int* exit_status);
+
+// 终止进程并回收
+void stop_process(pid_t pid);
+
+// ---------------------------------------------------------------------------
+// 阻塞式客户端辅助函数
+// ---------------------------------------------------------------------------
+
+// 连接到 127.0.0.1:port，失败返回-1
+int connect_to_relay(int port);
+
+// 发送全部数据
+bool send_all(int fd, const void* data, size_t len);
+
+// 接收指定长度数据
+bool recv_all(int fd, void* data, size_t len);
+
+// 发送旧版注册包 [4字节长度=8] + [8字节标记]
+bool send_register(int fd, const uint8_t* mark);
+
+// 发送转发包 [4字节长度] + [8字节目标标记] + [数据]
+bool send_forward(int fd, const uint8_t* target_mark, const void* data, size_t len);
+
+// 接收一个 [4字节长度] + [数据] 帧
+bool recv_frame(int fd, std::vector<uint8_t>& out);
+
+// 接收一个帧并返回帧类型（见 include/relay_protocol.h）
+bool recv_typed_frame(int fd, uint8_t& type, std::vector<uint8_t>& out);
+
+// 发送扩展注册 CTRL_HELLO；token != 0 时附带 TLV_RESUME 请求恢复会话，deadline_ms != 0 时附带 TLV_DEADLINE
+bool send_hello(int fd, const uint8_t* mark, uint32_t caps, uint64_t token = 0, uint64_t client_rx = 0,
+                uint32_t deadline_ms = 0);
+
+// 接收 CTRL_HELLO_ACK（跳过之前的 CTRL_ACK），输出状态、会话令牌与中继已收到的帧数
+bool recv_hello_ack(int fd, uint8_t& status, uint64_t& token, uint64_t& relay_rx);
+
+// 以 CTRL_HELLO（不启用任何能力）注册并等待 HELLO_ACK；注册成功后不会再收到控制帧
+bool register_with_ack(int fd, const uint8_t* mark);
+
+// 发送 CTRL_CLASS：之后发出的数据帧的类别（HELLO_ACK 含 CAP_LANES 之后）
+bool send_class(int fd, uint8_t traffic_class);
+
+// 发送一个紧凑帧 [varint 长度][标签][帧体]（HELLO_ACK 含 CAP_COMPACT 之后）
+bool send_compact(int fd, uint8_t tag, const void* body, size_t len);
+
+// 接收一个紧凑帧，输出标签与帧体
+bool recv_compact(int fd, uint8_t& tag, std::vector<uint8_t>& body);
+
+// 设置接收超时，避免测试失败时永久阻塞
+void set_recv_timeout(int fd, int timeout_ms);
+
+// 通过管理socket（relay_server -a <path>）执行一条命令，输出 END 之前的内容
+bool admin_query(const std::string& path, const std::string& command, std::string& out);
+
+// 读取 stats 命令中的一项统计，失败返回 UINT64_MAX
+uint64_t admin_stat(const std::string& path, const std::string& name);
+
+// 单调时钟（微秒），用于测量包从发送到收到的时间
+uint64_t steady_us();
+
+// 接收下一个数据帧（跳过控制帧）
+bool recv_data(int fd, std::vector<uint8_t>& body);
+
 #endif // TEST_HELPERS_H
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include <string>
+
+// handoff 记录格式，与 relay_server.cpp 中的 HandoffHeader 一致
+struct TestHandoffHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    uint32_t body_len;
+};
+constexpr uint32_t TEST_HANDOFF_MAGIC = 0x59524C48;
+constexpr uint16_t TEST_HANDOFF_VERSION = 9;
+constexpr uint16_t TEST_HANDOFF_HELLO = 1;
+constexpr uint16_t TEST_HANDOFF_END = 4;
+constexpr uint16_t TEST_HANDOFF_ACK = 5;
+constexpr uint16_t TEST_HANDOFF_COMMIT = 7;
+
+static bool send_handoff_test_record(int sock, uint16_t type) {
+    TestHandoffHeader hdr = {TEST_HANDOFF_MAGIC, TEST_HANDOFF_VERSION, type, 0};
+    return send_all(sock, &hdr, sizeof(hdr));
+}
+
+// 读取一条记录的类型并丢弃正文；附带的fd立即关闭（模拟的新进程不接管任何连接）
+static bool recv_handoff_test_record(int sock, uint16_t& type) {
+    TestHandoffHeader hdr;
+    struct iovec iov = {&hdr, sizeof(hdr)};
+    alignas(struct cmsghdr) char ctrl[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) {
+        return false;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int fd = -1;
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+            close(fd);
+        }
+    }
+    if (static_cast<size_t>(n) < sizeof(hdr) &&
+        !recv_all(sock, reinterpret_cast<uint8_t*>(&hdr) + n, sizeof(hdr) - static_cast<size_t>(n))) {
+        return false;
+    }
+    std::vector<uint8_t> body(hdr.body_len);
+    type = hdr.type;
+    return hdr.magic == TEST_HANDOFF_MAGIC && (body.empty() || recv_all(sock, body.data(), body.size()));
+}
+
+// 模拟的新进程：请求接管并读完全部记录；ack 为 true 时回复 HANDOFF_ACK 并等待旧进程的 HANDOFF_COMMIT
+static bool fake_takeover(const std::string& path, bool ack, bool& committed) {
+    committed = false;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    set_recv_timeout(sock, 3000);
+    bool ok = sock >= 0 && connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+              send_handoff_test_record(sock, TEST_HANDOFF_HELLO);
+    uint16_t type = 0;
+    while (ok && type != TEST_HANDOFF_END) {
+        ok = recv_handoff_test_record(sock, type);
+    }
+    if (ok && ack) {
+        ok = send_handoff_test_record(sock, TEST_HANDOFF_ACK) && recv_handoff_test_record(sock, type);
+        committed = ok && type == TEST_HANDOFF_COMMIT;
+    }
+    if (sock >= 0) close(sock);
+    return ok;
+}
+
+// 热重启提交点：新进程确认之前放弃接管时旧进程继续转发；确认后旧进程发出提交记录并退出，不再恢复服务
+bool test_hot_restart_commit_point() {
+    std::cout << "Testing hot restart commit point with a fake successor..." << std::endl;
+
+    int port = get_available_port();
+    std::string handoff_path = "/tmp/relay_handoff_commit_" + std::to_string(getpid()) + ".sock";
+    pid_t pid = spawn_relay_server({"-c", "16", "-H", handoff_path, std::to_string(port)});
+    if (pid < 0 || !wait_for_port(port, 3000)) {
+        std::cerr << "Failed to start relay_server" << std::endl;
+        stop_process(pid);
+        return false;
+    }
+
+    uint8_t mark_a[8] = {0x41, 0x51, 0x61, 0x71, 0x81, 0x91, 0xA1, 0xB1};
+    uint8_t mark_b[8] = {0x42, 0x52, 0x62, 0x72, 0x82, 0x92, 0xA2, 0xB2};
+    int fd_a = connect_to_relay(port);
+    int fd_b = connect_to_relay(port);
+    bool ok = fd_a >= 0 && fd_b >= 0 && register_with_ack(fd_a, mark_a) && register_with_ack(fd_b, mark_b);
+    if (ok) {
+        set_recv_timeout(fd_b, 3000);
+    }
+
+    // 新进程读完全部状态后不确认就断开：旧进程未到提交点，继续转发
+    bool committed = true;
+    bool aborted = ok && fake_takeover(handoff_path, false, committed) && !committed;
+    const char payload[] = "still served";
+    std::vector<uint8_t> frame;
+    bool kept_serving = aborted && send_forward(fd_a, mark_b, payload, sizeof(payload)) && recv_frame(fd_b, frame) &&
+                        frame.size() == sizeof(payload);
+
+    // 新进程确认后收到提交记录，旧进程退出；连接只由新进程持有（这里已关闭），客户端读到 EOF
+    bool handed = kept_serving && fake_takeover(handoff_path, true, committed) && committed;
+    int status = -1;
+    bool exited = handed && wait_process_exit(pid, 3000, &status);
+    bool closed = exited && !recv_frame(fd_b, frame);
+
+    std::cout << "aborted " << aborted << ", kept serving " << kept_serving << ", committed " << committed
+              << ", old exited " << exited << " (status " << status << ")" << std::endl;
+    if (fd_a >= 0) close(fd_a);
+    if (fd_b >= 0) close(fd_b);
+    if (!exited) {
+        stop_process(pid);
+    }
+    unlink(handoff_path.c_str());
+    return kept_serving && handed && exited && status == 0 && closed;
+}
+
+// 热重启测试：压力发送过程中启动新进程接管，验证无丢包、无乱序；接管后发送方的广播仍发给它的队友
+bool test_hot_restart_no_packet_loss() {
+    std::cout << "Testing hot restart with fd handoff..." << std::endl;
+
+    int port = get_available_port();
+    if (port == -1) {
+        std::cerr << "Failed to find available port" << std::endl;
+        return false;
+    }
+    std::string handoff_path = "/tmp/relay_handoff_test_" + std::to_string(getpid()) + ".sock";
+
+    pid_t old_pid = spawn_relay_server({"-c", "16", "-H", handoff_path, std::to_string(port)});
+    if (old_pid < 0 || !wait_for_port(port, 3000)) {
+        std::cerr << "Failed to start relay_server" << std::endl;
+        stop_process(old_pid);
+        return false;
+    }
+
+    uint8_t sender_mark[8] = {0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28};
+    uint8_t receiver_mark[8] = {0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38};
+
+    int sender_fd = connect_to_relay(port);
+    int receiver_fd = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    if (sender_fd < 0 || receiver_fd < 0 || !send_hello(sender_fd, sender_mark, relay::CAP_FANOUT) ||
+        !recv_hello_ack(sender_fd, status, token, relay_rx) || status != relay::HELLO_OK ||
+        !send_register(receiver_fd, receiver_mark)) {
+        std::cerr << "Client setup failed" << std::endl;
+        if (sender_fd >= 0) close(sender_fd);
+        if (receiver_fd >= 0) close(receiver_fd);
+        stop_process(old_pid);
+        return false;
+    }
+
+    // 等待注册完成
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const uint32_t num_messages = 3000;
+    const size_t message_size = 200;
+    std::atomic<uint32_t> sent_count(0);
+
+    std::thread sender_thread([&]() {
+        std::vector<uint8_t> payload(message_size, 0xAB);
+        for (uint32_t i = 0; i < num_messages; i++) {
+            std::memcpy(payload.data(), &i, sizeof(i));
+            if (!send_forward(sender_fd, receiver_mark, payload.data(), payload.size())) {
+                std::cerr << "Sending message " << i << " failed" << std::endl;
+                break;
+            }
+            sent_count++;
+            std::this_thread::sleep_for(std::chrono::microseconds(300));
+        }
+    });
+
+    uint32_t received = 0;
+    bool in_order = true;
+    std::thread receiver_thread([&]() {
+        std::vector<uint8_t> frame;
+        while (received < num_messages && recv_frame(receiver_fd, frame)) {
+            uint32_t seq = 0;
+            if (frame.size() != message_size) {
+                in_order = false;
+                break;
+            }
+            std::memcpy(&seq, frame.data(), sizeof(seq));
+            if (seq != received) {
+                std::cerr << "Out of order: expected " << received << ", got " << seq << std::endl;
+                in_order = false;
+                break;
+            }
+            received++;
+        }
+    });
+
+    // 发送进行到约三分之一时启动新进程接管
+    while (sent_count.load() < num_messages / 3) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    pid_t new_pid = spawn_relay_server({"-c", "16", "-H", handoff_path, "-T", std::to_string(port)});
+
+    int old_status = -1;
+    bool old_exited = wait_process_exit(old_pid, 5000, &old_status);
+    if (!old_exited) {
+        std::cerr << "Old relay_server did not exit after handoff" << std::endl;
+    }
+    std::cout << "Handoff done after " << sent_count.load() << " messages" << std::endl;
+
+    sender_thread.join();
+
+    // 接收线程在收齐后退出；超时则关闭socket使其返回
+    auto start_time = std::chrono::steady_clock::now();
+    while (received < num_messages && in_order &&
+           std::chrono::steady_clock::now() - start_time < std::chrono::seconds(10)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    if (received < num_messages) {
+        shutdown(receiver_fd, SHUT_RDWR);
+    }
+    receiver_thread.join();
+
+    // 队友列表随会话交给新进程：广播只发给接管前发往过的接收方
+    bool broadcast_ok = false;
+    if (received == num_messages) {
+        uint8_t broadcast[8];
+        relay::writeU64(broadcast, relay::FANOUT_BROADCAST);
+        const char after[] = "after handoff";
+        std::vector<uint8_t> frame;
+        set_recv_timeout(receiver_fd, 3000);
+        broadcast_ok = send_forward(sender_fd, broadcast, after, sizeof(after)) && recv_frame(receiver_fd, frame) &&
+                       frame.size() == sizeof(after) && std::memcmp(frame.data(), after, sizeof(after)) == 0;
+    }
+
+    close(sender_fd);
+    close(receiver_fd);
+    stop_process(new_pid);
+    if (!old_exited) {
+        stop_process(old_pid);
+    }
+    unlink(handoff_path.c_str());
+
+    std::cout << "Hot restart test: sent " << sent_count.load() << ", received " << received
+              << " (old process exit status " << old_status << "), broadcast to peers " << broadcast_ok << std::endl;
+
+    bool success = old_exited && old_status == 0 && in_order &&
+                   sent_count.load() == num_messages && received == num_messages && broadcast_ok;
+    std::cout << "Hot restart test " << (success ? "PASSED" : "FAILED") << std::endl;
+    return success;
+}
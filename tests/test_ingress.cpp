@@ -0,0 +1,181 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 洪泛方：中继暂停读取后内核缓冲区很快写满，发送超时后重试直到 stop
+static void flood(int fd, const std::vector<uint8_t>& frame, const std::atomic<bool>& stop) {
+    struct timeval tv = {0, 50 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    std::vector<uint8_t> batch;
+    while (batch.size() < 64 * 1024) {
+        batch.insert(batch.end(), frame.begin(), frame.end());
+    }
+    while (!stop) {
+        ssize_t n = send(fd, batch.data(), batch.size(), MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            break;
+        }
+    }
+}
+
+// 单个客户端以极小的帧与超大帧洪泛：令牌桶限制被处理的帧数与字节数，其他会话的往返延迟不受影响
+bool test_ingress_flood_latency() {
+    std::cout << "Testing ingress token buckets under a single-client flood..." << std::endl;
+
+    const int packets_per_sec = 2000;
+    const int bytes_per_sec = 1024 * 1024;
+    std::string admin = test_temp_path("ingress");
+    TestRelay relay({"-c", "16", "-a", admin, "-o", "ingress_packets_per_sec=" + std::to_string(packets_per_sec), "-o",
+                     "ingress_bytes_per_sec=" + std::to_string(bytes_per_sec)});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xA1, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xA2, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t mark_f[8] = {0xA3, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    uint8_t mark_g[8] = {0xA4, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44};
+    uint8_t nobody[8] = {0xAF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int f = connect_to_relay(port);
+    int g = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && f >= 0 && g >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b) &&
+              register_with_ack(f, mark_f) && register_with_ack(g, mark_g);
+    if (ok) {
+        set_recv_timeout(a, 1000);
+        set_recv_timeout(b, 1000);
+    }
+
+    // F: 1字节的数据帧（无法解析目标，逐帧丢弃）；G: 60000 字节发往不存在的目标
+    std::vector<uint8_t> tiny(relay::FRAME_HEADER_SIZE + 1);
+    relay::writeFrameHeader(tiny.data(), 1, relay::FRAME_DATA);
+    std::vector<uint8_t> huge(relay::FRAME_HEADER_SIZE + 60000);
+    relay::writeFrameHeader(huge.data(), 60000, relay::FRAME_DATA);
+    std::memcpy(huge.data() + relay::FRAME_HEADER_SIZE, nobody, 8);
+
+    std::atomic<bool> stop{false};
+    uint64_t flood_start = steady_us();
+    std::thread flood_f;
+    std::thread flood_g;
+    std::thread echo;
+    if (ok) {
+        flood_f = std::thread(flood, f, std::cref(tiny), std::cref(stop));
+        flood_g = std::thread(flood, g, std::cref(huge), std::cref(stop));
+        // B 原样回给 A
+        echo = std::thread([&]() {
+            std::vector<uint8_t> body;
+            while (!stop && recv_frame(b, body)) {
+                send_forward(b, mark_a, body.data(), body.size());
+            }
+        });
+    }
+
+    // A<->B 每 5ms 一次往返
+    const int rounds = 200;
+    std::vector<double> rtts;
+    std::vector<uint8_t> body;
+    for (int i = 0; i < rounds && ok; i++) {
+        uint64_t sent_us = steady_us();
+        uint8_t ping[8];
+        relay::writeU64(ping, sent_us);
+        ok = send_forward(a, mark_b, ping, sizeof(ping)) && recv_frame(a, body) && body.size() == sizeof(ping) &&
+             relay::readU64(body.data()) == sent_us;
+        if (ok) {
+            rtts.push_back((steady_us() - sent_us) / 1000.0);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    // 洪泛期间中继最多处理一秒的突发配额加上按速率补充的部分
+    double elapsed_s = (steady_us() - flood_start) / 1e6;
+    uint64_t tiny_handled = admin_stat(admin, "drop_small_packet");
+    uint64_t huge_handled = admin_stat(admin, "drop_no_target");
+    uint64_t paused = admin_stat(admin, "ingress_paused");
+    stop = true;
+    if (flood_f.joinable()) flood_f.join();
+    if (flood_g.joinable()) flood_g.join();
+    if (echo.joinable()) echo.join();
+
+    double p50 = 0;
+    double p99 = 0;
+    if (!rtts.empty()) {
+        std::sort(rtts.begin(), rtts.end());
+        p50 = rtts[rtts.size() / 2];
+        p99 = rtts[std::min(rtts.size() - 1, rtts.size() * 99 / 100)];
+    }
+    double tiny_budget = packets_per_sec * (1.0 + elapsed_s) * 1.25;
+    double huge_budget = bytes_per_sec * (1.0 + elapsed_s) * 1.25 / 60000.0 + 2;
+    std::cout << "round trips " << rtts.size() << "/" << rounds << " p50 " << p50 << "ms p99 " << p99
+              << "ms during " << elapsed_s << "s flood; tiny frames handled " << tiny_handled << " (budget "
+              << tiny_budget << "), huge frames handled " << huge_handled << " (budget " << huge_budget
+              << "), ingress pauses " << paused << std::endl;
+
+    for (int fd : {a, b, f, g}) {
+        if (fd >= 0) close(fd);
+    }
+    relay.stop();
+    return ok && static_cast<int>(rtts.size()) == rounds && p99 < 20.0 && tiny_handled != UINT64_MAX &&
+           tiny_handled > 0 && tiny_handled < tiny_budget && huge_handled != UINT64_MAX && huge_handled > 0 &&
+           huge_handled < huge_budget && paused != UINT64_MAX && paused > 0;
+}
+
+// 同一IP的连接数上限：超出的连接被立即关闭，已有连接断开后可以再连
+bool test_ingress_ip_limit() {
+    std::cout << "Testing per-IP connection limit..." << std::endl;
+
+    std::string admin = test_temp_path("iplimit");
+    TestRelay relay({"-c", "16", "-a", admin, "-o", "max_connections_per_ip=3"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    int fds[3];
+    bool ok = true;
+    for (int i = 0; i < 3; i++) {
+        uint8_t mark[8] = {0xB1, static_cast<uint8_t>(i), 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+        fds[i] = connect_to_relay(port);
+        ok = ok && fds[i] >= 0 && register_with_ack(fds[i], mark);
+    }
+
+    // 第4个连接：中继接受后立即关闭
+    int extra = connect_to_relay(port);
+    bool rejected = false;
+    if (ok && extra >= 0) {
+        set_recv_timeout(extra, 1000);
+        uint8_t byte;
+        rejected = recv(extra, &byte, 1, 0) == 0;
+        close(extra);
+    }
+    uint64_t rejected_count = admin_stat(admin, "ip_limit_rejected");
+
+    // 断开一个后名额释放
+    close(fds[0]);
+    fds[0] = -1;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint8_t mark[8] = {0xB1, 0x09, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    int again = connect_to_relay(port);
+    bool reaccepted = ok && again >= 0 && register_with_ack(again, mark);
+
+    std::cout << "3 connections " << ok << ", 4th rejected " << rejected << " (ip_limit_rejected=" << rejected_count
+              << "), accepted after one closed " << reaccepted << std::endl;
+
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+    if (again >= 0) close(again);
+    relay.stop();
+    return ok && rejected && rejected_count == 1 && reaccepted;
+}
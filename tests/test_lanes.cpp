@@ -0,0 +1,297 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 负载: [8字节 发送时间][4字节 序号][1字节 种类]
+enum LaneKind : uint8_t { KIND_BULK = 0, KIND_SMALL_A = 1, KIND_SMALL_C = 2, KIND_COUNT = 3 };
+constexpr size_t LANE_HEADER_SIZE = 8 + 4 + 1;
+
+struct LaneResult {
+    int sent[KIND_COUNT] = {};
+    int received[KIND_COUNT] = {};
+    double p99_ms[KIND_COUNT] = {};
+    bool in_order = true;
+};
+
+static bool send_lane_packet(int fd, const uint8_t* target, std::vector<uint8_t>& payload, uint8_t kind,
+                             int seq) {
+    relay::writeU64(payload.data(), steady_us());
+    relay::writeU32(payload.data() + 8, static_cast<uint32_t>(seq));
+    payload[12] = kind;
+    return send_forward(fd, target, payload.data(), payload.size());
+}
+
+// 慢速目标 B 同时收到 A 的大块传输（夹带少量小包）与 C 的小包；lanes 为真时 A 声明 CAP_LANES，
+// 小包以 CTRL_CLASS 标为不可靠。统计每种包从发送到 B 收到的延迟
+static bool run_lanes(bool lanes, LaneResult& result) {
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x91, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0x92, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t mark_c[8] = {0x93, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = a >= 0 && b >= 0 && c >= 0;
+    if (ok) {
+        int rcvbuf = 256 * 1024;
+        setsockopt(b, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        set_recv_timeout(b, 500);
+    }
+    ok = ok && register_with_ack(b, mark_b) && register_with_ack(c, mark_c) &&
+         send_hello(a, mark_a, lanes ? relay::CAP_LANES : 0) && recv_hello_ack(a, status, token, relay_rx) &&
+         status == relay::HELLO_OK;
+
+    // A 约 48MB/s 发出 16000 字节的包，每 5ms 切换类别夹带一个小包；B 只以约 20MB/s 读取
+    const int bulk_count = 2500;
+    std::atomic<bool> bulk_done{false};
+    std::thread sender_a([&]() {
+        std::vector<uint8_t> bulk(16000);
+        std::vector<uint8_t> small(64);
+        uint64_t next_small = steady_us();
+        for (int i = 0; i < bulk_count && ok; i++) {
+            if (!send_lane_packet(a, mark_b, bulk, KIND_BULK, i)) {
+                break;
+            }
+            result.sent[KIND_BULK]++;
+            if (steady_us() >= next_small) {
+                next_small += 5000;
+                if (!send_class(a, relay::CLASS_UNRELIABLE) ||
+                    !send_lane_packet(a, mark_b, small, KIND_SMALL_A, result.sent[KIND_SMALL_A]) ||
+                    !send_class(a, relay::CLASS_RELIABLE)) {
+                    break;
+                }
+                result.sent[KIND_SMALL_A]++;
+            }
+            if (i % 3 == 2) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        bulk_done = true;
+    });
+    std::thread sender_c([&]() {
+        std::vector<uint8_t> small(64);
+        while (ok && !bulk_done) {
+            if (!send_lane_packet(c, mark_b, small, KIND_SMALL_C, result.sent[KIND_SMALL_C])) {
+                break;
+            }
+            result.sent[KIND_SMALL_C]++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    });
+
+    std::vector<double> ages[KIND_COUNT];
+    int64_t last_seq[KIND_COUNT] = {-1, -1, -1};
+    std::vector<uint8_t> body;
+    size_t since_pause = 0;
+    while (ok && recv_frame(b, body)) {
+        if (body.size() < LANE_HEADER_SIZE || body[12] >= KIND_COUNT) {
+            result.in_order = false;
+            break;
+        }
+        uint8_t kind = body[12];
+        ages[kind].push_back((steady_us() - relay::readU64(body.data())) / 1000.0);
+        int64_t seq = relay::readU32(body.data() + 8);
+        result.in_order = result.in_order && seq == last_seq[kind] + 1;
+        last_seq[kind] = seq;
+        since_pause += body.size();
+        if (since_pause >= 20000) {
+            since_pause = 0;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    sender_a.join();
+    sender_c.join();
+
+    for (int k = 0; k < KIND_COUNT; k++) {
+        result.received[k] = static_cast<int>(ages[k].size());
+        if (!ages[k].empty()) {
+            std::sort(ages[k].begin(), ages[k].end());
+            result.p99_ms[k] = ages[k][std::min(ages[k].size() - 1, ages[k].size() * 99 / 100)];
+        }
+    }
+
+    close(a);
+    close(b);
+    close(c);
+    relay.stop();
+    return ok;
+}
+
+// 出站调度：大块传输占满目标链路时，其他来源的小包与同一来源的不可靠小包仍保持低延迟
+bool test_egress_lanes_latency() {
+    std::cout << "Testing egress lanes under a bulk transfer..." << std::endl;
+
+    LaneResult baseline;
+    LaneResult lanes;
+    bool ok = run_lanes(false, baseline) && run_lanes(true, lanes);
+
+    const char* names[KIND_COUNT] = {"bulk", "A small", "C small"};
+    for (const LaneResult* r : {&baseline, &lanes}) {
+        std::cout << (r == &baseline ? "without lanes:" : "with lanes:   ");
+        for (int k = 0; k < KIND_COUNT; k++) {
+            std::cout << " " << names[k] << " " << r->received[k] << "/" << r->sent[k] << " p99 " << r->p99_ms[k]
+                      << "ms;";
+        }
+        std::cout << " in order " << r->in_order << std::endl;
+    }
+
+    bool delivered = true;
+    for (const LaneResult* r : {&baseline, &lanes}) {
+        for (int k = 0; k < KIND_COUNT; k++) {
+            delivered = delivered && r->sent[k] > 0 && r->received[k] == r->sent[k];
+        }
+        delivered = delivered && r->in_order;
+    }
+    // 其他来源的小包总有自己的子队列；同一来源的小包只有声明为不可靠类别时才不排在大块数据之后
+    const double interactive_ms = 60.0;
+    bool baseline_ok = baseline.p99_ms[KIND_BULK] > 4 * interactive_ms &&
+                       baseline.p99_ms[KIND_SMALL_A] > 4 * interactive_ms &&
+                       baseline.p99_ms[KIND_SMALL_C] < interactive_ms;
+    bool lanes_ok = lanes.p99_ms[KIND_BULK] > 4 * interactive_ms && lanes.p99_ms[KIND_SMALL_A] < interactive_ms &&
+                    lanes.p99_ms[KIND_SMALL_C] < interactive_ms;
+    return ok && delivered && baseline_ok && lanes_ok;
+}
+
+// 客户端库：P2P_SendPacketEx 的类别变化时先发出已打包的记录再发 CTRL_CLASS，未启用时不发
+bool test_connection_manager_lanes() {
+    std::cout << "Testing ConnectionManager traffic classes..." << std::endl;
+
+    std::string admin = test_temp_path("lanes");
+    TestRelay relay({"-c", "16", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    const int ticks = 50;
+    uint64_t switches[2] = {UINT64_MAX, UINT64_MAX};
+    bool delivered[2] = {false, false};
+    for (int run = 0; run < 2; run++) {
+        uint32_t flags = P2P_RELAY_FLAG_SOURCE | P2P_RELAY_FLAG_BUNDLE | (run == 1 ? P2P_RELAY_FLAG_LANES : 0);
+        uint64_t local = 0x9400000000000001ULL + run;
+        uint64_t remote = 0x9500000000000001ULL + run;
+        uint8_t remote_mark[8];
+        std::memcpy(remote_mark, &remote, 8);
+        int b = connect_to_relay(port);
+        bool ok = b >= 0 && register_with_ack(b, remote_mark);
+        if (b >= 0) {
+            set_recv_timeout(b, 3000);
+        }
+
+        P2PPeerID peer = P2P_INVALID_PEER_ID;
+        ok = ok && P2P_Init() == P2P_OK && P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) == P2P_OK &&
+             P2P_EnableRelaySession(peer, local, flags) == P2P_OK;
+        for (int i = 0; i < 20 && ok; i++) {
+            P2P_RunCallbacks();
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        uint64_t before = admin_stat(admin, "class_switches");
+        std::vector<uint8_t> packet(8 + 2);
+        std::memcpy(packet.data(), &remote, 8);
+        std::vector<uint8_t> body;
+        int received = 0;
+        for (int t = 0; t < ticks && ok; t++) {
+            // 每帧一个可靠包、一个不可靠包，打包帧在类别变化处切开
+            packet[8] = 'R';
+            packet[9] = static_cast<uint8_t>(t);
+            ok = P2P_SendPacketEx(peer, packet.data(), static_cast<uint32_t>(packet.size()), 0) == P2P_OK;
+            packet[8] = 'U';
+            ok = ok && P2P_SendPacketEx(peer, packet.data(), static_cast<uint32_t>(packet.size()),
+                                        P2P_SEND_UNRELIABLE) == P2P_OK;
+            P2P_RunCallbacks();
+            for (char kind : {'R', 'U'}) {
+                ok = ok && recv_frame(b, body) && body.size() == 8 + 2 && std::memcmp(body.data(), &local, 8) == 0 &&
+                     body[8] == kind && body[9] == static_cast<uint8_t>(t);
+                received += ok ? 1 : 0;
+            }
+        }
+        uint64_t after = admin_stat(admin, "class_switches");
+        P2P_Shutdown();
+        if (b >= 0) close(b);
+
+        delivered[run] = ok && received == ticks * 2;
+        switches[run] = before != UINT64_MAX && after != UINT64_MAX ? after - before : UINT64_MAX;
+    }
+    relay.stop();
+
+    std::cout << "without lanes: delivered " << delivered[0] << ", class switches " << switches[0]
+              << "; with lanes: delivered " << delivered[1] << ", class switches " << switches[1] << std::endl;
+    return delivered[0] && delivered[1] && switches[0] == 0 &&
+           switches[1] == static_cast<uint64_t>(ticks * 2 - 1);
+}
+
+// 客户端库：续传会话缓存的数据包在 HELLO_ACK 之后重发时按各自发送时的类别发出
+bool test_connection_manager_lanes_replay() {
+    std::cout << "Testing ConnectionManager traffic classes on replay..." << std::endl;
+
+    std::string admin = test_temp_path("lanes_replay");
+    TestRelay relay({"-c", "16", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    const int count = 20;
+    uint64_t local = 0x9600000000000001ULL;
+    uint64_t remote = 0x9700000000000001ULL;
+    uint8_t remote_mark[8];
+    std::memcpy(remote_mark, &remote, 8);
+    int b = connect_to_relay(port);
+    bool ok = b >= 0 && register_with_ack(b, remote_mark);
+    if (b >= 0) {
+        set_recv_timeout(b, 3000);
+    }
+
+    // HELLO_ACK 之前发出的包全部缓存在未确认队列中，可靠与不可靠交替
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    ok = ok && P2P_Init() == P2P_OK && P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) == P2P_OK &&
+         P2P_EnableRelaySession(peer, local, P2P_RELAY_FLAG_RESUME | P2P_RELAY_FLAG_LANES) == P2P_OK;
+    uint64_t before = admin_stat(admin, "class_switches");
+    std::vector<uint8_t> packet(8 + 2);
+    std::memcpy(packet.data(), &remote, 8);
+    for (int i = 0; i < count && ok; i++) {
+        packet[8] = (i % 2 == 0) ? 'R' : 'U';
+        packet[9] = static_cast<uint8_t>(i);
+        ok = P2P_SendPacketEx(peer, packet.data(), static_cast<uint32_t>(packet.size()),
+                              (i % 2 == 0) ? 0 : P2P_SEND_UNRELIABLE) == P2P_OK;
+    }
+
+    // HELLO_ACK 到达后按序重发
+    for (int i = 0; i < 20 && ok; i++) {
+        P2P_RunCallbacks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    int received = 0;
+    std::vector<uint8_t> body;
+    for (int i = 0; i < count && ok; i++) {
+        ok = recv_frame(b, body) && body.size() == 2 && body[0] == ((i % 2 == 0) ? 'R' : 'U') && body[1] == i;
+        received += ok ? 1 : 0;
+    }
+    uint64_t after = admin_stat(admin, "class_switches");
+    P2P_Shutdown();
+    if (b >= 0) close(b);
+    relay.stop();
+
+    uint64_t switches = before != UINT64_MAX && after != UINT64_MAX ? after - before : UINT64_MAX;
+    std::cout << "replayed " << received << "/" << count << ", class switches " << switches << std::endl;
+    return received == count && switches == static_cast<uint64_t>(count - 1);
+}
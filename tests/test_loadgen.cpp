@@ -0,0 +1,170 @@
+#include "test_helpers.h"
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// 运行 relay_loadgen 并取得输出；路径默认为 ../server/relay_loadgen，可通过 RELAY_LOADGEN_BIN 覆盖
+static bool run_loadgen(const std::string& args, std::string& output) {
+    const char* bin = std::getenv("RELAY_LOADGEN_BIN");
+    std::string command = std::string(bin ? bin : "../server/relay_loadgen") + " " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return false;
+    }
+    char line[1024];
+    output.clear();
+    while (fgets(line, sizeof(line), pipe)) {
+        output += line;
+    }
+    return pclose(pipe) == 0;
+}
+
+static double summary_value(const std::string& summary, const std::string& key) {
+    size_t pos = summary.find(" " + key + "=");
+    return pos == std::string::npos ? -1 : std::atof(summary.c_str() + pos + key.size() + 2);
+}
+
+// 读取模型文件: "通道 字段" -> [(值, 权重)]
+static std::map<std::string, std::vector<std::pair<double, double>>> read_profile(const std::string& path) {
+    std::map<std::string, std::vector<std::pair<double, double>>> profile;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        std::string keyword, channel, field, item;
+        if (!(words >> keyword >> channel >> field) || keyword != "channel") {
+            continue;
+        }
+        auto& bins = profile[channel + " " + field];
+        while (words >> item) {
+            size_t colon = item.find(':');
+            bins.emplace_back(std::atof(item.substr(0, colon).c_str()), std::atof(item.c_str() + colon + 1));
+        }
+    }
+    return profile;
+}
+
+// 分布的加权中位数
+static double weighted_median(const std::vector<std::pair<double, double>>& bins) {
+    double total = 0;
+    for (const auto& bin : bins) total += bin.second;
+    double seen = 0;
+    for (const auto& bin : bins) {
+        seen += bin.second;
+        if (seen * 2 >= total) return bin.first;
+    }
+    return -1;
+}
+
+// 抓一段节奏固定的流量，从抓包文件学习模型：通道按目标的包数排序，负载长度、突发长度与空闲间隔与发送节奏一致
+bool test_loadgen_learn_profile() {
+    std::cout << "Testing session model learning from a capture..." << std::endl;
+
+    std::string path = test_temp_path("loadgen", ".cap");
+    std::string profile_path = test_temp_path("loadgen", ".profile");
+    TestRelay relay({"-c", "16", "-w", path});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xE1, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xE2, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t mark_c[8] = {0xE3, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && c >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b) &&
+              register_with_ack(c, mark_c);
+
+    // 约1秒：每20ms向 B 连发3个100字节的包，每50ms向 C 发1个500字节的包
+    std::vector<uint8_t> payload(500, 0x5A);
+    auto next = std::chrono::steady_clock::now();
+    for (int tick = 0; tick < 100 && ok; tick++) {
+        for (int i = 0; i < 3 && ok && tick % 2 == 0; i++) {
+            ok = send_forward(a, mark_b, payload.data(), 100);
+        }
+        if (ok && tick % 5 == 0) {
+            ok = send_forward(a, mark_c, payload.data(), 500);
+        }
+        next += std::chrono::milliseconds(10);
+        std::this_thread::sleep_until(next);
+    }
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    if (c >= 0) close(c);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    relay.stop();
+
+    std::string output;
+    bool learned = ok && run_loadgen("-c " + path + " -n 0 -O " + profile_path, output);
+    auto profile = read_profile(profile_path);
+    auto all_equal = [&](const std::string& key, double value) {
+        const auto& bins = profile[key];
+        return bins.size() == 1 && bins[0].first == value;
+    };
+    double idle0 = weighted_median(profile["0 idle_us"]);
+    double idle1 = weighted_median(profile["1 idle_us"]);
+    std::cout << "channel 0 idle median " << idle0 << "us, channel 1 idle median " << idle1 << "us, channel 2 "
+              << (profile.count("2 sizes") ? "present" : "absent") << std::endl;
+
+    bool profile_ok = learned && all_equal("0 sizes", 100) && all_equal("0 bursts", 3) && all_equal("1 sizes", 500) &&
+                      all_equal("1 bursts", 1) && idle0 > 15000 && idle0 < 25000 && idle1 > 45000 &&
+                      idle1 < 55000 && profile.count("2 sizes") == 0;
+
+    std::remove(path.c_str());
+    std::remove(profile_path.c_str());
+    return ok && profile_ok;
+}
+
+// 按手写模型合成会话压中继：收发帧数与中继计数一致，包数比例符合模型，并输出延迟与吞吐分位数
+bool test_loadgen_synthetic_sessions() {
+    std::cout << "Testing synthetic 4-player sessions against the relay..." << std::endl;
+
+    std::string admin = test_temp_path("loadgen");
+    std::string profile_path = test_temp_path("loadgen", ".profile");
+    {
+        std::ofstream out(profile_path);
+        out << "# 通道0: 每20ms两个200字节的包；通道1: 每50ms一个64字节的包；通道2不发\n"
+            << "channel 0 sizes 200:1\nchannel 0 bursts 2:1\nchannel 0 gaps_us 200:1\nchannel 0 idle_us 20000:1\n"
+            << "channel 1 sizes 64:1\nchannel 1 bursts 1:1\nchannel 1 idle_us 50000:1\n";
+    }
+    TestRelay relay({"-c", "128", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    std::string summary;
+    bool ran = run_loadgen("-P " + profile_path + " -n 20 -t 2 -d 1000 127.0.0.1 " + std::to_string(port), summary);
+    uint64_t packets_in = admin_stat(admin, "packets_in");
+    uint64_t packets_out = admin_stat(admin, "packets_out");
+    relay.stop();
+    std::cout << summary;
+
+    // 每个玩家每秒约100个200字节的包和20个64字节的包
+    double sent = summary_value(summary, "sent_frames");
+    double bytes = summary_value(summary, "sent_bytes");
+    double big = (bytes - 64 * sent) / (200 - 64);
+    double ratio = sent > big ? big / (sent - big) : 0;
+    std::cout << "relay packets_in " << packets_in << " packets_out " << packets_out << ", 200/64 byte ratio "
+              << ratio << std::endl;
+
+    std::remove(profile_path.c_str());
+    return ran && summary_value(summary, "connections") == 80 && sent > 80 * 120 * 0.8 && sent < 80 * 120 * 1.1 &&
+           ratio > 4 && ratio < 6 && summary_value(summary, "recv_frames") == sent &&
+           summary_value(summary, "recv_bytes") == bytes && summary_value(summary, "lost") == 0 &&
+           summary_value(summary, "disconnected") == 0 && packets_in == sent && packets_out == sent &&
+           summary_value(summary, "lat_p50_us") > 0 &&
+           summary_value(summary, "lat_p99_us") >= summary_value(summary, "lat_p50_us") &&
+           summary_value(summary, "lat_max_us") >= summary_value(summary, "lat_p999_us") &&
+           summary_value(summary, "tput_p50_mbps") > 0;
+}
@@ -8,6 +8,62 @@ extern bool test_two_clients_forwarding();
 extern bool test_socket_forwarding();
 extern bool test_two_clients_high_throughput();
 extern bool test_three_clients_high_throughput();
+extern bool test_hot_restart_no_packet_loss();
+extern bool test_hot_restart_commit_point();
+extern bool test_relay_session_resume();
+extern bool test_connection_manager_resume();
+extern bool test_stale_session_takeover();
+extern bool test_timer_wheel_100k();
+extern bool test_register_deadline();
+extern bool test_heartbeat_idle_timeout();
+extern bool test_registration_replies();
+extern bool test_registration_to_first_packet_benchmark();
+extern bool test_presence_and_nack();
+extern bool test_connection_manager_presence();
+extern bool test_presence_session_scope();
+extern bool test_compact_framing();
+extern bool test_connection_manager_compact();
+extern bool test_relay_shim();
+extern bool test_source_stamping();
+extern bool test_connection_manager_source();
+extern bool test_bundle_routing();
+extern bool test_connection_manager_bundle();
+extern bool test_connection_manager_bundle_threads();
+extern bool test_bundle_benchmark();
+extern bool test_fanout_routing();
+extern bool test_connection_manager_fanout();
+extern bool test_tap_mirroring();
+extern bool test_tap_stalled_bounded_memory();
+extern bool test_data_deadline_p99();
+extern bool test_data_deadline_resume();
+extern bool test_data_deadline_reliable();
+extern bool test_egress_lanes_latency();
+extern bool test_connection_manager_lanes();
+extern bool test_connection_manager_lanes_replay();
+extern bool test_ingress_flood_latency();
+extern bool test_ingress_ip_limit();
+extern bool test_federation_routing();
+extern bool test_federation_trunk_multiplexing();
+extern bool test_federation_client_limit();
+extern bool test_redirect_on_register();
+extern bool test_connection_manager_redirect();
+extern bool test_connection_manager_redirect_nonblocking();
+extern bool test_mirror_canary_counters();
+extern bool test_mirror_slow_canary_drops();
+extern bool test_capture_file_index();
+extern bool test_capture_replay();
+extern bool test_loadgen_learn_profile();
+extern bool test_loadgen_synthetic_sessions();
+extern bool test_bench_csv_report();
+extern bool test_bench_connection_churn();
+extern bool test_embedded_relay_forwarding();
+extern bool test_embedded_injected_clock();
+extern bool test_embedded_admin_pipelining();
+extern bool test_embedded_federation();
+extern bool test_perf_record_compare();
+extern bool test_perf_regression_detection();
+extern bool test_soak_returns_to_baseline();
+extern bool test_soak_send_buffer_released();
 
 TEST_CASE("Two Clients Forwarding Test", "[p2p]") {
     REQUIRE(test_two_clients_forwarding() == true);
@@ -23,4 +79,226 @@ TEST_CASE("Two Clients High Throughput Test", "[stress]") {
 
 TEST_CASE("Three Clients High Throughput Test", "[stress]") {
     REQUIRE(test_three_clients_high_throughput() == true);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Hot Restart No Packet Loss Test", "[restart]") {
+    REQUIRE(test_hot_restart_no_packet_loss() == true);
+}
+TEST_CASE("Hot Restart Commit Point Test", "[restart]") {
+    REQUIRE(test_hot_restart_commit_point() == true);
+}
+TEST_CASE("Relay Session Resume Test", "[resume]") {
+    REQUIRE(test_relay_session_resume() == true);
+}
+
+TEST_CASE("ConnectionManager Session Resume Test", "[resume]") {
+    REQUIRE(test_connection_manager_resume() == true);
+}
+
+TEST_CASE("Stale Session Takeover Test", "[resume]") {
+    REQUIRE(test_stale_session_takeover() == true);
+}
+
+TEST_CASE("Timer Wheel 100k Timers Test", "[timer]") {
+    REQUIRE(test_timer_wheel_100k() == true);
+}
+
+TEST_CASE("Registration Deadline Test", "[timer]") {
+    REQUIRE(test_register_deadline() == true);
+}
+
+TEST_CASE("Heartbeat Idle Timeout Test", "[timer]") {
+    REQUIRE(test_heartbeat_idle_timeout() == true);
+}
+
+TEST_CASE("Registration Replies Test", "[p2p]") {
+    REQUIRE(test_registration_replies() == true);
+}
+
+TEST_CASE("Registration To First Packet Benchmark", "[benchmark]") {
+    REQUIRE(test_registration_to_first_packet_benchmark() == true);
+}
+
+TEST_CASE("Peer Presence And NACK Test", "[presence]") {
+    REQUIRE(test_presence_and_nack() == true);
+}
+
+TEST_CASE("ConnectionManager Presence Test", "[presence]") {
+    REQUIRE(test_connection_manager_presence() == true);
+}
+
+TEST_CASE("Presence Session Scope Test", "[presence]") {
+    REQUIRE(test_presence_session_scope() == true);
+}
+
+TEST_CASE("Compact Framing Test", "[compact]") {
+    REQUIRE(test_compact_framing() == true);
+}
+
+TEST_CASE("ConnectionManager Compact Framing Test", "[compact]") {
+    REQUIRE(test_connection_manager_compact() == true);
+}
+
+TEST_CASE("Relay Shim Packet Format Test", "[source]") {
+    REQUIRE(test_relay_shim() == true);
+}
+
+TEST_CASE("Source Stamping Test", "[source]") {
+    REQUIRE(test_source_stamping() == true);
+}
+
+TEST_CASE("ConnectionManager Source Stamping Test", "[source]") {
+    REQUIRE(test_connection_manager_source() == true);
+}
+
+TEST_CASE("Bundle Routing Test", "[bundle]") {
+    REQUIRE(test_bundle_routing() == true);
+}
+
+TEST_CASE("ConnectionManager Bundling Test", "[bundle]") {
+    REQUIRE(test_connection_manager_bundle() == true);
+}
+
+TEST_CASE("ConnectionManager Bundling Across Threads Test", "[bundle]") {
+    REQUIRE(test_connection_manager_bundle_threads() == true);
+}
+
+TEST_CASE("Bundle Framing Benchmark", "[benchmark]") {
+    REQUIRE(test_bundle_benchmark() == true);
+}
+
+TEST_CASE("Fan-out Routing Test", "[fanout]") {
+    REQUIRE(test_fanout_routing() == true);
+}
+
+TEST_CASE("ConnectionManager Fan-out Test", "[fanout]") {
+    REQUIRE(test_connection_manager_fanout() == true);
+}
+
+TEST_CASE("Spectator Tap Mirroring Test", "[tap]") {
+    REQUIRE(test_tap_mirroring() == true);
+}
+
+TEST_CASE("Stalled Spectator Bounded Memory Test", "[tap]") {
+    REQUIRE(test_tap_stalled_bounded_memory() == true);
+}
+
+TEST_CASE("Per-packet Deadline Congested Target Test", "[deadline]") {
+    REQUIRE(test_data_deadline_p99() == true);
+}
+
+TEST_CASE("Per-packet Deadline Session Resume Test", "[deadline]") {
+    REQUIRE(test_data_deadline_resume() == true);
+}
+
+TEST_CASE("Per-packet Deadline Reliable Class Test", "[deadline]") {
+    REQUIRE(test_data_deadline_reliable() == true);
+}
+
+TEST_CASE("Egress Lanes Latency Test", "[lanes]") {
+    REQUIRE(test_egress_lanes_latency() == true);
+}
+
+TEST_CASE("ConnectionManager Traffic Class Test", "[lanes]") {
+    REQUIRE(test_connection_manager_lanes() == true);
+}
+
+TEST_CASE("ConnectionManager Traffic Class Replay Test", "[lanes]") {
+    REQUIRE(test_connection_manager_lanes_replay() == true);
+}
+
+TEST_CASE("Ingress Flood Shedding Test", "[ingress]") {
+    REQUIRE(test_ingress_flood_latency() == true);
+}
+
+TEST_CASE("Per-IP Connection Limit Test", "[ingress]") {
+    REQUIRE(test_ingress_ip_limit() == true);
+}
+
+TEST_CASE("Relay Federation Routing Test", "[federation]") {
+    REQUIRE(test_federation_routing() == true);
+}
+
+TEST_CASE("Federation Trunk Multiplexing Test", "[federation]") {
+    REQUIRE(test_federation_trunk_multiplexing() == true);
+}
+
+TEST_CASE("Federation Client Limit Test", "[federation]") {
+    REQUIRE(test_federation_client_limit() == true);
+}
+
+TEST_CASE("Redirect On Register Test", "[redirect]") {
+    REQUIRE(test_redirect_on_register() == true);
+}
+
+TEST_CASE("ConnectionManager Load-aware Placement Test", "[redirect]") {
+    REQUIRE(test_connection_manager_redirect() == true);
+}
+
+TEST_CASE("ConnectionManager Non-blocking Redirect Test", "[redirect]") {
+    REQUIRE(test_connection_manager_redirect_nonblocking() == true);
+}
+
+TEST_CASE("Canary Mirror Counters Test", "[mirror]") {
+    REQUIRE(test_mirror_canary_counters() == true);
+}
+
+TEST_CASE("Stalled Canary Mirror Drop Test", "[mirror]") {
+    REQUIRE(test_mirror_slow_canary_drops() == true);
+}
+
+TEST_CASE("Binary Capture Index Test", "[capture]") {
+    REQUIRE(test_capture_file_index() == true);
+}
+
+TEST_CASE("Capture Deterministic Replay Test", "[capture]") {
+    REQUIRE(test_capture_replay() == true);
+}
+
+TEST_CASE("Load Generator Profile Learning Test", "[loadgen]") {
+    REQUIRE(test_loadgen_learn_profile() == true);
+}
+
+TEST_CASE("Load Generator Synthetic Sessions Test", "[loadgen]") {
+    REQUIRE(test_loadgen_synthetic_sessions() == true);
+}
+
+TEST_CASE("Relay Bench CSV Report Test", "[bench]") {
+    REQUIRE(test_bench_csv_report() == true);
+}
+
+TEST_CASE("Relay Bench Connection Churn Test", "[bench]") {
+    REQUIRE(test_bench_connection_churn() == true);
+}
+
+TEST_CASE("Embedded Relay Server Test", "[embedded]") {
+    REQUIRE(test_embedded_relay_forwarding() == true);
+}
+
+TEST_CASE("Embedded Relay Injected Clock Test", "[embedded]") {
+    REQUIRE(test_embedded_injected_clock() == true);
+}
+
+TEST_CASE("Embedded Relay Admin Pipelining Test", "[embedded]") {
+    REQUIRE(test_embedded_admin_pipelining() == true);
+}
+
+TEST_CASE("Embedded Relay Federation Test", "[embedded]") {
+    REQUIRE(test_embedded_federation() == true);
+}
+
+TEST_CASE("Perf Baseline Record And Compare Test", "[perf]") {
+    REQUIRE(test_perf_record_compare() == true);
+}
+
+TEST_CASE("Perf Regression Detection Test", "[perf]") {
+    REQUIRE(test_perf_regression_detection() == true);
+}
+
+TEST_CASE("Soak Returns To Baseline Test", "[soak]") {
+    REQUIRE(test_soak_returns_to_baseline() == true);
+}
+
+TEST_CASE("Soak Send Buffer Released Test", "[soak]") {
+    REQUIRE(test_soak_send_buffer_released() == true);
+}
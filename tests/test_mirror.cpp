@@ -0,0 +1,173 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 等待统计项达到期望值，失败时返回最后读到的值
+static uint64_t wait_stat_equal(const std::string& admin, const std::string& name, uint64_t expected, int timeout_ms) {
+    uint64_t value = UINT64_MAX;
+    for (int waited = 0; waited <= timeout_ms; waited += 20) {
+        value = admin_stat(admin, name);
+        if (value == expected) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    return value;
+}
+
+// 主中继把客户端入站流量镜像到金丝雀中继：金丝雀收到完全相同的字节流，两边的入站计数一致
+bool test_mirror_canary_counters() {
+    std::cout << "Testing ingress mirroring to a canary relay..." << std::endl;
+
+    std::string canary_admin = test_temp_path("canary");
+    TestRelay canary({"-c", "16", "-a", canary_admin});
+    if (!canary.started()) {
+        return false;
+    }
+    std::string admin = test_temp_path("mirror");
+    TestRelay relay({"-c", "16", "-a", admin, "-m", "127.0.0.1:" + std::to_string(canary.port())});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xC1, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xC2, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t nobody[8] = {0xCF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b);
+    if (ok) {
+        set_recv_timeout(a, 1000);
+        set_recv_timeout(b, 1000);
+    }
+
+    // A->B、B->A 各 500 个大小不一的包，另有发往不存在目标的包
+    const int count = 500;
+    int received = 0;
+    std::vector<uint8_t> payload(1200);
+    std::vector<uint8_t> body;
+    for (int i = 0; i < count && ok; i++) {
+        size_t len = 16 + static_cast<size_t>(i * 7) % 1100;
+        relay::writeU32(payload.data(), static_cast<uint32_t>(i));
+        ok = send_forward(a, mark_b, payload.data(), len) && recv_frame(b, body) && body.size() == len &&
+             send_forward(b, mark_a, payload.data(), len) && recv_frame(a, body) && body.size() == len;
+        received += ok ? 2 : 0;
+        if (ok && i % 50 == 0) {
+            ok = send_forward(a, nobody, payload.data(), len);
+        }
+    }
+
+    // 金丝雀上的镜像连接以相同的标记注册，收到相同的包；镜像连接发回的数据被主中继丢弃
+    const char* names[] = {"packets_in", "bytes_in", "drop_no_target", "packets_out"};
+    uint64_t primary[4];
+    uint64_t mirrored[4];
+    bool equal = ok;
+    for (int i = 0; i < 4; i++) {
+        primary[i] = admin_stat(admin, names[i]);
+        mirrored[i] = wait_stat_equal(canary_admin, names[i], primary[i], 3000);
+        equal = equal && primary[i] != UINT64_MAX && primary[i] == mirrored[i];
+    }
+    uint64_t mirror_bytes = admin_stat(admin, "mirror_bytes");
+    uint64_t mirror_sent = wait_stat_equal(admin, "mirror_sent", mirror_bytes, 3000);
+    uint64_t drops = admin_stat(admin, "mirror_drops");
+    uint64_t mirrors = admin_stat(admin, "mirrors");
+
+    for (int i = 0; i < 4; i++) {
+        std::cout << names[i] << " primary " << primary[i] << " canary " << mirrored[i] << "; ";
+    }
+    std::cout << "mirror bytes " << mirror_bytes << " sent " << mirror_sent << " drops " << drops << ", mirrors "
+              << mirrors << ", delivered " << received << "/" << count * 2 << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    // 客户端断开后镜像连接随之关闭，金丝雀上的会话也被注销
+    uint64_t mirrors_after = wait_stat_equal(admin, "mirrors", 0, 2000);
+    uint64_t canary_clients = wait_stat_equal(canary_admin, "connections", 0, 2000);
+    relay.stop();
+    canary.stop();
+    return ok && received == count * 2 && equal && mirror_bytes != UINT64_MAX && mirror_bytes > 0 &&
+           mirror_sent == mirror_bytes && drops == 0 && mirrors == 2 && mirrors_after == 0 && canary_clients == 0;
+}
+
+// 金丝雀不读取：镜像管道写满后放弃该连接的镜像，主路径的转发不受影响
+bool test_mirror_slow_canary_drops() {
+    std::cout << "Testing ingress mirroring with a stalled canary..." << std::endl;
+
+    // 只接受连接从不读取的“金丝雀”
+    int stalled = socket(AF_INET, SOCK_STREAM, 0);
+    int small = 4096;
+    setsockopt(stalled, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+    sockaddr_in addr{};
+    socklen_t addr_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (stalled < 0 || bind(stalled, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(stalled, 16) != 0 || getsockname(stalled, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+        std::cerr << "Failed to start stalled canary" << std::endl;
+        if (stalled >= 0) close(stalled);
+        return false;
+    }
+
+    std::string admin = test_temp_path("mirror_slow");
+    TestRelay relay({"-c", "16", "-a", admin, "-o", "mirror_pipe_bytes=65536", "-m",
+                     "127.0.0.1:" + std::to_string(ntohs(addr.sin_port))});
+    if (!relay.started()) {
+        close(stalled);
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xC3, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0xC4, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && register_with_ack(a, mark_a) && register_with_ack(b, mark_b);
+    if (ok) {
+        set_recv_timeout(b, 1000);
+    }
+
+    // A 发出约 8MB，远超金丝雀链路（内核缓冲区加镜像管道）能容纳的量
+    const int count = 8000;
+    std::thread sender([&]() {
+        std::vector<uint8_t> payload(1000);
+        for (int i = 0; i < count && ok; i++) {
+            relay::writeU32(payload.data(), static_cast<uint32_t>(i));
+            if (!send_forward(a, mark_b, payload.data(), payload.size())) {
+                break;
+            }
+        }
+    });
+    int received = 0;
+    bool in_order = true;
+    std::vector<uint8_t> body;
+    while (ok && received < count && recv_frame(b, body)) {
+        in_order = in_order && body.size() == 1000 && relay::readU32(body.data()) == static_cast<uint32_t>(received);
+        received++;
+    }
+    sender.join();
+
+    uint64_t drops = admin_stat(admin, "mirror_drops");
+    uint64_t mirrors = admin_stat(admin, "mirrors");
+    uint64_t mirror_bytes = admin_stat(admin, "mirror_bytes");
+    std::cout << "delivered " << received << "/" << count << " in order " << in_order << ", mirror drops " << drops
+              << ", mirrors left " << mirrors << ", mirrored bytes " << mirror_bytes << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    relay.stop();
+    close(stalled);
+    // A 的镜像被放弃；B 几乎没有入站流量，镜像保留
+    return ok && received == count && in_order && drops == 1 && mirrors == 1 && mirror_bytes != UINT64_MAX &&
+           mirror_bytes < static_cast<uint64_t>(count) * 1000;
+}
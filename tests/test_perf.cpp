@@ -0,0 +1,103 @@
+#include "test_helpers.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// 运行 relay_perf，返回退出码（无法运行时为-1）；路径默认为 ../server/relay_perf，可通过 RELAY_PERF_BIN 覆盖
+static int run_perf(const std::string& args, std::string& output) {
+    const char* bin = std::getenv("RELAY_PERF_BIN");
+    std::string command = std::string(bin ? bin : "../server/relay_perf") + " " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return -1;
+    }
+    char line[1024];
+    output.clear();
+    while (fgets(line, sizeof(line), pipe)) {
+        output += line;
+    }
+    int status = pclose(pipe);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// 输出中某个指标所在的行
+static std::string metric_line(const std::string& output, const std::string& name) {
+    std::istringstream in(output);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.find(" " + name + " ") != std::string::npos) {
+            return line;
+        }
+    }
+    return "";
+}
+
+// 记录基线后在同一机器上比较：基线文件按机器键保存微基准与两个场景的重复测量，宽阈值下比较无回归
+bool test_perf_record_compare() {
+    std::cout << "Testing relay_perf record and compare..." << std::endl;
+
+    std::string base = "/tmp/p2p_test_perf_" + std::to_string(getpid()) + ".json";
+    std::string args = "-f " + base + " -m test-box -R 2 -d 500 -B ./p2p_bench -F '\"Client PacketQueue push/pop\"' ";
+    std::string recorded;
+    std::string compared;
+    int record_rc = run_perf(args + "record", recorded);
+    int compare_rc = run_perf(args + "-T 90 -L 1000 compare", compared);
+    std::cout << recorded << compared;
+
+    std::ifstream in(base);
+    std::stringstream json;
+    json << in.rdbuf();
+    std::string text = json.str();
+    std::remove(base.c_str());
+
+    return record_rc == 0 && compare_rc == 0 && text.find("\"test-box\"") != std::string::npos &&
+           text.find("\"bench/PacketQueue push/pop size=32 batch=1\"") != std::string::npos &&
+           text.find("\"scenario/latency/lat_p99_us\"") != std::string::npos &&
+           text.find("\"scenario/throughput/recv_pps\"") != std::string::npos &&
+           metric_line(compared, "scenario/throughput/recv_pps").find("新指标") == std::string::npos &&
+           compared.find("无回归") != std::string::npos;
+}
+
+// 统计比较：显著超过阈值的吞吐下降与延迟增加判为回归；差异在噪声范围内或低于阈值的不判
+bool test_perf_regression_detection() {
+    std::cout << "Testing relay_perf regression detection..." << std::endl;
+
+    std::string base = "/tmp/p2p_test_perf_base_" + std::to_string(getpid()) + ".json";
+    std::string cur = "/tmp/p2p_test_perf_cur_" + std::to_string(getpid()) + ".json";
+    auto write = [](const std::string& path, const std::string& metrics) {
+        std::ofstream out(path);
+        out << "{\"version\": 1, \"machines\": {\"box\": {\"recorded\": \"t\", \"metrics\": {" << metrics << "}}}}\n";
+    };
+    write(base,
+          "\"tput_drop\": {\"unit\": \"pps\", \"better\": \"higher\", \"samples\": [1000, 1010, 990, 1000, 1005]},"
+          "\"tput_noisy\": {\"unit\": \"pps\", \"better\": \"higher\", \"samples\": [1000, 600, 1400, 900, 1100]},"
+          "\"lat_up\": {\"unit\": \"us\", \"better\": \"lower\", \"samples\": [100, 102, 98, 101, 99]},"
+          "\"lat_small\": {\"unit\": \"us\", \"better\": \"lower\", \"samples\": [100, 101, 99, 100, 100]},"
+          "\"lat_down\": {\"unit\": \"us\", \"better\": \"lower\", \"samples\": [100, 101, 99, 100, 100]}");
+    write(cur,
+          "\"tput_drop\": {\"unit\": \"pps\", \"better\": \"higher\", \"samples\": [900, 905, 895, 900, 898]},"
+          "\"tput_noisy\": {\"unit\": \"pps\", \"better\": \"higher\", \"samples\": [800, 1300, 500, 1000, 900]},"
+          "\"lat_up\": {\"unit\": \"us\", \"better\": \"lower\", \"samples\": [130, 128, 133, 131, 129]},"
+          "\"lat_small\": {\"unit\": \"us\", \"better\": \"lower\", \"samples\": [105, 106, 104, 105, 105]},"
+          "\"lat_down\": {\"unit\": \"us\", \"better\": \"lower\", \"samples\": [70, 71, 69, 70, 70]}");
+
+    std::string output;
+    int rc = run_perf("-f " + base + " -m box -i " + cur + " compare", output);
+    std::string unchanged;
+    int same_rc = run_perf("-f " + base + " -m box -i " + base + " compare", unchanged);
+    std::cout << output;
+    std::remove(base.c_str());
+    std::remove(cur.c_str());
+
+    return rc == 2 && output.find("发现 2 项回归") != std::string::npos &&
+           metric_line(output, "tput_drop").find("回归") != std::string::npos &&
+           metric_line(output, "lat_up").find("回归") != std::string::npos &&
+           metric_line(output, "tput_noisy").find("不显著") != std::string::npos &&
+           metric_line(output, "lat_small").find("回归") == std::string::npos &&
+           metric_line(output, "lat_down").find("改进") != std::string::npos && same_rc == 0;
+}
@@ -0,0 +1,273 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <unistd.h>
+#include <poll.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <functional>
+
+// 在 window_ms 内收取所有控制帧（心跳、确认除外）
+static std::vector<std::vector<uint8_t>> collect_ctrl(int fd, int window_ms) {
+    std::vector<std::vector<uint8_t>> frames;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(window_ms);
+    while (true) {
+        int remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count());
+        if (remaining <= 0) {
+            break;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, remaining) <= 0) {
+            continue;
+        }
+        uint8_t type = 0;
+        std::vector<uint8_t> body;
+        if (!recv_typed_frame(fd, type, body)) {
+            break;
+        }
+        if (type == relay::FRAME_CTRL && !body.empty() && body[0] != relay::CTRL_PING && body[0] != relay::CTRL_ACK) {
+            frames.push_back(body);
+        }
+    }
+    return frames;
+}
+
+static int count_events(const std::vector<std::vector<uint8_t>>& frames, uint8_t op, const uint8_t* mark) {
+    int count = 0;
+    uint32_t offset = op == relay::CTRL_NACK ? 2 : 1;
+    for (const auto& body : frames) {
+        if (body[0] == op && body.size() >= offset + 8 && std::memcmp(body.data() + offset, mark, 8) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// 在线通知：只通知会话发往过的标记（同一局的队友）的上线/下线，以及按目标限速的 NACK
+bool test_presence_and_nack() {
+    std::cout << "Testing peer presence events and rate-limited NACKs..." << std::endl;
+
+    TestRelay relay({"-c", "16", "-o", "nack_interval_ms=300"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8};
+    uint8_t mark_b[8] = {0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8};
+    uint8_t mark_c[8] = {0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = a >= 0 && b >= 0 && c >= 0 && send_hello(a, mark_a, relay::CAP_PRESENCE) &&
+              recv_hello_ack(a, status, token, relay_rx) && status == relay::HELLO_OK;
+
+    // B 尚未上线：100个包只换来1个 NACK，限速间隔过后再有1个
+    uint8_t payload[64] = {};
+    for (int i = 0; i < 100 && ok; i++) {
+        ok = send_forward(a, mark_b, payload, sizeof(payload));
+    }
+    int nacks_first = ok ? count_events(collect_ctrl(a, 150), relay::CTRL_NACK, mark_b) : 0;
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    for (int i = 0; i < 100 && ok; i++) {
+        ok = send_forward(a, mark_b, payload, sizeof(payload));
+    }
+    int nacks_second = ok ? count_events(collect_ctrl(a, 150), relay::CTRL_NACK, mark_b) : 0;
+
+    // 旧版客户端 C 上线：A 没有发给过 C，不在 A 的通知范围内；B 上线时 A 收到通知，B 的快照为空
+    ok = ok && send_register(c, mark_c);
+    int a_join_c = ok ? count_events(collect_ctrl(a, 150), relay::CTRL_PEER_JOIN, mark_c) : 0;
+    ok = ok && send_hello(b, mark_b, relay::CAP_PRESENCE) && recv_hello_ack(b, status, token, relay_rx) &&
+         status == relay::HELLO_OK;
+    std::vector<std::vector<uint8_t>> b_snapshot = ok ? collect_ctrl(b, 150) : std::vector<std::vector<uint8_t>>();
+    int a_join_b = ok ? count_events(collect_ctrl(a, 150), relay::CTRL_PEER_JOIN, mark_b) : 0;
+
+    // B 上线后 A 的数据正常转发，不再收到 NACK
+    std::vector<uint8_t> frame;
+    set_recv_timeout(b, 3000);
+    bool forwarded = ok && send_forward(a, mark_b, payload, sizeof(payload)) && recv_frame(b, frame) &&
+                     frame.size() == sizeof(payload);
+
+    // B 第一次发给在线的 A：立即收到 A 的上线通知
+    ok = ok && send_forward(b, mark_a, payload, sizeof(payload));
+    int b_join_a = ok ? count_events(collect_ctrl(b, 150), relay::CTRL_PEER_JOIN, mark_a) : 0;
+
+    // C 断开：不在 A、B 的通知范围内；B 断开：A 收到下线通知
+    if (c >= 0) {
+        close(c);
+        c = -1;
+    }
+    std::vector<std::vector<uint8_t>> b_events = ok ? collect_ctrl(b, 150) : std::vector<std::vector<uint8_t>>();
+    if (b >= 0) {
+        close(b);
+        b = -1;
+    }
+    std::vector<std::vector<uint8_t>> a_events = ok ? collect_ctrl(a, 300) : std::vector<std::vector<uint8_t>>();
+    int a_leave_c = count_events(a_events, relay::CTRL_PEER_LEAVE, mark_c);
+    int b_leave_c = count_events(b_events, relay::CTRL_PEER_LEAVE, mark_c);
+    int a_leave_b = count_events(a_events, relay::CTRL_PEER_LEAVE, mark_b);
+
+    std::cout << "NACKs " << nacks_first << "+" << nacks_second << ", join C=" << a_join_c << " B=" << a_join_b
+              << " A=" << b_join_a << ", snapshot " << b_snapshot.size() << ", forwarded " << forwarded
+              << ", leave C " << a_leave_c << "/" << b_leave_c << ", leave B " << a_leave_b << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    if (c >= 0) close(c);
+    relay.stop();
+
+    return ok && nacks_first == 1 && nacks_second == 1 && a_join_c == 0 && a_join_b == 1 && b_join_a == 1 &&
+           b_snapshot.empty() && forwarded && a_leave_c == 0 && b_leave_c == 0 && a_leave_b == 1;
+}
+
+// 客户端库：收到 NACK 后暂停发往该目标，目标上线后恢复
+bool test_connection_manager_presence() {
+    std::cout << "Testing ConnectionManager presence handling..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint64_t mark_a = 0x1122334455667701ULL;
+    uint64_t mark_b = 0x1122334455667702ULL;
+    uint8_t mark_b_bytes[8];
+    std::memcpy(mark_b_bytes, &mark_b, sizeof(mark_b));
+
+    struct PresenceLog {
+        int online = 0;
+        int offline = 0;
+    } log;
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    if (P2P_Init() != P2P_OK || P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) != P2P_OK) {
+        std::cerr << "P2P connect failed" << std::endl;
+        P2P_Shutdown();
+        relay.stop();
+        return false;
+    }
+    P2P_SetPresenceCallback([](P2PPeerID, uint64_t, bool online, void* user) {
+        PresenceLog* l = static_cast<PresenceLog*>(user);
+        (online ? l->online : l->offline)++;
+    }, &log);
+    P2P_EnableRelaySession(peer, mark_a, P2P_RELAY_FLAG_PRESENCE);
+
+    uint8_t packet[32] = {};
+    std::memcpy(packet, &mark_b, sizeof(mark_b));
+    auto pump_until = [&](const std::function<bool()>& done, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (std::chrono::steady_clock::now() < deadline) {
+            P2P_RunCallbacks();
+            if (done()) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        return false;
+    };
+
+    // 目标未注册：第一个包发出后收到 NACK，此后发送直接被拒绝
+    bool first_sent = pump_until([&]() { return P2P_SendPacket(peer, packet, sizeof(packet)) == P2P_OK; }, 2000);
+    bool paused = pump_until([&]() { return !P2P_IsRelayTargetAvailable(peer, mark_b); }, 2000);
+    P2PResult paused_result = P2P_SendPacket(peer, packet, sizeof(packet));
+
+    // 目标上线：收到 CTRL_PEER_JOIN 后恢复发送，数据到达
+    int b = connect_to_relay(port);
+    bool resumed = b >= 0 && register_with_ack(b, mark_b_bytes) &&
+                   pump_until([&]() { return P2P_IsRelayTargetAvailable(peer, mark_b); }, 2000);
+    std::vector<uint8_t> frame;
+    bool delivered = false;
+    if (resumed) {
+        set_recv_timeout(b, 3000);
+        delivered = P2P_SendPacket(peer, packet, sizeof(packet)) == P2P_OK &&
+                    pump_until([]() { return true; }, 10) && recv_frame(b, frame) &&
+                    frame.size() == sizeof(packet) - sizeof(mark_b);
+    }
+
+    std::cout << "first sent " << first_sent << ", paused " << paused << " (result " << paused_result
+              << "), resumed " << resumed << ", delivered " << delivered << ", events online=" << log.online
+              << " offline=" << log.offline << std::endl;
+
+    P2P_SetPresenceCallback(nullptr, nullptr);
+    P2P_Shutdown();
+    if (b >= 0) close(b);
+    relay.stop();
+
+    return first_sent && paused && paused_result == P2P_ERROR_TARGET_UNAVAILABLE && resumed && delivered &&
+           log.online == 1 && log.offline == 1;
+}
+
+// 同一中继上的两局游戏：各自只收到本局队友的在线通知；续传的会话在快照中重新收到队友的上线通知
+bool test_presence_session_scope() {
+    std::cout << "Testing presence scoped to each session's peers..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    // A、B 一局，C、D 一局；D 不续传，断开即下线
+    uint8_t mark_a[8] = {0x91, 1, 1, 1, 1, 1, 1, 1};
+    uint8_t mark_b[8] = {0x92, 2, 2, 2, 2, 2, 2, 2};
+    uint8_t mark_c[8] = {0x93, 3, 3, 3, 3, 3, 3, 3};
+    uint8_t mark_d[8] = {0x94, 4, 4, 4, 4, 4, 4, 4};
+    const uint8_t* marks[4] = {mark_a, mark_b, mark_c, mark_d};
+    int fds[4];
+    uint64_t tokens[4] = {};
+    bool ok = true;
+    for (int i = 0; i < 4; i++) {
+        fds[i] = connect_to_relay(port);
+        uint8_t status = 0;
+        uint64_t relay_rx = 0;
+        uint32_t caps = relay::CAP_PRESENCE | (i < 3 ? relay::CAP_RESUME : 0);
+        ok = ok && fds[i] >= 0 && send_hello(fds[i], marks[i], caps) &&
+             recv_hello_ack(fds[i], status, tokens[i], relay_rx) && status == relay::HELLO_OK;
+    }
+    uint8_t payload[16] = {};
+    for (int i = 0; i < 4 && ok; i++) {
+        ok = send_forward(fds[i], marks[i ^ 1], payload, sizeof(payload));
+    }
+    int partner_joins = 0;
+    for (int i = 0; i < 4 && ok; i++) {
+        partner_joins += count_events(collect_ctrl(fds[i], 150), relay::CTRL_PEER_JOIN, marks[i ^ 1]);
+    }
+
+    // D 下线：只有 C 收到通知
+    close(fds[3]);
+    fds[3] = -1;
+    std::vector<std::vector<uint8_t>> events[3];
+    for (int i = 0; i < 3 && ok; i++) {
+        events[i] = collect_ctrl(fds[i], i == 0 ? 300 : 100);
+    }
+    bool leave_scoped = events[0].empty() && events[1].empty() &&
+                        count_events(events[2], relay::CTRL_PEER_LEAVE, mark_d) == 1 && events[2].size() == 1;
+
+    // A 断线后续传：快照中只有 B
+    close(fds[0]);
+    fds[0] = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    ok = ok && fds[0] >= 0 && send_hello(fds[0], mark_a, relay::CAP_PRESENCE | relay::CAP_RESUME, tokens[0], 0) &&
+         recv_hello_ack(fds[0], status, token, relay_rx) && status == relay::HELLO_RESUMED;
+    std::vector<std::vector<uint8_t>> snapshot = ok ? collect_ctrl(fds[0], 150) : std::vector<std::vector<uint8_t>>();
+    bool snapshot_ok = snapshot.size() == 1 && count_events(snapshot, relay::CTRL_PEER_JOIN, mark_b) == 1;
+
+    std::cout << "partner joins " << partner_joins << "/4, leave scoped " << leave_scoped << ", resumed snapshot "
+              << snapshot.size() << " event(s)" << std::endl;
+
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+    relay.stop();
+    return ok && partner_joins == 4 && leave_scoped && snapshot_ok;
+}
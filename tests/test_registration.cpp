@@ -0,0 +1,157 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 注册应答：成功时带槽位号与中继能力位，失败时带原因并关闭连接
+bool test_registration_replies() {
+    std::cout << "Testing registration ack and error replies..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark[8] = {0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98};
+    int first = connect_to_relay(port);
+    int second = connect_to_relay(port);
+    int bad_version = connect_to_relay(port);
+    bool ok = first >= 0 && second >= 0 && bad_version >= 0;
+    if (ok) {
+        set_recv_timeout(first, 3000);
+        set_recv_timeout(second, 3000);
+        set_recv_timeout(bad_version, 3000);
+    }
+
+    // 成功：状态、令牌、槽位号、版本与能力位
+    std::vector<uint8_t> body;
+    uint8_t type = 0;
+    ok = ok && send_hello(first, mark, 0) && recv_typed_frame(first, type, body) &&
+         type == relay::FRAME_CTRL && body.size() >= relay::HELLO_ACK_SIZE && body[0] == relay::CTRL_HELLO_ACK;
+    if (ok) {
+        uint8_t status = body[1];
+        uint64_t token = relay::readU64(body.data() + 2);
+        uint32_t slot = relay::readU32(body.data() + 23);
+        uint32_t server_caps = relay::readU32(body.data() + 27);
+        std::cout << "HELLO_ACK status=" << int(status) << " version=" << int(body[22]) << " slot=" << slot
+                  << " server_caps=0x" << std::hex << server_caps << std::dec << std::endl;
+        ok = status == relay::HELLO_OK && token != 0 && slot != 0 && body[22] == relay::PROTOCOL_VERSION &&
+             (server_caps & relay::CAP_RESUME) && (server_caps & relay::CAP_HEARTBEAT);
+    }
+
+    // 重复标记：HELLO_ERR_MARK_IN_USE，随后连接被关闭
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool in_use_rejected = ok && send_hello(second, mark, 0) && recv_hello_ack(second, status, token, relay_rx) &&
+                           status == relay::HELLO_ERR_MARK_IN_USE && token == 0 &&
+                           !recv_typed_frame(second, type, body);
+
+    // 不支持的协议版本
+    bool version_rejected = false;
+    if (ok) {
+        uint8_t frame[relay::FRAME_HEADER_SIZE + relay::HELLO_FIXED_SIZE] = {};
+        relay::writeFrameHeader(frame, relay::HELLO_FIXED_SIZE, relay::FRAME_CTRL);
+        frame[4] = relay::CTRL_HELLO;
+        frame[5] = 0;
+        std::memcpy(frame + 10, mark, 8);
+        version_rejected = send_all(bad_version, frame, sizeof(frame)) &&
+                           recv_hello_ack(bad_version, status, token, relay_rx) && status == relay::HELLO_ERR_VERSION;
+    }
+
+    std::cout << "Duplicate mark rejected: " << in_use_rejected << ", bad version rejected: " << version_rejected
+              << std::endl;
+
+    if (first >= 0) close(first);
+    if (second >= 0) close(second);
+    if (bad_version >= 0) close(bad_version);
+    relay.stop();
+    return ok && in_use_rejected && version_rejected;
+}
+
+static double percentile(std::vector<double> samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    std::sort(samples.begin(), samples.end());
+    size_t idx = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+    return samples[idx];
+}
+
+// 基准：从发起连接到对端收到第一个转发包的耗时，与单次往返（PING/PONG）对比
+// 收到 HELLO_ACK 即可发送，不再需要固定等待注册完成
+bool test_registration_to_first_packet_benchmark() {
+    std::cout << "Benchmarking connect-to-first-forwarded-packet latency..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t receiver_mark[8] = {0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8};
+    int receiver = connect_to_relay(port);
+    if (receiver < 0 || !register_with_ack(receiver, receiver_mark)) {
+        std::cerr << "Receiver registration failed" << std::endl;
+        if (receiver >= 0) close(receiver);
+        relay.stop();
+        return false;
+    }
+    set_recv_timeout(receiver, 3000);
+
+    using clock = std::chrono::steady_clock;
+    const int iterations = 200;
+    std::vector<double> rtt_us;
+    std::vector<double> setup_us;
+    bool ok = true;
+
+    // 单次往返基准：客户端 PING，中继 PONG
+    for (int i = 0; i < iterations && ok; i++) {
+        uint8_t ping[relay::FRAME_HEADER_SIZE + relay::CTRL_PING_SIZE];
+        relay::writeFrameHeader(ping, relay::CTRL_PING_SIZE, relay::FRAME_CTRL);
+        ping[4] = relay::CTRL_PING;
+        relay::writeU64(ping + 5, static_cast<uint64_t>(i));
+        auto start = clock::now();
+        std::vector<uint8_t> body;
+        uint8_t type = 0;
+        ok = send_all(receiver, ping, sizeof(ping)) && recv_typed_frame(receiver, type, body) &&
+             type == relay::FRAME_CTRL && !body.empty() && body[0] == relay::CTRL_PONG;
+        rtt_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+    }
+
+    for (int i = 0; i < iterations && ok; i++) {
+        uint8_t sender_mark[8] = {0xB1, 0xB2, 0xB3, 0xB4, 0, 0, 0, 0};
+        std::memcpy(sender_mark + 4, &i, sizeof(i));
+
+        auto start = clock::now();
+        int sender = connect_to_relay(port);
+        std::vector<uint8_t> frame;
+        ok = sender >= 0 && register_with_ack(sender, sender_mark) &&
+             send_forward(sender, receiver_mark, &i, sizeof(i)) && recv_frame(receiver, frame) &&
+             frame.size() == sizeof(i) && std::memcmp(frame.data(), &i, sizeof(i)) == 0;
+        setup_us.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+        if (sender >= 0) close(sender);
+    }
+
+    close(receiver);
+    relay.stop();
+    if (!ok) {
+        std::cerr << "Benchmark iteration failed" << std::endl;
+        return false;
+    }
+
+    double rtt_p50 = percentile(rtt_us, 0.5);
+    double setup_p50 = percentile(setup_us, 0.5);
+    double setup_p99 = percentile(setup_us, 0.99);
+    std::cout << "RTT p50=" << rtt_p50 << "us; connect-to-first-packet p50=" << setup_p50 << "us p99=" << setup_p99
+              << "us (" << setup_p50 / rtt_p50 << " RTT, previously a fixed 200ms wait)" << std::endl;
+
+    // 本机上应远小于原来固定等待的200ms
+    return setup_p50 < 20000.0;
+}
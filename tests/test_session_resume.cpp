@@ -0,0 +1,334 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <p2p_network.h>
+#include <poll.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <atomic>
+#include <string>
+
+// 接收下一个数据帧（跳过中继发来的控制帧）
+static bool recv_data_frame(int fd, std::vector<uint8_t>& out) {
+    uint8_t type = 0;
+    while (recv_typed_frame(fd, type, out)) {
+        if (type == relay::FRAME_DATA) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool expect_seq(int fd, uint32_t expected) {
+    std::vector<uint8_t> frame;
+    uint32_t seq = 0;
+    if (!recv_data_frame(fd, frame) || frame.size() != sizeof(seq)) {
+        std::cerr << "Receiving seq " << expected << " failed" << std::endl;
+        return false;
+    }
+    std::memcpy(&seq, frame.data(), sizeof(seq));
+    if (seq != expected) {
+        std::cerr << "Expected seq " << expected << ", got " << seq << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// 断线续传（原始socket）：断线期间发往该标记的数据被缓存，恢复后只重放未收到的部分
+bool test_relay_session_resume() {
+    std::cout << "Testing relay session resume..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x01};
+    uint8_t mark_b[8] = {0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x02};
+    bool success = false;
+    int a = -1, b = -1;
+    uint8_t status = 0xFF;
+    uint64_t token = 0, relay_rx = 0;
+
+    do {
+        b = connect_to_relay(port);
+        a = connect_to_relay(port);
+        if (a < 0 || b < 0 || !send_register(b, mark_b) || !send_hello(a, mark_a, relay::CAP_RESUME)) {
+            std::cerr << "Client setup failed" << std::endl;
+            break;
+        }
+        set_recv_timeout(a, 3000);
+        set_recv_timeout(b, 3000);
+        if (!recv_hello_ack(a, status, token, relay_rx) || status != relay::HELLO_OK || token == 0) {
+            std::cerr << "HELLO_ACK invalid status=" << int(status) << std::endl;
+            break;
+        }
+
+        // B -> A: 1..5，A 全部收到
+        bool ok = true;
+        for (uint32_t seq = 1; seq <= 5; seq++) {
+            ok = ok && send_forward(b, mark_a, &seq, sizeof(seq));
+        }
+        for (uint32_t seq = 1; ok && seq <= 5; seq++) {
+            ok = expect_seq(a, seq);
+        }
+        // A -> B: 1..3
+        for (uint32_t seq = 1; ok && seq <= 3; seq++) {
+            ok = send_forward(a, mark_b, &seq, sizeof(seq));
+        }
+        for (uint32_t seq = 1; ok && seq <= 3; seq++) {
+            ok = expect_seq(b, seq);
+        }
+        if (!ok) {
+            break;
+        }
+
+        // A 断线，期间 B 继续发送 6..10（旧版客户端会被计为 drop_no_target）
+        close(a);
+        a = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        for (uint32_t seq = 6; ok && seq <= 10; seq++) {
+            ok = send_forward(b, mark_a, &seq, sizeof(seq));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        // A 重连恢复：已收到5帧，中继应回复已收到A的3帧并只重放 6..10
+        a = connect_to_relay(port);
+        if (!ok || a < 0 || !send_hello(a, mark_a, relay::CAP_RESUME, token, 5)) {
+            std::cerr << "Reconnect failed" << std::endl;
+            break;
+        }
+        set_recv_timeout(a, 3000);
+        uint64_t resumed_token = 0;
+        if (!recv_hello_ack(a, status, resumed_token, relay_rx) || status != relay::HELLO_RESUMED ||
+            resumed_token != token || relay_rx != 3) {
+            std::cerr << "Resume rejected status=" << int(status) << " relay_rx=" << relay_rx << std::endl;
+            break;
+        }
+        for (uint32_t seq = 6; ok && seq <= 10; seq++) {
+            ok = expect_seq(a, seq);
+        }
+        // 恢复后的会话继续双向转发
+        uint32_t seq = 4;
+        ok = ok && send_forward(a, mark_b, &seq, sizeof(seq)) && expect_seq(b, 4);
+        if (!ok) {
+            break;
+        }
+
+        // 令牌错误：不能恢复，按新会话注册
+        close(a);
+        a = connect_to_relay(port);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        uint64_t fresh_token = 0;
+        if (a < 0 || !send_hello(a, mark_a, relay::CAP_RESUME, token + 1, 10)) {
+            break;
+        }
+        set_recv_timeout(a, 3000);
+        if (!recv_hello_ack(a, status, fresh_token, relay_rx) || status != relay::HELLO_OK ||
+            fresh_token == token || relay_rx != 0) {
+            std::cerr << "Stale token was not rejected status=" << int(status) << std::endl;
+            break;
+        }
+        success = true;
+    } while (false);
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    relay.stop();
+
+    std::cout << "Relay session resume test " << (success ? "PASSED" : "FAILED") << std::endl;
+    return success;
+}
+
+// 测试用TCP代理：双向转发字节流，blip() 同时断开两侧以模拟网络闪断
+class BlipProxy {
+public:
+    ~BlipProxy() { stop(); }
+
+    bool start(int upstream_port) {
+        upstream_port_ = upstream_port;
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        socklen_t addr_len = sizeof(addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd_, 4) != 0 ||
+            getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+            close(listen_fd_);
+            listen_fd_ = -1;
+            return false;
+        }
+        port_ = ntohs(addr.sin_port);
+        running_ = true;
+        thread_ = std::thread([this]() { run(); });
+        return true;
+    }
+
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+        if (listen_fd_ >= 0) {
+            close(listen_fd_);
+            listen_fd_ = -1;
+        }
+    }
+
+    void blip() { blips_++; }
+    int port() const { return port_; }
+
+private:
+    void run() {
+        while (running_) {
+            pollfd lp{listen_fd_, POLLIN, 0};
+            if (poll(&lp, 1, 50) <= 0) {
+                continue;
+            }
+            int client = accept(listen_fd_, nullptr, nullptr);
+            int upstream = client >= 0 ? connect_to_relay(upstream_port_) : -1;
+            int seen_blips = blips_.load();
+            while (running_ && client >= 0 && upstream >= 0 && seen_blips == blips_.load()) {
+                pollfd fds[2] = {{client, POLLIN, 0}, {upstream, POLLIN, 0}};
+                if (poll(fds, 2, 20) <= 0) {
+                    continue;
+                }
+                if (!pump(fds[0], upstream) || !pump(fds[1], client)) {
+                    break;
+                }
+            }
+            if (client >= 0) close(client);
+            if (upstream >= 0) close(upstream);
+        }
+    }
+
+    static bool pump(const pollfd& from, int to) {
+        if (!(from.revents & (POLLIN | POLLHUP | POLLERR))) {
+            return true;
+        }
+        char buf[16384];
+        ssize_t n = read(from.fd, buf, sizeof(buf));
+        return n > 0 && send_all(to, buf, static_cast<size_t>(n));
+    }
+
+    int upstream_port_ = 0;
+    int port_ = 0;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::atomic<int> blips_{0};
+    std::thread thread_;
+};
+
+// 断线续传（客户端库）：连接闪断期间双向发送的数据包在重连后全部按序到达
+bool test_connection_manager_resume() {
+    std::cout << "Testing ConnectionManager relay session resume..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    BlipProxy proxy;
+    if (!relay.started() || !proxy.start(relay.port())) {
+        std::cerr << "Failed to start relay/proxy" << std::endl;
+        return false;
+    }
+    int relay_port = relay.port();
+
+    const uint64_t mark_a = 0x0A0A0A0A0A0A0A0AULL;
+    uint8_t mark_a_bytes[8];
+    std::memcpy(mark_a_bytes, &mark_a, sizeof(mark_a));
+    uint8_t mark_b[8] = {0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B};
+    const uint32_t num_messages = 400;
+
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    int b = connect_to_relay(relay_port);
+    if (P2P_Init() != P2P_OK || b < 0 || !send_register(b, mark_b) ||
+        P2P_Connect("127.0.0.1", static_cast<uint16_t>(proxy.port()), &peer) != P2P_OK) {
+        std::cerr << "Client setup failed" << std::endl;
+        if (b >= 0) close(b);
+        P2P_Shutdown();
+        relay.stop();
+        return false;
+    }
+    P2P_SetAutoReconnect(peer, true, 50, 200);
+    P2P_EnableRelaySession(peer, mark_a, P2P_RELAY_FLAG_RESUME);
+    set_recv_timeout(b, 10000);
+
+    // B：接收 A 发来的数据包，检查顺序
+    std::atomic<uint32_t> b_received{0};
+    std::atomic<bool> b_in_order{true};
+    std::thread b_thread([&]() {
+        std::vector<uint8_t> frame;
+        while (b_received < num_messages && recv_frame(b, frame)) {
+            uint32_t seq = 0;
+            if (frame.size() == sizeof(seq)) {
+                std::memcpy(&seq, frame.data(), sizeof(seq));
+            }
+            if (frame.size() != sizeof(seq) || seq != b_received) {
+                std::cerr << "B: expected " << b_received.load() << ", got " << seq << std::endl;
+                b_in_order = false;
+                break;
+            }
+            b_received++;
+        }
+    });
+
+    uint32_t a_received = 0;
+    bool a_in_order = true;
+    auto drain_a = [&]() {
+        P2P_RunCallbacks();
+        uint8_t buf[64];
+        uint32_t size = 0;
+        while (P2P_ReadPacket(peer, buf, sizeof(buf), &size, nullptr) == P2P_OK) {
+            uint32_t seq = 0;
+            std::memcpy(&seq, buf, sizeof(seq));
+            if (size != sizeof(seq) || seq != a_received) {
+                std::cerr << "A: expected " << a_received << ", got " << seq << std::endl;
+                a_in_order = false;
+            }
+            a_received++;
+        }
+    };
+
+    // 等待 B 能收到 A 的首个数据包后再开始（确认 A 已完成注册）
+    for (uint32_t seq = 0; seq < num_messages; seq++) {
+        uint8_t packet[12];
+        std::memcpy(packet, mark_b, 8);
+        std::memcpy(packet + 8, &seq, sizeof(seq));
+        P2P_SendPacket(peer, packet, sizeof(packet));
+        if (seq == 0) {
+            auto start = std::chrono::steady_clock::now();
+            while (b_received == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(3)) {
+                drain_a();
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+        send_forward(b, mark_a_bytes, &seq, sizeof(seq));
+        if (seq == num_messages / 2) {
+            proxy.blip();
+        }
+        drain_a();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    while ((a_received < num_messages || b_received < num_messages) && a_in_order && b_in_order &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        drain_a();
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    shutdown(b, SHUT_RDWR);
+    b_thread.join();
+
+    close(b);
+    P2P_Shutdown();
+    proxy.stop();
+    relay.stop();
+
+    std::cout << "ConnectionManager resume: A received " << a_received << ", B received " << b_received.load()
+              << " of " << num_messages << std::endl;
+    bool success = a_in_order && b_in_order && a_received == num_messages && b_received == num_messages;
+    std::cout << "ConnectionManager resume test " << (success ? "PASSED" : "FAILED") << std::endl;
+    return success;
+}
@@ -0,0 +1,140 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 接收下一个数据帧中的序号（跳过控制帧）
+static bool recv_seq(int fd, uint32_t& seq) {
+    std::vector<uint8_t> frame;
+    uint8_t type = 0;
+    while (recv_typed_frame(fd, type, frame)) {
+        if (type == relay::FRAME_DATA) {
+            if (frame.size() != sizeof(seq)) {
+                return false;
+            }
+            std::memcpy(&seq, frame.data(), sizeof(seq));
+            return true;
+        }
+    }
+    return false;
+}
+
+// 旧连接未关闭（模拟网络已断但socket尚未被keepalive回收）时，
+// 出示注册令牌的重连应立即接管标记，并在毫秒级恢复转发
+bool test_stale_session_takeover() {
+    std::cout << "Testing stale session takeover..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58};
+    uint8_t mark_b[8] = {0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68};
+    bool success = false;
+    int stale = -1, b = -1, intruder = -1, a = -1;
+    uint8_t status = 0xFF;
+    uint64_t token = 0, relay_rx = 0;
+    double takeover_ms = -1.0;
+
+    do {
+        b = connect_to_relay(port);
+        stale = connect_to_relay(port);
+        if (b < 0 || stale < 0 || !send_register(b, mark_b) ||
+            !send_hello(stale, mark_a, relay::CAP_RESUME)) {
+            std::cerr << "Client setup failed" << std::endl;
+            break;
+        }
+        set_recv_timeout(stale, 3000);
+        set_recv_timeout(b, 3000);
+        if (!recv_hello_ack(stale, status, token, relay_rx) || token == 0) {
+            std::cerr << "Initial HELLO_ACK invalid" << std::endl;
+            break;
+        }
+
+        // 旧连接收到 1..3；之后 4..5 还在路上，旧连接不再读取
+        bool ok = true;
+        uint32_t seq = 0;
+        for (uint32_t i = 1; ok && i <= 3; i++) {
+            ok = send_forward(b, mark_a, &i, sizeof(i)) && recv_seq(stale, seq) && seq == i;
+        }
+        for (uint32_t i = 4; ok && i <= 5; i++) {
+            ok = send_forward(b, mark_a, &i, sizeof(i));
+        }
+        if (!ok) {
+            std::cerr << "Forwarding before takeover failed" << std::endl;
+            break;
+        }
+
+        // 不带令牌（或令牌错误）的注册仍被拒绝：收到失败原因后连接被关闭
+        intruder = connect_to_relay(port);
+        set_recv_timeout(intruder, 3000);
+        std::vector<uint8_t> frame;
+        uint8_t type = 0;
+        uint64_t unused = 0;
+        if (intruder < 0 || !send_hello(intruder, mark_a, relay::CAP_RESUME, token + 1, 0) ||
+            !recv_hello_ack(intruder, status, unused, unused) || status != relay::HELLO_ERR_MARK_IN_USE ||
+            recv_typed_frame(intruder, type, frame)) {
+            std::cerr << "Registration with wrong token was not rejected" << std::endl;
+            break;
+        }
+
+        // 出示令牌重连：从发起连接到收到第一个转发包的耗时
+        auto start = std::chrono::steady_clock::now();
+        a = connect_to_relay(port);
+        if (a < 0 || !send_hello(a, mark_a, relay::CAP_RESUME, token, 3)) {
+            break;
+        }
+        set_recv_timeout(a, 3000);
+        uint64_t new_token = 0;
+        if (!recv_hello_ack(a, status, new_token, relay_rx) || status != relay::HELLO_RESUMED) {
+            std::cerr << "Takeover rejected status=" << int(status) << std::endl;
+            break;
+        }
+        // 旧连接上未读的 4..5 被重放，随后新数据正常转发
+        for (uint32_t i = 4; ok && i <= 5; i++) {
+            ok = recv_seq(a, seq) && seq == i;
+        }
+        uint32_t next = 6;
+        ok = ok && send_forward(b, mark_a, &next, sizeof(next)) && recv_seq(a, seq) && seq == next;
+        takeover_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (!ok) {
+            std::cerr << "Forwarding after takeover failed" << std::endl;
+            break;
+        }
+
+        // 旧连接已被服务器关闭
+        set_recv_timeout(stale, 1000);
+        bool stale_closed = false;
+        while (true) {
+            char buf[256];
+            ssize_t n = read(stale, buf, sizeof(buf));
+            if (n <= 0) {
+                stale_closed = (n == 0);
+                break;
+            }
+        }
+        if (!stale_closed) {
+            std::cerr << "Stale connection was not closed" << std::endl;
+            break;
+        }
+
+        success = takeover_ms < 500.0;
+    } while (false);
+
+    if (a >= 0) close(a);
+    if (intruder >= 0) close(intruder);
+    if (stale >= 0) close(stale);
+    if (b >= 0) close(b);
+    relay.stop();
+
+    std::cout << "Reconnect-to-forwarding time: " << takeover_ms << " ms" << std::endl;
+    std::cout << "Stale session takeover test " << (success ? "PASSED" : "FAILED") << std::endl;
+    return success;
+}
@@ -0,0 +1,160 @@
+#include "test_helpers.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 运行 relay_soak，返回退出码（无法运行时为-1）；路径默认为 ../server/relay_soak，可通过 RELAY_SOAK_BIN 覆盖
+static int run_soak(const std::string& args, std::string& output) {
+    const char* bin = std::getenv("RELAY_SOAK_BIN");
+    std::string command = std::string(bin ? bin : "../server/relay_soak") + " " + args + " 2>/dev/null";
+    FILE* pipe = popen(command.c_str(), "r");
+    if (!pipe) {
+        return -1;
+    }
+    char line[1024];
+    output.clear();
+    while (fgets(line, sizeof(line), pipe)) {
+        output += line;
+    }
+    int status = pclose(pipe);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// 中继 mem 命令输出中的某一项（不存在时返回 UINT64_MAX）
+static uint64_t mem_value(const std::string& admin, const std::string& name) {
+    std::string out;
+    admin_query(admin, "mem", out);
+    std::istringstream in(out);
+    std::string key;
+    uint64_t value;
+    while (in >> key >> value) {
+        if (key == name) {
+            return value;
+        }
+    }
+    return UINT64_MAX;
+}
+
+// list 输出中指定标记的连接行里 send_cap 字段的值（找不到时为-1）
+static long long list_send_cap(const std::string& list, const std::string& mark) {
+    std::istringstream in(list);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t pos = line.find(" send_cap=");
+        if (line.find(" mark=" + mark + " ") != std::string::npos && pos != std::string::npos) {
+            return std::atoll(line.c_str() + pos + 10);
+        }
+    }
+    return -1;
+}
+
+// 会话反复连接、突发、空闲、断开后中继的堆、RSS 与 fd 回到基线；空闲连接的缓冲区预算为0时判为未通过
+bool test_soak_returns_to_baseline() {
+    std::cout << "Testing relay_soak against a running relay..." << std::endl;
+
+    std::string admin = test_temp_path("soak");
+    std::string csv = test_temp_path("soak", ".csv");
+    TestRelay relay({"-c", "64", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    std::string target = admin + " 127.0.0.1 " + std::to_string(port);
+    std::string output;
+    std::string strict;
+    int rc = run_soak("-d 2000 -n 6 -p 3 -b 100 -s 1200 -L 300 -i 500 -I 200 -D 500 -C " + csv + " " + target, output);
+    int strict_rc = run_soak("-d 1 -w 1 -n 2 -p 2 -b 50 -L 200 -i 500 -I 100 -D 200 -B 0 " + target, strict);
+    std::cout << output << strict;
+    uint64_t connections = admin_stat(admin, "connections");
+    relay.stop();
+
+    // CSV 包含全部阶段，每轮断开后没有残留的连接与缓冲区
+    std::ifstream in(csv);
+    std::string line;
+    std::getline(in, line);
+    bool header = line.find("heap_in_use_bytes") != std::string::npos && line.find("open_fds") != std::string::npos;
+    std::string phases;
+    std::string last;
+    while (std::getline(in, line)) {
+        std::string phase = line.substr(line.find(',') + 1);
+        phase = phase.substr(0, phase.find(','));
+        if (phases.find(phase) == std::string::npos) {
+            phases += phase + " ";
+        }
+        last = line;
+    }
+    std::remove(csv.c_str());
+
+    return rc == 0 && output.find("通过") != std::string::npos && output.find("未通过") == std::string::npos &&
+           header && phases == "baseline warmup load after " && last.find(",after,") != std::string::npos &&
+           strict_rc == 2 && strict.find("突发后缓冲区未缩小") != std::string::npos && connections == 0;
+}
+
+// 目标不读取时积压的发送缓冲区在读空后归还：list 的 send_cap 与 mem 的 buf_capacity_max 回落
+bool test_soak_send_buffer_released() {
+    std::cout << "Testing send buffer capacity release after a burst..." << std::endl;
+
+    std::string admin = test_temp_path("soak_buf");
+    TestRelay relay({"-c", "8", "-a", admin});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x5A, 1, 2, 3, 4, 5, 6, 7};
+    uint8_t mark_b[8] = {0x5B, 1, 2, 3, 4, 5, 6, 7};
+    int fd_a = connect_to_relay(port);
+    int fd_b = connect_to_relay(port);
+    bool ok = fd_a >= 0 && fd_b >= 0 && register_with_ack(fd_a, mark_a) && register_with_ack(fd_b, mark_b);
+    uint64_t released_before = admin_stat(admin, "buf_released");
+
+    // B 暂不读取：接近最大长度的帧在中继积压，B 读取时子队列逐帧移入 send_buf
+    const int frames = 60;
+    std::vector<uint8_t> payload(65000, 0x3C);
+    std::thread sender([&] {
+        for (int i = 0; ok && i < frames; i++) {
+            send_forward(fd_a, mark_b, payload.data(), payload.size());
+        }
+    });
+    usleep(300 * 1000);
+    uint64_t peak = mem_value(admin, "buf_capacity_max");
+    std::string list;
+    admin_query(admin, "list", list);
+    long long peak_cap = list_send_cap(list, "5b01020304050607");
+
+    int received = 0;
+    std::vector<uint8_t> frame;
+    if (ok) {
+        set_recv_timeout(fd_b, 3000);
+        while (received < frames && recv_frame(fd_b, frame) && frame.size() == payload.size()) {
+            received++;
+        }
+    }
+    sender.join();
+    usleep(200 * 1000);
+
+    uint64_t after = mem_value(admin, "buf_capacity_max");
+    uint64_t released = admin_stat(admin, "buf_released") - released_before;
+    admin_query(admin, "list", list);
+    long long after_cap = list_send_cap(list, "5b01020304050607");
+    std::string mem;
+    admin_query(admin, "mem", mem);
+    std::cout << "received " << received << "/" << frames << ", peak per-connection capacity " << peak
+              << " B, after drain " << after << " B, released " << released << std::endl
+              << mem;
+    if (fd_a >= 0) close(fd_a);
+    if (fd_b >= 0) close(fd_b);
+    relay.stop();
+
+    return ok && received == frames && peak > 1024 * 1024 && peak_cap >= static_cast<long long>(peak) &&
+           after <= 64 * 1024 && after_cap >= 0 && after_cap <= 64 * 1024 && released >= 1 &&
+           mem.find("rss_bytes ") != std::string::npos && mem.find("open_fds ") != std::string::npos;
+}
@@ -0,0 +1,250 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include "relay_shim.h"
+#include <p2p_network.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Hook 收发格式：省略本地 SteamID 后，经中继补上来源，接收端解析结果与旧格式一致
+bool test_relay_shim() {
+    std::cout << "Testing hook relay shim packet format..." << std::endl;
+
+    uint64_t target = 0x0110000100000002ULL;
+    uint64_t local = 0x0110000100000001ULL;
+    uint8_t data[32];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = static_cast<uint8_t>(i + 1);
+    }
+
+    // 中继的处理：去掉目标标记；发送方声明 CAP_SOURCE 时在前面补上来源标记
+    auto relay_forward = [&](const std::vector<uint8_t>& packet, bool stamped) {
+        std::vector<uint8_t> delivered;
+        if (stamped) {
+            const uint8_t* mark = reinterpret_cast<const uint8_t*>(&local);
+            delivered.assign(mark, mark + relay_shim::STEAM_ID_SIZE);
+        }
+        delivered.insert(delivered.end(), packet.begin() + relay_shim::STEAM_ID_SIZE, packet.end());
+        return delivered;
+    };
+
+    bool ok = true;
+    uint32_t sizes[2] = {};
+    for (int stamped = 0; stamped < 2; stamped++) {
+        std::vector<uint8_t> packet;
+        sizes[stamped] = relay_shim::BuildSendPacket(packet, target, local, stamped != 0, data, sizeof(data));
+        uint64_t written_target = 0;
+        std::memcpy(&written_target, packet.data(), sizeof(written_target));
+
+        std::vector<uint8_t> delivered = relay_forward(packet, stamped != 0);
+        uint64_t source = 0;
+        const uint8_t* payload = nullptr;
+        uint32_t payload_size = 0;
+        ok = ok && written_target == target && sizes[stamped] == packet.size() &&
+             relay_shim::ParseRecvPacket(delivered.data(), static_cast<uint32_t>(delivered.size()), source, payload,
+                                         payload_size) &&
+             source == local && payload_size == sizeof(data) && std::memcmp(payload, data, sizeof(data)) == 0;
+    }
+
+    // 空数据与过短的数据包
+    std::vector<uint8_t> empty;
+    uint64_t source = 0;
+    const uint8_t* payload = nullptr;
+    uint32_t payload_size = 1;
+    bool empty_ok = relay_shim::BuildSendPacket(empty, target, local, true, nullptr, 0) == relay_shim::STEAM_ID_SIZE &&
+                    relay_shim::ParseRecvPacket(reinterpret_cast<const uint8_t*>(&local), relay_shim::STEAM_ID_SIZE,
+                                                source, payload, payload_size) &&
+                    source == local && payload_size == 0;
+    bool short_rejected = !relay_shim::ParseRecvPacket(data, relay_shim::STEAM_ID_SIZE - 1, source, payload,
+                                                       payload_size);
+
+    std::cout << "uplink packet " << sizes[0] << "B -> " << sizes[1] << "B, empty " << empty_ok << ", short rejected "
+              << short_rejected << std::endl;
+    return ok && sizes[0] - sizes[1] == relay_shim::STEAM_ID_SIZE && empty_ok && short_rejected;
+}
+
+// 接收下一个紧凑数据帧（跳过控制帧），输出标签
+static bool recv_compact_data(int fd, uint8_t& tag, std::vector<uint8_t>& body) {
+    while (recv_compact(fd, tag, body)) {
+        if (tag != relay::COMPACT_TAG_CTRL) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool starts_with_mark(const std::vector<uint8_t>& body, const uint8_t* mark, const uint8_t* payload,
+                             size_t payload_len) {
+    return body.size() == 8 + payload_len && std::memcmp(body.data(), mark, 8) == 0 &&
+           (payload_len == 0 || std::memcmp(body.data() + 8, payload, payload_len) == 0);
+}
+
+// 中继补上来源标记：v1、旧版与紧凑帧接收方收到的格式一致
+bool test_source_stamping() {
+    std::cout << "Testing relay-stamped source marks..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68};
+    uint8_t mark_b[8] = {0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78};
+    uint8_t mark_c[8] = {0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && c >= 0;
+    if (ok) {
+        set_recv_timeout(a, 3000);
+        set_recv_timeout(b, 3000);
+        set_recv_timeout(c, 3000);
+    }
+
+    // A: v1 + CAP_SOURCE；B: 旧版注册；C: 紧凑帧 + CAP_SOURCE
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    ok = ok && send_hello(a, mark_a, relay::CAP_SOURCE) && recv_hello_ack(a, status, token, relay_rx) &&
+         status == relay::HELLO_OK && send_register(b, mark_b);
+    ok = ok && send_hello(c, mark_c, relay::CAP_PRESENCE | relay::CAP_COMPACT | relay::CAP_SOURCE) &&
+         recv_hello_ack(c, status, token, relay_rx) && status == relay::HELLO_OK;
+
+    uint8_t payload[48];
+    for (size_t i = 0; i < sizeof(payload); i++) {
+        payload[i] = static_cast<uint8_t>(0xA0 + i);
+    }
+
+    // C 以标记寻址各发一个包后收到 A、B 的上线通知与短编号（A、B 收到 [C][数据]）
+    uint8_t c_slot_a = 0;
+    uint8_t c_slot_b = 0;
+    std::vector<uint8_t> body;
+    uint8_t tag = 0;
+    for (const uint8_t* target : {mark_a, mark_b}) {
+        std::vector<uint8_t> marked(target, target + 8);
+        marked.insert(marked.end(), payload, payload + sizeof(payload));
+        ok = ok && send_compact(c, relay::COMPACT_TAG_DATA, marked.data(), marked.size()) &&
+             (target == mark_a ? recv_data(a, body) : recv_frame(b, body)) &&
+             starts_with_mark(body, mark_c, payload, sizeof(payload)) && recv_compact(c, tag, body) &&
+             tag == relay::COMPACT_TAG_CTRL && body.size() == relay::CTRL_PEER_JOIN_COMPACT_SIZE &&
+             body[0] == relay::CTRL_PEER_JOIN && std::memcmp(body.data() + 1, target, 8) == 0;
+        if (ok) {
+            (target == mark_a ? c_slot_a : c_slot_b) = body[relay::CTRL_PEER_EVENT_SIZE];
+        }
+    }
+    ok = ok && c_slot_a != 0 && c_slot_b != 0;
+
+    // A -> B：A 不带自己的标记，B 收到 [A][数据]
+    bool to_legacy = ok && send_forward(a, mark_b, payload, sizeof(payload)) && recv_frame(b, body) &&
+                     starts_with_mark(body, mark_a, payload, sizeof(payload));
+
+    // B（旧版，自带标记）-> A：原样转发
+    std::vector<uint8_t> legacy(mark_b, mark_b + 8);
+    legacy.insert(legacy.end(), payload, payload + sizeof(payload));
+    bool from_legacy = ok && send_forward(b, mark_a, legacy.data(), legacy.size()) && recv_data(a, body) &&
+                       starts_with_mark(body, mark_b, payload, sizeof(payload));
+
+    // A -> C：C 持有 A 的短编号，来源以短编号标签标识，不带标记
+    bool slot_source = ok && send_forward(a, mark_c, payload, sizeof(payload)) && recv_compact_data(c, tag, body) &&
+                       tag == c_slot_a && body.size() == sizeof(payload) &&
+                       std::memcmp(body.data(), payload, sizeof(payload)) == 0;
+
+    // C -> B 按短编号寻址：B 收到 [C][数据]；C -> A 空负载：A 收到只有来源标记的包
+    bool compact_to_legacy = ok && send_compact(c, c_slot_b, payload, sizeof(payload)) && recv_frame(b, body) &&
+                             starts_with_mark(body, mark_c, payload, sizeof(payload));
+    uint8_t target_a[8];
+    std::memcpy(target_a, mark_a, 8);
+    bool empty_payload = ok && send_compact(c, relay::COMPACT_TAG_DATA, target_a, sizeof(target_a)) &&
+                         recv_data(a, body) && starts_with_mark(body, mark_c, nullptr, 0);
+
+    std::cout << "v1->legacy " << to_legacy << ", legacy->v1 " << from_legacy << ", slot source " << slot_source
+              << ", compact->legacy " << compact_to_legacy << ", empty payload " << empty_payload << std::endl;
+
+    if (a >= 0) close(a);
+    if (b >= 0) close(b);
+    if (c >= 0) close(c);
+    relay.stop();
+    return to_legacy && from_legacy && slot_source && compact_to_legacy && empty_payload;
+}
+
+// 客户端库：P2P_RELAY_FLAG_SOURCE 发送不带本地标记，按短编号接收时还原来源标记
+bool test_connection_manager_source() {
+    std::cout << "Testing ConnectionManager source stamping..." << std::endl;
+
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint64_t mark_a = 0x99AABBCCDDEE0001ULL;
+    uint64_t mark_b = 0x99AABBCCDDEE0002ULL;
+    uint8_t mark_a_bytes[8];
+    uint8_t mark_b_bytes[8];
+    std::memcpy(mark_a_bytes, &mark_a, 8);
+    std::memcpy(mark_b_bytes, &mark_b, 8);
+
+    // B 声明 CAP_SOURCE，发给 A 的包由中继补上来源；A 是紧凑帧连接，收到的是 B 的短编号
+    int b = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    P2PPeerID peer = P2P_INVALID_PEER_ID;
+    if (b < 0 || !send_hello(b, mark_b_bytes, relay::CAP_SOURCE) || !recv_hello_ack(b, status, token, relay_rx) ||
+        P2P_Init() != P2P_OK || P2P_Connect("127.0.0.1", static_cast<uint16_t>(port), &peer) != P2P_OK) {
+        std::cerr << "Setup failed" << std::endl;
+        P2P_Shutdown();
+        if (b >= 0) close(b);
+        relay.stop();
+        return false;
+    }
+    set_recv_timeout(b, 3000);
+    P2P_EnableRelaySession(peer, mark_a, P2P_RELAY_FLAG_COMPACT | P2P_RELAY_FLAG_SOURCE);
+
+    const int count = 20;
+    int received_by_b = 0;
+    int received_by_a = 0;
+    for (int i = 0; i < count; i++) {
+        uint8_t packet[8 + sizeof(int)];
+        std::memcpy(packet, &mark_b, 8);
+        std::memcpy(packet + 8, &i, sizeof(i));
+        P2P_SendPacket(peer, packet, sizeof(packet));
+        P2P_RunCallbacks();
+
+        // 第一个包在 HELLO_ACK 之后才发出，按顺序计数
+        std::vector<uint8_t> body;
+        while (received_by_b <= i && recv_data(b, body)) {
+            if (starts_with_mark(body, mark_a_bytes, reinterpret_cast<uint8_t*>(&received_by_b), sizeof(int))) {
+                received_by_b++;
+            }
+        }
+        send_forward(b, mark_a_bytes, &i, sizeof(i));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+    while (received_by_a < count && std::chrono::steady_clock::now() < deadline) {
+        P2P_RunCallbacks();
+        uint8_t buf[64];
+        uint32_t size = 0;
+        while (P2P_ReadPacket(peer, buf, sizeof(buf), &size, nullptr) == P2P_OK) {
+            if (size == 8 + sizeof(int) && std::memcmp(buf, mark_b_bytes, 8) == 0 &&
+                std::memcmp(buf + 8, &received_by_a, sizeof(int)) == 0) {
+                received_by_a++;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::cout << "B received " << received_by_b << "/" << count << " stamped, A received " << received_by_a << "/"
+              << count << " with restored source" << std::endl;
+
+    P2P_Shutdown();
+    close(b);
+    relay.stop();
+    return received_by_b == count && received_by_a == count;
+}
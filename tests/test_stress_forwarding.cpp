@@ -33,11 +33,14 @@ std::vector<uint8_t> generate_random_data(size_t size) {
 bool test_two_clients_high_throughput() {
     std::cout << "Testing high throughput with 2 clients..." << std::endl;
 
-    // 使用固定的测试端口
-    const int port = 8889;
+    // 进程内中继，监听临时端口
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    const int port = relay.port();
     
     // 连接两个客户端进行高吞吐量测试
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
     
     // 客户端1
     int client1_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -66,16 +69,9 @@ bool test_two_clients_high_throughput() {
         return false;
     }
     
-    // 注册客户端1
-    uint8_t reg_header[4];
-    write_packet_length(reg_header, 8);
-    
+    // 注册客户端1（收到 HELLO_ACK 即注册完成）
     uint8_t client1_mark[8] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
-    std::vector<uint8_t> client1_reg;
-    client1_reg.insert(client1_reg.end(), reg_header, reg_header + 4);
-    client1_reg.insert(client1_reg.end(), client1_mark, client1_mark + 8);
-    
-    if (send(client1_fd, client1_reg.data(), client1_reg.size(), 0) < 0) {
+    if (!register_with_ack(client1_fd, client1_mark)) {
         std::cerr << "Client 1 registration failed" << std::endl;
         close(client1_fd);
         close(client2_fd);
@@ -84,20 +80,13 @@ bool test_two_clients_high_throughput() {
     
     // 注册客户端2
     uint8_t client2_mark[8] = {0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01};
-    std::vector<uint8_t> client2_reg;
-    client2_reg.insert(client2_reg.end(), reg_header, reg_header + 4);
-    client2_reg.insert(client2_reg.end(), client2_mark, client2_mark + 8);
-    
-    if (send(client2_fd, client2_reg.data(), client2_reg.size(), 0) < 0) {
+    if (!register_with_ack(client2_fd, client2_mark)) {
         std::cerr << "Client 2 registration failed" << std::endl;
         close(client1_fd);
         close(client2_fd);
         return false;
     }
     
-    // 等待注册完成
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-    
     // 开始高吞吐量测试
     const int num_messages = 500;  // 发送500条消息
     const size_t message_size = 256; // 每条消息256B
@@ -222,11 +211,14 @@ bool test_two_clients_high_throughput() {
 bool test_three_clients_high_throughput() {
     std::cout << "Testing high throughput with 3 clients..." << std::endl;
 
-    // 使用固定的测试端口
-    const int port = 8889;
+    // 进程内中继，监听临时端口
+    TestRelay relay({"-c", "16"});
+    if (!relay.started()) {
+        return false;
+    }
+    const int port = relay.port();
     
     // 连接三个客户端进行高吞吐量测试
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
     
     int client_fds[3];
     struct sockaddr_in serv_addrs[3];
@@ -254,16 +246,9 @@ bool test_three_clients_high_throughput() {
         {0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88}
     };
     
-    // 注册所有客户端
-    uint8_t reg_header[4];
-    write_packet_length(reg_header, 8);
-    
+    // 注册所有客户端（收到 HELLO_ACK 即注册完成）
     for (int i = 0; i < 3; i++) {
-        std::vector<uint8_t> client_reg;
-        client_reg.insert(client_reg.end(), reg_header, reg_header + 4);
-        client_reg.insert(client_reg.end(), client_marks[i], client_marks[i] + 8);
-        
-        if (send(client_fds[i], client_reg.data(), client_reg.size(), 0) < 0) {
+        if (!register_with_ack(client_fds[i], client_marks[i])) {
             std::cerr << "Client " << (i+1) << " registration failed" << std::endl;
             for (int j = 0; j < 3; j++) {
                 close(client_fds[j]);
@@ -272,9 +257,6 @@ bool test_three_clients_high_throughput() {
         }
     }
     
-    // 等待注册完成
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-    
     // 开始高吞吐量测试 - 三个客户端互相发送数据
     const int num_messages_per_client = 200;  // 每客户端200条消息
     const size_t message_size = 128; // 每条消息128B
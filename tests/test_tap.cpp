@@ -0,0 +1,238 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include <sys/socket.h>
+#include <unistd.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// 测试中继的观察连接密钥（-k 参数与 CTRL_TAP 中的8字节密钥）
+static const char* TAP_KEY_HEX = "7a9f31c04e6b2d58";
+static const uint8_t TAP_KEY[8] = {0x7a, 0x9f, 0x31, 0xc0, 0x4e, 0x6b, 0x2d, 0x58};
+
+// CTRL_TAP: 出示密钥，订阅来源或目标为给定标记的流量
+static bool send_tap(int fd, const std::vector<const uint8_t*>& marks, const uint8_t* key = TAP_KEY) {
+    std::vector<uint8_t> body(relay::CTRL_TAP_FIXED_SIZE);
+    body[0] = relay::CTRL_TAP;
+    body[1] = relay::PROTOCOL_VERSION;
+    std::memcpy(body.data() + 2, key, 8);
+    body[10] = static_cast<uint8_t>(marks.size());
+    for (const uint8_t* mark : marks) {
+        body.insert(body.end(), mark, mark + 8);
+    }
+    std::vector<uint8_t> frame(relay::FRAME_HEADER_SIZE + body.size());
+    relay::writeFrameHeader(frame.data(), static_cast<uint32_t>(body.size()), relay::FRAME_CTRL);
+    std::memcpy(frame.data() + relay::FRAME_HEADER_SIZE, body.data(), body.size());
+    return send_all(fd, frame.data(), frame.size());
+}
+
+// 接收一个观察帧 [来源][目标][负载]
+static bool recv_tap(int fd, std::vector<uint8_t>& body) {
+    uint8_t type = 0;
+    return recv_typed_frame(fd, type, body) && type == relay::FRAME_TAP && body.size() >= relay::TAP_HEADER_SIZE;
+}
+
+static bool tap_is(const std::vector<uint8_t>& body, const uint8_t* source, const uint8_t* target, const void* payload,
+                   size_t len) {
+    return body.size() == relay::TAP_HEADER_SIZE + len && std::memcmp(body.data(), source, 8) == 0 &&
+           std::memcmp(body.data() + 8, target, 8) == 0 &&
+           std::memcmp(body.data() + relay::TAP_HEADER_SIZE, payload, len) == 0;
+}
+
+// 中继在进程内运行，本进程的常驻内存即包含中继的内存
+static long read_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+    return -1;
+}
+
+// 观察连接：须出示密钥并列出标记；镜像单播、扇出与打包帧记录，按标记过滤，本身不可寻址、发来的数据被丢弃
+bool test_tap_mirroring() {
+    std::cout << "Testing spectator taps..." << std::endl;
+
+    TestRelay relay({"-c", "16", "-k", TAP_KEY_HEX});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x71, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0x72, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    uint8_t mark_c[8] = {0x73, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33};
+    uint8_t multicast[8];
+    relay::writeU64(multicast, relay::FANOUT_MULTICAST);
+
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int c = connect_to_relay(port);
+    int watch_a = connect_to_relay(port);
+    int only_c = connect_to_relay(port);
+    bool ok = a >= 0 && b >= 0 && c >= 0 && watch_a >= 0 && only_c >= 0;
+    if (ok) {
+        for (int fd : {a, b, c, watch_a, only_c}) {
+            set_recv_timeout(fd, 3000);
+        }
+    }
+
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    ok = ok && send_tap(watch_a, {mark_a}) && recv_hello_ack(watch_a, status, token, relay_rx) && status == relay::HELLO_OK &&
+         send_tap(only_c, {mark_c}) && recv_hello_ack(only_c, status, token, relay_rx) && status == relay::HELLO_OK &&
+         send_hello(a, mark_a, relay::CAP_SOURCE | relay::CAP_FANOUT | relay::CAP_BUNDLE) &&
+         recv_hello_ack(a, status, token, relay_rx) && register_with_ack(b, mark_b) && register_with_ack(c, mark_c);
+
+    // 单播 A->B、A->C，扇出到 B、C，打包帧中的一条记录 A->C
+    const char p1[] = "to-b";
+    const char p2[] = "to-c";
+    const char p3[] = "everyone";
+    uint8_t p3_list[1 + 16 + sizeof(p3)] = {2};
+    std::memcpy(p3_list + 1, mark_b, 8);
+    std::memcpy(p3_list + 9, mark_c, 8);
+    std::memcpy(p3_list + 17, p3, sizeof(p3));
+    const char p4[] = "bundled";
+    std::vector<uint8_t> bundle(2 + 8 + sizeof(p4));
+    bundle[0] = static_cast<uint8_t>(1 + 8 + sizeof(p4));
+    bundle[1] = relay::COMPACT_TAG_DATA;
+    std::memcpy(bundle.data() + 2, mark_c, 8);
+    std::memcpy(bundle.data() + 10, p4, sizeof(p4));
+    std::vector<uint8_t> frame(relay::FRAME_HEADER_SIZE + bundle.size());
+    relay::writeFrameHeader(frame.data(), static_cast<uint32_t>(bundle.size()), relay::FRAME_BUNDLE);
+    std::memcpy(frame.data() + relay::FRAME_HEADER_SIZE, bundle.data(), bundle.size());
+    ok = ok && send_forward(a, mark_b, p1, sizeof(p1)) && send_forward(a, mark_c, p2, sizeof(p2)) &&
+         send_forward(a, multicast, p3_list, sizeof(p3_list)) && send_all(a, frame.data(), frame.size());
+
+    std::vector<uint8_t> body;
+    bool watch_ok = ok && recv_tap(watch_a, body) && tap_is(body, mark_a, mark_b, p1, sizeof(p1)) && recv_tap(watch_a, body) &&
+                  tap_is(body, mark_a, mark_c, p2, sizeof(p2)) && recv_tap(watch_a, body) &&
+                  tap_is(body, mark_a, multicast, p3, sizeof(p3)) && recv_tap(watch_a, body) &&
+                  tap_is(body, mark_a, mark_c, p4, sizeof(p4));
+    bool filtered_ok = ok && recv_tap(only_c, body) && tap_is(body, mark_a, mark_c, p2, sizeof(p2)) &&
+                       recv_tap(only_c, body) && tap_is(body, mark_a, mark_c, p4, sizeof(p4));
+
+    // 玩家照常收到（B: 单播 + 扇出；C: 单播 + 扇出 + 打包记录）
+    std::vector<uint8_t> frame_body;
+    bool players_ok = ok;
+    for (int i = 0; i < 2 && players_ok; i++) {
+        players_ok = recv_frame(b, frame_body);
+    }
+    for (int i = 0; i < 3 && players_ok; i++) {
+        players_ok = recv_frame(c, frame_body);
+    }
+
+    // 观察连接发来的数据帧被丢弃，连接保持；其他连接无法向它寻址
+    uint8_t zero_mark[8] = {};
+    ok = ok && send_forward(watch_a, mark_b, p1, sizeof(p1)) && send_forward(a, zero_mark, p1, sizeof(p1)) &&
+         send_forward(a, mark_b, p2, sizeof(p2));
+    bool not_routable = ok && recv_frame(b, frame_body) && frame_body.size() == 8 + sizeof(p2) &&
+                        std::memcmp(frame_body.data() + 8, p2, sizeof(p2)) == 0 && recv_tap(watch_a, body) &&
+                        tap_is(body, mark_a, mark_b, p2, sizeof(p2));
+
+    // 密钥不符或未列出标记的观察连接被拒绝
+    uint8_t wrong_key[8] = {};
+    bool denied = true;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int fd = connect_to_relay(port);
+        set_recv_timeout(fd, 3000);
+        bool sent = attempt == 0 ? send_tap(fd, {mark_a}, wrong_key) : send_tap(fd, {});
+        uint8_t expected = attempt == 0 ? relay::HELLO_ERR_DENIED : relay::HELLO_ERR_BAD_REQUEST;
+        denied = denied && fd >= 0 && sent && recv_hello_ack(fd, status, token, relay_rx) && status == expected;
+        if (fd >= 0) close(fd);
+    }
+
+    std::cout << "tap of A " << watch_ok << ", filtered tap " << filtered_ok << ", players " << players_ok
+              << ", tap not routable " << not_routable
+              << ", denied " << denied << std::endl;
+
+    for (int fd : {a, b, c, watch_a, only_c}) {
+        if (fd >= 0) close(fd);
+    }
+    relay.stop();
+    return watch_ok && filtered_ok && players_ok && not_routable && denied;
+}
+
+// 卡住的观察者：镜像帧超过队列上限后被丢弃，中继内存有界，玩家之间的转发不受影响
+bool test_tap_stalled_bounded_memory() {
+    std::cout << "Testing stalled spectator with bounded memory..." << std::endl;
+
+    std::string admin = test_temp_path("tap");
+    TestRelay relay({"-c", "16", "-a", admin, "-k", TAP_KEY_HEX, "-o", "tap_queue_bytes=65536"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark_a[8] = {0x74, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11};
+    uint8_t mark_b[8] = {0x75, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22};
+    int a = connect_to_relay(port);
+    int b = connect_to_relay(port);
+    int tap = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = a >= 0 && b >= 0 && tap >= 0;
+    if (ok) {
+        int small = 4096;
+        setsockopt(tap, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+        set_recv_timeout(b, 3000);
+        set_recv_timeout(tap, 3000);
+    }
+    ok = ok && send_tap(tap, {mark_a}) && recv_hello_ack(tap, status, token, relay_rx) && status == relay::HELLO_OK &&
+         register_with_ack(a, mark_a) && register_with_ack(b, mark_b);
+    long rss_before = read_rss_kb();
+
+    // 40MB 的转发流量，观察者一个字节都不读
+    const int count = 40000;
+    const size_t size = 1000;
+    std::thread sender([&]() {
+        std::vector<uint8_t> payload(size);
+        for (int i = 0; i < count && ok; i++) {
+            std::memcpy(payload.data(), &i, sizeof(i));
+            if (!send_forward(a, mark_b, payload.data(), payload.size())) {
+                break;
+            }
+        }
+    });
+    auto start = std::chrono::steady_clock::now();
+    int received = 0;
+    std::vector<uint8_t> body;
+    while (ok && received < count && recv_frame(b, body)) {
+        if (body.size() == size && std::memcmp(body.data(), &received, sizeof(int)) == 0) {
+            received++;
+        }
+    }
+    double elapsed_ms =
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    sender.join();
+    long rss_after = read_rss_kb();
+    uint64_t drops = admin_stat(admin, "tap_drops");
+    uint64_t mirrored = admin_stat(admin, "tap_frames");
+
+    // 观察者恢复读取后收到的仍是完整的镜像帧
+    int tap_frames = 0;
+    set_recv_timeout(tap, 300);
+    while (recv_tap(tap, body) && body.size() == relay::TAP_HEADER_SIZE + size) {
+        tap_frames++;
+    }
+
+    long growth_kb = rss_before > 0 && rss_after > 0 ? rss_after - rss_before : -1;
+    std::cout << "player received " << received << "/" << count << " in " << elapsed_ms << "ms; tap mirrored "
+              << mirrored << ", dropped " << drops << ", read back " << tap_frames << " intact; relay RSS growth "
+              << growth_kb << "KB (tap queue limit 64KB)" << std::endl;
+
+    close(a);
+    close(b);
+    close(tap);
+    relay.stop();
+    return received == count && drops != UINT64_MAX && drops > 0 && mirrored + drops == static_cast<uint64_t>(count) &&
+           tap_frames > 0 && growth_kb >= 0 && growth_kb < 16 * 1024;
+}
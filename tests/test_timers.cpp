@@ -0,0 +1,189 @@
+#include "test_helpers.h"
+#include "relay_protocol.h"
+#include "timer_wheel.h"
+#include <unistd.h>
+#include <poll.h>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 时间轮：10万个定时器随机插入、取消三分之一，验证其余全部按时且按序触发
+bool test_timer_wheel_100k() {
+    std::cout << "Testing timer wheel with 100k timers..." << std::endl;
+
+    const uint64_t tick_ms = 10;
+    const uint64_t start_ms = 123456;
+    const size_t count = 100000;
+    TimerWheel wheel(tick_ms, start_ms);
+
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> expire_at(count);
+    std::vector<TimerWheel::TimerId> ids(count);
+    std::vector<bool> cancelled(count, false);
+
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        // 覆盖全部4层：最长约2小时
+        expire_at[i] = start_ms + 1 + rng() % (2 * 3600 * 1000);
+        ids[i] = wheel.schedule(expire_at[i], i);
+    }
+    for (size_t i = 0; i < count; i += 3) {
+        if (!wheel.cancel(ids[i])) {
+            std::cerr << "Cancel failed for timer " << i << std::endl;
+            return false;
+        }
+        cancelled[i] = true;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    double insert_cancel_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+    if (wheel.cancel(ids[0])) {
+        std::cerr << "Double cancel should fail" << std::endl;
+        return false;
+    }
+
+    // 以不规则步长推进，模拟事件循环被其他事件唤醒
+    size_t fired = 0;
+    size_t late = 0;
+    size_t wrong = 0;
+    uint64_t last_expire = 0;
+    uint64_t now = start_ms;
+    const uint64_t step_ms = 997;
+    while (wheel.size() > 0 && now < start_ms + 3 * 3600 * 1000) {
+        now += step_ms;
+        wheel.advance(now, [&](TimerWheel::TimerId, uint64_t data) {
+            fired++;
+            if (data >= count || cancelled[data] || expire_at[data] > now) {
+                wrong++;
+                return;
+            }
+            // 精度为一个tick，加上推进步长
+            if (now - expire_at[data] > step_ms + tick_ms) {
+                late++;
+            }
+            uint64_t tick = (expire_at[data] + tick_ms - 1) / tick_ms;
+            if (tick < last_expire) {
+                wrong++;
+            }
+            last_expire = tick;
+        });
+    }
+
+    size_t expected = count - (count + 2) / 3;
+    std::cout << "Insert+cancel: " << insert_cancel_ms << " ms, fired " << fired << "/" << expected
+              << ", late " << late << ", wrong " << wrong << std::endl;
+    return fired == expected && late == 0 && wrong == 0 && wheel.size() == 0 && insert_cancel_ms < 1000.0;
+}
+
+// 等待对端关闭连接；timeout_ms 内未关闭返回false。elapsed_ms 输出实际耗时
+static bool wait_closed(int fd, int timeout_ms, int& elapsed_ms, bool answer_pings) {
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]() {
+        return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    };
+    while (true) {
+        elapsed_ms = elapsed();
+        if (elapsed_ms >= timeout_ms) {
+            return false;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms - elapsed_ms) <= 0) {
+            continue;
+        }
+        uint8_t type = 0;
+        std::vector<uint8_t> frame;
+        if (!recv_typed_frame(fd, type, frame)) {
+            elapsed_ms = elapsed();
+            return true;
+        }
+        if (answer_pings && type == relay::FRAME_CTRL && !frame.empty() && frame[0] == relay::CTRL_PING &&
+            frame.size() >= relay::CTRL_PING_SIZE) {
+            uint8_t pong[4 + relay::CTRL_PING_SIZE];
+            relay::writeFrameHeader(pong, relay::CTRL_PING_SIZE, relay::FRAME_CTRL);
+            pong[4] = relay::CTRL_PONG;
+            std::memcpy(pong + 5, frame.data() + 1, 8);
+            send_all(fd, pong, sizeof(pong));
+        }
+    }
+}
+
+// 注册截止：连接后不注册的socket被及时断开，已注册的连接不受影响
+bool test_register_deadline() {
+    std::cout << "Testing registration deadline..." << std::endl;
+
+    TestRelay relay({"-c", "16", "-o", "register_timeout_ms=300"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t mark[8] = {0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68};
+    int silent_fd = connect_to_relay(port);
+    int registered_fd = connect_to_relay(port);
+    bool ok = silent_fd >= 0 && registered_fd >= 0 && send_register(registered_fd, mark);
+
+    int elapsed = 0;
+    bool silent_closed = ok && wait_closed(silent_fd, 2000, elapsed, false);
+    int unused = 0;
+    bool registered_open = ok && !wait_closed(registered_fd, 500, unused, false);
+    std::cout << "Unregistered socket closed after " << elapsed << " ms" << std::endl;
+
+    if (silent_fd >= 0) close(silent_fd);
+    if (registered_fd >= 0) close(registered_fd);
+    relay.stop();
+
+    return silent_closed && elapsed >= 250 && registered_open;
+}
+
+// 心跳：应答PING的客户端保持在线，不应答的客户端在空闲超时后被断开
+bool test_heartbeat_idle_timeout() {
+    std::cout << "Testing heartbeat ping/pong and idle timeout..." << std::endl;
+
+    TestRelay relay({"-c", "16", "-o", "ping_interval_ms=100", "-o", "idle_timeout_ms=600"});
+    if (!relay.started()) {
+        return false;
+    }
+    int port = relay.port();
+
+    uint8_t alive_mark[8] = {0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78};
+    uint8_t silent_mark[8] = {0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88};
+    int alive_fd = connect_to_relay(port);
+    int silent_fd = connect_to_relay(port);
+    uint8_t status = 0;
+    uint64_t token = 0;
+    uint64_t relay_rx = 0;
+    bool ok = alive_fd >= 0 && silent_fd >= 0 &&
+              send_hello(alive_fd, alive_mark, relay::CAP_HEARTBEAT) &&
+              recv_hello_ack(alive_fd, status, token, relay_rx) &&
+              send_hello(silent_fd, silent_mark, relay::CAP_HEARTBEAT) &&
+              recv_hello_ack(silent_fd, status, token, relay_rx);
+    if (!ok) {
+        std::cerr << "HELLO failed" << std::endl;
+    }
+
+    // 两个连接并行等待：一个应答PING，一个只读不应答
+    bool alive_closed = false;
+    int alive_elapsed = 0;
+    std::thread alive_thread([&]() {
+        if (ok) {
+            alive_closed = wait_closed(alive_fd, 1500, alive_elapsed, true);
+        }
+    });
+    int silent_elapsed = 0;
+    bool silent_closed = ok && wait_closed(silent_fd, 3000, silent_elapsed, false);
+    alive_thread.join();
+    std::cout << "Silent client closed after " << silent_elapsed << " ms, responsive client "
+              << (alive_closed ? "closed" : "still connected") << std::endl;
+
+    if (alive_fd >= 0) close(alive_fd);
+    if (silent_fd >= 0) close(silent_fd);
+    relay.stop();
+
+    // 计时从双方注册完成后开始，略短于 idle_timeout_ms
+    return ok && silent_closed && silent_elapsed >= 400 && !alive_closed;
+}